@@ -1,10 +1,15 @@
+#define _POSIX_C_SOURCE 200809L /* for fileno */
+
 #include "nbt.h"
 
 #include <errno.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 static void die(const char* message)
 {
@@ -39,6 +44,384 @@ static bool check_size(nbt_node* n, void* aux)
     return true;
 }
 
+/* Counts a matcher's matches for each query, and remembers the first. */
+struct match_counts {
+    size_t n[32];
+    nbt_node* first[32];
+    size_t stop_after;
+};
+
+static bool count_match(size_t query, nbt_node* node, void* aux)
+{
+    struct match_counts* c = aux;
+
+    if(c->n[query]++ == 0)
+        c->first[query] = node;
+
+    return --c->stop_after > 0;
+}
+
+static bool count_event_match(size_t query, const struct nbt_event* ev, void* aux)
+{
+    (void)ev;
+    struct match_counts* c = aux;
+
+    c->n[query]++;
+    return --c->stop_after > 0;
+}
+
+/* Writes down the order nbt_map visits nodes in. */
+struct visit_order {
+    nbt_node** nodes;
+    size_t n;
+};
+
+static bool record_visit(nbt_node* n, void* aux)
+{
+    struct visit_order* order = aux;
+    order->nodes[order->n++] = n;
+
+    return true;
+}
+
+/* The first match of a path, which has to be there. */
+static nbt_node* find_path(nbt_node* tree, const char* path)
+{
+    nbt_path* compiled = nbt_path_compile(path);
+    if(compiled == NULL) die_with_err(errno);
+
+    nbt_node* ret = nbt_path_first(compiled, tree);
+    if(ret == NULL) die("FAILED. A path wasn't found.");
+
+    nbt_path_free(compiled);
+    return ret;
+}
+
+/* Every child of every compound must be found by nbt_compound_get. */
+static bool check_compound_get(nbt_node* n, void* aux)
+{
+    (void)aux;
+
+    if(n->type != TAG_COMPOUND)
+        return true;
+
+    const struct list_head* pos;
+    list_for_each(pos, &n->payload.tag_compound->entry)
+    {
+        nbt_node* child = list_entry(pos, struct nbt_list, entry)->data;
+        nbt_node* found = nbt_compound_get(n, child->name);
+
+        if(found == NULL || strcmp(found->name, child->name) != 0)
+            return false;
+    }
+
+    return nbt_compound_get(n, "this name does not exist") == NULL;
+}
+
+static bool unpack_lists(nbt_node* n, void* aux)
+{
+    (void)aux;
+    return nbt_list_unpack(n) == NBT_OK;
+}
+
+/*
+ * Every node of an augmented tree must lead back to the root, and its cached
+ * size must match what a full walk finds.
+ */
+static bool check_augmented(nbt_node* n, void* aux)
+{
+    nbt_node* root = aux;
+    nbt_node* top = n;
+
+    while(nbt_parent(top) != NULL)
+        top = nbt_parent(top);
+
+    int size = 0;
+    nbt_map(n, check_size, &size);
+
+    return top == root && nbt_size(n) == (size_t)size;
+}
+
+/* Every list's count must match what's actually in it. */
+static bool check_list_count(nbt_node* n, void* aux)
+{
+    (void)aux;
+
+    if(n->type != TAG_LIST || (n->flags & NBT_NODE_PACKED))
+        return true;
+
+    return nbt_list_length(n) == (int32_t)list_length(&n->payload.tag_list->entry);
+}
+
+static bool is_nonempty_list(const nbt_node* n, void* aux)
+{
+    (void)aux;
+    return n->type == TAG_LIST && nbt_list_length(n) > 0;
+}
+
+static bool is_not_of_type(const nbt_node* n, void* aux)
+{
+    return n->type != *(nbt_type*)aux;
+}
+
+/* A reduction which counts nodes and adds up ints. */
+struct totals {
+    size_t nodes;
+    int64_t ints;
+};
+
+static void totals_init(void* acc, void* aux)
+{
+    (void)aux;
+    *(struct totals*)acc = (struct totals) { 0, 0 };
+}
+
+static bool totals_visit(const nbt_node* n, void* acc, void* aux)
+{
+    (void)aux;
+    struct totals* t = acc;
+
+    t->nodes++;
+    if(n->type == TAG_INT) t->ints += n->payload.tag_int;
+
+    return true;
+}
+
+static void totals_combine(void* acc, const void* other, void* aux)
+{
+    (void)aux;
+    struct totals* t = acc;
+    const struct totals* o = other;
+
+    t->nodes += o->nodes;
+    t->ints  += o->ints;
+}
+
+static bool add_ints(nbt_node* n, void* aux)
+{
+    return totals_visit(n, aux, NULL);
+}
+
+static bool never(const nbt_node* n, void* aux)
+{
+    (void)n; (void)aux;
+    return false;
+}
+
+/* Does the frozen node hold the same thing as the tree? */
+static bool frozen_eq(const nbt_node* n, const nbt_frozen* f)
+{
+    if(f == NULL)
+        return false;
+
+    const char* name = nbt_frozen_name(f);
+
+    if(nbt_frozen_type(f) != n->type)
+        return false;
+    if((name == NULL) != (n->name == NULL) || (name && strcmp(name, n->name) != 0))
+        return false;
+
+    switch(n->type)
+    {
+    case TAG_BYTE:   return nbt_frozen_int(f) == n->payload.tag_byte;
+    case TAG_SHORT:  return nbt_frozen_int(f) == n->payload.tag_short;
+    case TAG_INT:    return nbt_frozen_int(f) == n->payload.tag_int;
+    case TAG_LONG:   return nbt_frozen_int(f) == n->payload.tag_long;
+    case TAG_FLOAT:  return nbt_frozen_double(f) == n->payload.tag_float;
+    case TAG_DOUBLE: return nbt_frozen_double(f) == n->payload.tag_double;
+
+    case TAG_STRING:
+        return strcmp(nbt_frozen_string(f), n->payload.tag_string) == 0;
+
+    case TAG_BYTE_ARRAY:
+        return nbt_frozen_length(f) == n->payload.tag_byte_array.length &&
+               (n->payload.tag_byte_array.length == 0 ||
+                memcmp(nbt_frozen_array(f), n->payload.tag_byte_array.data, n->payload.tag_byte_array.length) == 0);
+
+    case TAG_INT_ARRAY:
+        return nbt_frozen_length(f) == n->payload.tag_int_array.length &&
+               (n->payload.tag_int_array.length == 0 ||
+                memcmp(nbt_frozen_array(f), n->payload.tag_int_array.data, n->payload.tag_int_array.length * 4) == 0);
+
+    case TAG_LONG_ARRAY:
+        return nbt_frozen_length(f) == n->payload.tag_long_array.length &&
+               (n->payload.tag_long_array.length == 0 ||
+                memcmp(nbt_frozen_array(f), n->payload.tag_long_array.data, n->payload.tag_long_array.length * 8) == 0);
+
+    case TAG_LIST:
+    case TAG_COMPOUND:
+        break;
+
+    default:
+        return false;
+    }
+
+    struct nbt_span span;
+    bool packed = nbt_frozen_span(f, &span);
+    int32_t i = 0;
+
+    const struct list_head* pos;
+    list_for_each(pos, &n->payload.tag_list->entry)
+    {
+        const nbt_node* child = list_entry(pos, struct nbt_list, entry)->data;
+        size_t size = nbt_scalar_size(child->type);
+
+        if(packed && memcmp((const char*)span.data + i * size, &child->payload, size) != 0)
+            return false;
+
+        if(!packed && !frozen_eq(child, nbt_frozen_child(f, i)))
+            return false;
+
+        /* The first child of that name has to be found by name. */
+        if(n->type == TAG_COMPOUND && nbt_compound_get((nbt_node*)n, child->name) == child &&
+           nbt_frozen_get(f, child->name) != nbt_frozen_child(f, i))
+            return false;
+
+        i++;
+    }
+
+    return i == nbt_frozen_length(f) && nbt_frozen_child(f, i) == NULL;
+}
+
+/* Moves a compound's first child to its end. */
+static bool rotate_compound(nbt_node* n, void* aux)
+{
+    (void)aux;
+
+    if(n->type != TAG_COMPOUND || list_empty(&n->payload.tag_compound->entry))
+        return true;
+
+    nbt_node* first = list_entry(n->payload.tag_compound->entry.flink, struct nbt_list, entry)->data;
+
+    return nbt_compound_take(n, first->name) == first && nbt_compound_append(n, first) == NBT_OK;
+}
+
+/* Writes out a tree (with no packed lists) with the emitter. */
+static nbt_status emit_tree(struct nbt_emitter* e, const nbt_node* n, const char* name)
+{
+    const struct list_head* pos;
+
+    switch(n->type)
+    {
+    case TAG_BYTE:       return nbt_emit_byte(e, name, n->payload.tag_byte);
+    case TAG_SHORT:      return nbt_emit_short(e, name, n->payload.tag_short);
+    case TAG_INT:        return nbt_emit_int(e, name, n->payload.tag_int);
+    case TAG_LONG:       return nbt_emit_long(e, name, n->payload.tag_long);
+    case TAG_FLOAT:      return nbt_emit_float(e, name, n->payload.tag_float);
+    case TAG_DOUBLE:     return nbt_emit_double(e, name, n->payload.tag_double);
+    case TAG_STRING:     return nbt_emit_string(e, name, n->payload.tag_string);
+
+    case TAG_BYTE_ARRAY:
+        return nbt_emit_byte_array(e, name, n->payload.tag_byte_array.data, n->payload.tag_byte_array.length);
+    case TAG_INT_ARRAY:
+        return nbt_emit_int_array(e, name, n->payload.tag_int_array.data, n->payload.tag_int_array.length);
+    case TAG_LONG_ARRAY:
+        return nbt_emit_long_array(e, name, n->payload.tag_long_array.data, n->payload.tag_long_array.length);
+
+    case TAG_LIST:
+        nbt_emit_begin_list(e, name, n->payload.tag_list->data->type, nbt_list_length(n));
+
+        list_for_each(pos, &n->payload.tag_list->entry)
+            emit_tree(e, list_entry(pos, const struct nbt_list, entry)->data, NULL);
+
+        return nbt_emit_end(e);
+
+    default:
+        nbt_emit_begin_compound(e, name);
+
+        list_for_each(pos, &n->payload.tag_compound->entry)
+        {
+            const nbt_node* child = list_entry(pos, const struct nbt_list, entry)->data;
+            emit_tree(e, child, child->name);
+        }
+
+        return nbt_emit_end(e);
+    }
+}
+
+static nbt_transform_action keep(const struct nbt_event* ev, struct nbt_emitter* out, void* aux)
+{
+    (void)ev; (void)out; (void)aux;
+    return NBT_TRANSFORM_KEEP;
+}
+
+/* Drops the string `aux'. */
+static nbt_transform_action drop_string(const struct nbt_event* ev, struct nbt_emitter* out, void* aux)
+{
+    (void)out;
+
+    const char* s = aux;
+    bool same = ev->type == TAG_STRING && (size_t)ev->length == strlen(s) && memcmp(ev->payload, s, ev->length) == 0;
+
+    return same ? NBT_TRANSFORM_DROP : NBT_TRANSFORM_KEEP;
+}
+
+/* Replaces an int with ten times it, or with a short if `aux' isn't NULL. */
+static nbt_transform_action times_ten(const struct nbt_event* ev, struct nbt_emitter* out, void* aux)
+{
+    if(aux != NULL)
+        nbt_emit_short(out, "", 1);
+    else
+        nbt_emit_int(out, "", (int32_t)ev->value.integer * 10);
+
+    return NBT_TRANSFORM_REPLACE;
+}
+
+static nbt_transform_action redact(const struct nbt_event* ev, struct nbt_emitter* out, void* aux)
+{
+    (void)ev; (void)aux;
+
+    nbt_emit_string(out, "", "redacted");
+    return NBT_TRANSFORM_REPLACE;
+}
+
+/* Returns the first child of a compound, or NULL if it hasn't got one. */
+static nbt_node* first_child(nbt_node* n)
+{
+    if(n->type != TAG_COMPOUND || list_empty(&n->payload.tag_compound->entry))
+        return NULL;
+
+    return list_entry(n->payload.tag_compound->entry.flink, struct nbt_list, entry)->data;
+}
+
+/* Frees a tree at thread exit, after the node pool's own destructor. */
+static pthread_key_t late_key;
+
+static void free_late(void* tree)
+{
+    nbt_free(tree);
+}
+
+/* Thread body: leaves a copy of a tree for free_late. */
+static void* exit_holding(void* tree)
+{
+    nbt_node* copy = nbt_clone(tree);
+
+    if(copy != NULL && pthread_setspecific(late_key, copy) != 0)
+    {
+        nbt_free(copy);
+        copy = NULL;
+    }
+
+    return copy;
+}
+
+/* Thread body: finds every child of Level in a tree. Returns NULL if one's missing. */
+static void* look_up_level(void* tree)
+{
+    nbt_node* level = nbt_compound_get(tree, "Level");
+
+    for(char name[2] = "a"; name[0] <= 'p'; name[0]++)
+    {
+        nbt_node* child = nbt_compound_get(level, name);
+
+        if(child == NULL || child->payload.tag_int != name[0] - 'a')
+            return NULL;
+    }
+
+    return tree;
+}
+
 int main(int argc, char** argv)
 {
     if(argc == 1 || strcmp(argv[1], "--help") == 0)
@@ -70,12 +453,1920 @@ int main(int argc, char** argv)
     }
 
     {
-        printf("Checking nbt_clone... ");
-        nbt_node* clone = nbt_clone(tree);
-        if(!nbt_eq(tree, clone))
-            die("FAILED. Clones not equal.");
-        nbt_free(tree); /* swap the tree out for its clone */
-        tree = clone;
+        printf("Checking nbt_compound_get... ");
+        if(!nbt_map(tree, check_compound_get, NULL))
+            die("FAILED. Lookup returned the wrong child.");
+
+        if(tree->type == TAG_COMPOUND)
+        {
+            /* take a child out and put it back, at the end this time. */
+            nbt_node* first = list_entry(tree->payload.tag_compound->entry.flink, struct nbt_list, entry)->data;
+            nbt_node* taken = nbt_compound_take(tree, first->name);
+
+            if(taken != first || nbt_compound_get(tree, first->name) == first)
+                die("FAILED. nbt_compound_take didn't unlink the child.");
+            if(nbt_compound_append(tree, taken) != NBT_OK)
+                die_with_err(NBT_EMEM);
+            if(nbt_compound_get(tree, first->name) != first)
+                die("FAILED. nbt_compound_append didn't relink the child.");
+        }
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking interned parsing... ");
+        struct buffer b = nbt_dump_binary(tree);
+        if(b.data == NULL) die_with_err(errno);
+
+        nbt_node* interned = nbt_parse_ex(b.data, b.len, NBT_PARSE_INTERN | NBT_PARSE_INDEX);
+        if(interned == NULL) die_with_err(errno);
+        buffer_free(&b);
+
+        if(!nbt_eq(tree, interned))
+            die("FAILED. Interned tree not equal.");
+        if(tree->name && nbt_find_by_name(interned, tree->name) != interned)
+            die("FAILED. Couldn't find the interned root by name.");
+
+        /* Paths far too long for the stack are fine too. */
+        size_t len = 200000;
+        char* deep = malloc(len + 1);
+        if(deep == NULL) die_with_err(NBT_EMEM);
+
+        for(size_t i = 0; i < len; i += 2)
+            memcpy(deep + i, ".a", 2);
+
+        deep[len] = '\0';
+        errno = NBT_OK;
+
+        if(nbt_find_by_path(interned, deep + 1) != NULL || errno == NBT_EMEM)
+            die("FAILED. Found a path that isn't there.");
+
+        free(deep);
+
+        nbt_node* clone = nbt_clone(interned);
+        if(clone == NULL || clone->name != interned->name || !nbt_eq(clone, interned))
+            die("FAILED. Interned clones aren't sharing names.");
+
+        nbt_free(clone);
+        nbt_free(interned);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking packed lists... ");
+        struct buffer b = nbt_dump_binary(tree);
+        if(b.data == NULL) die_with_err(errno);
+
+        nbt_node* packed = nbt_parse_ex(b.data, b.len, NBT_PARSE_PACK);
+        if(packed == NULL) die_with_err(errno);
+
+        if(!nbt_eq(tree, packed) || !nbt_eq(packed, tree))
+            die("FAILED. Packed tree not equal.");
+
+        /* It has to dump the exact same bytes, in binary and in ascii. */
+        struct buffer rb = nbt_dump_binary(packed);
+        if(rb.data == NULL) die_with_err(errno);
+        if(rb.len != b.len || memcmp(rb.data, b.data, b.len) != 0)
+            die("FAILED. Packed tree dumped differently.");
+
+        char* ascii = nbt_dump_ascii(packed);
+        if(ascii == NULL) die_with_err(errno);
+        if(strcmp(ascii, the_tree) != 0)
+            die("FAILED. Packed tree printed differently.");
+
+        nbt_node* clone = nbt_clone(packed);
+        if(clone == NULL || !nbt_eq(clone, tree))
+            die("FAILED. Packed clone not equal.");
+
+        if(!nbt_map(packed, unpack_lists, NULL) || !nbt_eq(packed, tree))
+            die("FAILED. Unpacked tree not equal.");
+
+        /* Packed elements aren't nodes, so traversals keep them or drop them whole. */
+        static const char snbt[] = "{l:[1b,2b,3b],n:4b}";
+        nbt_node* bytes = nbt_parse_snbt(snbt, sizeof snbt - 1);
+        if(bytes == NULL) die_with_err(errno);
+
+        nbt_node* l = nbt_compound_get(bytes, "l");
+        nbt_type byte = TAG_BYTE;
+
+        if(nbt_list_pack(l) != NBT_OK || !(l->flags & NBT_NODE_PACKED))
+            die("FAILED. Couldn't pack a list of bytes.");
+        if(nbt_size(bytes) != 3 || nbt_find(l, is_not_of_type, &byte) != l)
+            die("FAILED. Packed elements were visited.");
+
+        nbt_node* filtered = nbt_filter(bytes, is_not_of_type, &byte);
+        if(filtered == NULL || nbt_list_length(nbt_compound_get(filtered, "l")) != 3 ||
+           nbt_compound_get(filtered, "n") != NULL)
+            die("FAILED. Packed elements were filtered.");
+        nbt_free(filtered);
+
+        if(nbt_list_unpack(l) != NBT_OK || nbt_size(bytes) != 6)
+            die("FAILED. Unpacked elements weren't counted.");
+
+        filtered = nbt_filter(bytes, is_not_of_type, &byte);
+        if(filtered == NULL || nbt_list_length(nbt_compound_get(filtered, "l")) != 0)
+            die("FAILED. Unpacked elements weren't filtered.");
+        nbt_free(filtered);
+        nbt_free(bytes);
+
+        free(ascii);
+        nbt_free(clone);
+        nbt_free(packed);
+        buffer_free(&rb);
+        buffer_free(&b);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking augmented trees... ");
+        struct buffer b = nbt_dump_binary(tree);
+        if(b.data == NULL) die_with_err(errno);
+
+        nbt_node* aug = nbt_parse_ex(b.data, b.len, NBT_PARSE_AUGMENT);
+        if(aug == NULL) die_with_err(errno);
+        buffer_free(&b);
+
+        if(!nbt_eq(aug, tree) || nbt_size(aug) != nbt_size(tree))
+            die("FAILED. Augmented tree not equal.");
+        if(nbt_parent(aug) != NULL || !nbt_map(aug, check_augmented, aug))
+            die("FAILED. Augmented bookkeeping is off.");
+
+        char* path = nbt_path_of(aug);
+        if(path == NULL) die_with_err(errno);
+        if(strcmp(path, aug->name ? aug->name : "") != 0)
+            die("FAILED. Wrong path for the root.");
+        free(path);
+
+        if(aug->type == TAG_COMPOUND && !list_empty(&aug->payload.tag_compound->entry))
+        {
+            nbt_node* first = list_entry(aug->payload.tag_compound->entry.flink, struct nbt_list, entry)->data;
+            size_t size = nbt_size(aug);
+            size_t children = nbt_children(aug);
+
+            nbt_node* taken = nbt_compound_take(aug, first->name);
+            if(taken == NULL || nbt_parent(taken) != NULL ||
+               nbt_size(aug) != size - nbt_size(taken) || nbt_children(aug) != children - 1)
+                die("FAILED. Take didn't update the bookkeeping.");
+
+            if(nbt_compound_append(tree, taken) != NBT_ERR)
+                die("FAILED. Mixed an augmented node into a regular tree.");
+
+            if(nbt_compound_append(aug, taken) != NBT_OK ||
+               nbt_parent(taken) != aug || nbt_size(aug) != size ||
+               !nbt_map(aug, check_augmented, aug))
+                die("FAILED. Append didn't update the bookkeeping.");
+        }
+
+        nbt_node* copy = nbt_augment(tree);
+        if(copy == NULL) die_with_err(errno);
+        if(!nbt_eq(copy, tree) || !nbt_map(copy, check_augmented, copy))
+            die("FAILED. Augmented copy not equal.");
+
+        nbt_free(copy);
+        nbt_free(aug);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking list counts... ");
+        if(!nbt_map(tree, check_list_count, NULL))
+            die("FAILED. A list miscounted.");
+
+        nbt_node* copy = nbt_clone(tree);
+        if(copy == NULL) die_with_err(errno);
+
+        nbt_node* list = nbt_find(copy, is_nonempty_list, NULL);
+
+        if(list != NULL)
+        {
+            int32_t len = nbt_list_length(list);
+            nbt_node* elem = nbt_clone(nbt_list_item(list, 0));
+            nbt_node* wrong = nbt_clone(nbt_find(copy, is_not_of_type, &elem->type));
+
+            if(wrong != NULL && nbt_list_append(list, wrong) != NBT_ERR)
+                die("FAILED. Appended an element of the wrong type.");
+            nbt_free(wrong);
+
+            if(nbt_list_append(list, elem) != NBT_OK ||
+               nbt_list_length(list) != len + 1 || nbt_list_item(list, len) != elem)
+                die("FAILED. Append didn't count.");
+
+            nbt_list_invalidate(list);
+            if(nbt_list_length(list) != len + 1 || !nbt_map(copy, check_list_count, NULL))
+                die("FAILED. Couldn't count an invalidated list.");
+        }
+
+        /* Counted or not, it has to come back the same. */
+        struct buffer b = nbt_dump_binary(copy);
+        if(b.data == NULL) die_with_err(errno);
+
+        nbt_node* reparsed = nbt_parse(b.data, b.len);
+        if(reparsed == NULL) die_with_err(errno);
+        if(!nbt_eq(reparsed, copy) || !nbt_map(reparsed, check_list_count, NULL))
+            die("FAILED. Appended list didn't survive a round trip.");
+
+        nbt_free(reparsed);
+        nbt_free(copy);
+        buffer_free(&b);
+
+        /* Grown by hand, a counted list mustn't dump with its old count... */
+        static const char snbt[] = "{l:[1,2,3]}";
+        nbt_node* grown = nbt_parse_snbt(snbt, sizeof snbt - 1);
+        if(grown == NULL) die_with_err(errno);
+
+        list = nbt_compound_get(grown, "l");
+        nbt_node* nine = nbt_clone(nbt_list_item(list, 0));
+        struct nbt_list* entry = malloc(sizeof *entry);
+        if(nine == NULL || entry == NULL) die("Out of memory.");
+
+        nine->payload.tag_int = 9;
+        entry->data = nine;
+        list_add_tail(&entry->entry, &list->payload.tag_list->entry);
+
+        b = nbt_dump_binary(grown);
+        if(b.data != NULL || errno != NBT_ERR)
+            die("FAILED. Dumped a list with a stale count.");
+
+        nbt_list_invalidate(list);
+        if((b = nbt_dump_binary(grown)).data == NULL) die_with_err(errno);
+        if((reparsed = nbt_parse_ex(b.data, b.len, NBT_PARSE_NAMELESS)) == NULL) die_with_err(errno);
+        if(!nbt_eq(reparsed, grown) || nbt_list_length(nbt_compound_get(reparsed, "l")) != 4)
+            die("FAILED. Invalidated list didn't survive a round trip.");
+        buffer_free(&b);
+
+        /* ...or with an element of the wrong type, even if the count is right. */
+        list = nbt_compound_get(reparsed, "l");
+        entry = list_entry(list->payload.tag_list->entry.flink, struct nbt_list, entry);
+        entry->data->type = TAG_SHORT;
+
+        b = nbt_dump_binary(reparsed);
+        if(b.data != NULL || errno != NBT_ERR)
+            die("FAILED. Dumped a list with an element of the wrong type.");
+
+        nbt_free(reparsed);
+        nbt_free(grown);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking exact-size dumps... ");
+        struct buffer b = nbt_dump_binary(tree);
+        if(b.data == NULL) die_with_err(errno);
+
+        if(nbt_serialized_size(tree) != b.len || b.cap != b.len)
+            die("FAILED. Dump wasn't sized exactly.");
+
+        unsigned char* into = malloc(b.len);
+        if(into == NULL) die("Out of memory.");
+
+        size_t written;
+        if(nbt_dump_binary_into(tree, into, b.len - 1, &written) != NBT_EMEM || written != b.len)
+            die("FAILED. Dumped into a buffer that was too small.");
+
+        if(nbt_dump_binary_into(tree, into, b.len, &written) != NBT_OK ||
+           written != b.len || memcmp(into, b.data, b.len) != 0)
+            die("FAILED. Dumped into a buffer differently.");
+
+        free(into);
+        buffer_free(&b);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking output sinks... ");
+        struct buffer b = nbt_dump_binary(tree);
+        if(b.data == NULL) die_with_err(errno);
+
+        struct buffer sunk = BUFFER_INIT;
+        struct nbt_sink sink = nbt_sink_buffer(&sunk);
+        if(nbt_dump_binary_to(tree, &sink) != NBT_OK ||
+           sunk.len != b.len || memcmp(sunk.data, b.data, b.len) != 0)
+            die("FAILED. Buffer sink got something else.");
+        buffer_free(&sunk);
+
+        struct nbt_fixed_sink fixed = { malloc(b.len), b.len - 1, 0 };
+        if(fixed.data == NULL) die("Out of memory.");
+        sink = nbt_sink_fixed(&fixed);
+        if(nbt_dump_binary_to(tree, &sink) != NBT_EMEM)
+            die("FAILED. Overflowed a fixed sink.");
+
+        fixed.cap = b.len;
+        fixed.len = 0;
+        if(nbt_dump_binary_to(tree, &sink) != NBT_OK ||
+           fixed.len != b.len || memcmp(fixed.data, b.data, b.len) != 0)
+            die("FAILED. Fixed sink got something else.");
+        free(fixed.data);
+
+        FILE* fp = tmpfile();
+        if(fp == NULL) die("Could not open a temporary file.");
+
+        struct nbt_fd_sink fd;
+        sink = nbt_sink_fd(&fd, fileno(fp));
+        if(nbt_dump_binary_to(tree, &sink) != NBT_OK)
+            die("FAILED. Couldn't write to a file descriptor.");
+
+        unsigned char* back = malloc(b.len + 1);
+        if(back == NULL) die("Out of memory.");
+        rewind(fp);
+        if(fread(back, 1, b.len + 1, fp) != b.len || memcmp(back, b.data, b.len) != 0)
+            die("FAILED. File descriptor sink got something else.");
+        free(back);
+        fclose(fp);
+
+        struct buffer compressed = nbt_dump_compressed(tree, STRAT_INFLATE);
+        if(compressed.data == NULL) die_with_err(errno);
+        nbt_node* inflated = nbt_parse_compressed(compressed.data, compressed.len);
+        if(inflated == NULL || !nbt_eq(inflated, tree))
+            die("FAILED. Streamed compression didn't round trip.");
+        nbt_free(inflated);
+        buffer_free(&compressed);
+
+        char* ascii = nbt_dump_ascii(tree);
+        if(ascii == NULL) die_with_err(errno);
+        sink = nbt_sink_buffer(&sunk);
+        if(nbt_dump_ascii_to(tree, &sink) != NBT_OK ||
+           sunk.len != strlen(ascii) || memcmp(sunk.data, ascii, sunk.len) != 0)
+            die("FAILED. Ascii sink got something else.");
+        buffer_free(&sunk);
+        free(ascii);
+
+        buffer_free(&b);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking ascii dumps... ");
+
+        /* Numbers have to come out just like printf would have them. */
+        static const double tricky[] = {
+            0.0, 1.0, 0.5, 0.0000005, 0.0000015, 0.0000025, 1.0000005, 2.5e-7,
+            123456.7890125, 3999999999.9999995, 1e-300, 4e9, 1e20, 1.7976931348623157e308
+        };
+
+        uint64_t seed = 42;
+        char expected[512];
+
+        for(int i = 0; i < 200000; i++)
+        {
+            double v;
+
+            if(i < (int)(sizeof tricky / sizeof tricky[0]) * 2)
+                v = tricky[i / 2] * (i % 2 ? -1 : 1);
+            else
+            {
+                seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+
+                /* A random mantissa, scaled to around where the shortcut ends. */
+                v = (double)(seed >> 11) / (double)(1ULL << (seed % 64));
+                if(i % 3 == 0) v = (float)v;
+                if(i % 5 == 0) v = -v;
+            }
+
+            nbt_node n = { .type = TAG_DOUBLE, .name = "d", .payload.tag_double = v };
+            snprintf(expected, sizeof expected, "TAG_Double(\"d\"): %f\n", v);
+
+            char* got = nbt_dump_ascii(&n);
+            if(got == NULL) die_with_err(errno);
+            if(strcmp(got, expected) != 0)
+            {
+                printf("got %s instead of %s", got, expected);
+                die("FAILED. Numbers don't match printf.");
+            }
+            free(got);
+        }
+
+        nbt_node l = { .type = TAG_LONG, .name = NULL, .payload.tag_long = INT64_MIN };
+        char* got = nbt_dump_ascii(&l);
+        if(got == NULL || strcmp(got, "TAG_Long(\"<null>\"): -9223372036854775808\n") != 0)
+            die("FAILED. Got the smallest long wrong.");
+        free(got);
+
+        /* Long arrays get cut short, and deep trees get cut off. */
+        unsigned char bytes[10] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 255 };
+        nbt_node a = { .type = TAG_BYTE_ARRAY, .name = "a",
+                       .payload.tag_byte_array = { bytes, 10 } };
+
+        struct buffer out = BUFFER_INIT;
+        struct nbt_sink sink = nbt_sink_buffer(&out);
+
+        struct nbt_ascii_options opts = { 3, 0 };
+        static const char short_array[] = "TAG_Byte_Array(\"a\"): [ 0 1 2 ... 7 more ]\n";
+
+        if(nbt_dump_ascii_ex(&a, &opts, &sink) != NBT_OK ||
+           out.len != strlen(short_array) || memcmp(out.data, short_array, out.len) != 0)
+            die("FAILED. Didn't cut the array short.");
+        out.len = 0;
+
+        opts = (struct nbt_ascii_options) { 0, 1 };
+        snprintf(expected, sizeof expected, "TAG_Compound(\"%s\")\n{ ... }\n",
+                 tree->name ? tree->name : "<null>");
+
+        if(nbt_dump_ascii_ex(tree, &opts, &sink) != NBT_OK ||
+           out.len != strlen(expected) || memcmp(out.data, expected, out.len) != 0)
+            die("FAILED. Didn't stop at the right depth.");
+
+        buffer_free(&out);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking SNBT... ");
+
+        /* Whatever we write has to read back to the same tree. */
+        char* snbt = nbt_dump_snbt(tree);
+        if(snbt == NULL) die_with_err(errno);
+
+        nbt_node* parsed = nbt_parse_snbt(snbt, strlen(snbt));
+        if(parsed == NULL) die_with_err(errno);
+
+        parsed->name = tree->name ? strdup(tree->name) : NULL;
+        if(!nbt_eq(parsed, tree))
+            die("FAILED. SNBT didn't round trip.");
+
+        nbt_free(parsed);
+        free(snbt);
+
+        /* Unquoted values are typed by what they look like. */
+        static const char in[] =
+            "{ Pos: [1.0d, 2.0d], id: \"minecraft:pig\", 'k y': 1b, n: -5s, l: 9L,\n"
+            "  f: 1.5f, d: .5, big: 1e300d, t: true, s: abc, e: 1e5, nan: NaNd,\n"
+            "  esc: 'it\\'s \"\\\\\\u00e9\"', arr: [B; 1b, -2b, true], ia: [I;], la: [L; 3l, 4L,],\n"
+            "  list: [[], [{}]], }";
+        static const char out[] =
+            "{Pos:[1.0d,2.0d],id:\"minecraft:pig\",\"k y\":1b,n:-5s,l:9L,"
+            "f:1.5f,d:0.5d,big:1.0e+300d,t:1b,s:\"abc\",e:\"1e5\",nan:NaNd,"
+            "esc:\"it's \\\"\\\\\u00e9\\\"\",arr:[B;1b,-2b,1b],ia:[I;],la:[L;3L,4L],"
+            "list:[[],[{}]]}";
+
+        if((parsed = nbt_parse_snbt(in, sizeof in - 1)) == NULL)
+            die_with_err(errno);
+        if((snbt = nbt_dump_snbt(parsed)) == NULL)
+            die_with_err(errno);
+        if(strcmp(snbt, out) != 0)
+            die("FAILED. Misread an SNBT value.");
+
+        free(snbt);
+        nbt_free(parsed);
+
+        static const char* const bad[] = {
+            "{a:1", "[1,2b]", "{a:[B;1L]}", "\"\\q\"", "{a:1}x", "{:1}", "[I;1.5]", ""
+        };
+
+        for(size_t i = 0; i < sizeof bad / sizeof bad[0]; i++)
+            if(nbt_parse_snbt(bad[i], strlen(bad[i])) != NULL || errno != NBT_ERR)
+                die("FAILED. Accepted bad SNBT.");
+
+        /* Reals have to come back bit for bit. */
+        uint64_t seed = 7;
+
+        for(int i = 0; i < 100000; i++)
+        {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+
+            double v;
+            uint64_t bits = seed;
+            memcpy(&v, &bits, sizeof v);
+
+            if(v != v) continue;
+
+            bool single = i % 2;
+            nbt_node n = { .type = single ? TAG_FLOAT : TAG_DOUBLE };
+
+            if(single) n.payload.tag_float  = (float)v;
+            else       n.payload.tag_double = v;
+
+            if((snbt = nbt_dump_snbt(&n)) == NULL) die_with_err(errno);
+            if((parsed = nbt_parse_snbt(snbt, strlen(snbt))) == NULL) die_with_err(errno);
+
+            if(!nbt_eq(parsed, &n))
+            {
+                printf("%s ", snbt);
+                die("FAILED. A real didn't round trip.");
+            }
+
+            nbt_free(parsed);
+            free(snbt);
+        }
+
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking Bedrock encodings... ");
+
+        static const nbt_encoding encodings[] = { NBT_ENCODING_JAVA, NBT_ENCODING_BEDROCK, NBT_ENCODING_NETWORK };
+
+        for(size_t i = 0; i < sizeof encodings / sizeof *encodings; i++)
+        {
+            struct buffer b = nbt_dump_encoded(tree, encodings[i]);
+            if(b.data == NULL) die_with_err(errno);
+
+            struct buffer streamed = BUFFER_INIT;
+            struct nbt_sink sink = nbt_sink_buffer(&streamed);
+
+            if(nbt_dump_encoded_to(tree, encodings[i], &sink) != NBT_OK) die_with_err(errno);
+
+            if(streamed.len != b.len || memcmp(streamed.data, b.data, b.len) != 0)
+                die("FAILED. Streamed a different dump.");
+
+            nbt_node* plain  = nbt_parse_encoded(b.data, b.len, encodings[i], NBT_PARSE_DEFAULT);
+            nbt_node* packed = nbt_parse_encoded(b.data, b.len, encodings[i], NBT_PARSE_PACK | NBT_PARSE_INTERN);
+
+            if(plain == NULL || packed == NULL) die_with_err(errno);
+
+            if(!nbt_eq(plain, tree) || !nbt_eq(packed, tree))
+                die("FAILED. An encoding didn't round-trip.");
+
+            nbt_free(plain);
+            nbt_free(packed);
+            buffer_free(&streamed);
+            buffer_free(&b);
+        }
+
+        static const char in[] = "{i:-1,l:300L,s:\"hi\",a:[I;-2],n:[L;-1L,64L]}";
+
+        static const unsigned char network[] = {
+            10, 0,
+             3, 1, 'i', 0x01,
+             4, 1, 'l', 0xd8, 0x04,
+             8, 1, 's', 2, 'h', 'i',
+            11, 1, 'a', 0x02, 0x03,
+            12, 1, 'n', 0x04, 0x01, 0x80, 0x01,
+            0
+        };
+
+        static const unsigned char bedrock[] = {
+            10, 0, 0,
+             3, 1, 0, 'i', 0xff, 0xff, 0xff, 0xff,
+             4, 1, 0, 'l', 0x2c, 0x01, 0, 0, 0, 0, 0, 0,
+             8, 1, 0, 's', 2, 0, 'h', 'i',
+            11, 1, 0, 'a', 1, 0, 0, 0, 0xfe, 0xff, 0xff, 0xff,
+            12, 1, 0, 'n', 2, 0, 0, 0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                                      64, 0, 0, 0, 0, 0, 0, 0,
+            0
+        };
+
+        nbt_node* parsed = nbt_parse_snbt(in, sizeof in - 1);
+        if(parsed == NULL) die_with_err(errno);
+
+        parsed->name = strdup("");
+
+        struct buffer n = nbt_dump_encoded(parsed, NBT_ENCODING_NETWORK);
+        struct buffer b = nbt_dump_encoded(parsed, NBT_ENCODING_BEDROCK);
+
+        if(n.data == NULL || b.data == NULL) die_with_err(errno);
+
+        if(n.len != sizeof network || memcmp(n.data, network, n.len) != 0 ||
+           b.len != sizeof bedrock || memcmp(b.data, bedrock, b.len) != 0)
+            die("FAILED. Wrote the wrong bytes.");
+
+        /* Cutting either one short anywhere has to fail. */
+        for(size_t len = 0; len < n.len; len++)
+            if(nbt_parse_encoded(n.data, len, NBT_ENCODING_NETWORK, NBT_PARSE_DEFAULT) != NULL)
+                die("FAILED. Parsed truncated network NBT.");
+
+        for(size_t len = 0; len < b.len; len++)
+            if(nbt_parse_encoded(b.data, len, NBT_ENCODING_BEDROCK, NBT_PARSE_DEFAULT) != NULL)
+                die("FAILED. Parsed truncated little-endian NBT.");
+
+        /* A varint that never ends isn't a length. */
+        static const unsigned char endless[] = { 8, 0, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01 };
+
+        if(nbt_parse_encoded(endless, sizeof endless, NBT_ENCODING_NETWORK, NBT_PARSE_DEFAULT) != NULL)
+            die("FAILED. Parsed an overlong varint.");
+
+        nbt_free(parsed);
+        buffer_free(&n);
+        buffer_free(&b);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking nameless roots... ");
+
+        static const nbt_encoding encodings[] = { NBT_ENCODING_JAVA, NBT_ENCODING_BEDROCK, NBT_ENCODING_NETWORK };
+
+        /* The tree to compare against, which is the test tree without its root's name. */
+        nbt_node nameless = *tree;
+        nameless.name = NULL;
+
+        for(size_t i = 0; i < sizeof encodings / sizeof *encodings; i++)
+        {
+            struct buffer named = nbt_dump_encoded(tree, encodings[i]);
+            if(named.data == NULL) die_with_err(errno);
+
+            size_t written;
+
+            /* Ask how big it is, then dump it between a packet's other fields. */
+            if(nbt_dump_encoded_into(tree, encodings[i], NBT_DUMP_NAMELESS, NULL, 0, &written) != NBT_EMEM)
+                die("FAILED. A nameless dump fit in nothing.");
+
+            unsigned char* packet = malloc(written + 2);
+            if(packet == NULL) die_with_err(NBT_EMEM);
+
+            packet[0] = 0xaa;
+            packet[written + 1] = 0xbb;
+
+            size_t again;
+            if(nbt_dump_encoded_into(tree, encodings[i], NBT_DUMP_NAMELESS, packet + 1, written, &again) != NBT_OK)
+                die_with_err(errno);
+
+            if(again != written || packet[0] != 0xaa || packet[written + 1] != 0xbb)
+                die("FAILED. A nameless dump went out of bounds.");
+
+            if(tree->name != NULL && encodings[i] != NBT_ENCODING_NETWORK && named.len - written != 2 + strlen(tree->name))
+                die("FAILED. A nameless dump kept its name.");
+
+            size_t consumed;
+            nbt_node* parsed = nbt_parse_prefix(packet + 1, written + 1, encodings[i], NBT_PARSE_NAMELESS, &consumed);
+
+            if(parsed == NULL) die_with_err(errno);
+            if(consumed != written) die("FAILED. Consumed the wrong number of bytes.");
+            if(parsed->name != NULL || !nbt_eq(parsed, &nameless)) die("FAILED. A nameless root didn't round-trip.");
+
+            nbt_free(parsed);
+
+            if(nbt_parse_prefix(packet + 1, written - 1, encodings[i], NBT_PARSE_NAMELESS, &consumed) != NULL || consumed != 0)
+                die("FAILED. Parsed a truncated nameless root.");
+
+            free(packet);
+            buffer_free(&named);
+        }
+
+        static const unsigned char java[] = { 10, 1, 0, 1, 'a', 1, 0, 0xff };
+
+        size_t consumed;
+        nbt_node* parsed = nbt_parse_prefix(java, sizeof java, NBT_ENCODING_JAVA, NBT_PARSE_NAMELESS, &consumed);
+
+        if(parsed == NULL) die_with_err(errno);
+        if(consumed != sizeof java - 1 || nbt_find_by_name(parsed, "a") == NULL)
+            die("FAILED. Misread a nameless root.");
+
+        nbt_free(parsed);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking the event parser... ");
+        struct buffer b = nbt_dump_binary(tree);
+        if(b.data == NULL) die_with_err(errno);
+
+        struct nbt_reader* r = malloc(sizeof *r);
+        if(r == NULL) die("Out of memory.");
+
+        struct nbt_event ev;
+        size_t open = 0;
+
+        nbt_reader_init(r, b.data, b.len);
+        while(nbt_reader_next(r, &ev) == NBT_OK && ev.kind != NBT_EVENT_DONE)
+        {
+            if(ev.kind == NBT_EVENT_BEGIN) open++;
+            if(ev.kind == NBT_EVENT_END)   open--;
+
+            if(ev.depth != open - (ev.kind == NBT_EVENT_BEGIN))
+                die("FAILED. Got the depth wrong.");
+        }
+
+        if(ev.kind != NBT_EVENT_DONE || open != 0 || r->pos != b.len)
+            die("FAILED. Didn't walk the whole tree.");
+
+        /* Skipping the root goes straight to the end. */
+        nbt_reader_init(r, b.data, b.len);
+        if(nbt_reader_next(r, &ev) != NBT_OK || nbt_reader_skip(r) != NBT_OK ||
+           nbt_reader_next(r, &ev) != NBT_OK || ev.kind != NBT_EVENT_DONE || r->pos != b.len)
+            die("FAILED. Skipped the wrong amount.");
+
+        nbt_reader_init(r, b.data, b.len - 1);
+        while(nbt_reader_next(r, &ev) == NBT_OK && ev.kind != NBT_EVENT_DONE)
+            ;
+
+        if(r->state != NBT_ERR)
+            die("FAILED. Read past the end.");
+
+        free(r);
+        buffer_free(&b);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking JSON... ");
+        struct buffer b = nbt_dump_binary(tree);
+        if(b.data == NULL) die_with_err(errno);
+
+        /* The tree and the binary have to come out the same, whatever the flags. */
+        for(unsigned flags = 0; flags < 16; flags++)
+        {
+            char* json = nbt_dump_json(tree, flags);
+            if(json == NULL) die_with_err(errno);
+
+            struct buffer streamed = BUFFER_INIT;
+            struct nbt_sink sink = nbt_sink_buffer(&streamed);
+
+            if(nbt_dump_json_binary(b.data, b.len, flags, &sink) != NBT_OK)
+                die("FAILED. Couldn't dump binary as JSON.");
+
+            if(streamed.len != strlen(json) || memcmp(streamed.data, json, streamed.len) != 0)
+                die("FAILED. The tree and the binary dumped differently.");
+
+            buffer_free(&streamed);
+            free(json);
+        }
+
+        buffer_free(&b);
+
+        static const char in[] =
+            "{a:1b,s:\"q\\\"\\\\\x01\",l:[1L,2L],L:-9L,f:NaNf,d:0.25d,b:[B;1b,2b,-1b],e:[],c:{}}";
+
+        static const char plain[] =
+            "{\"a\":1,\"s\":\"q\\\"\\\\\\u0001\",\"l\":[1,2],\"L\":-9,\"f\":null,\"d\":0.25,"
+            "\"b\":[1,2,-1],\"e\":[],\"c\":{}}";
+
+        static const char typed[] =
+            "{\"\":{\"type\":\"TAG_COMPOUND\",\"value\":{"
+            "\"a\":{\"type\":\"TAG_BYTE\",\"value\":1},"
+            "\"s\":{\"type\":\"TAG_STRING\",\"value\":\"q\\\"\\\\\\u0001\"},"
+            "\"l\":{\"type\":\"TAG_LIST\",\"elements\":\"TAG_LONG\",\"value\":[\"1\",\"2\"]},"
+            "\"L\":{\"type\":\"TAG_LONG\",\"value\":\"-9\"},"
+            "\"f\":{\"type\":\"TAG_FLOAT\",\"value\":\"NaN\"},"
+            "\"d\":{\"type\":\"TAG_DOUBLE\",\"value\":0.25},"
+            "\"b\":{\"type\":\"TAG_BYTE_ARRAY\",\"value\":\"AQL/\"},"
+            "\"e\":{\"type\":\"TAG_LIST\",\"elements\":\"TAG_END\",\"value\":[]},"
+            "\"c\":{\"type\":\"TAG_COMPOUND\",\"value\":{}}}}}";
+
+        nbt_node* parsed = nbt_parse_snbt(in, sizeof in - 1);
+        if(parsed == NULL) die_with_err(errno);
+
+        char* json = nbt_dump_json(parsed, NBT_JSON_DEFAULT);
+        if(json == NULL) die_with_err(errno);
+        if(strcmp(json, plain) != 0) die("FAILED. Wrote the wrong JSON.");
+        free(json);
+
+        json = nbt_dump_json(parsed, NBT_JSON_TYPED | NBT_JSON_LONG_STRINGS |
+                                     NBT_JSON_BASE64 | NBT_JSON_NAMED_ROOT);
+        if(json == NULL) die_with_err(errno);
+        if(strcmp(json, typed) != 0) die("FAILED. Wrote the wrong typed JSON.");
+        free(json);
+
+        nbt_free(parsed);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking canonical dumps and hashes... ");
+        struct buffer b = nbt_dump_binary(tree);
+        struct buffer canon = nbt_dump_canonical(tree);
+        if(b.data == NULL || canon.data == NULL) die_with_err(errno);
+
+        if(canon.len != b.len)
+            die("FAILED. The canonical dump is the wrong size.");
+
+        /* Shuffling compounds changes neither. */
+        nbt_node* shuffled = nbt_parse(b.data, b.len);
+        if(shuffled == NULL) die_with_err(errno);
+        if(!nbt_map(shuffled, rotate_compound, NULL))
+            die("FAILED. Couldn't shuffle a compound.");
+
+        struct buffer again = nbt_dump_canonical(shuffled);
+        if(again.data == NULL) die_with_err(errno);
+
+        if(again.len != canon.len || memcmp(again.data, canon.data, canon.len) != 0)
+            die("FAILED. The canonical dump depends on order.");
+        if(nbt_hash(shuffled) != nbt_hash(tree))
+            die("FAILED. The hash depends on order.");
+
+        nbt_free(shuffled);
+        buffer_free(&again);
+
+        /* Nor does packing lists. */
+        nbt_node* packed = nbt_parse_ex(canon.data, canon.len, NBT_PARSE_PACK);
+        if(packed == NULL) die_with_err(errno);
+        if(nbt_hash(packed) != nbt_hash(tree))
+            die("FAILED. The hash depends on packing.");
+
+        again = nbt_dump_canonical(packed);
+        if(again.data == NULL) die_with_err(errno);
+        if(again.len != canon.len || memcmp(again.data, canon.data, canon.len) != 0)
+            die("FAILED. The canonical dump depends on packing.");
+
+        nbt_free(packed);
+        buffer_free(&again);
+        buffer_free(&canon);
+        buffer_free(&b);
+
+        static const char* const same[][2] = {
+            { "{a:NaNf,b:0.0d,c:[],d:[{x:1,y:2}]}", "{d:[{y:2,x:1}],c:[],b:-0.0d,a:NaNf}" },
+            { "{k:1b,k:2b}", "{k:1b,k:2b}" },
+        };
+
+        static const char* const different[][2] = {
+            { "{a:1b}", "{a:2b}" },
+            { "{a:1b}", "{b:1b}" },
+            { "{a:1b}", "{a:1s}" },
+            { "{a:[I;1,2]}", "{a:[I;1,3]}" },
+            { "{a:[L;1L,2L]}", "{a:[L;1L,3L]}" },
+            { "{a:[1,2]}", "{a:[2,1]}" },
+            { "{a:{}}", "{a:[]}" },
+        };
+
+        for(size_t i = 0; i < sizeof same / sizeof same[0] + sizeof different / sizeof different[0]; i++)
+        {
+            bool want_same = i < sizeof same / sizeof same[0];
+            const char* const* pair = want_same ? same[i] : different[i - sizeof same / sizeof same[0]];
+
+            nbt_node* x = nbt_parse_snbt(pair[0], strlen(pair[0]));
+            nbt_node* y = nbt_parse_snbt(pair[1], strlen(pair[1]));
+            if(x == NULL || y == NULL) die_with_err(errno);
+
+            struct buffer cx = nbt_dump_canonical(x);
+            struct buffer cy = nbt_dump_canonical(y);
+            if(cx.data == NULL || cy.data == NULL) die_with_err(errno);
+
+            bool dumped_same = cx.len == cy.len && memcmp(cx.data, cy.data, cx.len) == 0;
+
+            if(dumped_same != want_same || (nbt_hash(x) == nbt_hash(y)) != want_same)
+            {
+                printf("%s %s ", pair[0], pair[1]);
+                die("FAILED. Canonicalized the wrong things.");
+            }
+
+            if(!want_same && nbt_eq(x, y))
+                die("FAILED. nbt_eq missed a difference.");
+
+            buffer_free(&cx);
+            buffer_free(&cy);
+            nbt_free(x);
+            nbt_free(y);
+        }
+
+        /* Every NaN is the same NaN. */
+        nbt_node nan = { .type = TAG_DOUBLE, .payload.tag_double = NAN };
+        nbt_node negative_nan = { .type = TAG_DOUBLE, .payload.tag_double = -NAN };
+
+        if(nbt_hash(&nan) != nbt_hash(&negative_nan))
+            die("FAILED. Hashed two NaNs differently.");
+
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking cached hashes... ");
+
+        static const char in[] =
+            "{Level:{xPos:1,Sections:[{Y:0b,Blocks:[B;1b,2b]},{Y:1b}],Pos:[0.5d,1.0d],Name:\"a\"}}";
+
+        nbt_node* parsed = nbt_parse_snbt(in, sizeof in - 1);
+        if(parsed == NULL) die_with_err(errno);
+
+        nbt_node* aug = nbt_augment(parsed);
+        if(aug == NULL) die_with_err(errno);
+
+        uint64_t saved = nbt_hash(aug);
+
+        if(saved != nbt_hash(parsed) || nbt_changed(aug, saved))
+            die("FAILED. An augmented tree hashed differently.");
+
+        nbt_node* level = nbt_compound_get(aug, "Level");
+        nbt_node* y = find_path(aug, "Level.Sections[1].Y");
+
+        /* Until it's invalidated, the cache is trusted... */
+        y->payload.tag_byte = 7;
+
+        if(nbt_changed(aug, saved))
+            die("FAILED. A cached hash wasn't used.");
+
+        /* ...and then only the path up to the change is hashed again. */
+        nbt_hash_invalidate(y);
+
+        nbt_node* fresh = nbt_augment(aug);
+        if(fresh == NULL) die_with_err(errno);
+
+        if(!nbt_changed(aug, saved) || nbt_hash(aug) != nbt_hash(fresh))
+            die("FAILED. An invalidated hash wasn't recomputed.");
+
+        if(nbt_eq(aug, parsed) || !nbt_eq(aug, fresh))
+            die("FAILED. nbt_eq was fooled by cached hashes.");
+
+        y->payload.tag_byte = 1;
+        nbt_hash_invalidate(y);
+
+        if(nbt_changed(aug, saved))
+            die("FAILED. Changing a tree back didn't change its hash back.");
+
+        /* Taking children out and putting them back changes the hash too. */
+        nbt_node* name = nbt_compound_take(level, "Name");
+
+        if(name == NULL || !nbt_changed(aug, saved))
+            die("FAILED. nbt_compound_take didn't invalidate the hash.");
+
+        if(nbt_compound_append(level, name) != NBT_OK || nbt_changed(aug, saved))
+            die("FAILED. nbt_compound_append didn't invalidate the hash.");
+
+        /* Floats are compared with slack, so their hashes can't rule anything out. */
+        nbt_node* nudged = nbt_augment(aug);
+        if(nudged == NULL) die_with_err(errno);
+
+        find_path(nudged, "Level.Pos[0]")->payload.tag_double += 1e-9;
+
+        if(nbt_hash(nudged) == nbt_hash(aug) || !nbt_eq(nudged, aug))
+            die("FAILED. Hashes short-circuited a comparison of floats.");
+
+        nbt_free(nudged);
+        nbt_free(fresh);
+        nbt_free(aug);
+        nbt_free(parsed);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking diffs and patches... ");
+
+        static const char* const pairs[][2] = {
+            { "{a:1,b:\"x\"}", "{a:1,b:\"x\"}" },
+            { "{a:1,b:\"x\",c:{d:[I;1,2,3,4,5],e:[L;1L]}}",
+              "{a:2,c:{d:[I;1,2,9,9,4,5],e:[L;],f:\"new\"},g:[B;]}" },
+            { "{l:[{id:1},{id:2},{id:3},{id:4}]}", "{l:[{id:1},{id:5},{id:3,x:1b},{id:4},{id:6}]}" },
+            { "{l:[{id:1},{id:2},{id:3}]}", "{l:[{id:3}]}" },
+            { "{l:[1,2,3,4],m:[1.0f,2.0f]}", "{l:[1,7,7,3,4],m:[]}" },
+            { "{l:[1,2,3,4]}", "{l:[]}" },
+            { "{l:[1d,2d,3d]}", "{l:[1d,5d,6d,3d]}" },
+            { "{a:1,b:[1,2],c:{x:1}}", "{a:1L,b:[\"s\"],c:[1]}" },
+            { "{l:[[1,2],[3]]}", "{l:[[1,2,3],[3],[]]}" },
+            { "{\"a.b\":1,\"\":{\"x\\\"y\":2}}", "{\"a.b\":2,\"\":{\"x\\\"y\":3,\"*\":1}}" },
+        };
+
+        /*
+         * Plain, augmented, with `l' packed, applied to a shared copy, and with
+         * the diff's own lists packed when it's loaded.
+         */
+        for(size_t i = 0; i < sizeof pairs / sizeof *pairs; i++)
+        for(int variant = 0; variant < 5; variant++)
+        {
+            nbt_node* a = nbt_parse_snbt(pairs[i][0], strlen(pairs[i][0]));
+            nbt_node* b = nbt_parse_snbt(pairs[i][1], strlen(pairs[i][1]));
+            if(a == NULL || b == NULL) die_with_err(errno);
+
+            if(variant == 1)
+            {
+                nbt_node* x = nbt_augment(a);
+                nbt_node* y = nbt_augment(b);
+                if(x == NULL || y == NULL) die_with_err(errno);
+
+                nbt_free(a); a = x;
+                nbt_free(b); b = y;
+            }
+
+            if(variant == 2 && nbt_compound_get(a, "l") && nbt_list_pack(nbt_compound_get(a, "l")) != NBT_OK)
+                die_with_err(NBT_EMEM);
+
+            nbt_node* diff = nbt_diff(a, b);
+            if(diff == NULL) die_with_err(errno);
+
+            if(i == 0 && nbt_list_length(nbt_compound_get(diff, "ops")) != 0)
+                die("FAILED. Equal trees had a diff.");
+
+            /* The binary encoding is just the diff dumped as NBT. */
+            struct buffer bin = nbt_dump_binary(diff);
+            if(bin.data == NULL) die_with_err(errno);
+
+            nbt_node* loaded = nbt_parse_ex(bin.data, bin.len, variant == 4 ? NBT_PARSE_PACK : 0);
+            if(loaded == NULL) die_with_err(errno);
+
+            uint64_t before = nbt_hash(a);
+            nbt_node* patched = variant == 3 ? nbt_share(a) : a;
+
+            nbt_status err = nbt_diff_apply(&patched, loaded);
+            if(err != NBT_OK) die_with_err(err);
+
+            if(nbt_hash(patched) != nbt_hash(b) || !nbt_eq(patched, b))
+            {
+                char* text = nbt_dump_ascii(diff);
+                printf("%s\n", text ? text : "");
+                free(text);
+                die("FAILED. A patched tree didn't match.");
+            }
+
+            if(variant == 3 && nbt_hash(a) != before)
+                die("FAILED. Patching changed a shared tree.");
+
+            if(variant == 1)
+            {
+                nbt_node* fresh = nbt_augment(patched);
+                if(fresh == NULL) die_with_err(errno);
+
+                if(nbt_size(fresh) != nbt_size(patched) || nbt_changed(patched, nbt_hash(fresh)))
+                    die("FAILED. Patching broke an augmented tree.");
+
+                nbt_free(fresh);
+            }
+
+            if(variant == 3)
+                nbt_free(patched);
+
+            buffer_free(&bin);
+            nbt_free(loaded);
+            nbt_free(diff);
+            nbt_free(b);
+            nbt_free(a);
+        }
+
+        /* Patches have to fit the tree they're applied to. */
+        {
+            nbt_node* a = nbt_parse_snbt("{a:1}", 5);
+            nbt_node* b = nbt_parse_snbt("{a:2}", 5);
+            nbt_node* other = nbt_parse_snbt("{b:1}", 5);
+            if(a == NULL || b == NULL || other == NULL) die_with_err(errno);
+
+            nbt_node* diff = nbt_diff(a, b);
+            if(diff == NULL) die_with_err(errno);
+
+            if(nbt_diff_apply(&other, diff) != NBT_ERR || nbt_diff_apply(&other, a) != NBT_ERR)
+                die("FAILED. A patch which didn't fit was applied.");
+
+            nbt_free(diff);
+            nbt_free(other);
+            nbt_free(b);
+            nbt_free(a);
+        }
+
+        /* One change in a big augmented tree makes one op. */
+        struct buffer text = BUFFER_INIT;
+        buffer_append(&text, "{", 1);
+
+        for(int i = 0; i < 2000; i++)
+        {
+            char entry[64];
+            int n = sprintf(entry, "%sk%d:{x:%d,y:[I;%d]}", i ? "," : "", i, i, i);
+            if(buffer_append(&text, entry, n)) die_with_err(NBT_EMEM);
+        }
+
+        if(buffer_append(&text, "}", 1)) die_with_err(NBT_EMEM);
+
+        nbt_node* parsed = nbt_parse_snbt((char*)text.data, text.len);
+        if(parsed == NULL) die_with_err(errno);
+
+        nbt_node* a = nbt_augment(parsed);
+        nbt_node* b = nbt_augment(parsed);
+        if(a == NULL || b == NULL) die_with_err(errno);
+
+        nbt_node* x = find_path(b, "k1234.x");
+        x->payload.tag_int = -1;
+        nbt_hash_invalidate(x);
+
+        nbt_node* diff = nbt_diff(a, b);
+        if(diff == NULL) die_with_err(errno);
+
+        nbt_node* op = nbt_list_item(nbt_compound_get(diff, "ops"), 0);
+
+        if(nbt_list_length(nbt_compound_get(diff, "ops")) != 1 ||
+           strcmp(nbt_compound_get(op, "path")->payload.tag_string, "k1234.x") != 0)
+            die("FAILED. A small change made a big diff.");
+
+        nbt_status err = nbt_diff_apply(&a, diff);
+        if(err != NBT_OK) die_with_err(err);
+
+        if(nbt_changed(a, nbt_hash(b)))
+            die("FAILED. A patched tree didn't match.");
+
+        nbt_free(diff);
+        nbt_free(b);
+        nbt_free(a);
+        nbt_free(parsed);
+        buffer_free(&text);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking the emitter... ");
+        struct buffer b = nbt_dump_binary(tree);
+        if(b.data == NULL) die_with_err(errno);
+
+        nbt_node* unpacked = nbt_parse(b.data, b.len);
+        if(unpacked == NULL) die_with_err(errno);
+
+        struct nbt_emitter* e = malloc(sizeof *e);
+        if(e == NULL) die("Out of memory.");
+
+        struct buffer emitted = BUFFER_INIT;
+        struct nbt_sink sink = nbt_sink_buffer(&emitted);
+
+        nbt_emitter_init(e, &sink);
+        emit_tree(e, unpacked, unpacked->name);
+
+        if(nbt_emitter_finish(e) != NBT_OK)
+            die("FAILED. Couldn't emit the tree.");
+        if(emitted.len != b.len || memcmp(emitted.data, b.data, b.len) != 0)
+            die("FAILED. Emitted something else.");
+
+        nbt_free(unpacked);
+        buffer_free(&emitted);
+        buffer_free(&b);
+
+        /* Each of these goes wrong on its last call. */
+        for(int i = 0; i < 7; i++)
+        {
+            nbt_emitter_init(e, &sink);
+            nbt_emit_begin_compound(e, "");
+
+            nbt_status err = NBT_OK;
+
+            switch(i)
+            {
+            case 0: err = nbt_emit_int(e, NULL, 1); break;
+            case 1: nbt_emit_begin_list(e, "l", TAG_INT, 1); err = nbt_emit_short(e, NULL, 1); break;
+            case 2: nbt_emit_begin_list(e, "l", TAG_INT, 1); err = nbt_emit_int(e, "x", 1); break;
+            case 3: nbt_emit_begin_list(e, "l", TAG_INT, 1); err = nbt_emit_end(e); break;
+            case 4: nbt_emit_begin_list(e, "l", TAG_INT, 0); nbt_emit_end(e); err = nbt_emit_int(e, NULL, 1); break;
+            case 5: nbt_emit_end(e); err = nbt_emit_int(e, "x", 1); break;
+            case 6: err = nbt_emitter_finish(e); break;
+            }
+
+            if(err != NBT_ERR || nbt_emit_end(e) != NBT_ERR)
+                die("FAILED. The emitter let a mistake through.");
+
+            buffer_free(&emitted);
+        }
+
+        free(e);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking in-place patches... ");
+
+        static const char in[] = "{a:{b:1s,c:[{d:2.5f}],s:\"abc\",ia:[I;1,2],l:9L},b:3b}";
+        static const char out[] = "{a:{b:-7s,c:[{d:4.25f}],s:\"xyz\",ia:[I;5,6],l:-9000000000L},b:3b}";
+
+        nbt_node* parsed = nbt_parse_snbt(in, sizeof in - 1);
+        if(parsed == NULL) die_with_err(errno);
+
+        parsed->name = strdup("");
+
+        struct buffer b = nbt_dump_binary(parsed);
+        if(b.data == NULL) die_with_err(errno);
+
+        nbt_free(parsed);
+
+        static const int32_t ia[] = { 5, 6 };
+
+        if(nbt_patch_int(b.data, b.len, ".a.b", -7) != NBT_OK ||
+           nbt_patch_real(b.data, b.len, ".a.c..d", 4.25) != NBT_OK ||
+           nbt_patch_string(b.data, b.len, ".a.s", "xyz") != NBT_OK ||
+           nbt_patch_array(b.data, b.len, ".a.ia", TAG_INT_ARRAY, ia, 2) != NBT_OK ||
+           nbt_patch_int(b.data, b.len, ".a.l", -9000000000LL) != NBT_OK)
+            die("FAILED. Couldn't patch a tag.");
+
+        /* None of these fit, so nothing changes. */
+        if(nbt_patch_int(b.data, b.len, ".a.b", 40000) != NBT_ERR ||
+           nbt_patch_int(b.data, b.len, ".b", -129) != NBT_ERR ||
+           nbt_patch_int(b.data, b.len, ".a.s", 1) != NBT_ERR ||
+           nbt_patch_string(b.data, b.len, ".a.s", "ab") != NBT_ERR ||
+           nbt_patch_array(b.data, b.len, ".a.ia", TAG_INT_ARRAY, ia, 1) != NBT_ERR ||
+           nbt_patch_int(b.data, b.len, ".a.nope", 1) != NBT_ERR ||
+           nbt_patch_int(b.data, b.len, "a.b", 1) != NBT_ERR)
+            die("FAILED. Patched something that doesn't fit.");
+
+        if((parsed = nbt_parse(b.data, b.len)) == NULL) die_with_err(errno);
+
+        char* snbt = nbt_dump_snbt(parsed);
+        if(snbt == NULL) die_with_err(errno);
+        if(strcmp(snbt, out) != 0) die("FAILED. Patched the wrong thing.");
+
+        free(snbt);
+        nbt_free(parsed);
+        buffer_free(&b);
+
+        /* Paths are found in the binary just as they are in the tree. */
+        if((b = nbt_dump_binary(tree)).data == NULL) die_with_err(errno);
+
+        nbt_node* child = first_child(tree);
+
+        if(child != NULL && tree->name != NULL && child->name != NULL)
+        {
+            char path[1024];
+            snprintf(path, sizeof path, "%s.%s", tree->name, child->name);
+
+            struct nbt_event ev;
+
+            if(nbt_locate(b.data, b.len, path, &ev) != NBT_OK ||
+               ev.kind == NBT_EVENT_DONE || ev.type != nbt_find_by_path(tree, path)->type)
+                die("FAILED. Couldn't find a path.");
+        }
+
+        /* However long a path is, it doesn't have to fit on the stack. */
+        char* deep = malloc(200001);
+        if(deep == NULL) die_with_err(NBT_EMEM);
+
+        memset(deep, '.', 200000);
+        deep[200000] = '\0';
+
+        struct nbt_event ev;
+
+        if(nbt_locate(b.data, b.len, deep, &ev) != NBT_OK || ev.kind != NBT_EVENT_DONE)
+            die("FAILED. Found a path that isn't there.");
+
+        free(deep);
+        buffer_free(&b);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking streaming transforms... ");
+        struct buffer b = nbt_dump_binary(tree);
+        if(b.data == NULL) die_with_err(errno);
+
+        /* Keeping everything, whether it's looked at or not, changes nothing. */
+        struct nbt_transform_rule everything = { "*.*.*.*", keep, NULL };
+
+        for(size_t n = 0; n <= 1; n++)
+        {
+            struct buffer got = BUFFER_INIT;
+            struct nbt_sink sink = nbt_sink_buffer(&got);
+
+            if(nbt_transform(b.data, b.len, &everything, n, &sink) != NBT_OK)
+                die("FAILED. Couldn't transform the tree.");
+            if(got.len != b.len || memcmp(got.data, b.data, b.len) != 0)
+                die("FAILED. Changed something nothing asked to change.");
+
+            buffer_free(&got);
+        }
+
+        buffer_free(&b);
+
+        static const char in[] =
+            "{UUID:[I;1,2,3,4],name:\"Steve\",Inv:[{id:\"a\",UUID:1L},{id:\"b\",tag:{pages:[\"p\"]}}],"
+            "tags:[\"a\",\"secret\",\"b\",\"secret\"],n:[1,2,3],keep:{UUID:5b}}";
+        static const char out[] =
+            "{name:\"redacted\",Inv:[{id:\"a\"},{id:\"b\",tag:{}}],tags:[\"a\",\"b\"],n:[10,20,30],keep:{UUID:5b}}";
+
+        nbt_node* parsed = nbt_parse_snbt(in, sizeof in - 1);
+        if(parsed == NULL) die_with_err(errno);
+
+        parsed->name = strdup("");
+
+        if((b = nbt_dump_binary(parsed)).data == NULL) die_with_err(errno);
+        nbt_free(parsed);
+
+        const struct nbt_transform_rule rules[] = {
+            { ".UUID",          NULL,        NULL     },
+            { ".Inv.*.UUID",    NULL,        NULL     },
+            { ".Inv.*.tag.*",   NULL,        NULL     },
+            { ".name",          redact,      NULL     },
+            { ".tags.*",        drop_string, "secret" },
+            { ".n.*",           times_ten,   NULL     },
+        };
+
+        struct buffer got = BUFFER_INIT;
+        struct nbt_sink sink = nbt_sink_buffer(&got);
+
+        if(nbt_transform(b.data, b.len, rules, sizeof rules / sizeof rules[0], &sink) != NBT_OK)
+            die("FAILED. Couldn't transform a tree.");
+
+        if((parsed = nbt_parse(got.data, got.len)) == NULL) die_with_err(errno);
+
+        char* snbt = nbt_dump_snbt(parsed);
+        if(snbt == NULL) die_with_err(errno);
+        if(strcmp(snbt, out) != 0) die("FAILED. Transformed the wrong things.");
+
+        free(snbt);
+        nbt_free(parsed);
+
+        /* A list can't change type halfway through. */
+        struct nbt_transform_rule shorts = { ".n.*", times_ten, "short" };
+
+        got.len = 0;
+        if(nbt_transform(b.data, b.len, &shorts, 1, &sink) != NBT_ERR)
+            die("FAILED. Put the wrong type in a list.");
+
+        buffer_free(&got);
+        buffer_free(&b);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking region writes... ");
+
+        char path[] = "/tmp/cnbt-region-XXXXXX";
+        int fd = mkstemp(path);
+        if(fd < 0) die("Couldn't make a temporary file.");
+        close(fd);
+
+        struct buffer b = nbt_dump_binary(tree);
+        if(b.data == NULL) die_with_err(errno);
+
+        /* Something which doesn't compress, to make a chunk outgrow its sectors. */
+        struct buffer big = BUFFER_INIT;
+        uint64_t seed = 1;
+
+        for(int i = 0; i < 20000; i++)
+        {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            unsigned char byte = (unsigned char)(seed >> 56);
+
+            if(buffer_append(&big, &byte, 1)) die("Out of memory.");
+        }
+
+        nbt_region* region = nbt_region_open_rw(path);
+        if(region == NULL) die_with_err(errno);
+
+        if(nbt_region_write(region, 0, 0, b.data, b.len, 1) != NBT_OK ||
+           nbt_region_write(region, 31, 31, b.data, b.len, 2) != NBT_OK ||
+           nbt_region_write(region, 0, 0, big.data, big.len, 3) != NBT_OK)
+            die("FAILED. Couldn't write a chunk.");
+
+        nbt_region_close(region);
+
+        if((region = nbt_region_open(path)) == NULL) die_with_err(errno);
+
+        struct buffer got = BUFFER_INIT;
+
+        if(nbt_region_read(region, 0, 0, &got) != NBT_OK ||
+           got.len != big.len || memcmp(got.data, big.data, big.len) != 0)
+            die("FAILED. A moved chunk didn't read back.");
+
+        if(nbt_region_read(region, 31, 31, &got) != NBT_OK ||
+           got.len != b.len || memcmp(got.data, b.data, b.len) != 0)
+            die("FAILED. A chunk didn't read back.");
+
+        if(nbt_region_timestamp(region, 0, 0) != 3 || nbt_region_timestamp(region, 31, 31) != 2 ||
+           nbt_region_has_chunk(region, 5, 5))
+            die("FAILED. Wrote the wrong header.");
+
+        nbt_node* chunk = nbt_region_chunk(region, 31, 31, NBT_PARSE_DEFAULT);
+        if(chunk == NULL) die_with_err(errno);
+        if(!nbt_eq(chunk, tree)) die("FAILED. A chunk didn't parse back.");
+
+        nbt_free(chunk);
+        nbt_region_close(region);
+        remove(path);
+
+        buffer_free(&got);
+        buffer_free(&big);
+        buffer_free(&b);
+        printf("OK.\n");
+    }
+
+    /* Region files are checked when there's one named after the tree. */
+    {
+        char path[4096];
+        const char* dot = strrchr(argv[1], '.');
+        int stem = dot ? (int)(dot - argv[1]) : (int)strlen(argv[1]);
+
+        snprintf(path, sizeof path, "%.*s.mca", stem, argv[1]);
+
+        nbt_region* region = nbt_region_open(path);
+
+        if(region != NULL)
+        {
+            printf("Checking region files... ");
+
+            /* One line of JSON per chunk, the same as parsing each one. */
+            struct buffer expected = BUFFER_INIT;
+            size_t chunks = 0;
+
+            for(int z = 0; z < 32; z++)
+                for(int x = 0; x < 32; x++)
+                {
+                    if(!nbt_region_has_chunk(region, x, z))
+                    {
+                        if(nbt_region_chunk(region, x, z, NBT_PARSE_DEFAULT) != NULL || errno != NBT_OK)
+                            die("FAILED. Found a chunk which isn't there.");
+
+                        continue;
+                    }
+
+                    nbt_node* chunk = nbt_region_chunk(region, x, z, NBT_PARSE_DEFAULT);
+                    if(chunk == NULL) die_with_err(errno);
+
+                    char* json = nbt_dump_json(chunk, NBT_JSON_TYPED);
+                    if(json == NULL) die_with_err(errno);
+
+                    if(buffer_append(&expected, json, strlen(json)) ||
+                       buffer_append(&expected, "\n", 1))
+                        die("Out of memory.");
+
+                    free(json);
+                    nbt_free(chunk);
+                    chunks++;
+                }
+
+            struct buffer got = BUFFER_INIT;
+            struct nbt_sink sink = nbt_sink_buffer(&got);
+
+            if(nbt_region_dump_json(region, NBT_JSON_TYPED, &sink) != NBT_OK)
+                die("FAILED. Couldn't dump the region.");
+
+            if(chunks == 0 || got.len != expected.len || memcmp(got.data, expected.data, got.len) != 0)
+                die("FAILED. The region dumped differently.");
+
+            buffer_free(&got);
+            buffer_free(&expected);
+            nbt_region_close(region);
+            printf("OK.\n");
+        }
+    }
+
+    {
+        printf("Checking compiled paths... ");
+
+        static const char in[] =
+            "{Level:{Sections:[{Y:0b,BlockStates:[L;1L,2L]},{Y:1b},{Y:2b,BlockStates:[L;3L]}],"
+            "\"a.b\":5,n:{n:{n:1}}}}";
+
+        static const struct {
+            const char* path;
+            size_t matches;
+            const char* first;  /* SNBT of the first match */
+        } queries[] = {
+            { "Level.Sections[*].BlockStates@long_array", 2, "[L;1L,2L]" },
+            { ".Level.Sections[-1].Y",                    1, "2b"        },
+            { "Level.Sections[0]..Y",                     1, "0b"        },
+            { "Level.Sections[3]",                        0, NULL        },
+            { "Level.Sections[-4]",                       0, NULL        },
+            { "Level.Sections[1].BlockStates",            0, NULL        },
+            { "[\"Level\"][\"a.b\"]",                     1, "5"         },
+            { "Level.\"a.b\"@TAG_Int",                    1, "5"         },
+            { "Level.\"a.b\"@short",                      0, NULL        },
+            { "Level.*",                                  3, NULL        },
+            { "..n",                                      3, NULL        },
+            { "..n@int",                                  1, "1"         },
+            { "..Sections[*].Y",                          3, "0b"        },
+            { "..*@byte",                                 3, "0b"        },
+            { "Level.Sections.Y",                         0, NULL        },
+            { "",                                         1, NULL        },
+        };
+
+        nbt_node* parsed = nbt_parse_snbt(in, sizeof in - 1);
+        if(parsed == NULL) die_with_err(errno);
+
+        parsed->name = strdup("");
+
+        struct buffer b = nbt_dump_binary(parsed);
+        if(b.data == NULL) die_with_err(errno);
+
+        /* Interned trees are matched by pointer, and have to give the same answers. */
+        nbt_node* interned = nbt_parse_ex(b.data, b.len, NBT_PARSE_INTERN);
+        if(interned == NULL) die_with_err(errno);
+
+        struct nbt_path_iter* it = malloc(sizeof *it);
+        if(it == NULL) die_with_err(NBT_EMEM);
+
+        for(size_t i = 0; i < sizeof queries / sizeof *queries; i++)
+        {
+            nbt_path* path = nbt_path_compile(queries[i].path);
+            if(path == NULL) die_with_err(errno);
+
+            for(int pass = 0; pass < 2; pass++)
+            {
+                nbt_node* first = NULL;
+                size_t n = 0;
+
+                nbt_path_begin(it, path, pass ? interned : parsed);
+
+                for(nbt_node* m; (m = nbt_path_next(it)) != NULL; n++)
+                    if(first == NULL)
+                        first = m;
+
+                if(errno != NBT_OK || n != queries[i].matches)
+                    die("FAILED. A path matched the wrong number of tags.");
+
+                if(first != nbt_path_first(path, pass ? interned : parsed))
+                    die("FAILED. nbt_path_first didn't find the first match.");
+
+                if(queries[i].first != NULL)
+                {
+                    nbt_node unnamed = *first;
+                    unnamed.name = NULL;
+
+                    char* snbt = nbt_dump_snbt(&unnamed);
+                    if(snbt == NULL) die_with_err(errno);
+
+                    if(strcmp(snbt, queries[i].first) != 0)
+                        die("FAILED. A path matched the wrong tag.");
+
+                    free(snbt);
+                }
+            }
+
+            nbt_path_free(path);
+        }
+
+        static const char* const bad[] = { "a[", "a[x]", "a[1", "a@nope", "a..", "a.", "\"abc", "a]", "a[\"b\"" };
+
+        for(size_t i = 0; i < sizeof bad / sizeof *bad; i++)
+            if(nbt_path_compile(bad[i]) != NULL || errno != NBT_ERR)
+                die("FAILED. Compiled a bad path.");
+
+        /* Every node but the root is somewhere underneath it. */
+        nbt_path* all = nbt_path_compile("..*");
+        if(all == NULL) die_with_err(errno);
+
+        size_t n = 0;
+        for(nbt_path_begin(it, all, tree); nbt_path_next(it) != NULL; )
+            n++;
+
+        if(n + 1 != nbt_size(tree))
+            die("FAILED. ..* didn't visit every node.");
+
+        nbt_path_free(all);
+        printf("OK.\n");
+
+        printf("Checking multi-path matchers... ");
+
+        /* A matcher has to agree with running each of its paths on its own. */
+        const char* paths[sizeof queries / sizeof *queries];
+        for(size_t i = 0; i < sizeof queries / sizeof *queries; i++)
+            paths[i] = queries[i].path;
+
+        nbt_matcher* m = nbt_matcher_compile(paths, sizeof paths / sizeof *paths);
+        if(m == NULL) die_with_err(errno);
+
+        for(int pass = 0; pass < 3; pass++)
+        {
+            struct match_counts c = { .stop_after = SIZE_MAX };
+            nbt_status err = pass < 2 ? nbt_matcher_run(m, pass ? interned : parsed, count_match, &c)
+                                      : nbt_matcher_run_binary(m, b.data, b.len, count_event_match, &c);
+            if(err != NBT_OK) die_with_err(err);
+
+            for(size_t i = 0; i < sizeof queries / sizeof *queries; i++)
+            {
+                if(c.n[i] != queries[i].matches)
+                    die("FAILED. A matcher matched the wrong number of tags.");
+
+                if(pass < 2 && c.n[i] > 0)
+                {
+                    nbt_path* path = nbt_path_compile(queries[i].path);
+                    if(path == NULL) die_with_err(errno);
+
+                    if(c.first[i] != nbt_path_first(path, pass ? interned : parsed))
+                        die("FAILED. A matcher's first match wasn't the path's.");
+
+                    nbt_path_free(path);
+                }
+            }
+
+            /* Stopping early. */
+            struct match_counts once = { .stop_after = 1 };
+            err = pass < 2 ? nbt_matcher_run(m, pass ? interned : parsed, count_match, &once)
+                           : nbt_matcher_run_binary(m, b.data, b.len, count_event_match, &once);
+            if(err != NBT_OK) die_with_err(err);
+
+            size_t total = 0;
+            for(size_t i = 0; i < sizeof queries / sizeof *queries; i++)
+                total += once.n[i];
+
+            if(total != 1)
+                die("FAILED. A matcher didn't stop.");
+        }
+
+        if(nbt_matcher_compile((const char* const[]) { "a", "a[" }, 2) != NULL || errno != NBT_ERR)
+            die("FAILED. Compiled a matcher with a bad path.");
+
+        nbt_matcher_free(m);
+
+        /* Every node in a real file, in one walk of its binary form. */
+        struct buffer whole = nbt_dump_binary(tree);
+        if(whole.data == NULL) die_with_err(errno);
+
+        m = nbt_matcher_compile((const char* const[]) { "..*", "" }, 2);
+        if(m == NULL) die_with_err(errno);
+
+        struct match_counts c = { .stop_after = SIZE_MAX };
+        nbt_status err = nbt_matcher_run(m, tree, count_match, &c);
+        if(err != NBT_OK) die_with_err(err);
+
+        if(c.n[0] + 1 != nbt_size(tree) || c.n[1] != 1)
+            die("FAILED. A matcher didn't visit every node.");
+
+        struct match_counts events = { .stop_after = SIZE_MAX };
+        if((err = nbt_matcher_run_binary(m, whole.data, whole.len, count_event_match, &events)) != NBT_OK)
+            die_with_err(err);
+
+        if(events.n[0] != c.n[0] || events.n[1] != 1)
+            die("FAILED. A matcher didn't visit every event.");
+
+        nbt_matcher_free(m);
+        buffer_free(&whole);
+        free(it);
+        nbt_free(interned);
+        nbt_free(parsed);
+        buffer_free(&b);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking iterators... ");
+
+        size_t size = nbt_size(tree);
+        struct visit_order order = { malloc(size * sizeof *order.nodes), 0 };
+        struct nbt_iter* it = malloc(sizeof *it);
+        if(order.nodes == NULL || it == NULL) die_with_err(NBT_EMEM);
+
+        nbt_map(tree, record_visit, &order);
+
+        /* Pre-order is nbt_map's order. */
+        size_t n = 0;
+        nbt_iter_init(it, tree, NBT_PREORDER);
+
+        for(nbt_node* node; (node = nbt_iter_next(it)) != NULL; n++)
+            if(n >= size || node != order.nodes[n] || (n == 0) != (it->depth == 0))
+                die("FAILED. Pre-order didn't match nbt_map.");
+
+        if(errno != NBT_OK || n != size)
+            die("FAILED. Pre-order missed some nodes.");
+
+        /* In post-order, a list or compound comes right after its last child. */
+        nbt_node* prev = NULL;
+        size_t prev_depth = 0;
+        n = 0;
+        nbt_iter_init(it, tree, NBT_POSTORDER);
+
+        for(nbt_node* node; (node = nbt_iter_next(it)) != NULL; n++)
+        {
+            if(node->type == TAG_COMPOUND || (node->type == TAG_LIST && !(node->flags & NBT_NODE_PACKED)))
+            {
+                struct list_head* head = &node->payload.tag_compound->entry;
+
+                if(!list_empty(head) &&
+                   (list_entry(head->blink, struct nbt_list, entry)->data != prev || prev_depth != it->depth + 1))
+                    die("FAILED. Post-order visited a node before its children.");
+            }
+
+            prev = node;
+            prev_depth = it->depth;
+        }
+
+        if(errno != NBT_OK || n != size || prev != tree || prev_depth != 0)
+            die("FAILED. Post-order missed some nodes.");
+
+        /* Skipping the root's children leaves just the root... */
+        nbt_iter_init(it, tree, NBT_PREORDER);
+
+        if(nbt_iter_next(it) != tree)
+            die("FAILED. Pre-order didn't start at the root.");
+
+        nbt_iter_skip_children(it);
+
+        if(nbt_iter_next(it) != NULL)
+            die("FAILED. Didn't skip the root's children.");
+
+        /* ...and skipping theirs leaves just the root and its children. */
+        struct list_head* pos;
+        nbt_node* child;
+        size_t children = 0;
+
+        NBT_FOREACH_CHILD(pos, child, tree)
+            if(child != NULL)
+                children++;
+
+        n = 0;
+        nbt_iter_init(it, tree, NBT_PREORDER);
+
+        for(nbt_node* node; (node = nbt_iter_next(it)) != NULL; n++)
+            if(it->depth == 1)
+                nbt_iter_skip_children(it);
+
+        if(n != children + 1)
+            die("FAILED. Didn't skip the children of the root's children.");
+
+        free(it);
+        free(order.nodes);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking parallel traversal... ");
+
+        /* A big list, so the default grain gets split too. */
+        struct buffer snbt = BUFFER_INIT;
+        if(buffer_append(&snbt, "{Entities:[", 11)) die_with_err(NBT_EMEM);
+
+        for(int i = 0; i < 3000; i++)
+        {
+            char entity[64];
+            int len = sprintf(entity, "%s{id:%d,name:\"e%d\",Pos:[0.5d,%dd]}", i ? "," : "", i, i, i);
+
+            if(buffer_append(&snbt, entity, len)) die_with_err(NBT_EMEM);
+        }
+
+        if(buffer_append(&snbt, "]}", 2)) die_with_err(NBT_EMEM);
+
+        nbt_node* entities = nbt_parse_snbt((const char*)snbt.data, snbt.len);
+        if(entities == NULL) die_with_err(errno);
+
+        nbt_node* aug = nbt_augment(tree);
+        if(aug == NULL) die_with_err(errno);
+
+        static const struct nbt_reducer totals = { sizeof(struct totals), totals_init, totals_visit, totals_combine };
+        static const struct nbt_parallel splits[] = { { 4, 2 }, { 3, 0 }, { 1, 1 }, { 0, 0 } };
+
+        nbt_node* trees[] = { tree, entities, aug };
+        nbt_type dropped = TAG_STRING;
+
+        for(size_t i = 0; i < sizeof trees / sizeof *trees; i++)
+        for(size_t j = 0; j < sizeof splits / sizeof *splits; j++)
+        {
+            const struct nbt_parallel* opts = &splits[j];
+
+            struct totals expected = { 0, 0 }, got;
+            nbt_map(trees[i], add_ints, &expected);
+
+            if(!nbt_reduce(trees[i], &totals, &got, NULL, opts) ||
+               got.nodes != expected.nodes || got.ints != expected.ints)
+                die("FAILED. A parallel reduction got the wrong result.");
+
+            if(nbt_size_parallel(trees[i], opts) != nbt_size(trees[i]))
+                die("FAILED. nbt_size_parallel got the wrong size.");
+
+            if(nbt_map_parallel(trees[i], never, NULL, opts))
+                die("FAILED. nbt_map_parallel didn't stop.");
+
+            nbt_node* seq = nbt_filter(trees[i], is_not_of_type, &dropped);
+            if(seq == NULL) die_with_err(errno);
+
+            nbt_node* par = nbt_filter_parallel(trees[i], is_not_of_type, &dropped, opts);
+            if(par == NULL) die_with_err(errno);
+
+            if(!nbt_eq(seq, par) || nbt_size(seq) != nbt_size(par) || !nbt_map(par, check_list_count, NULL))
+                die("FAILED. A parallel filter didn't match nbt_filter.");
+
+            if(i == 2 && !nbt_map(par, check_augmented, par))
+                die("FAILED. A parallel filter broke an augmented tree.");
+
+            nbt_free(seq);
+            nbt_free(par);
+        }
+
+        nbt_free(aug);
+        nbt_free(entities);
+        buffer_free(&snbt);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking frozen trees... ");
+        struct buffer b = nbt_freeze(tree);
+        if(b.data == NULL) die_with_err(errno);
+
+        /* It had better not care where it lives. */
+        size_t len = b.len;
+        void* moved = malloc(len);
+        if(moved == NULL) die("Out of memory.");
+        memcpy(moved, b.data, len);
+        buffer_free(&b);
+
+        const nbt_frozen* root = nbt_frozen_root(moved, len);
+        if(root == NULL) die_with_err(errno);
+
+        if(!frozen_eq(tree, root))
+            die("FAILED. Frozen tree not equal.");
+        if(nbt_frozen_get(root, "this name does not exist") != NULL)
+            die("FAILED. Found a child that doesn't exist.");
+
+        ((char*)moved)[0] ^= 1;
+        if(nbt_frozen_root(moved, len) != NULL)
+            die("FAILED. Accepted a broken header.");
+
+        free(moved);
+
+        /* An unnamed child mustn't get in the way of one named "". */
+        static const char snbt[] = "{b:1b,\"\":2b,a:3b}";
+        nbt_node* named = nbt_parse_snbt(snbt, sizeof snbt - 1);
+        if(named == NULL) die_with_err(errno);
+
+        nbt_node* unnamed = first_child(named);
+        free(unnamed->name);
+        unnamed->name = NULL;
+
+        b = nbt_freeze(named);
+        if(b.data == NULL) die_with_err(errno);
+        if((root = nbt_frozen_root(b.data, b.len)) == NULL) die_with_err(errno);
+
+        const nbt_frozen* empty = nbt_frozen_get(root, "");
+        const nbt_frozen* none = nbt_frozen_get(root, NULL);
+
+        if(empty == NULL || nbt_frozen_name(empty) == NULL || nbt_frozen_int(empty) != 2)
+            die("FAILED. Didn't find the child named \"\".");
+        if(none == NULL || nbt_frozen_name(none) != NULL || nbt_frozen_int(none) != 1)
+            die("FAILED. Didn't find the unnamed child.");
+
+        buffer_free(&b);
+        nbt_free(named);
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking nbt_clone... ");
+        nbt_node* clone = nbt_clone(tree);
+        if(!nbt_eq(tree, clone))
+            die("FAILED. Clones not equal.");
+        nbt_free(tree); /* swap the tree out for its clone */
+        tree = clone;
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking copy-on-write sharing... ");
+        nbt_node* reference = nbt_clone(tree);
+        if(reference == NULL) die_with_err(errno);
+
+        nbt_node* snap = nbt_share(tree);
+        nbt_node* copy = nbt_share(tree);
+        if(snap != tree || copy != tree)
+            die("FAILED. Sharing copied the tree.");
+
+        /* Change something two levels down if we can, or one if we can't. */
+        nbt_node* child = first_child(tree);
+        nbt_node* grandchild = child ? first_child(child) : NULL;
+
+        if(grandchild != NULL)
+        {
+            char path[512];
+            snprintf(path, sizeof path, "%s.%s", tree->name ? tree->name : "", child->name);
+
+            nbt_node* w = nbt_writable(&copy, path);
+            if(w == NULL || w == child || copy == tree)
+                die("FAILED. The path wasn't copied.");
+
+            nbt_free(nbt_compound_take(w, grandchild->name));
+        }
+        else if(child != NULL)
+        {
+            if(nbt_writable(&copy, NULL) != copy || copy == tree)
+                die("FAILED. The root wasn't copied.");
+
+            nbt_free(nbt_compound_take(copy, child->name));
+        }
+
+        if(child != NULL && nbt_eq(copy, reference))
+            die("FAILED. The copy didn't change.");
+        if(!nbt_eq(snap, reference))
+            die("FAILED. The snapshot changed.");
+
+        /* Everything off the copied path must still be shared. */
+        nbt_node* last = tree->type == TAG_COMPOUND ? nbt_list_item(tree, nbt_children(tree) - 1) : NULL;
+        if(last != NULL && last != child && nbt_compound_get(copy, last->name) != last)
+            die("FAILED. A sibling was copied.");
+
+        nbt_free(copy);
+        nbt_free(snap);
+
+        if(!nbt_eq(tree, reference))
+            die("FAILED. The original changed.");
+
+        nbt_free(reference);
+
+        /*
+         * Two owners on two threads look things up at once. The compound under
+         * the root doesn't know it's shared, and gets indexed on first use.
+         */
+        static const char level[] =
+            "{Level:{a:0,b:1,c:2,d:3,e:4,f:5,g:6,h:7,i:8,j:9,k:10,l:11,m:12,n:13,o:14,p:15}}";
+
+        for(int round = 0; round < 50; round++)
+        {
+            nbt_node* main_tree = nbt_parse_snbt(level, sizeof level - 1);
+            if(main_tree == NULL) die_with_err(errno);
+
+            nbt_node* saved = nbt_share(main_tree);
+            pthread_t saver;
+
+            if(pthread_create(&saver, NULL, look_up_level, saved) != 0)
+                die("FAILED. Couldn't start a thread.");
+
+            bool ok = look_up_level(main_tree) != NULL;
+            void* saver_ok;
+
+            pthread_join(saver, &saver_ok);
+
+            if(!ok || saver_ok == NULL)
+                die("FAILED. A shared lookup went wrong.");
+
+            nbt_free(saved);
+            nbt_free(main_tree);
+        }
+
+        printf("OK.\n");
+    }
+
+    {
+        printf("Checking the node pool... ");
+        struct nbt_pool_stats stats;
+        nbt_pool_stats(&stats);
+
+        /* We've freed plenty of trees by now. Their nodes had better be reused. */
+        if(stats.node_hits == 0 || stats.list_hits == 0)
+            die("FAILED. Nothing was recycled.");
+
+        /* Nodes freed as a thread exits mustn't be pooled for it again. */
+        pthread_t t;
+        void* copied;
+
+        if(pthread_key_create(&late_key, free_late) != 0 ||
+           pthread_create(&t, NULL, exit_holding, tree) != 0 ||
+           pthread_join(t, &copied) != 0)
+            die("Could not run a thread.");
+        if(copied == NULL)
+            die("Could not copy the tree in a thread.");
         printf("OK.\n");
     }
 
@@ -57,6 +57,27 @@ typedef enum {
 } nbt_compression_strategy;
 
 struct nbt_node;
+struct nbt_index;
+
+/*
+ * Bits of nbt_node's `flags'. These are bookkeeping for the library. If you
+ * build nodes by hand, zero them.
+ */
+enum {
+    NBT_NODE_INTERNED = 1 << 0, /* `name' lives in the intern table (see
+                                   nbt_intern). It must not be freed or
+                                   modified. */
+
+    NBT_NODE_PACKED   = 1 << 1, /* This TAG_LIST is stored in
+                                   payload.tag_packed_list, not tag_list. */
+
+    NBT_NODE_AUGMENTED = 1 << 2, /* This node knows its parent and the size of
+                                   its subtree. See NBT_PARSE_AUGMENT. */
+
+    NBT_NODE_COUNTED  = 1 << 3  /* Only on a list's sentinel node: every
+                                   element is of the sentinel's type, and
+                                   payload.tag_int is how many there are. */
+};
 
 /*
  * Represents a single node in the tree. You should switch on `type' and ONLY
@@ -67,6 +88,9 @@ struct nbt_node;
  */
 typedef struct nbt_node {
     nbt_type type;
+    uint32_t flags; /* Any combination of NBT_NODE_* bits. */
+    uint32_t refs;  /* How many owners share this node, not counting the
+                       first. See nbt_share. Zero it if you build by hand. */
     char* name; /* This may be NULL. Check your damn pointers. */
 
     union { /* payload */
@@ -96,6 +120,22 @@ typedef struct nbt_node {
 
         char* tag_string; /* TODO: technically, this should be a UTF-8 string */
 
+        /*
+         * A list of scalars (TAG_BYTE through TAG_DOUBLE) may be stored as a
+         * flat array instead of a linked list of nodes. That's one allocation
+         * for the whole list instead of two per element. Such a list still
+         * has type TAG_LIST, but NBT_NODE_PACKED is set in `flags'.
+         *
+         * The elements are not nodes: nbt_map, nbt_find and friends don't
+         * visit them, and nbt_size doesn't count them. Use nbt_list_span to
+         * read them, or nbt_list_unpack to turn them back into nodes.
+         */
+        struct nbt_packed_list {
+            void* data;     /* `length' native-endian elements of `type' */
+            int32_t length;
+            nbt_type type;
+        } tag_packed_list;
+
         /*
          * Design addendum: we make tag_list a linked list instead of an array
          * so that nbt_node can be a true recursive data structure. If we used
@@ -120,15 +160,72 @@ typedef struct nbt_node {
          * In an nbt_list, the sentinel node contains a valid data pointer with
          * only the type filled in. This is to deal with empty lists which
          * still posess types. Therefore, the sentinel's data pointer must be
-         * deallocated.
+         * deallocated. The library also keeps the number of elements there,
+         * see NBT_NODE_COUNTED.
          *
          * In the tag_compound, the only use of the sentinel is to get the
          * beginning and end of the doubly linked list. The data pointer is
          * unused and set to NULL.
          */
     } payload;
+
+    /*
+     * A lazily-built hash index over a compound's children, used by
+     * nbt_compound_get. This is always NULL for every other type. If you build
+     * nodes by hand, set it to NULL and let the library worry about the rest.
+     */
+    struct nbt_index* index;
 } nbt_node;
 
+                         /***** Output Sinks *****/
+
+/*
+ * Somewhere to write serialized data to, for the nbt_dump_*_to functions.
+ * `write' is handed each piece of output in order, and returns NBT_OK or an
+ * error, which aborts the dump. `flush', if not NULL, is called once the dump
+ * is complete. `ctx' is passed along to both.
+ */
+struct nbt_sink {
+    nbt_status (*write)(void* ctx, const void* data, size_t len);
+    nbt_status (*flush)(void* ctx);
+    void* ctx;
+};
+
+/* Writes to a stdio stream. Errors come back as NBT_EIO. */
+struct nbt_sink nbt_sink_file(FILE* fp);
+
+/* Appends to a buffer. Running out of memory comes back as NBT_EMEM. */
+struct nbt_sink nbt_sink_buffer(struct buffer* b);
+
+/*
+ * A caller-owned block of memory which is never reallocated. Set `data' and
+ * `cap', and zero `len'. Writes which don't fit fail with NBT_EMEM, and leave
+ * the block as it was.
+ */
+struct nbt_fixed_sink {
+    unsigned char* data;
+    size_t cap;
+    size_t len; /* How much of it has been written so far. */
+};
+
+struct nbt_sink nbt_sink_fixed(struct nbt_fixed_sink* f);
+
+/*
+ * Writes to a raw file descriptor, such as a socket. Small writes are staged
+ * and sent together with the next big one in a single writev, so big pieces
+ * of output are never copied. The sink's flush sends whatever is left.
+ * Errors come back as NBT_EIO.
+ */
+#define NBT_FD_SINK_STAGE 4096
+
+struct nbt_fd_sink {
+    int fd;
+    size_t used;
+    unsigned char stage[NBT_FD_SINK_STAGE];
+};
+
+struct nbt_sink nbt_sink_fd(struct nbt_fd_sink* s, int fd);
+
                /***** High Level Loading/Saving Functions *****/
 
 /*
@@ -174,8 +271,47 @@ nbt_status nbt_dump_file(const nbt_node* tree,
 struct buffer nbt_dump_compressed(const nbt_node* tree,
                                   nbt_compression_strategy);
 
+/*
+ * The same as nbt_dump_compressed, but the compressed data is streamed into
+ * `sink' as it's produced, instead of being collected in a buffer.
+ */
+nbt_status nbt_dump_compressed_to(const nbt_node* tree,
+                                  nbt_compression_strategy,
+                                  struct nbt_sink* sink);
+
                 /***** Low Level Loading/Saving Functions *****/
 
+/*
+ * Flags which tweak how a tree is built by nbt_parse_ex. They may be OR'd
+ * together.
+ */
+typedef enum {
+    NBT_PARSE_DEFAULT = 0,
+
+    NBT_PARSE_INDEX   = 1 << 0, /* Eagerly build the name index of every
+                                   compound while parsing, instead of waiting
+                                   for the first nbt_compound_get. */
+
+    NBT_PARSE_INTERN  = 1 << 1, /* Point every tag name into the intern table
+                                   instead of giving each node its own copy.
+                                   Comparing interned names is a pointer
+                                   compare. */
+
+    NBT_PARSE_PACK    = 1 << 2, /* Store lists of scalars as packed arrays.
+                                   See struct nbt_packed_list. */
+
+    NBT_PARSE_AUGMENT = 1 << 3, /* Build an augmented tree, where every node
+                                   also keeps track of its parent, its number
+                                   of children, and the size of its subtree.
+                                   That makes nbt_size O(1), and enables
+                                   nbt_parent and nbt_path_of. It costs three
+                                   words per node. */
+
+    NBT_PARSE_NAMELESS = 1 << 4 /* The root tag has a type but no name, as in
+                                   Java Edition's protocol since 1.20.2. The
+                                   root of the tree won't have a name either. */
+} nbt_parse_flags;
+
 /*
  * Loads a NBT tree from memory. The tree MUST NOT be compressed. If an error
  * occurs, NULL will be returned, and errno will be set to the appropriate
@@ -183,6 +319,46 @@ struct buffer nbt_dump_compressed(const nbt_node* tree,
  */
 nbt_node* nbt_parse(const void* memory, size_t length);
 
+/*
+ * The same as nbt_parse, but the tree is built according to `flags', which is
+ * any combination of nbt_parse_flags.
+ */
+nbt_node* nbt_parse_ex(const void* memory, size_t length, unsigned flags);
+
+/*
+ * The ways binary NBT is written. Every encoding stores the same tags, and
+ * parses to the same trees.
+ */
+typedef enum {
+    NBT_ENCODING_JAVA,    /* Big-endian, as everywhere in Java Edition. What
+                             nbt_parse and nbt_dump_binary use. */
+
+    NBT_ENCODING_BEDROCK, /* Little-endian, as in Bedrock Edition's level.dat
+                             (after its 8-byte header) and world database.
+                             String lengths are unsigned. */
+
+    NBT_ENCODING_NETWORK  /* Bedrock Edition's "network NBT", as sent to
+                             clients. Little-endian, except that ints, longs,
+                             and the lengths of arrays and lists are zigzag
+                             varints, and string lengths are plain varints. */
+} nbt_encoding;
+
+/*
+ * The same as nbt_parse_ex, but reads `encoding' instead of Java Edition's
+ * big-endian NBT.
+ */
+nbt_node* nbt_parse_encoded(const void* memory, size_t length, nbt_encoding encoding, unsigned flags);
+
+/*
+ * The same as nbt_parse_encoded, but made for tags embedded in something
+ * bigger, like a network packet. The tag is parsed from the start of
+ * `memory', and `*consumed' is set to how many bytes it took up, so whatever
+ * follows it can be read from there. Anything after the tag is left alone.
+ * `*consumed' is 0 if the tag couldn't be parsed.
+ */
+nbt_node* nbt_parse_prefix(const void* memory, size_t length, nbt_encoding encoding, unsigned flags,
+                           size_t* consumed);
+
 /*
  * Returns a NULL-terminated string as the ascii representation of the tree. If
  * an error occurs, NULL will be returned and errno will be set.
@@ -192,6 +368,78 @@ nbt_node* nbt_parse(const void* memory, size_t length);
  */
 char* nbt_dump_ascii(const nbt_node* tree);
 
+/* The same as nbt_dump_ascii, but into `sink'. No null-terminator is written. */
+nbt_status nbt_dump_ascii_to(const nbt_node* tree, struct nbt_sink* sink);
+
+/* What nbt_dump_ascii_ex may leave out. Zero means no limit, for either. */
+struct nbt_ascii_options {
+    size_t max_elements; /* Array elements shown before the rest are just
+                            counted, as in `[ 1 2 3 ... 61 more ]'. */
+    size_t max_depth;    /* Levels of nesting shown. Lists and compounds
+                            past that show `{ ... }' for their contents. */
+};
+
+/*
+ * The same as nbt_dump_ascii_to, but trimmed down according to `opts', which
+ * may be NULL. If an error shows up halfway through, whatever came before it
+ * has already been written.
+ */
+nbt_status nbt_dump_ascii_ex(const nbt_node* tree,
+                             const struct nbt_ascii_options* opts,
+                             struct nbt_sink* sink);
+
+/*
+ * SNBT is the text form of NBT which commands and data packs use, such as
+ * `{Pos:[1.0d,2.0d],id:"minecraft:pig"}'. There's no room in it for the
+ * root's name, which is left out when dumping and NULL when parsing.
+ */
+
+/*
+ * Returns the tree as a NULL-terminated SNBT string, which has to be freed. If
+ * an error occurs, NULL will be returned and errno will be set.
+ */
+char* nbt_dump_snbt(const nbt_node* tree);
+
+/* The same as nbt_dump_snbt, but into `sink'. No null-terminator is written. */
+nbt_status nbt_dump_snbt_to(const nbt_node* tree, struct nbt_sink* sink);
+
+/*
+ * Parses `length' bytes of SNBT. Unquoted values are numbers if they look like
+ * one, true and false are bytes, and anything else is a string. If the text
+ * isn't valid SNBT, or a list mixes types, NULL is returned and errno is set.
+ */
+nbt_node* nbt_parse_snbt(const char* text, size_t length);
+
+/* How nbt_dump_json writes things JSON has no direct way of saying. */
+typedef enum {
+    NBT_JSON_DEFAULT      = 0,
+    NBT_JSON_TYPED        = 1 << 0, /* Every value becomes {"type":..,"value":..},
+                                       and lists say what's in them. Otherwise
+                                       tags are written as plain JSON values. */
+    NBT_JSON_LONG_STRINGS = 1 << 1, /* Longs are quoted, so readers which only
+                                       have doubles don't round them. */
+    NBT_JSON_BASE64       = 1 << 2, /* Byte arrays are base64 strings. */
+    NBT_JSON_NAMED_ROOT   = 1 << 3  /* The root is wrapped in an object under
+                                       its name. */
+} nbt_json_flags;
+
+/*
+ * Returns the tree as a NULL-terminated JSON string, which has to be freed.
+ * NaN and infinity are null, or strings when typed. If an error occurs, NULL
+ * will be returned and errno will be set.
+ */
+char* nbt_dump_json(const nbt_node* tree, unsigned flags);
+
+/* The same as nbt_dump_json, but into `sink'. No null-terminator is written. */
+nbt_status nbt_dump_json_to(const nbt_node* tree, unsigned flags, struct nbt_sink* sink);
+
+/*
+ * The same as nbt_dump_json_to, but straight from `length' bytes of
+ * uncompressed binary NBT, without building a tree.
+ */
+nbt_status nbt_dump_json_binary(const void* memory, size_t length, unsigned flags,
+                                struct nbt_sink* sink);
+
 /*
  * Returns a buffer representing the uncompressed tree in Notch's official
  * binary format. Trees dumped with this function can be regenerated with
@@ -203,6 +451,330 @@ char* nbt_dump_ascii(const nbt_node* tree);
  */
 struct buffer nbt_dump_binary(const nbt_node* tree);
 
+/*
+ * Returns exactly how many bytes nbt_dump_binary would produce for `tree'.
+ * Returns 0 and sets errno if `tree' can't be dumped, or is NULL. Trees are
+ * measured before they're dumped, so the dump itself never has to reallocate.
+ */
+size_t nbt_serialized_size(const nbt_node* tree);
+
+/*
+ * The same as nbt_dump_binary, but into the `cap' bytes at `buf'. `*written'
+ * is set to the size of the dump. If that's more than `cap', nothing is
+ * written and NBT_EMEM is returned, so you can try again with a bigger buffer.
+ */
+nbt_status nbt_dump_binary_into(const nbt_node* tree, void* buf, size_t cap, size_t* written);
+
+/*
+ * The same as nbt_dump_binary, but streamed into `sink' a few kilobytes at a
+ * time. The tree is checked before anything is written, so a tree which can't
+ * be dumped never produces partial output.
+ */
+nbt_status nbt_dump_binary_to(const nbt_node* tree, struct nbt_sink* sink);
+
+/* The same as nbt_dump_binary, but written in `encoding'. */
+struct buffer nbt_dump_encoded(const nbt_node* tree, nbt_encoding encoding);
+
+/* The same as nbt_dump_binary_to, but written in `encoding'. */
+nbt_status nbt_dump_encoded_to(const nbt_node* tree, nbt_encoding encoding, struct nbt_sink* sink);
+
+/* Flags for nbt_dump_encoded_into. They may be OR'd together. */
+typedef enum {
+    NBT_DUMP_DEFAULT  = 0,
+
+    NBT_DUMP_NAMELESS = 1 << 0  /* Leave out the root's name, even if it has
+                                   one. See NBT_PARSE_NAMELESS. */
+} nbt_dump_flags;
+
+/*
+ * The same as nbt_dump_binary_into, but written in `encoding' and tweaked by
+ * `flags', which is any combination of nbt_dump_flags. Together with
+ * nbt_parse_prefix, this lets tags be read from and written to packet buffers
+ * in place.
+ */
+nbt_status nbt_dump_encoded_into(const nbt_node* tree, nbt_encoding encoding, unsigned flags,
+                                 void* buf, size_t cap, size_t* written);
+
+/*
+ * The same as nbt_dump_binary, but canonical: trees which only differ in the
+ * order of their compounds' children, the bits of their NaNs, the sign of
+ * their zeros, or what their empty lists were declared to hold are dumped
+ * byte for byte the same. Compound children are sorted by name, keeping
+ * duplicates in order. The result is still valid NBT, and the same size as
+ * the regular dump.
+ */
+struct buffer nbt_dump_canonical(const nbt_node* tree);
+
+/* The same as nbt_dump_canonical, but into `sink'. */
+nbt_status nbt_dump_canonical_to(const nbt_node* tree, struct nbt_sink* sink);
+
+                     /***** Event Parsing Functions *****/
+
+/*
+ * The event parser walks through uncompressed binary NBT without building a
+ * tree. Each call to nbt_reader_next reports the next tag as an event, and
+ * nothing is allocated or copied: names, strings and arrays point straight
+ * into the input, still big-endian.
+ */
+
+typedef enum {
+    NBT_EVENT_VALUE, /* A tag with no children: anything but a list or compound. */
+    NBT_EVENT_BEGIN, /* A list or compound. Its children come next, then... */
+    NBT_EVENT_END,   /* ...its end. */
+    NBT_EVENT_DONE   /* The root is over. There's nothing else to report. */
+} nbt_event_kind;
+
+struct nbt_event {
+    nbt_event_kind kind;
+    nbt_type type;          /* For an END, the type of what's ending. */
+
+    const char* name;       /* NOT null-terminated. NULL for list elements. */
+    size_t name_len;
+
+    const void* payload;    /* Where a string's text, an array's elements, or
+                               a list's elements start in the input. */
+    int32_t length;         /* Bytes in a string, elements in an array or a
+                               list, and -1 for a compound. */
+    nbt_type list_type;     /* The type of a list's elements. */
+
+    union {
+        int64_t integer;    /* TAG_BYTE to TAG_LONG, sign-extended */
+        double  real;       /* TAG_FLOAT and TAG_DOUBLE */
+    } value;
+
+    size_t depth;           /* 0 for the root. An END has its BEGIN's depth. */
+    size_t start;           /* The offset of the tag's first byte (its type,
+                               or its payload for list elements)... */
+    size_t end;             /* ...and of the byte just after it. For a BEGIN,
+                               that's where its children start. */
+};
+
+/* How deeply lists and compounds may be nested for the event parser. */
+#define NBT_READER_MAX_DEPTH 512
+
+/* The state of the event parser. Treat it as opaque, except for `pos'. */
+struct nbt_reader {
+    const unsigned char* data;
+    size_t length;
+    size_t pos;             /* How much of the input has been read. */
+
+    nbt_status state;
+    bool done;
+
+    size_t depth;
+    struct {
+        int32_t left;       /* Elements left in a list. */
+        uint8_t type;       /* TAG_LIST or TAG_COMPOUND */
+        uint8_t list_type;
+    } stack[NBT_READER_MAX_DEPTH];
+};
+
+/* Gets ready to read the tree in the `length' bytes at `memory'. */
+void nbt_reader_init(struct nbt_reader* r, const void* memory, size_t length);
+
+/*
+ * Fills in `ev' with the next event. Once the root's over, `ev' is a DONE and
+ * `r->pos' is how many bytes the tree took up. If the input isn't valid NBT,
+ * an error is returned, and keeps being returned from then on.
+ */
+nbt_status nbt_reader_next(struct nbt_reader* r, struct nbt_event* ev);
+
+/*
+ * Skips the rest of the innermost list or compound, including its END. Lists
+ * of scalars are skipped in O(1).
+ */
+nbt_status nbt_reader_skip(struct nbt_reader* r);
+
+/*
+ * Finds the tag at `path' in `length' bytes of binary NBT, without building
+ * a tree. Paths and matching are the same as for nbt_find_by_path. `ev' is
+ * filled in with the tag's event, or is a DONE if there's no such tag.
+ */
+nbt_status nbt_locate(const void* memory, size_t length, const char* path, struct nbt_event* ev);
+
+/*
+ * The nbt_patch_* functions overwrite the tag at `path' in binary NBT, where
+ * it is. Nothing changes size, so the new value has to fit in the old one:
+ * integers have to be in range of whichever integer type is there, strings
+ * have to be as long as the old one, and arrays have to have as many
+ * elements. If there's no such tag, it's of the wrong type, or the new value
+ * doesn't fit, NBT_ERR is returned and nothing is changed.
+ */
+nbt_status nbt_patch_int(void* memory, size_t length, const char* path, int64_t value);
+
+/* Floats are rounded to the nearest float. */
+nbt_status nbt_patch_real(void* memory, size_t length, const char* path, double value);
+
+nbt_status nbt_patch_string(void* memory, size_t length, const char* path, const char* value);
+
+/* `data' holds `count' elements in native byte order, as they would in a tree. */
+nbt_status nbt_patch_array(void* memory, size_t length, const char* path,
+                           nbt_type type, const void* data, int32_t count);
+
+                       /***** Emitter Functions *****/
+
+/*
+ * The emitter writes binary NBT straight into a sink, one tag per call,
+ * without building a tree. For example:
+ *
+ *     nbt_emit_begin_compound(&e, "");
+ *         nbt_emit_int(&e, "x", 1);
+ *         nbt_emit_begin_list(&e, "Pos", TAG_DOUBLE, 2);
+ *             nbt_emit_double(&e, NULL, 0.5);
+ *             nbt_emit_double(&e, NULL, 64.0);
+ *         nbt_emit_end(&e);
+ *     nbt_emit_end(&e);
+ *
+ * Tags in compounds, and the root, need a name. List elements mustn't have
+ * one, and must be of the list's type. Every call is checked against what's
+ * been written so far, and the first one that's wrong, or that the sink
+ * fails, is returned by it and every call after it.
+ */
+
+/* How deeply lists and compounds may be nested for the emitter. */
+#define NBT_EMITTER_MAX_DEPTH 512
+
+#define NBT_EMITTER_STAGE 4096
+
+/* The state of the emitter. Treat it as opaque. */
+struct nbt_emitter {
+    struct nbt_sink* sink;
+    unsigned char* pos;     /* The end of what's staged. */
+    nbt_status err;
+    bool done;              /* The root's been written. */
+
+    size_t depth;
+    struct {
+        int32_t left;       /* Elements left to write in a list. */
+        uint8_t type;       /* TAG_LIST or TAG_COMPOUND */
+        uint8_t list_type;
+    } stack[NBT_EMITTER_MAX_DEPTH];
+
+    unsigned char stage[NBT_EMITTER_STAGE];
+};
+
+void nbt_emitter_init(struct nbt_emitter* e, struct nbt_sink* sink);
+
+/*
+ * Writes whatever's still staged and flushes the sink. Returns NBT_ERR if
+ * the root isn't finished.
+ */
+nbt_status nbt_emitter_finish(struct nbt_emitter* e);
+
+nbt_status nbt_emit_begin_compound(struct nbt_emitter* e, const char* name);
+
+/* Exactly `count' elements of `type' must follow before the nbt_emit_end. */
+nbt_status nbt_emit_begin_list(struct nbt_emitter* e, const char* name, nbt_type type, int32_t count);
+
+/* Ends the innermost list or compound. */
+nbt_status nbt_emit_end(struct nbt_emitter* e);
+
+nbt_status nbt_emit_byte  (struct nbt_emitter* e, const char* name, int8_t v);
+nbt_status nbt_emit_short (struct nbt_emitter* e, const char* name, int16_t v);
+nbt_status nbt_emit_int   (struct nbt_emitter* e, const char* name, int32_t v);
+nbt_status nbt_emit_long  (struct nbt_emitter* e, const char* name, int64_t v);
+nbt_status nbt_emit_float (struct nbt_emitter* e, const char* name, float v);
+nbt_status nbt_emit_double(struct nbt_emitter* e, const char* name, double v);
+nbt_status nbt_emit_string(struct nbt_emitter* e, const char* name, const char* s);
+
+nbt_status nbt_emit_byte_array(struct nbt_emitter* e, const char* name, const unsigned char* data, int32_t length);
+nbt_status nbt_emit_int_array (struct nbt_emitter* e, const char* name, const int32_t* data, int32_t length);
+nbt_status nbt_emit_long_array(struct nbt_emitter* e, const char* name, const int64_t* data, int32_t length);
+
+/*
+ * nbt_transform copies binary NBT to a sink, dropping or rewriting the tags
+ * which match its rules, without building a tree. Lists get their counts
+ * fixed up to match what's left in them.
+ */
+
+typedef enum {
+    NBT_TRANSFORM_KEEP,    /* Leave it be, though rules for its children
+                              still apply. */
+    NBT_TRANSFORM_DROP,
+    NBT_TRANSFORM_REPLACE  /* Exactly one tag was emitted to take its place. */
+} nbt_transform_action;
+
+/*
+ * Decides what happens to a tag a rule matched. To replace it, emit one tag
+ * to `out' as the root, and return NBT_TRANSFORM_REPLACE. Its name doesn't
+ * matter, since the tag it replaces keeps its own, and in a list, it must be
+ * of the list's type.
+ */
+typedef nbt_transform_action (*nbt_rewriter_t)(const struct nbt_event* ev, struct nbt_emitter* out, void* aux);
+
+struct nbt_transform_rule {
+    const char* path;       /* As for nbt_find_by_path, except a part which is
+                               just "*" matches any name. */
+    nbt_rewriter_t rewrite; /* NULL drops everything the rule matches. */
+    void* aux;              /* Passed along to `rewrite'. */
+};
+
+/*
+ * Copies the tree in `length' bytes of binary NBT into `sink', transformed
+ * by `n' rules (up to 64). The first rule to match a tag decides what happens
+ * to it. Parts of the tree no rule can reach are copied as they are, in one
+ * piece.
+ */
+nbt_status nbt_transform(const void* memory, size_t length,
+                         const struct nbt_transform_rule* rules, size_t n,
+                         struct nbt_sink* sink);
+
+                       /***** Region File Functions *****/
+
+/*
+ * A region file (.mcr or .mca) holds up to 32x32 chunks, each its own tree.
+ * Chunks are addressed by their position in the region, from 0 to 31.
+ */
+typedef struct nbt_region nbt_region;
+
+/*
+ * Opens a region file and reads its header. The file stays open until
+ * nbt_region_close. If an error occurs, NULL will be returned and errno will
+ * be set.
+ */
+nbt_region* nbt_region_open(const char* path);
+
+/*
+ * The same as nbt_region_open, but chunks can be written with
+ * nbt_region_write as well. The file is created if it isn't there.
+ */
+nbt_region* nbt_region_open_rw(const char* path);
+
+void nbt_region_close(nbt_region* region);
+
+bool nbt_region_has_chunk(const nbt_region* region, int x, int z);
+
+/* When the chunk was last saved, in seconds since the epoch. */
+uint32_t nbt_region_timestamp(const nbt_region* region, int x, int z);
+
+/*
+ * Replaces the contents of `out' with the chunk's uncompressed binary NBT.
+ * A chunk which isn't there leaves `out' empty. The same buffer can be reused
+ * for every chunk.
+ */
+nbt_status nbt_region_read(nbt_region* region, int x, int z, struct buffer* out);
+
+/*
+ * Parses a chunk with nbt_parse_ex. If the chunk isn't there, NULL is returned
+ * and errno is NBT_OK.
+ */
+nbt_node* nbt_region_chunk(nbt_region* region, int x, int z, unsigned flags);
+
+/*
+ * Compresses `length' bytes of binary NBT with zlib and stores them as the
+ * chunk, saved at `timestamp'. The chunk is rewritten in place if it still
+ * fits, or else moved to the end of the file. Chunks which don't fit in 1MiB
+ * compressed can't be written, and are NBT_ERR.
+ */
+nbt_status nbt_region_write(nbt_region* region, int x, int z,
+                            const void* data, size_t length, uint32_t timestamp);
+
+/*
+ * Writes every chunk in the region to `sink' as a line of JSON, in the order
+ * they're laid out in the header. No trees are built.
+ */
+nbt_status nbt_region_dump_json(nbt_region* region, unsigned flags, struct nbt_sink* sink);
+
                    /***** Tree Manipulation Functions *****/
 
 /*
@@ -212,10 +784,47 @@ nbt_node* nbt_clone(nbt_node*);
 
 /*
  * Recursively deallocates a node and all its children. If this is used on a an
- * entire tree, no memory will be leaked.
+ * entire tree, no memory will be leaked. Shared nodes (see nbt_share) just
+ * lose an owner, and are only really freed along with the last one.
  */
 void nbt_free(nbt_node*);
 
+/*
+ * Takes a copy-on-write snapshot of `tree' in O(1), by adding an owner to it
+ * instead of copying anything. The returned tree is `tree' itself, and both
+ * owners must nbt_free it when they're done. Shared subtrees may be read
+ * from several threads at once, nbt_compound_get included.
+ *
+ * Shared nodes must not be modified in place, by you or by any library
+ * routine other than nbt_filter_inplace. Call nbt_writable (or nbt_unshare)
+ * first, which copies just the nodes on the way down to the one you want to
+ * change: everything else stays shared. Only the root is marked as shared,
+ * so the library can't tell that the nodes under it are, and won't stop you
+ * from changing them without going through nbt_writable.
+ *
+ * Augmented trees know their parents, so their nodes can't be shared. They're
+ * deep copied with nbt_clone instead. Returns NULL on memory errors.
+ */
+nbt_node* nbt_share(nbt_node* tree);
+
+/*
+ * Returns a copy of `node' which this owner is free to modify, and drops this
+ * owner's share of `node'. The copy has its own name and payload, but its
+ * children are shared with `node''s. Unshared nodes are returned as they are.
+ * Put the result wherever you got `node' from. Returns NULL on memory errors,
+ * in which case `node' is left alone.
+ */
+nbt_node* nbt_unshare(nbt_node* node);
+
+/*
+ * Makes the node at `path' (in the format nbt_find_by_path understands)
+ * writable, by unsharing it and every node between it and `*tree'. `*tree' is
+ * updated if the root had to be copied. A NULL path means the root itself.
+ * Returns the writable node, or NULL if there is no such node (or we ran out
+ * of memory, in which case errno is set to NBT_EMEM).
+ */
+nbt_node* nbt_writable(nbt_node** tree, const char* path);
+
 /*
  * Recursively frees all the elements of a list, and then frees the list itself.
  */
@@ -240,24 +849,102 @@ typedef bool (*nbt_predicate_t)(const nbt_node* node, void* aux);
  * Returns false if it was terminated by a visitor, true otherwise. In most
  * cases this can be ignored.
  *
- * TODO: Is there a way to do this without expensive function pointers? Maybe
- * something like list_for_each?
+ * A packed list is visited, but its elements aren't: they aren't nodes. Unpack
+ * it first (nbt_map with nbt_list_unpack will do) if you need to see them.
+ *
+ * To do without the function pointers, loop with an nbt_iter instead.
  */
 bool nbt_map(nbt_node* tree, nbt_visitor_t, void* aux);
 
+/*
+ * Loops over the children of `node', which has to be a compound or an
+ * unpacked list. `pos' is a struct list_head* to keep track with, and `child'
+ * is each child in turn. Don't remove `child' from inside the loop.
+ *
+ *   struct list_head* pos;
+ *   nbt_node* child;
+ *
+ *   NBT_FOREACH_CHILD(pos, child, compound)
+ *       printf("%s\n", child->name);
+ */
+#define NBT_FOREACH_CHILD(pos, child, node)                                  \
+    list_for_each((pos), &(node)->payload.tag_compound->entry)               \
+        if(((child) = list_entry((pos), struct nbt_list, entry)->data), 0) {} \
+        else
+
+typedef enum {
+    NBT_PREORDER,   /* Every node comes before its children... */
+    NBT_POSTORDER   /* ...or after them. */
+} nbt_order;
+
+/* How deeply an nbt_iter may walk into a tree. */
+#define NBT_ITER_MAX_DEPTH 512
+
+/*
+ * The state of a walk over a tree, which visits the same nodes as nbt_map.
+ * Treat it as opaque, except for `depth', which is how deep the last node
+ * returned is. The root is at 0.
+ */
+struct nbt_iter {
+    nbt_order order;
+    nbt_node* root;         /* Until it's been returned or walked into. */
+    nbt_node* last;         /* In pre-order, whose children come next. */
+    nbt_status err;
+
+    size_t depth;
+    struct nbt_iter_frame {
+        nbt_node* node;             /* The list or compound we're in... */
+        struct list_head* pos;      /* ...and the child we're at. */
+    } stack[NBT_ITER_MAX_DEPTH];
+};
+
+/*
+ * Gets ready to walk `tree'. The tree mustn't change while it's being walked,
+ * except that in pre-order, the node just returned may be changed before its
+ * children are. Nothing has to be freed if you stop early.
+ */
+void nbt_iter_init(struct nbt_iter* it, nbt_node* tree, nbt_order order);
+
+/*
+ * Returns the next node, or NULL when there are no more. If the tree is
+ * nested more than NBT_ITER_MAX_DEPTH deep, NULL is returned early, and errno
+ * is set to NBT_ERR.
+ *
+ *   struct nbt_iter it;
+ *
+ *   nbt_iter_init(&it, tree, NBT_PREORDER);
+ *   for(nbt_node* n; (n = nbt_iter_next(&it)) != NULL; )
+ *       if(n->type == TAG_LIST)
+ *           nbt_iter_skip_children(&it);
+ */
+nbt_node* nbt_iter_next(struct nbt_iter* it);
+
+/*
+ * In pre-order, don't walk into the children of the node just returned. In
+ * post-order they've been walked already, so this does nothing.
+ */
+void nbt_iter_skip_children(struct nbt_iter* it);
+
 /*
  * Returns a new tree, consisting of a copy of all the nodes the predicate
  * returned `true' for. If the new tree is empty, this function will return
  * NULL. If an out of memory error occured, errno will be set to NBT_EMEM.
  *
- * TODO: What if I want to keep a tree and all of its children? Do I need to
- * augment nbt_node with parent pointers?
+ * If you want to keep a node and all of its children, build an augmented tree
+ * and have the predicate check the node's ancestors with nbt_parent.
+ *
+ * The predicate is never asked about the elements of a packed list, so a kept
+ * packed list keeps all of them. Its unpacked equal may come out shorter.
  */
 nbt_node* nbt_filter(const nbt_node* tree, nbt_predicate_t, void* aux);
 
 /*
  * The exact same as nbt_filter, except instead of returning a new tree, the
  * existing tree is modified in place, and then returned for convenience.
+ *
+ * Shared subtrees (see nbt_share) are unshared before they're touched, so
+ * always use the returned tree. If that runs out of memory, errno is set to
+ * NBT_EMEM and the subtree is left unfiltered.
  */
 nbt_node* nbt_filter_inplace(nbt_node* tree, nbt_predicate_t, void* aux);
 
@@ -269,6 +956,9 @@ nbt_node* nbt_filter_inplace(nbt_node* tree, nbt_predicate_t, void* aux);
  * Since const-ing `tree' would require me const-ing the return value, you'll
  * just have to take my word for it that nbt_find DOES NOT modify the tree.
  * Feel free to cast as necessary.
+ *
+ * There are no nodes in a packed list to return, so its elements are never
+ * tried. Search them with nbt_list_span.
  */
 nbt_node* nbt_find(nbt_node* tree, nbt_predicate_t, void* aux);
 
@@ -291,26 +981,557 @@ nbt_node* nbt_find_by_name(nbt_node* tree, const char* name);
  * root.subelement..data == "root" -> "subelement" -> "" -> "data"
  *
  * Remember, if multiple elements exist in a sublist which share the same name
- * (including ""), the first one will be chosen.
+ * (including ""), the first one will be chosen. Very long paths are split up
+ * on the heap, so NULL with errno set to NBT_EMEM means we ran out of memory.
  */
 nbt_node* nbt_find_by_path(nbt_node* tree, const char* path);
 
-/* Returns the number of nodes in the tree. */
+/*
+ * Returns the number of nodes in the tree. This is O(1) for augmented trees,
+ * and walks the whole tree otherwise. A packed list counts as one node, so
+ * this is smaller than for the same tree unpacked.
+ */
 size_t nbt_size(const nbt_node* tree);
 
 /*
  * Returns the Nth item of a list
  * Don't use this to iterate through a list, it would be very inefficient
+ *
+ * Packed lists don't have nodes to return, so this always returns NULL for
+ * them. Use nbt_list_span instead.
  */
 nbt_node* nbt_list_item(nbt_node* list, int n);
 
+/*
+ * Returns the number of elements in a list. This is O(1) for packed lists and
+ * for lists built by the library, which keeps count as elements come and go.
+ * Returns -1 if `list' isn't a TAG_LIST.
+ */
+int32_t nbt_list_length(const nbt_node* list);
+
+/*
+ * Appends `elem' to the end of `list'. Its type must be the list's element
+ * type, unless the list is empty, in which case the list takes on its type.
+ * Packed lists are unpacked first. Returns NBT_ERR if the types don't match
+ * (or if one of the two is augmented and the other isn't), and NBT_EMEM if we
+ * ran out of memory. `elem' only belongs to the list if this succeeds.
+ */
+nbt_status nbt_list_append(nbt_node* list, nbt_node* elem);
+
+/*
+ * Call this after adding or removing elements of a list by hand, so the
+ * library stops trusting its count. It'll be checked on the next dump.
+ */
+void nbt_list_invalidate(nbt_node* list);
+
+                   /***** Parallel Traversal Functions *****/
+
+/*
+ * These walk a big tree with several threads. The work is split up at lists
+ * and compounds: the children of one with more than `grain' of them are
+ * handed out, `grain' at a time, to whichever thread is free. Visitors and
+ * predicates are called from all of them at once, and in no particular
+ * order, so they have to be thread-safe. The tree mustn't change until
+ * they're done, but they may look things up in it with nbt_compound_get.
+ */
+
+/* The default grain. */
+#define NBT_PARALLEL_GRAIN 256
+
+/* How to split the work up. Passing NULL is the same as all zeroes. */
+struct nbt_parallel {
+    unsigned threads;   /* How many, counting the caller. 0 for one per core. */
+    size_t grain;       /* 0 for NBT_PARALLEL_GRAIN. */
+};
+
+/*
+ * A reduction folds every node of a tree into one result. Each thread folds
+ * its nodes into a partial result of its own, and then the partial results
+ * are combined, in no particular order. So `combine' has to be associative
+ * and commutative, and `init' has to make a result which changes nothing
+ * when combined.
+ */
+struct nbt_reducer {
+    size_t size;                                            /* Of a result. */
+    void (*init)(void* acc, void* aux);
+    bool (*visit)(const nbt_node* node, void* acc, void* aux); /* false to stop */
+    void (*combine)(void* acc, const void* other, void* aux);
+};
+
+/*
+ * Folds every node nbt_map would visit into `result'. If a visitor returns
+ * false, the walk stops soon after, and `result' has what was folded so far.
+ * Returns false if it was stopped by a visitor, true otherwise.
+ */
+bool nbt_reduce(const nbt_node* tree, const struct nbt_reducer* r, void* result, void* aux,
+                const struct nbt_parallel* opts);
+
+/* nbt_map, across threads, for visitors which don't change the tree. */
+bool nbt_map_parallel(const nbt_node* tree, nbt_predicate_t, void* aux, const struct nbt_parallel* opts);
+
+/* nbt_size, across threads. */
+size_t nbt_size_parallel(const nbt_node* tree, const struct nbt_parallel* opts);
+
+/*
+ * nbt_filter, across threads. The result is exactly what nbt_filter would
+ * have made, in the same order.
+ */
+nbt_node* nbt_filter_parallel(const nbt_node* tree, nbt_predicate_t, void* aux,
+                              const struct nbt_parallel* opts);
+
+                     /***** Path Query Functions *****/
+
+/*
+ * Paths that are used over and over again can be compiled once, and then run
+ * against any number of trees. Unlike nbt_find_by_path, a compiled path
+ * starts at the root instead of matching the root's name. It's made of steps:
+ *
+ *   name  .name    The children of a compound called `name'. The first step
+ *                  doesn't need its dot.
+ *   .*             All the children of a compound.
+ *   [n]            The nth element of a list, counting from 0. Negative
+ *                  indices count back from the end, so [-1] is the last one.
+ *   [*]            All the elements of a list.
+ *   ..name  ..*    The nodes called `name', or all the nodes, anywhere
+ *                  underneath.
+ *
+ * Names can be quoted, as in ."minecraft:stone" or ["a.b"], with `\' escaping
+ * the next character. Names have to be quoted if they're empty, or have any
+ * of . [ ] " @ in them. A path can end in a type, like @TAG_Long_Array or
+ * @long_array, to only match tags of that type. So for example:
+ *
+ *   Level.Sections[*].BlockStates@long_array
+ *
+ * Matches come in document order. Elements of packed lists aren't nodes, so
+ * they are never matched.
+ */
+typedef struct nbt_path nbt_path;
+
+/*
+ * Compiles `path'. Returns NULL and sets errno to NBT_ERR if it isn't a valid
+ * path, or to NBT_EMEM if we ran out of memory. The result may be shared
+ * between threads. Free it with nbt_path_free.
+ */
+nbt_path* nbt_path_compile(const char* path);
+
+void nbt_path_free(nbt_path* path);
+
+/* How deeply a query may walk into a tree. */
+#define NBT_PATH_MAX_DEPTH 512
+
+/* The state of a query. Treat it as opaque. */
+struct nbt_path_iter {
+    const nbt_path* path;
+    nbt_node* root;         /* Until the first call to nbt_path_next. */
+    nbt_status err;
+
+    size_t depth;
+    struct nbt_path_frame {
+        struct list_head* head;     /* The children being matched... */
+        struct list_head* pos;      /* ...how far we've got... */
+        nbt_node* again;            /* ...which one to look inside next... */
+        size_t step;                /* ...and what they're matched against. */
+    } stack[NBT_PATH_MAX_DEPTH];
+};
+
+/*
+ * Gets ready to run `path' against `tree'. The tree mustn't change until the
+ * query's over, but nothing has to be freed if you stop early.
+ */
+void nbt_path_begin(struct nbt_path_iter* it, const nbt_path* path, nbt_node* tree);
+
+/*
+ * Returns the next match, or NULL when there are no more. If the tree is
+ * nested more than NBT_PATH_MAX_DEPTH deep, NULL is returned early, and errno
+ * is set to NBT_ERR.
+ */
+nbt_node* nbt_path_next(struct nbt_path_iter* it);
+
+/* Returns the first match of `path' in `tree', or NULL if there isn't one. */
+nbt_node* nbt_path_first(const nbt_path* path, nbt_node* tree);
+
+/*
+ * A matcher runs a whole set of paths at once, in one walk over the tree, so
+ * pulling twenty fields out of a chunk costs the same walk as pulling one.
+ * Paths with the same beginning share the work of matching it, and subtrees
+ * which none of them can reach are never looked at.
+ */
+typedef struct nbt_matcher nbt_matcher;
+
+/*
+ * Called for a match of the path numbered `query'. Return false to stop. A
+ * node which several paths match is reported once for each of them.
+ */
+typedef bool (*nbt_match_t)(size_t query, nbt_node* node, void* aux);
+typedef bool (*nbt_event_match_t)(size_t query, const struct nbt_event* ev, void* aux);
+
+/*
+ * Compiles the `n' paths in `paths'. They're numbered in the order they come
+ * in. Returns NULL and sets errno like nbt_path_compile if any of them isn't
+ * a valid path. The result may be shared between threads. Free it with
+ * nbt_matcher_free.
+ */
+nbt_matcher* nbt_matcher_compile(const char* const* paths, size_t n);
+
+void nbt_matcher_free(nbt_matcher* m);
+
+/*
+ * Reports every match of every path in `tree'. Matches come in document
+ * order, but a node's matches for different paths come in no particular
+ * order. Returns NBT_EMEM if we ran out of memory.
+ */
+nbt_status nbt_matcher_run(const nbt_matcher* m, nbt_node* tree, nbt_match_t match, void* aux);
+
+/*
+ * The same as nbt_matcher_run, but over the `length' bytes of binary NBT at
+ * `memory', with the event parser. A list or compound is reported with its
+ * BEGIN event. Unlike in a tree, the elements of lists of scalars can be
+ * matched. Returns the event parser's error if the input isn't valid.
+ */
+nbt_status nbt_matcher_run_binary(const nbt_matcher* m, const void* memory, size_t length,
+                                  nbt_event_match_t match, void* aux);
+
+                         /***** Diff Functions *****/
+
+/*
+ * A diff is an edit script which turns one tree into another. It's a tree
+ * itself, so it's saved and loaded like any other: nbt_dump_binary gives its
+ * binary encoding, and nbt_parse reads it back. It looks like
+ *
+ *   { ops: [ { op: 3b, path: "Level.Entities", start: 4, remove: 1, values: [...] }, ... ] }
+ *
+ * where `op' is one of these, and `path' is a compiled path (see
+ * nbt_path_compile) made of names and indices only. "" is the root.
+ */
+typedef enum {
+    NBT_DIFF_ADD     = 0, /* Add `value' to the compound at `path', as `name'. */
+    NBT_DIFF_REMOVE  = 1, /* Remove the child `name' of the compound at `path'. */
+    NBT_DIFF_REPLACE = 2, /* Replace the node at `path' with `value'. */
+    NBT_DIFF_SPLICE  = 3  /* Replace `remove' elements of the list or array at
+                             `path', from index `start' on, with `values'. */
+} nbt_diff_op;
+
+/*
+ * Returns the diff from `a' to `b', or NULL with errno set to NBT_EMEM if we
+ * ran out of memory. Compound children are matched up by name, and lists are
+ * matched up element by element once the unchanged ends are trimmed off, so
+ * it takes linear time. On augmented trees, unchanged subtrees are skipped by
+ * their cached hashes (see nbt_hash), so a small change to a big tree makes a
+ * quick diff, once its hashes are cached.
+ *
+ * The root's name, and the order of a compound's children, aren't part of the
+ * diff, and compounds are assumed to have unique names. Free it with nbt_free.
+ */
+nbt_node* nbt_diff(const nbt_node* a, const nbt_node* b);
+
+/*
+ * Applies `diff' to `*tree', which ends up equal to the `b' it was made from,
+ * as far as nbt_hash is concerned. Shared nodes are unshared on the way (see
+ * nbt_writable), and `*tree' is updated if the root was replaced or copied.
+ * Returns NBT_ERR if the diff doesn't fit the tree, or NBT_EMEM if we ran out
+ * of memory. On failure, the ops before the failing one stay applied.
+ */
+nbt_status nbt_diff_apply(nbt_node** tree, const nbt_node* diff);
+
+                    /***** Augmented Tree Functions *****/
+
+/*
+ * Augmented trees (see NBT_PARSE_AUGMENT) keep their bookkeeping up to date
+ * through every library routine: nbt_compound_append, nbt_compound_take,
+ * nbt_filter_inplace, nbt_list_pack and nbt_list_unpack. Clones and filtered
+ * copies of augmented trees are augmented too. If you splice lists by hand,
+ * the bookkeeping will go stale.
+ *
+ * Augmented nodes also remember their nbt_hash once it's been asked for, so
+ * hashing a subtree which hasn't changed since is O(1). That makes checking
+ * whether a chunk needs saving again cheap:
+ *
+ *   uint64_t saved = nbt_hash(chunk);
+ *   ...
+ *   if(nbt_changed(chunk, saved))
+ *       save(chunk);
+ *
+ * Hashing writes to the tree, so don't do it from several threads at once.
+ *
+ * Augmented and regular nodes can't be mixed in the same tree.
+ */
+
+/*
+ * Returns an augmented copy of `tree', or NULL if we ran out of memory. The
+ * original is left alone.
+ */
+nbt_node* nbt_augment(nbt_node* tree);
+
+/* Returns the parent of `node', or NULL if it's the root or not augmented. */
+nbt_node* nbt_parent(const nbt_node* node);
+
+/*
+ * Returns the number of direct child nodes of `node'. This is O(1) for
+ * augmented nodes. Packed lists have no child nodes.
+ */
+size_t nbt_children(const nbt_node* node);
+
+/*
+ * Returns the path from the root to `node', in the format nbt_find_by_path
+ * understands. `node' must be augmented. Returns NULL and sets errno on
+ * failure. Don't forget to free the result.
+ *
+ * The path is only a lookup key if there's no list on the way to `node', and
+ * no name on the way has a dot in it. List items have no name, so they show
+ * up as empty pieces, which every item of the list matches. nbt_find_by_path
+ * returns the first match, which may well be one of `node''s cousins.
+ */
+char* nbt_path_of(const nbt_node* node);
+
+/*
+ * Call this after changing a node of an augmented tree by hand, like setting
+ * its value or renaming it, so it and its ancestors get hashed again. It does
+ * nothing to other nodes.
+ */
+void nbt_hash_invalidate(nbt_node* node);
+
+                     /***** Packed List Functions *****/
+
+/* A read-only view of the elements of a packed list. */
+struct nbt_span {
+    const void* data;   /* Cast this to a pointer to `type''s C type. */
+    int32_t length;
+    nbt_type type;
+};
+
+/*
+ * Fills in `span' with the elements of `list'. Returns false, leaving `span'
+ * untouched, if `list' isn't a packed list.
+ */
+bool nbt_list_span(const nbt_node* list, struct nbt_span* span);
+
+/*
+ * Fills in the type and payload of `elem' with the `i'th element of `span',
+ * as if it were an unpacked list item. It has no name, and owns nothing, so
+ * don't nbt_free it.
+ */
+void nbt_span_get(const struct nbt_span* span, int32_t i, nbt_node* elem);
+
+/*
+ * Converts a list of scalars into its packed form, in place. Lists which are
+ * already packed, or which hold something other than scalars, are left alone.
+ * Returns NBT_EMEM if we ran out of memory, in which case `list' is unchanged.
+ */
+nbt_status nbt_list_pack(nbt_node* list);
+
+/*
+ * The inverse of nbt_list_pack. Turns a packed list back into a linked list of
+ * nodes, for code which wants to walk payload.tag_list. Returns NBT_EMEM if we
+ * ran out of memory, in which case `list' is unchanged.
+ */
+nbt_status nbt_list_unpack(nbt_node* list);
+
+                     /***** Frozen Tree Functions *****/
+
+/*
+ * A frozen tree is a read-only copy of a tree packed into a single block of
+ * memory. It has no pointers in it, so it can be written to disk as it is and
+ * mmapped back later, with no parsing at all. Scalars are native-endian and
+ * arrays are aligned, so everything can be read in place.
+ *
+ * Blocks are only readable on machines of the same byte order, and must start
+ * on an 8-byte boundary (mmap and malloc both take care of that).
+ */
+
+/* A node of a frozen tree. Use the nbt_frozen_* functions to look inside. */
+typedef struct nbt_frozen nbt_frozen;
+
+/*
+ * Freezes `tree' into a new block. Returns an empty buffer and sets errno on
+ * failure: NBT_EMEM if we ran out of memory, NBT_ERR if the block would be
+ * bigger than 4 GiB. Free it with buffer_free.
+ */
+struct buffer nbt_freeze(const nbt_node* tree);
+
+/*
+ * Returns the root of the frozen tree in the `len' bytes at `block'. Only the
+ * header is checked, so don't feed this untrusted data. Returns NULL and sets
+ * errno to NBT_ERR if it doesn't look like a frozen tree made on this machine.
+ * The nodes live in `block', so keep it around for as long as you use them.
+ */
+const nbt_frozen* nbt_frozen_root(const void* block, size_t len);
+
+nbt_type    nbt_frozen_type(const nbt_frozen*);
+const char* nbt_frozen_name(const nbt_frozen*); /* NULL if unnamed. */
+
+/*
+ * The number of children of a list or compound, elements of an array, or
+ * bytes of a string (not counting the null-terminator). 0 for scalars.
+ */
+int32_t nbt_frozen_length(const nbt_frozen*);
+
+/* The element type of a list, or TAG_INVALID if it isn't one. */
+nbt_type nbt_frozen_list_type(const nbt_frozen*);
+
+/*
+ * The value of a scalar, converted if it's of the other kind. These return 0
+ * for everything else.
+ */
+int64_t nbt_frozen_int(const nbt_frozen*);
+double  nbt_frozen_double(const nbt_frozen*);
+
+/* The null-terminated payload of a TAG_STRING, or NULL if it isn't one. */
+const char* nbt_frozen_string(const nbt_frozen*);
+
+/*
+ * The elements of a TAG_BYTE_ARRAY, TAG_INT_ARRAY or TAG_LONG_ARRAY. Returns
+ * NULL if the array is empty, or isn't an array at all.
+ */
+const void* nbt_frozen_array(const nbt_frozen*);
+
+/*
+ * Lists of scalars are always frozen as flat arrays, whether or not they were
+ * packed. This fills in `span' with their elements, and returns false for
+ * anything else. Such lists have no child nodes.
+ */
+bool nbt_frozen_span(const nbt_frozen*, struct nbt_span* span);
+
+/*
+ * Returns the `i'th child of a list or compound in O(1), or NULL if there's
+ * no such child.
+ */
+const nbt_frozen* nbt_frozen_child(const nbt_frozen*, int32_t i);
+
+/*
+ * Returns the first child of a compound named `name', or NULL if there is no
+ * such child. Children are kept sorted by name, so this is O(log n). A NULL
+ * `name' finds the first unnamed child.
+ */
+const nbt_frozen* nbt_frozen_get(const nbt_frozen*, const char* name);
+
+                    /***** Compound Lookup Functions *****/
+
+/*
+ * Returns the direct child of `compound' named `name', or NULL if there is no
+ * such child (or `compound' isn't a TAG_COMPOUND). Unlike nbt_find_by_name,
+ * this never descends into grandchildren.
+ *
+ * Small compounds are just scanned. The first lookup in a big compound builds
+ * a hash index over its children, after which lookups run in O(1). The index
+ * is kept up to date by nbt_compound_append and nbt_compound_take. If you
+ * splice a compound's list by hand, call nbt_compound_invalidate afterwards.
+ */
+nbt_node* nbt_compound_get(nbt_node* compound, const char* name);
+
+/*
+ * Appends `child' to the end of `compound', updating its index if it has one.
+ * `child' must be named. Returns NBT_EMEM if the list entry could not be
+ * allocated, in which case `child' still belongs to the caller, and NBT_ERR
+ * if one of the two is augmented and the other isn't.
+ */
+nbt_status nbt_compound_append(nbt_node* compound, nbt_node* child);
+
+/*
+ * Unlinks the direct child named `name' from `compound' and returns it. The
+ * child now belongs to the caller, and should be freed with nbt_free. Returns
+ * NULL if no such child exists.
+ */
+nbt_node* nbt_compound_take(nbt_node* compound, const char* name);
+
+/*
+ * Builds the index of every compound in `tree' right now, instead of waiting
+ * for the first lookup. Returns NBT_EMEM if we ran out of memory, in which
+ * case lookups will gracefully fall back to scanning.
+ */
+nbt_status nbt_compound_index(nbt_node* tree);
+
+/*
+ * Throws away the index of `compound'. It will be rebuilt on the next lookup.
+ * You only need this if you modify the children of a compound without going
+ * through the library.
+ */
+void nbt_compound_invalidate(nbt_node* compound);
+
 /* TODO: More utilities as requests are made and patches contributed. */
 
+                      /***** Allocation Functions *****/
+
+/*
+ * The library recycles nodes and list entries through a per-thread pool, so
+ * that parsing and freeing trees over and over doesn't keep going back to
+ * malloc. Trees you build by hand may mix these with plain malloc: pooled
+ * objects are individually allocated, so either kind can be released either
+ * way.
+ */
+
+/* Returns an uninitialized node, or NULL if we ran out of memory. */
+nbt_node* nbt_alloc_node(void);
+
+/* Returns an uninitialized list entry, or NULL if we ran out of memory. */
+struct nbt_list* nbt_alloc_list(void);
+
+/*
+ * Hands a single node or list entry back to the calling thread's pool. Unlike
+ * nbt_free and nbt_free_list, nothing they point to is freed.
+ */
+void nbt_release_node(nbt_node*);
+void nbt_release_list(struct nbt_list*);
+
+/* How well the calling thread's pool is doing. */
+struct nbt_pool_stats {
+    size_t node_hits;    /* Nodes handed out from the pool. */
+    size_t node_misses;  /* Nodes we had to malloc. */
+    size_t list_hits;    /* The same, for list entries. */
+    size_t list_misses;
+
+    size_t pooled_nodes; /* Objects currently sitting in the pool. */
+    size_t pooled_lists;
+};
+
+void nbt_pool_stats(struct nbt_pool_stats*);
+
+/* Gives every object in the calling thread's pool back to the system. */
+void nbt_pool_trim(void);
+
                       /***** Utility Functions *****/
 
-/* Returns true if the trees are identical. */
+/*
+ * Returns the interned copy of the first `len' bytes of `s', adding it to the
+ * intern table if it isn't in there yet. `s' need not be null-terminated, but
+ * the returned string is. Interned strings live as long as the process, so
+ * two names are equal if and only if their interned pointers are. This is
+ * thread-safe. Returns NULL if we ran out of memory.
+ */
+const char* nbt_intern(const char* s, size_t len);
+
+/*
+ * The same as nbt_intern, except the string is never added to the table. If
+ * it isn't in there, NULL is returned, and no interned name can be equal to
+ * it.
+ */
+const char* nbt_intern_find(const char* s, size_t len);
+
+/*
+ * Returns true if the trees are identical, with their compounds' children in
+ * the same order. Floats only have to be within a millionth of each other.
+ * Augmented subtrees whose hashes are already known to be different aren't
+ * looked inside, unless they have floats in them.
+ */
 bool nbt_eq(const nbt_node* restrict a, const nbt_node* restrict b);
 
+/*
+ * A 64-bit hash of the tree's structure and values, without its root's name,
+ * so a subtree hashes the same wherever it is. Trees with the same canonical
+ * dump (see nbt_dump_canonical) have the same hash, on any machine. Nothing
+ * is allocated or sorted, so this is a single pass over the tree. On an
+ * augmented tree, only the parts which changed since the last time are.
+ */
+uint64_t nbt_hash(const nbt_node* tree);
+
+/* Has `tree' changed since it hashed to `since'? See nbt_hash. */
+bool nbt_changed(const nbt_node* tree, uint64_t since);
+
+/*
+ * Returns the size in bytes of a scalar type's payload, or 0 if the type is not
+ * a scalar (TAG_BYTE through TAG_DOUBLE).
+ */
+size_t nbt_scalar_size(nbt_type);
+
 /*
  * Converts a type to a print-friendly string. The string is statically
  * allocated, and therefore does not have to be freed by the user.
@@ -0,0 +1,191 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#include "nbt.h"
+#include "nbt_internal.h"
+
+#include "list.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Returns the list of child nodes, or NULL if `node' can't have any. */
+static struct nbt_list* children_of(const nbt_node* node)
+{
+    if(node->type == TAG_COMPOUND)
+        return node->payload.tag_compound;
+
+    if(node->type == TAG_LIST && !(node->flags & NBT_NODE_PACKED))
+        return node->payload.tag_list;
+
+    return NULL;
+}
+
+/*
+ * Recounts `node''s cache from its children, and points them back at it.
+ * Returns the change in size.
+ */
+static ptrdiff_t recount(nbt_node* node)
+{
+    struct nbt_augmented* aug = AUGMENTED(node);
+    struct nbt_list* list = children_of(node);
+
+    size_t old_size = aug->size;
+
+    aug->children = 0;
+    aug->size     = 1;
+
+    if(list != NULL)
+    {
+        const struct list_head* pos;
+        list_for_each(pos, &list->entry)
+        {
+            nbt_node* child = list_entry(pos, struct nbt_list, entry)->data;
+
+            assert(is_augmented(child));
+
+            AUGMENTED(child)->parent = node;
+
+            aug->children++;
+            aug->size += AUGMENTED(child)->size;
+        }
+    }
+
+    return (ptrdiff_t)aug->size - (ptrdiff_t)old_size;
+}
+
+/* Adds `delta' to the size of every ancestor of `node'. */
+static void propagate(nbt_node* node, ptrdiff_t delta)
+{
+    if(delta == 0) return;
+
+    for(nbt_node* p = AUGMENTED(node)->parent; p != NULL; p = AUGMENTED(p)->parent)
+        AUGMENTED(p)->size += delta;
+}
+
+void _nbt_aug_adopt(nbt_node* node)
+{
+    assert(is_augmented(node));
+
+    AUGMENTED(node)->size   = 1;
+    AUGMENTED(node)->hashed = false;
+    recount(node);
+}
+
+void _nbt_aug_refresh(nbt_node* node)
+{
+    assert(is_augmented(node));
+
+    propagate(node, recount(node));
+    _nbt_aug_touch(node);
+}
+
+void _nbt_aug_touch(nbt_node* node)
+{
+    /* Anything above a node without a hash doesn't have one either. */
+    for(nbt_node* n = node; n != NULL && AUGMENTED(n)->hashed; n = AUGMENTED(n)->parent)
+        AUGMENTED(n)->hashed = false;
+}
+
+void _nbt_aug_link(nbt_node* parent, nbt_node* child)
+{
+    assert(is_augmented(parent) && is_augmented(child));
+
+    AUGMENTED(child)->parent = parent;
+    AUGMENTED(parent)->children++;
+    AUGMENTED(parent)->size += AUGMENTED(child)->size;
+
+    propagate(parent, (ptrdiff_t)AUGMENTED(child)->size);
+    _nbt_aug_touch(parent);
+}
+
+void _nbt_aug_unlink(nbt_node* parent, nbt_node* child)
+{
+    assert(is_augmented(parent) && is_augmented(child));
+    assert(AUGMENTED(child)->parent == parent);
+
+    AUGMENTED(child)->parent = NULL;
+    AUGMENTED(parent)->children--;
+    AUGMENTED(parent)->size -= AUGMENTED(child)->size;
+
+    propagate(parent, -(ptrdiff_t)AUGMENTED(child)->size);
+    _nbt_aug_touch(parent);
+}
+
+void nbt_hash_invalidate(nbt_node* node)
+{
+    if(node != NULL && is_augmented(node))
+        _nbt_aug_touch(node);
+}
+
+nbt_node* nbt_parent(const nbt_node* node)
+{
+    if(node == NULL || !is_augmented(node))
+        return NULL;
+
+    return AUGMENTED(node)->parent;
+}
+
+size_t nbt_children(const nbt_node* node)
+{
+    if(node == NULL)
+        return 0;
+
+    if(is_augmented(node))
+        return AUGMENTED(node)->children;
+
+    struct nbt_list* list = children_of(node);
+    return list ? list_length(&list->entry) : 0;
+}
+
+char* nbt_path_of(const nbt_node* node)
+{
+    assert(node);
+
+    if(!is_augmented(node))
+    {
+        errno = NBT_ERR;
+        return NULL;
+    }
+
+    /* Measure first, so we can build the path back to front in one go. */
+    size_t len = 0;
+
+    for(const nbt_node* n = node; n != NULL; n = AUGMENTED(n)->parent)
+        len += (n->name ? strlen(n->name) : 0) + 1; /* the dot, or the '\0' */
+
+    char* ret = malloc(len);
+
+    if(ret == NULL)
+    {
+        errno = NBT_EMEM;
+        return NULL;
+    }
+
+    char* end = ret + len - 1;
+    *end = '\0';
+
+    for(const nbt_node* n = node; n != NULL; n = AUGMENTED(n)->parent)
+    {
+        size_t n_len = n->name ? strlen(n->name) : 0;
+
+        end -= n_len;
+        if(n_len) memcpy(end, n->name, n_len);
+
+        if(end != ret)
+            *--end = '.';
+    }
+
+    assert(end == ret);
+
+    return ret;
+}
@@ -0,0 +1,855 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+
+/*
+ * The binary parser and writer. This isn't a regular header: nbt_parsing.c
+ * includes it once for every nbt_encoding, with CODEC_ENCODING set to the
+ * encoding and CODEC(name) naming that copy of each function. Byte order and
+ * integer encoding are only ever asked of CODEC_ENCODING, which is a constant,
+ * so every copy is compiled with its own answers and nothing is decided per
+ * field.
+ */
+
+/* Are ints, longs and lengths zigzag varints? */
+#define VARINTS (CODEC_ENCODING == NBT_ENCODING_NETWORK)
+
+/* Is a `type' payload, or array element, written as a varint? */
+#define IS_VARINT(type) (VARINTS && ((type) == TAG_INT || (type) == TAG_LONG))
+
+/* Reads fixed-size numbers, putting them in native byte order. */
+#define SCANNER (CODEC_ENCODING == NBT_ENCODING_JAVA ? swapped_memscan : le_memscan)
+
+/* The longest string the length prefix can say. */
+#define STRING_MAX (CODEC_ENCODING == NBT_ENCODING_JAVA    ? 32767 /* SHORT_MAX */     : \
+                    CODEC_ENCODING == NBT_ENCODING_BEDROCK ? 65535 /* USHRT_MAX */     : \
+                                                             2147483647 /* INT_MAX */)
+
+static nbt_node* CODEC(parse_unnamed_tag)(nbt_type type, char* name, const char** memory, size_t* length, unsigned flags);
+
+/* Puts `n' bytes which are in the encoding's byte order into native order. */
+static inline void CODEC(to_native)(void* p, size_t n)
+{
+    if(CODEC_ENCODING == NBT_ENCODING_JAVA)
+        be2ne(p, n);
+    else
+        le2ne(p, n);
+}
+
+/* Reads a TAG_INT payload, or the length of an array or list. */
+static bool CODEC(read_int)(int32_t* out, const char** memory, size_t* length)
+{
+    if(VARINTS)
+        return read_zigzag32(out, memory, length);
+
+    READ_GENERIC(out, sizeof *out, SCANNER, return false);
+    return true;
+}
+
+static bool CODEC(read_long)(int64_t* out, const char** memory, size_t* length)
+{
+    if(VARINTS)
+        return read_zigzag64(out, memory, length);
+
+    READ_GENERIC(out, sizeof *out, SCANNER, return false);
+    return true;
+}
+
+/* Reads the length in front of a string, and checks that the string's there. */
+static bool CODEC(read_string_length)(size_t* out, const char** memory, size_t* length)
+{
+    if(VARINTS)
+    {
+        uint64_t n;
+
+        if(!read_varint(&n, 5, memory, length) || n > STRING_MAX)
+            return false;
+
+        *out = (size_t)n;
+    }
+    else if(CODEC_ENCODING == NBT_ENCODING_BEDROCK)
+    {
+        uint16_t n;
+        READ_GENERIC(&n, sizeof n, SCANNER, return false);
+
+        *out = n;
+    }
+    else
+    {
+        int16_t n;
+        READ_GENERIC(&n, sizeof n, SCANNER, return false);
+
+        if(n < 0) return false;
+
+        *out = (size_t)n;
+    }
+
+    return *length >= *out;
+}
+
+/*
+ * Reads a string from memory, moving the pointer and updating the length
+ * appropriately. Returns NULL on failure.
+ */
+static char* CODEC(read_string)(const char** memory, size_t* length)
+{
+    size_t string_length;
+    char* ret = NULL;
+
+    if(!CODEC(read_string_length)(&string_length, memory, length)) goto parse_error;
+
+    CHECKED_MALLOC(ret, string_length + 1, goto parse_error);
+
+    READ_GENERIC(ret, string_length, memscan, goto parse_error);
+
+    ret[string_length] = '\0'; /* don't forget to NULL-terminate ;) */
+    return ret;
+
+parse_error:
+    if(errno == NBT_OK)
+        errno = NBT_ERR;
+
+    free(ret);
+    return NULL;
+}
+
+/*
+ * Reads a tag name. If we're interning, the name is looked up straight from
+ * the stream without an intermediate copy. Otherwise, it's just read_string.
+ */
+static char* CODEC(read_name)(const char** memory, size_t* length, unsigned flags)
+{
+    if(!(flags & NBT_PARSE_INTERN))
+        return CODEC(read_string)(memory, length);
+
+    size_t name_length;
+    const char* ret;
+
+    if(!CODEC(read_string_length)(&name_length, memory, length)) goto parse_error;
+
+    if((ret = nbt_intern(*memory, name_length)) == NULL)
+    {
+        errno = NBT_EMEM;
+        goto parse_error;
+    }
+
+    *memory += name_length;
+    *length -= name_length;
+
+    return (char*)ret;
+
+parse_error:
+    if(errno == NBT_OK)
+        errno = NBT_ERR;
+
+    return NULL;
+}
+
+static nbt_node* CODEC(parse_named_tag)(const char** memory, size_t* length, unsigned flags)
+{
+  char* name = NULL;
+
+  uint8_t type;
+  READ_GENERIC(&type, sizeof type, memscan, goto parse_error);
+
+  if(!(flags & NBT_PARSE_NAMELESS) && (name = CODEC(read_name)(memory, length, flags)) == NULL)
+    goto parse_error;
+
+  nbt_node* ret = CODEC(parse_unnamed_tag)((nbt_type)type, name, memory, length, flags);
+  if(ret == NULL) goto parse_error;
+
+  return ret;
+
+parse_error:
+  if(errno == NBT_OK)
+    errno = NBT_ERR;
+
+  free_name(name, flags);
+  return NULL;
+}
+
+/*
+ * Reads `count' numbers of `type' into `dest', in native byte order. Varints
+ * are decoded one at a time. Everything else is copied in one go, and swapped
+ * where it lies if it has to be.
+ */
+static bool CODEC(read_elements)(void* dest, int32_t count, nbt_type type, const char** memory, size_t* length)
+{
+    size_t size = nbt_scalar_size(type);
+
+    if(IS_VARINT(type))
+    {
+        for(int32_t i = 0; i < count; i++)
+        {
+            bool ok = type == TAG_INT ? read_zigzag32((int32_t*)dest + i, memory, length)
+                                      : read_zigzag64((int64_t*)dest + i, memory, length);
+            if(!ok)
+                return false;
+        }
+
+        return true;
+    }
+
+    READ_GENERIC(dest, (size_t)count * size, memscan, return false);
+
+    if(size > 1)
+        for(int32_t i = 0; i < count; i++)
+            CODEC(to_native)((char*)dest + i * size, size);
+
+    return true;
+}
+
+/*
+ * Reads an array's length, and checks that there could be that many elements
+ * of `type' left before anything's allocated for them. Every varint takes at
+ * least a byte.
+ */
+static bool CODEC(read_array_length)(int32_t* out, nbt_type type, const char** memory, size_t* length)
+{
+    if(!CODEC(read_int)(out, memory, length) || *out < 0)
+        return false;
+
+    size_t size = IS_VARINT(type) ? 1 : nbt_scalar_size(type);
+
+    return *length / size >= (size_t)*out;
+}
+
+static struct nbt_byte_array CODEC(read_byte_array)(const char** memory, size_t* length)
+{
+    struct nbt_byte_array ret = { NULL, 0 };
+
+    if(!CODEC(read_array_length)(&ret.length, TAG_BYTE, memory, length)) goto parse_error;
+
+    CHECKED_MALLOC(ret.data, ret.length, goto parse_error);
+
+    READ_GENERIC(ret.data, (size_t)ret.length, memscan, goto parse_error);
+
+    return ret;
+
+parse_error:
+    if(errno == NBT_OK)
+        errno = NBT_ERR;
+
+    free(ret.data);
+    ret.data = NULL;
+    return ret;
+}
+
+static struct nbt_int_array CODEC(read_int_array)(const char** memory, size_t* length)
+{
+    struct nbt_int_array ret = { NULL, 0 };
+
+    if(!CODEC(read_array_length)(&ret.length, TAG_INT, memory, length)) goto parse_error;
+
+    CHECKED_MALLOC(ret.data, ret.length * sizeof(int32_t), goto parse_error);
+
+    if(!CODEC(read_elements)(ret.data, ret.length, TAG_INT, memory, length)) goto parse_error;
+
+    return ret;
+
+parse_error:
+    if(errno == NBT_OK)
+        errno = NBT_ERR;
+
+    free(ret.data);
+    ret.data = NULL;
+    return ret;
+}
+
+static struct nbt_long_array CODEC(read_long_array)(const char** memory, size_t* length)
+{
+    struct nbt_long_array ret = { NULL, 0 };
+
+    if(!CODEC(read_array_length)(&ret.length, TAG_LONG, memory, length)) goto parse_error;
+
+    CHECKED_MALLOC(ret.data, ret.length * sizeof(int64_t), goto parse_error);
+
+    if(!CODEC(read_elements)(ret.data, ret.length, TAG_LONG, memory, length)) goto parse_error;
+
+    return ret;
+
+parse_error:
+    if(errno == NBT_OK)
+        errno = NBT_ERR;
+
+    free(ret.data);
+    ret.data = NULL;
+    return ret;
+}
+
+/* Reads the header and elements of a list of scalars into a flat array. */
+static struct nbt_packed_list CODEC(read_packed_list)(const char** memory, size_t* length)
+{
+    struct nbt_packed_list ret = { NULL, 0, TAG_INVALID };
+    uint8_t type;
+
+    READ_GENERIC(&type, sizeof type, memscan, goto parse_error);
+
+    ret.type = (nbt_type)type;
+
+    size_t size = nbt_scalar_size(ret.type);
+
+    if(size == 0)                                                              goto parse_error;
+    if(!CODEC(read_array_length)(&ret.length, ret.type, memory, length))       goto parse_error;
+
+    if(ret.length == 0)
+        return ret;
+
+    CHECKED_MALLOC(ret.data, ret.length * size, goto parse_error);
+
+    if(!CODEC(read_elements)(ret.data, ret.length, ret.type, memory, length))  goto parse_error;
+
+    return ret;
+
+parse_error:
+    if(errno == NBT_OK)
+        errno = NBT_ERR;
+
+    free(ret.data);
+    ret.data = NULL;
+    return ret;
+}
+
+static struct nbt_list* CODEC(read_list)(const char** memory, size_t* length, unsigned flags)
+{
+    uint8_t type;
+    int32_t elems;
+    struct nbt_list* ret;
+
+    CHECKED_ALLOC(ret, nbt_alloc_list(), goto parse_error);
+
+    INIT_LIST_HEAD(&ret->entry);
+
+    /* we allocate the data pointer to store the type of the list in the first
+     * sentinel element */
+    CHECKED_ALLOC(ret->data, nbt_alloc_node(), goto parse_error);
+
+    ret->data->flags = 0;
+    ret->data->refs  = 0;
+    ret->data->index = NULL;
+
+    READ_GENERIC(&type, sizeof type, memscan, goto parse_error);
+    if(!CODEC(read_int)(&elems, memory, length)) goto parse_error;
+
+    ret->data->type = type == TAG_INVALID ? TAG_COMPOUND : (nbt_type)type;
+
+    for(int32_t i = 0; i < elems; i++)
+    {
+        struct nbt_list* new;
+
+        CHECKED_ALLOC(new, nbt_alloc_list(), goto parse_error);
+
+        new->data = CODEC(parse_unnamed_tag)((nbt_type)type, NULL, memory, length, flags);
+
+        if(new->data == NULL)
+        {
+            nbt_release_list(new);
+            goto parse_error;
+        }
+
+        list_add_tail(&new->entry, &ret->entry);
+    }
+
+    list_set_count(ret, elems > 0 ? elems : 0);
+
+    return ret;
+
+parse_error:
+    if(errno == NBT_OK)
+        errno = NBT_ERR;
+
+    nbt_free_list(ret);
+    return NULL;
+}
+
+static struct nbt_list* CODEC(read_compound)(const char** memory, size_t* length, unsigned flags)
+{
+    struct nbt_list* ret;
+
+    CHECKED_ALLOC(ret, nbt_alloc_list(), goto parse_error);
+
+    ret->data = NULL;
+    INIT_LIST_HEAD(&ret->entry);
+
+    for(;;)
+    {
+        uint8_t type;
+        char* name = NULL;
+        struct nbt_list* new_entry;
+
+        READ_GENERIC(&type, sizeof type, memscan, goto parse_error);
+
+        if(type == 0) break; /* TAG_END == 0. We've hit the end of the list when type == TAG_END. */
+
+        name = CODEC(read_name)(memory, length, flags);
+        if(name == NULL) goto parse_error;
+
+        CHECKED_ALLOC(new_entry, nbt_alloc_list(),
+            free_name(name, flags);
+            goto parse_error;
+        );
+
+        new_entry->data = CODEC(parse_unnamed_tag)((nbt_type)type, name, memory, length, flags);
+
+        if(new_entry->data == NULL)
+        {
+            nbt_release_list(new_entry);
+            free_name(name, flags);
+            goto parse_error;
+        }
+
+        list_add_tail(&new_entry->entry, &ret->entry);
+    }
+
+    return ret;
+
+parse_error:
+    if(errno == NBT_OK)
+        errno = NBT_ERR;
+    nbt_free_list(ret);
+
+    return NULL;
+}
+
+/*
+ * Parses a tag, given a name (may be NULL) and a type. Fills in the payload.
+ */
+static nbt_node* CODEC(parse_unnamed_tag)(nbt_type type, char* name, const char** memory, size_t* length, unsigned flags)
+{
+    nbt_node* node;
+
+    if(flags & NBT_PARSE_AUGMENT)
+        CHECKED_ALLOC(node, _nbt_alloc_augmented(), goto parse_error);
+    else
+        CHECKED_ALLOC(node, nbt_alloc_node(), goto parse_error);
+
+    node->type  = type;
+    node->flags = flags & NBT_PARSE_AUGMENT ? NBT_NODE_AUGMENTED : 0;
+    node->refs  = 0;
+    node->name  = name;
+    node->index = NULL;
+
+    if(name && (flags & NBT_PARSE_INTERN))
+        node->flags |= NBT_NODE_INTERNED;
+
+#define COPY_INTO_PAYLOAD(payload_name) \
+    READ_GENERIC(&node->payload.payload_name, sizeof node->payload.payload_name, SCANNER, goto parse_error);
+
+    switch(type)
+    {
+    case TAG_BYTE:
+        COPY_INTO_PAYLOAD(tag_byte);
+        break;
+    case TAG_SHORT:
+        COPY_INTO_PAYLOAD(tag_short);
+        break;
+    case TAG_INT:
+        if(!CODEC(read_int)(&node->payload.tag_int, memory, length)) goto parse_error;
+        break;
+    case TAG_LONG:
+        if(!CODEC(read_long)(&node->payload.tag_long, memory, length)) goto parse_error;
+        break;
+    case TAG_FLOAT:
+        COPY_INTO_PAYLOAD(tag_float);
+        break;
+    case TAG_DOUBLE:
+        COPY_INTO_PAYLOAD(tag_double);
+        break;
+    case TAG_BYTE_ARRAY:
+        node->payload.tag_byte_array = CODEC(read_byte_array)(memory, length);
+        break;
+    case TAG_INT_ARRAY:
+        node->payload.tag_int_array = CODEC(read_int_array)(memory, length);
+        break;
+    case TAG_LONG_ARRAY:
+        node->payload.tag_long_array = CODEC(read_long_array)(memory, length);
+        break;
+    case TAG_STRING:
+        node->payload.tag_string = CODEC(read_string)(memory, length);
+        break;
+    case TAG_LIST:
+        /* Peek at the element type to see if we can pack this list. */
+        if((flags & NBT_PARSE_PACK) && *length > 0 &&
+           nbt_scalar_size((nbt_type)(uint8_t)**memory) != 0)
+        {
+            node->flags |= NBT_NODE_PACKED;
+            node->payload.tag_packed_list = CODEC(read_packed_list)(memory, length);
+        }
+        else
+            node->payload.tag_list = CODEC(read_list)(memory, length, flags);
+        break;
+    case TAG_COMPOUND:
+        node->payload.tag_compound = CODEC(read_compound)(memory, length, flags);
+        break;
+
+    default:
+        goto parse_error; /* Unknown node or TAG_END. Either way, we shouldn't be parsing this. */
+    }
+
+#undef COPY_INTO_PAYLOAD
+
+    if(errno != NBT_OK) goto parse_error;
+
+    if(is_augmented(node))
+    {
+        AUGMENTED(node)->parent = NULL; /* until our own parent adopts us */
+        _nbt_aug_adopt(node);
+    }
+
+    return node;
+
+parse_error:
+    if(errno == NBT_OK)
+        errno = NBT_ERR;
+
+    nbt_release_node(node);
+    return NULL;
+}
+
+/*
+ * The writer. See the comment above nbt_serialized_size for how the two
+ * passes fit together.
+ */
+
+/* How many bytes an int or a length takes up. */
+static inline size_t CODEC(int_size)(int64_t n, size_t fixed)
+{
+    return VARINTS ? varint_size(zigzag(n)) : fixed;
+}
+
+/* Adds the size of a name or TAG_STRING payload to `size'. */
+static nbt_status CODEC(measure_string)(const char* s, size_t* size)
+{
+    assert(s);
+
+    size_t len = strlen(s);
+
+    if(len > STRING_MAX)
+        return NBT_ERR;
+
+    *size += (VARINTS ? varint_size(len) : sizeof(int16_t)) + len;
+    return NBT_OK;
+}
+
+/* Adds the size of `count' elements of `type' to `size'. */
+static void CODEC(measure_elements)(const void* data, int32_t count, nbt_type type, size_t* size)
+{
+    if(!IS_VARINT(type))
+    {
+        *size += (size_t)count * nbt_scalar_size(type);
+        return;
+    }
+
+    for(int32_t i = 0; i < count; i++)
+        *size += varint_size(zigzag(type == TAG_INT ? ((const int32_t*)data)[i] : ((const int64_t*)data)[i]));
+}
+
+/* Adds the size of an array's length and elements to `size'. */
+static nbt_status CODEC(measure_array)(const void* data, int32_t count, nbt_type type, size_t* size)
+{
+    if(count < 0) return NBT_ERR;
+
+    *size += CODEC(int_size)(count, sizeof(int32_t));
+    CODEC(measure_elements)(data, count, type, size);
+
+    return NBT_OK;
+}
+
+static nbt_status CODEC(measure_node)(const nbt_node* tree, bool dump_type, size_t* size)
+{
+    nbt_status err;
+
+    if(dump_type)
+        *size += 1;
+
+    if(tree->name && (err = CODEC(measure_string)(tree->name, size)) != NBT_OK)
+        return err;
+
+    switch(tree->type)
+    {
+    case TAG_BYTE:
+    case TAG_SHORT:
+    case TAG_FLOAT:
+    case TAG_DOUBLE:
+        *size += nbt_scalar_size(tree->type);
+        return NBT_OK;
+
+    case TAG_INT:
+        *size += CODEC(int_size)(tree->payload.tag_int, sizeof(int32_t));
+        return NBT_OK;
+
+    case TAG_LONG:
+        *size += CODEC(int_size)(tree->payload.tag_long, sizeof(int64_t));
+        return NBT_OK;
+
+    case TAG_BYTE_ARRAY:
+        return CODEC(measure_array)(tree->payload.tag_byte_array.data,
+                                    tree->payload.tag_byte_array.length, TAG_BYTE, size);
+
+    case TAG_INT_ARRAY:
+        return CODEC(measure_array)(tree->payload.tag_int_array.data,
+                                    tree->payload.tag_int_array.length, TAG_INT, size);
+
+    case TAG_LONG_ARRAY:
+        return CODEC(measure_array)(tree->payload.tag_long_array.data,
+                                    tree->payload.tag_long_array.length, TAG_LONG, size);
+
+    case TAG_STRING:
+        return CODEC(measure_string)(tree->payload.tag_string, size);
+
+    case TAG_LIST:
+        if(tree->flags & NBT_NODE_PACKED)
+        {
+            const struct nbt_packed_list* p = &tree->payload.tag_packed_list;
+
+            if(nbt_scalar_size(p->type) == 0) return NBT_ERR;
+
+            *size += 1;
+            return CODEC(measure_array)(p->data, p->length, p->type, size);
+        }
+        else
+        {
+            int32_t len;
+            nbt_type type = list_header(tree->payload.tag_list, &len);
+
+            if(type == TAG_INVALID)
+                return NBT_ERR;
+
+            *size += 1 + CODEC(int_size)(len, sizeof(int32_t));
+
+            /*
+             * The writer goes by the header, so make sure it's right. A list
+             * changed by hand without nbt_list_invalidate may have outgrown
+             * its count, or have something of the wrong type in it.
+             */
+            int32_t n = 0;
+            const struct list_head* pos;
+            list_for_each(pos, &tree->payload.tag_list->entry)
+            {
+                const nbt_node* elem = list_entry(pos, const struct nbt_list, entry)->data;
+
+                if(elem->type != type || n++ == len)
+                    return NBT_ERR;
+
+                if((err = CODEC(measure_node)(elem, false, size)) != NBT_OK)
+                    return err;
+            }
+
+            return n == len ? NBT_OK : NBT_ERR;
+        }
+
+    case TAG_COMPOUND:
+        {
+            const struct list_head* pos;
+            list_for_each(pos, &tree->payload.tag_compound->entry)
+                if((err = CODEC(measure_node)(list_entry(pos, const struct nbt_list, entry)->data, true, size)) != NBT_OK)
+                    return err;
+
+            *size += 1; /* TAG_End */
+            return NBT_OK;
+        }
+
+    default:
+        return NBT_ERR;
+    }
+}
+
+/* Copies `n' bytes to the output, in the encoding's byte order. */
+static inline void CODEC(put_scalar)(struct nbt_writer* w, const void* src, size_t n)
+{
+    make_room(w, n);
+
+    memcpy(w->pos, src, n);
+    CODEC(to_native)(w->pos, n); /* Swapping is its own inverse. */
+    w->pos += n;
+}
+
+/* Writes a TAG_INT payload, or the length of an array or list. */
+static inline void CODEC(put_int32)(struct nbt_writer* w, int32_t n)
+{
+    if(VARINTS)
+        put_varint(w, zigzag(n));
+    else
+        CODEC(put_scalar)(w, &n, sizeof n);
+}
+
+static inline void CODEC(put_int64)(struct nbt_writer* w, int64_t n)
+{
+    if(VARINTS)
+        put_varint(w, zigzag(n));
+    else
+        CODEC(put_scalar)(w, &n, sizeof n);
+}
+
+static void CODEC(write_string)(struct nbt_writer* w, const char* s)
+{
+    size_t len = strlen(s);
+
+    if(VARINTS)
+        put_varint(w, len);
+    else
+    {
+        uint16_t dumped_len = (uint16_t)len;
+        CODEC(put_scalar)(w, &dumped_len, sizeof dumped_len);
+    }
+
+    put_raw(w, s, len);
+}
+
+/*
+ * Writes `length' elements of `type', swapping them where they lie. That's
+ * done as many at a time as fit in the staging area. Varints go one by one.
+ */
+static void CODEC(write_elements)(struct nbt_writer* w, const void* data, int32_t length, nbt_type type)
+{
+    const unsigned char* src = data;
+    size_t size = nbt_scalar_size(type);
+    size_t left = length;
+
+    if(size == 1)
+    {
+        put_raw(w, src, left);
+        return;
+    }
+
+    if(IS_VARINT(type))
+    {
+        for(int32_t i = 0; i < length; i++)
+            put_varint(w, zigzag(type == TAG_INT ? ((const int32_t*)data)[i] : ((const int64_t*)data)[i]));
+
+        return;
+    }
+
+    while(left > 0)
+    {
+        size_t n = (w->end - w->pos) / size;
+
+        if(n == 0)
+        {
+            flush_stage(w);
+            continue;
+        }
+
+        if(n > left) n = left;
+
+        memcpy(w->pos, src, n * size);
+
+        for(size_t i = 0; i < n; i++)
+            CODEC(to_native)(w->pos + i * size, size);
+
+        w->pos += n * size;
+        src    += n * size;
+        left   -= n;
+    }
+}
+
+/* Writes an array's length, then its elements. */
+static void CODEC(write_array)(struct nbt_writer* w, const void* data, int32_t length, nbt_type type)
+{
+    CODEC(put_int32)(w, length);
+    CODEC(write_elements)(w, data, length, type);
+}
+
+/*
+ * Writes out a node which measure_node has already vetted.
+ *
+ * @param dump_type   Should we dump the type, or just skip it? We need to skip
+ *                    when dumping lists, because the list header already says
+ *                    the type.
+ */
+static void CODEC(write_node)(struct nbt_writer* w, const nbt_node* tree, bool dump_type)
+{
+    if(dump_type)
+        put_byte(w, (uint8_t)tree->type);
+
+    if(tree->name)
+        CODEC(write_string)(w, tree->name);
+
+    const struct list_head* pos;
+
+    switch(tree->type)
+    {
+    /* Every member of the payload union starts at its beginning. */
+    case TAG_BYTE:
+    case TAG_SHORT:
+    case TAG_FLOAT:
+    case TAG_DOUBLE:
+        CODEC(put_scalar)(w, &tree->payload, nbt_scalar_size(tree->type));
+        break;
+
+    case TAG_INT:
+        CODEC(put_int32)(w, tree->payload.tag_int);
+        break;
+
+    case TAG_LONG:
+        CODEC(put_int64)(w, tree->payload.tag_long);
+        break;
+
+    case TAG_BYTE_ARRAY:
+        CODEC(write_array)(w, tree->payload.tag_byte_array.data,
+                              tree->payload.tag_byte_array.length, TAG_BYTE);
+        break;
+
+    case TAG_INT_ARRAY:
+        CODEC(write_array)(w, tree->payload.tag_int_array.data,
+                              tree->payload.tag_int_array.length, TAG_INT);
+        break;
+
+    case TAG_LONG_ARRAY:
+        CODEC(write_array)(w, tree->payload.tag_long_array.data,
+                              tree->payload.tag_long_array.length, TAG_LONG);
+        break;
+
+    case TAG_STRING:
+        CODEC(write_string)(w, tree->payload.tag_string);
+        break;
+
+    case TAG_LIST:
+        if(tree->flags & NBT_NODE_PACKED)
+        {
+            const struct nbt_packed_list* p = &tree->payload.tag_packed_list;
+
+            put_byte(w, (uint8_t)p->type);
+            CODEC(write_array)(w, p->data, p->length, p->type);
+        }
+        else
+        {
+            int32_t len;
+            nbt_type type = list_header(tree->payload.tag_list, &len);
+
+            put_byte(w, (uint8_t)type);
+            CODEC(put_int32)(w, len);
+
+            list_for_each(pos, &tree->payload.tag_list->entry)
+            {
+                const nbt_node* elem = list_entry(pos, const struct nbt_list, entry)->data;
+
+                assert(elem->type == type);
+                CODEC(write_node)(w, elem, false);
+            }
+        }
+        break;
+
+    case TAG_COMPOUND:
+        list_for_each(pos, &tree->payload.tag_compound->entry)
+            CODEC(write_node)(w, list_entry(pos, const struct nbt_list, entry)->data, true);
+
+        put_byte(w, 0); /* TAG_End */
+        break;
+
+    default:
+        assert(!"measure_node should have caught this");
+        break;
+    }
+}
+
+#undef VARINTS
+#undef IS_VARINT
+#undef SCANNER
+#undef STRING_MAX
@@ -0,0 +1,1001 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#include "nbt.h"
+#include "nbt_internal.h"
+
+#include "buffer.h"
+#include "list.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A diff is an NBT tree of its own, which makes the binary encoding free:
+ *
+ *   { ops: [ { op: <nbt_diff_op>b, path: "...", ... }, ... ] }
+ *
+ * Every op has a path, which is a compiled path made of names and indices
+ * only, with "" for the root. The rest depends on the op:
+ *
+ *   NBT_DIFF_ADD      name, value    Appends `value' to the compound at path,
+ *                                    called `name'.
+ *   NBT_DIFF_REMOVE   name           Removes the compound's child `name'.
+ *   NBT_DIFF_REPLACE  value          Replaces the node at path, keeping its
+ *                                    name.
+ *   NBT_DIFF_SPLICE   start, remove, Replaces `remove' elements of the list or
+ *                     values         array at path, from `start' on, with
+ *                                    `values'. That's a list for lists, and an
+ *                                    array of the same type for arrays.
+ *
+ * Ops are applied in order, and every path is resolved against the tree as it
+ * is by then.
+ */
+
+#define CHECKED_ALLOC(var, allocation, on_error) do { \
+    if((var = (allocation)) == NULL)                  \
+    {                                                 \
+        errno = NBT_EMEM;                             \
+        on_error;                                     \
+    }                                                 \
+} while(0)
+
+static char* copy_string(const char* s, size_t len)
+{
+    char* ret = malloc(len + 1);
+    if(ret == NULL) return NULL;
+
+    memcpy(ret, s, len);
+    ret[len] = '\0';
+
+    return ret;
+}
+
+static nbt_node* new_node(nbt_type type)
+{
+    nbt_node* ret;
+
+    CHECKED_ALLOC(ret, nbt_alloc_node(), return NULL);
+
+    ret->type  = type;
+    ret->flags = 0;
+    ret->refs  = 0;
+    ret->name  = NULL;
+    ret->index = NULL;
+
+    memset(&ret->payload, 0, sizeof ret->payload);
+
+    return ret;
+}
+
+/* An empty list of children. Lists of `type' are typed; compounds pass TAG_INVALID. */
+static struct nbt_list* new_list(nbt_type type)
+{
+    struct nbt_list* ret;
+
+    CHECKED_ALLOC(ret, nbt_alloc_list(), return NULL);
+
+    INIT_LIST_HEAD(&ret->entry);
+    ret->data = NULL;
+
+    if(type != TAG_INVALID)
+    {
+        if((ret->data = new_node(type)) == NULL)
+        {
+            nbt_release_list(ret);
+            return NULL;
+        }
+
+        list_set_count(ret, 0);
+    }
+
+    return ret;
+}
+
+/* Gives `node' its own copy of `name' instead of whatever it had. */
+static bool rename_node(nbt_node* node, const char* name)
+{
+    char* copy = NULL;
+
+    if(name && (copy = copy_string(name, strlen(name))) == NULL)
+        return false;
+
+    if(!(node->flags & NBT_NODE_INTERNED))
+        free(node->name);
+
+    node->flags &= ~NBT_NODE_INTERNED;
+    node->name   = copy;
+
+    return true;
+}
+
+/* Links `child' onto the end of the list node `list'. */
+static bool list_push(nbt_node* list, nbt_node* child)
+{
+    struct nbt_list* l = list->payload.tag_list;
+    struct nbt_list* entry;
+
+    CHECKED_ALLOC(entry, nbt_alloc_list(), return false);
+
+    entry->data = child;
+    list_add_tail(&entry->entry, &l->entry);
+
+    if(list_count(l) >= 0)
+        list_set_count(l, list_count(l) + 1);
+
+    return true;
+}
+
+/* The type of a list's elements, packed or not. */
+static nbt_type element_type(const nbt_node* list)
+{
+    return list->flags & NBT_NODE_PACKED ? list->payload.tag_packed_list.type
+                                         : list->payload.tag_list->data->type;
+}
+
+static bool is_array(nbt_type type)
+{
+    return type == TAG_BYTE_ARRAY || type == TAG_INT_ARRAY || type == TAG_LONG_ARRAY;
+}
+
+/* Byte, int and long arrays all have the same layout. */
+struct array {
+    char* data;
+    int32_t length;
+    size_t size;    /* Of an element. */
+};
+
+static struct array array_of(const nbt_node* node)
+{
+    switch(node->type)
+    {
+    case TAG_BYTE_ARRAY:
+        return (struct array) { (char*)node->payload.tag_byte_array.data,
+                                node->payload.tag_byte_array.length, 1 };
+    case TAG_INT_ARRAY:
+        return (struct array) { (char*)node->payload.tag_int_array.data,
+                                node->payload.tag_int_array.length, 4 };
+    default:
+        assert(node->type == TAG_LONG_ARRAY);
+        return (struct array) { (char*)node->payload.tag_long_array.data,
+                                node->payload.tag_long_array.length, 8 };
+    }
+}
+
+static void set_array(nbt_node* node, char* data, int32_t length)
+{
+    switch(node->type)
+    {
+    case TAG_BYTE_ARRAY:
+        node->payload.tag_byte_array.data   = (unsigned char*)data;
+        node->payload.tag_byte_array.length = length;
+        break;
+    case TAG_INT_ARRAY:
+        node->payload.tag_int_array.data   = (int32_t*)data;
+        node->payload.tag_int_array.length = length;
+        break;
+    default:
+        node->payload.tag_long_array.data   = (int64_t*)data;
+        node->payload.tag_long_array.length = length;
+        break;
+    }
+}
+
+                              /***** Diffing *****/
+
+struct differ {
+    nbt_node* ops;
+    struct buffer path; /* Where we are. Not null-terminated. */
+    nbt_status err;
+};
+
+/* Appends a step for `name' to the path, quoting it if it has to be. */
+static bool push_name(struct buffer* path, const char* name)
+{
+    bool quote = *name == '\0' || *name == '*' || strpbrk(name, ".[]\"@") != NULL;
+
+    if(path->len > 0 && buffer_append(path, ".", 1))
+        return false;
+
+    if(!quote)
+        return buffer_append(path, name, strlen(name)) == 0;
+
+    if(buffer_append(path, "\"", 1))
+        return false;
+
+    for(const char* c = name; *c; c++)
+        if(((*c == '"' || *c == '\\') && buffer_append(path, "\\", 1)) || buffer_append(path, c, 1))
+            return false;
+
+    return buffer_append(path, "\"", 1) == 0;
+}
+
+static bool push_index(struct buffer* path, int32_t i)
+{
+    char step[NBT_NUMBER_ROOM + 2] = "[";
+    char* end = _nbt_format_int(step + 1, i);
+
+    *end++ = ']';
+
+    return buffer_append(path, step, end - step) == 0;
+}
+
+/* Adds a new, empty field to `op', or returns NULL. */
+static nbt_node* add_field(struct differ* d, nbt_node* op, nbt_type type, const char* name)
+{
+    nbt_node* field = new_node(type);
+
+    if(field && rename_node(field, name) && nbt_compound_append(op, field) == NBT_OK)
+        return field;
+
+    nbt_free(field);
+    d->err = NBT_EMEM;
+    return NULL;
+}
+
+/* Adds a copy of `value' to `op', called `name'. */
+static bool add_copy(struct differ* d, nbt_node* op, const char* name, const nbt_node* value)
+{
+    nbt_node* copy = _nbt_clone(value, false);
+
+    if(copy && rename_node(copy, name) && nbt_compound_append(op, copy) == NBT_OK)
+        return true;
+
+    nbt_free(copy);
+    d->err = NBT_EMEM;
+    return false;
+}
+
+/* Starts a new op at the current path. Returns NULL if we ran out of memory. */
+static nbt_node* begin_op(struct differ* d, nbt_diff_op kind)
+{
+    nbt_node* op = new_node(TAG_COMPOUND);
+    nbt_node* field;
+
+    if(op == NULL || (op->payload.tag_compound = new_list(TAG_INVALID)) == NULL || !list_push(d->ops, op))
+    {
+        nbt_free(op);
+        d->err = NBT_EMEM;
+        return NULL;
+    }
+
+    if((field = add_field(d, op, TAG_BYTE, "op")) == NULL)
+        return NULL;
+
+    field->payload.tag_byte = (int8_t)kind;
+
+    if((field = add_field(d, op, TAG_STRING, "path")) == NULL)
+        return NULL;
+
+    if((field->payload.tag_string = copy_string((char*)d->path.data, d->path.len)) == NULL)
+        return d->err = NBT_EMEM, NULL;
+
+    return op;
+}
+
+static void replace(struct differ* d, const nbt_node* b)
+{
+    nbt_node* op = begin_op(d, NBT_DIFF_REPLACE);
+
+    if(op) add_copy(d, op, "value", b);
+}
+
+/* Starts a splice of `removed' elements from `start', and returns the op. */
+static nbt_node* begin_splice(struct differ* d, int32_t start, int32_t removed)
+{
+    nbt_node* op = begin_op(d, NBT_DIFF_SPLICE);
+    nbt_node* field;
+
+    if(op == NULL || (field = add_field(d, op, TAG_INT, "start")) == NULL)
+        return NULL;
+
+    field->payload.tag_int = start;
+
+    if((field = add_field(d, op, TAG_INT, "remove")) == NULL)
+        return NULL;
+
+    field->payload.tag_int = removed;
+
+    return op;
+}
+
+/* Do two scalars, strings or arrays hold the same thing, bit for bit? */
+static bool leaves_equal(const nbt_node* a, const nbt_node* b)
+{
+    if(a->type != b->type)
+        return false;
+
+    if(a->type == TAG_STRING)
+        return strcmp(a->payload.tag_string, b->payload.tag_string) == 0;
+
+    if(is_array(a->type))
+    {
+        struct array x = array_of(a), y = array_of(b);
+
+        return x.length == y.length && (x.length == 0 || memcmp(x.data, y.data, x.length * x.size) == 0);
+    }
+
+    /* Every scalar lives at the start of the payload union. */
+    return memcmp(&a->payload, &b->payload, nbt_scalar_size(a->type)) == 0;
+}
+
+/*
+ * Do two subtrees hold the same thing? Lists and compounds are compared by
+ * hash, which costs nothing once an augmented tree has them cached.
+ */
+static bool same(const nbt_node* a, const nbt_node* b)
+{
+    if(a->type != TAG_LIST && a->type != TAG_COMPOUND)
+        return leaves_equal(a, b);
+
+    return a->type == b->type && nbt_hash(a) == nbt_hash(b);
+}
+
+static void diff_node(struct differ* d, const nbt_node* a, const nbt_node* b);
+
+static void diff_compound(struct differ* d, const nbt_node* a, const nbt_node* b)
+{
+    const struct list_head* pos;
+    size_t mark = d->path.len;
+
+    /* Children are matched by name through the index, so this is linear. */
+    list_for_each(pos, &a->payload.tag_compound->entry)
+    {
+        const nbt_node* x = list_entry(pos, const struct nbt_list, entry)->data;
+        const struct nbt_list* y = _nbt_compound_entry((nbt_node*)b, x->name);
+
+        if(y == NULL)
+        {
+            nbt_node* op = begin_op(d, NBT_DIFF_REMOVE);
+            nbt_node* name;
+
+            if(op && (name = add_field(d, op, TAG_STRING, "name")) &&
+               (name->payload.tag_string = copy_string(x->name, strlen(x->name))) == NULL)
+                d->err = NBT_EMEM;
+        }
+        else if(push_name(&d->path, x->name))
+        {
+            diff_node(d, x, y->data);
+            d->path.len = mark;
+        }
+        else d->err = NBT_EMEM;
+
+        if(d->err) return;
+    }
+
+    list_for_each(pos, &b->payload.tag_compound->entry)
+    {
+        const nbt_node* y = list_entry(pos, const struct nbt_list, entry)->data;
+
+        if(_nbt_compound_entry((nbt_node*)a, y->name) != NULL)
+            continue;
+
+        nbt_node* op = begin_op(d, NBT_DIFF_ADD);
+        nbt_node* name;
+
+        if(op && (name = add_field(d, op, TAG_STRING, "name")))
+        {
+            if((name->payload.tag_string = copy_string(y->name, strlen(y->name))) == NULL)
+                d->err = NBT_EMEM;
+            else
+                add_copy(d, op, "value", y);
+        }
+
+        if(d->err) return;
+    }
+}
+
+/* The elements of a list, packed or not, by index. */
+struct elements {
+    const nbt_node** nodes;
+    struct nbt_span span;
+    bool packed;
+    int32_t length;
+};
+
+static bool load_elements(struct elements* e, const nbt_node* list)
+{
+    e->nodes  = NULL;
+    e->packed = nbt_list_span(list, &e->span);
+
+    if(e->packed)
+        return e->length = e->span.length, true;
+
+    const struct list_head* pos;
+    size_t n = 0;
+
+    list_for_each(pos, &list->payload.tag_list->entry)
+        n++;
+
+    if(n > 2147483647 /* INT_MAX */ || (n && (e->nodes = malloc(n * sizeof *e->nodes)) == NULL))
+        return false;
+
+    e->length = (int32_t)n;
+    n = 0;
+
+    list_for_each(pos, &list->payload.tag_list->entry)
+        e->nodes[n++] = list_entry(pos, const struct nbt_list, entry)->data;
+
+    return true;
+}
+
+/* The `i'th element. Packed ones are filled into `tmp'. */
+static const nbt_node* element(const struct elements* e, int32_t i, nbt_node* tmp)
+{
+    if(!e->packed)
+        return e->nodes[i];
+
+    nbt_span_get(&e->span, i, tmp);
+    return tmp;
+}
+
+static bool same_element(const struct elements* a, int32_t i, const struct elements* b, int32_t j)
+{
+    nbt_node x, y;
+    return same(element(a, i, &x), element(b, j, &y));
+}
+
+/* Splices b's elements [from, to) in over `removed' of a's, from `start'. */
+static void splice_list(struct differ* d, int32_t start, int32_t removed,
+                        nbt_type type, const struct elements* b, int32_t from, int32_t to)
+{
+    nbt_node* op = begin_splice(d, start, removed);
+    nbt_node* values;
+
+    if(op == NULL || (values = add_field(d, op, TAG_LIST, "values")) == NULL)
+        return;
+
+    if((values->payload.tag_list = new_list(type)) == NULL)
+    {
+        d->err = NBT_EMEM;
+        return;
+    }
+
+    for(int32_t i = from; i < to; i++)
+    {
+        nbt_node tmp;
+        nbt_node* copy = _nbt_clone(element(b, i, &tmp), false);
+
+        if(copy == NULL || !list_push(values, copy))
+        {
+            nbt_free(copy);
+            d->err = NBT_EMEM;
+            return;
+        }
+    }
+}
+
+static void diff_list(struct differ* d, const nbt_node* a, const nbt_node* b)
+{
+    nbt_type type = element_type(b);
+    struct elements x, y;
+
+    if(element_type(a) != type)
+    {
+        replace(d, b);
+        return;
+    }
+
+    if(!load_elements(&x, a))
+    {
+        d->err = NBT_EMEM;
+        return;
+    }
+
+    if(!load_elements(&y, b))
+    {
+        free(x.nodes);
+        d->err = NBT_EMEM;
+        return;
+    }
+
+    /* Insertions and removals only touch the middle. Trim off the rest. */
+    int32_t head = 0, tail = 0;
+
+    while(head < x.length && head < y.length && same_element(&x, head, &y, head))
+        head++;
+
+    while(tail < x.length - head && tail < y.length - head &&
+          same_element(&x, x.length - 1 - tail, &y, y.length - 1 - tail))
+        tail++;
+
+    int32_t from = x.length - head - tail, to = y.length - head - tail;
+
+    /*
+     * What's left of the middle lines up element for element, and the rest of
+     * it is spliced. That comes last, so the indices before it still hold.
+     * Scalars aren't worth the ops, and elements of packed lists can't be
+     * reached by a path anyway, so those are spliced outright.
+     */
+    int32_t paired = from < to ? from : to;
+    size_t mark = d->path.len;
+
+    if(x.packed || nbt_scalar_size(type) != 0)
+        paired = 0;
+
+    for(int32_t i = head; i < head + paired && d->err == NBT_OK; i++)
+    {
+        if(!push_index(&d->path, i))
+        {
+            d->err = NBT_EMEM;
+            break;
+        }
+
+        nbt_node tmp;
+        diff_node(d, x.nodes[i], element(&y, i, &tmp));
+        d->path.len = mark;
+    }
+
+    if(d->err == NBT_OK && (from != paired || to != paired))
+        splice_list(d, head + paired, from - paired, type, &y, head + paired, head + to);
+
+    free(x.nodes);
+    free(y.nodes);
+}
+
+static void diff_array(struct differ* d, const nbt_node* a, const nbt_node* b)
+{
+    struct array x = array_of(a), y = array_of(b);
+    int32_t head = 0, tail = 0;
+
+    while(head < x.length && head < y.length &&
+          memcmp(x.data + head * x.size, y.data + head * y.size, x.size) == 0)
+        head++;
+
+    while(tail < x.length - head && tail < y.length - head &&
+          memcmp(x.data + (x.length - 1 - tail) * x.size, y.data + (y.length - 1 - tail) * y.size, x.size) == 0)
+        tail++;
+
+    if(head == x.length && head == y.length)
+        return;
+
+    int32_t count = y.length - head - tail;
+    nbt_node* op = begin_splice(d, head, x.length - head - tail);
+    nbt_node* values;
+    char* data = NULL;
+
+    if(op == NULL || (values = add_field(d, op, b->type, "values")) == NULL)
+        return;
+
+    if(count > 0)
+    {
+        if((data = malloc(count * y.size)) == NULL)
+        {
+            d->err = NBT_EMEM;
+            return;
+        }
+
+        memcpy(data, y.data + head * y.size, count * y.size);
+    }
+
+    set_array(values, data, count);
+}
+
+static void diff_node(struct differ* d, const nbt_node* a, const nbt_node* b)
+{
+    /* With the hashes cached, whole unchanged subtrees are skipped in O(1). */
+    if(is_augmented(a) && is_augmented(b) && same(a, b))
+        return;
+
+    if(a->type != b->type)
+    {
+        replace(d, b);
+        return;
+    }
+
+    switch(a->type)
+    {
+    case TAG_COMPOUND:
+        diff_compound(d, a, b);
+        break;
+
+    case TAG_LIST:
+        diff_list(d, a, b);
+        break;
+
+    case TAG_BYTE_ARRAY:
+    case TAG_INT_ARRAY:
+    case TAG_LONG_ARRAY:
+        diff_array(d, a, b);
+        break;
+
+    default:
+        if(!leaves_equal(a, b))
+            replace(d, b);
+        break;
+    }
+}
+
+nbt_node* nbt_diff(const nbt_node* a, const nbt_node* b)
+{
+    assert(a && b);
+
+    struct differ d = { NULL, BUFFER_INIT, NBT_OK };
+    nbt_node* ret = new_node(TAG_COMPOUND);
+
+    /* Nameless roots are dumped without a name at all, which nbt_parse won't take. */
+    if(ret == NULL || !rename_node(ret, "") || (ret->payload.tag_compound = new_list(TAG_INVALID)) == NULL)
+        goto diff_error;
+
+    d.ops = add_field(&d, ret, TAG_LIST, "ops");
+
+    if(d.ops == NULL || (d.ops->payload.tag_list = new_list(TAG_COMPOUND)) == NULL)
+        goto diff_error;
+
+    diff_node(&d, a, b);
+    buffer_free(&d.path);
+
+    if(d.err != NBT_OK)
+        goto diff_error;
+
+    return ret;
+
+diff_error:
+    buffer_free(&d.path);
+    nbt_free(ret);
+    errno = NBT_EMEM;
+    return NULL;
+}
+
+                             /***** Patching *****/
+
+/* Where a path led: the node's slot, and whoever holds it (NULL for the root). */
+struct target {
+    nbt_node** slot;
+    nbt_node* parent;
+};
+
+/*
+ * Follows `path' from `*tree', unsharing every node on the way (like
+ * nbt_writable), so whatever it finds can be changed. `buf' needs room for
+ * the whole path.
+ */
+static nbt_status resolve(nbt_node** tree, const char* path, char* buf, struct target* t)
+{
+    t->slot   = tree;
+    t->parent = NULL;
+
+    for(const char* p = path; ; )
+    {
+        nbt_node* node = nbt_unshare(*t->slot);
+        if(node == NULL) return NBT_EMEM;
+
+        *t->slot = node;
+
+        if(*p == '\0')
+            return NBT_OK;
+
+        struct nbt_list* entry = NULL;
+
+        if(*p == '[' && p[1] != '"')
+        {
+            char* end;
+            long i = strtol(p + 1, &end, 10);
+
+            if(end == p + 1 || *end != ']' || i < 0 || node->type != TAG_LIST || !has_children(node))
+                return NBT_ERR;
+
+            struct list_head* pos;
+            list_for_each(pos, &node->payload.tag_list->entry)
+                if(i-- == 0)
+                {
+                    entry = list_entry(pos, struct nbt_list, entry);
+                    break;
+                }
+
+            p = end + 1;
+        }
+        else
+        {
+            bool bracket = *p == '[';
+
+            if(*p == '.' || bracket)
+                p++;
+            else if(p != path)
+                return NBT_ERR;
+
+            long len = _nbt_read_path_name(&p, buf);
+
+            if(len < 0 || (bracket && *p++ != ']') || node->type != TAG_COMPOUND)
+                return NBT_ERR;
+
+            buf[len] = '\0';
+            entry = _nbt_compound_entry(node, buf);
+        }
+
+        if(entry == NULL)
+            return NBT_ERR;
+
+        t->slot   = &entry->data;
+        t->parent = node;
+    }
+}
+
+static const nbt_node* field(const nbt_node* op, const char* name, nbt_type type)
+{
+    const nbt_node* ret = nbt_compound_get((nbt_node*)op, name);
+    return ret && ret->type == type ? ret : NULL;
+}
+
+/* A copy of an op's value to put into `like''s tree. */
+static nbt_node* copy_value(const nbt_node* value, const nbt_node* like, const char* name)
+{
+    nbt_node* ret = _nbt_clone(value, is_augmented(like));
+
+    if(ret && !rename_node(ret, name))
+    {
+        nbt_free(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+static nbt_status apply_replace(const struct target* t, const nbt_node* value)
+{
+    nbt_node* old = *t->slot;
+
+    if(t->parent && t->parent->type == TAG_LIST && element_type(t->parent) != value->type)
+        return NBT_ERR;
+
+    nbt_node* new = copy_value(value, old, old->name);
+    if(new == NULL) return NBT_EMEM;
+
+    *t->slot = new;
+
+    if(t->parent && is_augmented(t->parent))
+    {
+        _nbt_aug_unlink(t->parent, old);
+        _nbt_aug_link(t->parent, new);
+    }
+
+    nbt_free(old);
+    return NBT_OK;
+}
+
+static nbt_status splice_array(nbt_node* array, int32_t start, int32_t removed, const nbt_node* values)
+{
+    struct array a = array_of(array), v = array_of(values);
+
+    if(values->type != array->type)
+        return NBT_ERR;
+
+    int32_t kept = a.length - start - removed;
+    int64_t length = (int64_t)a.length - removed + v.length;
+
+    if(length > 2147483647 /* INT_MAX */)
+        return NBT_ERR;
+
+    char* data = a.data;
+
+    if(length > a.length && (data = realloc(a.data, length * a.size)) == NULL)
+        return NBT_EMEM;
+
+    memmove(data + (start + v.length) * a.size, data + (start + removed) * a.size, kept * a.size);
+
+    if(v.length > 0)
+        memcpy(data + start * a.size, v.data, v.length * a.size);
+
+    if(length == 0)
+    {
+        free(data);
+        data = NULL;
+    }
+
+    set_array(array, data, (int32_t)length);
+
+    if(is_augmented(array))
+        _nbt_aug_touch(array);
+
+    return NBT_OK;
+}
+
+static nbt_status splice_list_into(nbt_node* list, int32_t start, int32_t removed, const nbt_node* values)
+{
+    struct elements v;
+
+    if(values->type != TAG_LIST)
+        return NBT_ERR;
+
+    /* A diff which was loaded with NBT_PARSE_PACK has its values packed. */
+    if(!load_elements(&v, values))
+        return NBT_EMEM;
+
+    bool packed = list->flags & NBT_NODE_PACKED;
+    nbt_status err = nbt_list_unpack(list);
+
+    if(err != NBT_OK)
+        goto splice_exit;
+
+    struct nbt_list* l = list->payload.tag_list;
+    struct list_head* at = &l->entry;
+    nbt_type type = element_type(values);
+    int32_t length = 0;
+
+    struct list_head* pos;
+    list_for_each(pos, &l->entry)
+        if(length++ == start)
+            at = pos;
+
+    if(length - removed != 0 && type != l->data->type)
+    {
+        err = NBT_ERR;
+        goto splice_exit;
+    }
+
+    for(int32_t i = 0; i < removed; i++)
+    {
+        struct nbt_list* entry = list_entry(at, struct nbt_list, entry);
+
+        at = at->flink;
+        list_del(&entry->entry);
+
+        if(is_augmented(list))
+            _nbt_aug_unlink(list, entry->data);
+
+        nbt_free(entry->data);
+        nbt_release_list(entry);
+    }
+
+    l->data->type = type;
+
+    for(int32_t i = 0; i < v.length; i++)
+    {
+        nbt_node tmp;
+        const nbt_node* value = element(&v, i, &tmp);
+        struct nbt_list* entry;
+
+        if(value->type != type)
+        {
+            err = NBT_ERR;
+            goto splice_exit;
+        }
+
+        err = NBT_EMEM;
+        CHECKED_ALLOC(entry, nbt_alloc_list(), goto splice_exit);
+
+        if((entry->data = copy_value(value, list, NULL)) == NULL)
+        {
+            nbt_release_list(entry);
+            goto splice_exit;
+        }
+
+        /* Adding to the tail of an entry puts it just before that entry. */
+        list_add_tail(&entry->entry, at);
+        length++;
+
+        if(is_augmented(list))
+            _nbt_aug_link(list, entry->data);
+    }
+
+    list_set_count(l, length - removed);
+
+    err = packed ? nbt_list_pack(list) : NBT_OK;
+
+splice_exit:
+    free(v.nodes);
+    return err;
+}
+
+static nbt_status apply_splice(const struct target* t, const nbt_node* op)
+{
+    const nbt_node* start   = field(op, "start", TAG_INT);
+    const nbt_node* removed = field(op, "remove", TAG_INT);
+    const nbt_node* values  = nbt_compound_get((nbt_node*)op, "values");
+    nbt_node* node = *t->slot;
+    int32_t length;
+
+    if(start == NULL || removed == NULL || values == NULL)
+        return NBT_ERR;
+
+    if(is_array(node->type))
+        length = array_of(node).length;
+    else if(node->type == TAG_LIST)
+        length = node->flags & NBT_NODE_PACKED ? node->payload.tag_packed_list.length
+                                               : nbt_list_length(node);
+    else
+        return NBT_ERR;
+
+    int32_t s = start->payload.tag_int, r = removed->payload.tag_int;
+
+    if(s < 0 || r < 0 || s > length || r > length - s)
+        return NBT_ERR;
+
+    return node->type == TAG_LIST ? splice_list_into(node, s, r, values)
+                                  : splice_array(node, s, r, values);
+}
+
+static nbt_status apply_op(nbt_node** tree, const nbt_node* op, char* buf)
+{
+    const nbt_node* kind  = field(op, "op", TAG_BYTE);
+    const nbt_node* path  = field(op, "path", TAG_STRING);
+    const nbt_node* name  = field(op, "name", TAG_STRING);
+    const nbt_node* value = nbt_compound_get((nbt_node*)op, "value");
+    struct target t;
+    nbt_status err;
+
+    if(kind == NULL || path == NULL)
+        return NBT_ERR;
+
+    if((err = resolve(tree, path->payload.tag_string, buf, &t)) != NBT_OK)
+        return err;
+
+    nbt_node* node = *t.slot;
+
+    switch(kind->payload.tag_byte)
+    {
+    case NBT_DIFF_ADD:
+    {
+        if(name == NULL || value == NULL || node->type != TAG_COMPOUND)
+            return NBT_ERR;
+
+        nbt_node* child = copy_value(value, node, name->payload.tag_string);
+        if(child == NULL) return NBT_EMEM;
+
+        if((err = nbt_compound_append(node, child)) != NBT_OK)
+            nbt_free(child);
+
+        return err;
+    }
+
+    case NBT_DIFF_REMOVE:
+    {
+        if(name == NULL || node->type != TAG_COMPOUND)
+            return NBT_ERR;
+
+        nbt_node* child = nbt_compound_take(node, name->payload.tag_string);
+        if(child == NULL) return NBT_ERR;
+
+        nbt_free(child);
+        return NBT_OK;
+    }
+
+    case NBT_DIFF_REPLACE:
+        return value ? apply_replace(&t, value) : NBT_ERR;
+
+    case NBT_DIFF_SPLICE:
+        return apply_splice(&t, op);
+
+    default:
+        return NBT_ERR;
+    }
+}
+
+nbt_status nbt_diff_apply(nbt_node** tree, const nbt_node* diff)
+{
+    assert(tree && *tree && diff);
+
+    const nbt_node* ops = field(diff, "ops", TAG_LIST);
+
+    if(ops == NULL || !has_children(ops))
+        return NBT_ERR;
+
+    const struct list_head* pos;
+    list_for_each(pos, &ops->payload.tag_list->entry)
+    {
+        const nbt_node* op   = list_entry(pos, const struct nbt_list, entry)->data;
+        const nbt_node* path = op->type == TAG_COMPOUND ? field(op, "path", TAG_STRING) : NULL;
+
+        if(path == NULL)
+            return NBT_ERR;
+
+        char* buf = malloc(strlen(path->payload.tag_string) + 1);
+        if(buf == NULL) return NBT_EMEM;
+
+        nbt_status err = apply_op(tree, op, buf);
+        free(buf);
+
+        if(err != NBT_OK)
+            return err;
+    }
+
+    return NBT_OK;
+}
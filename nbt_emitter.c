@@ -0,0 +1,354 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#include "nbt.h"
+#include "nbt_internal.h"
+
+#include <assert.h>
+#include <string.h>
+
+/*
+ * The emitter. It's the event parser run backwards: it keeps the lists and
+ * compounds it's inside of on a stack, which says whether the next tag needs
+ * its type and name written, and lets every call be checked against what's
+ * been written so far. Output goes through the same staging area as the
+ * dumpers, which lives in the emitter between calls.
+ */
+
+static inline struct nbt_writer writer(struct nbt_emitter* e)
+{
+    struct nbt_writer w = { e->stage, e->pos, e->stage + sizeof e->stage, e->sink, e->err };
+    return w;
+}
+
+static inline nbt_status save(struct nbt_emitter* e, const struct nbt_writer* w)
+{
+    e->pos = w->pos;
+    e->err = w->err;
+
+    return e->err;
+}
+
+/* Big-endian stores. These compile down to a byte swap and a store. */
+static inline void store16(unsigned char* p, uint16_t n)
+{
+    p[0] = (unsigned char)(n >> 8);
+    p[1] = (unsigned char)n;
+}
+
+static inline void store32(unsigned char* p, uint32_t n)
+{
+    p[0] = (unsigned char)(n >> 24);
+    p[1] = (unsigned char)(n >> 16);
+    p[2] = (unsigned char)(n >> 8);
+    p[3] = (unsigned char)n;
+}
+
+static inline void store64(unsigned char* p, uint64_t n)
+{
+    store32(p, (uint32_t)(n >> 32));
+    store32(p + 4, (uint32_t)n);
+}
+
+void nbt_emitter_init(struct nbt_emitter* e, struct nbt_sink* sink)
+{
+    assert(e);
+    assert(sink);
+
+    e->sink  = sink;
+    e->pos   = e->stage;
+    e->err   = NBT_OK;
+    e->depth = 0;
+    e->done  = false;
+}
+
+/* Fails the emitter for good. Nothing more will be written. */
+static nbt_status fail(struct nbt_emitter* e)
+{
+    if(e->err == NBT_OK)
+        e->err = NBT_ERR;
+
+    return e->err;
+}
+
+/*
+ * Checks that a tag of `type' can go next, and writes its type and name if
+ * it needs them. List elements have neither, and must be of the list's type.
+ */
+static nbt_status begin_tag(struct nbt_emitter* e, struct nbt_writer* w, nbt_type type, const char* name)
+{
+    if(e->err != NBT_OK || e->done)
+        return fail(e);
+
+    if(e->depth > 0 && e->stack[e->depth - 1].type == TAG_LIST)
+    {
+        if(e->stack[e->depth - 1].left == 0 || e->stack[e->depth - 1].list_type != type || name != NULL)
+            return fail(e);
+
+        e->stack[e->depth - 1].left--;
+        return NBT_OK;
+    }
+
+    if(name == NULL)
+        return fail(e);
+
+    size_t len = strlen(name);
+
+    if(len > 32767 /* SHORT_MAX */)
+        return fail(e);
+
+    make_room(w, 3);
+
+    w->pos[0] = (unsigned char)type;
+    store16(w->pos + 1, (uint16_t)len);
+    w->pos += 3;
+
+    put_raw(w, name, len);
+    return NBT_OK;
+}
+
+/* Notes that a tag's been written. If it was the root, that's everything. */
+static nbt_status end_tag(struct nbt_emitter* e, struct nbt_writer* w)
+{
+    if(e->depth == 0)
+        e->done = true;
+
+    return save(e, w);
+}
+
+static nbt_status push(struct nbt_emitter* e, nbt_type container, nbt_type elems, int32_t left)
+{
+    if(e->depth == NBT_EMITTER_MAX_DEPTH)
+        return fail(e);
+
+    e->stack[e->depth].type      = (uint8_t)container;
+    e->stack[e->depth].list_type = (uint8_t)elems;
+    e->stack[e->depth].left      = left;
+    e->depth++;
+
+    return NBT_OK;
+}
+
+nbt_status nbt_emit_begin_compound(struct nbt_emitter* e, const char* name)
+{
+    struct nbt_writer w = writer(e);
+
+    if(begin_tag(e, &w, TAG_COMPOUND, name) != NBT_OK || push(e, TAG_COMPOUND, TAG_INVALID, -1) != NBT_OK)
+        return e->err;
+
+    return save(e, &w);
+}
+
+nbt_status nbt_emit_begin_list(struct nbt_emitter* e, const char* name, nbt_type type, int32_t count)
+{
+    assert(e);
+
+    /* An empty list can say it holds anything, but nothing can hold TAG_End. */
+    if(count < 0 || type > TAG_LONG_ARRAY || (count > 0 && type == TAG_INVALID))
+        return fail(e);
+
+    struct nbt_writer w = writer(e);
+
+    if(begin_tag(e, &w, TAG_LIST, name) != NBT_OK || push(e, TAG_LIST, type, count) != NBT_OK)
+        return e->err;
+
+    make_room(&w, 5);
+
+    w.pos[0] = (unsigned char)type;
+    store32(w.pos + 1, (uint32_t)count);
+    w.pos += 5;
+
+    return save(e, &w);
+}
+
+nbt_status nbt_emit_end(struct nbt_emitter* e)
+{
+    assert(e);
+
+    if(e->err != NBT_OK || e->depth == 0)
+        return fail(e);
+
+    struct nbt_writer w = writer(e);
+
+    e->depth--;
+
+    if(e->stack[e->depth].type == TAG_COMPOUND)
+        put_byte(&w, 0); /* TAG_End */
+    else if(e->stack[e->depth].left != 0)
+        return fail(e);
+
+    return end_tag(e, &w);
+}
+
+/* Writes a scalar of `size' bytes, already in `bits'. */
+static nbt_status emit_scalar(struct nbt_emitter* e, const char* name, nbt_type type, uint64_t bits, size_t size)
+{
+    assert(e);
+
+    struct nbt_writer w = writer(e);
+
+    if(begin_tag(e, &w, type, name) != NBT_OK)
+        return e->err;
+
+    make_room(&w, size);
+
+    switch(size)
+    {
+    case 1:  w.pos[0] = (unsigned char)bits;      break;
+    case 2:  store16(w.pos, (uint16_t)bits);      break;
+    case 4:  store32(w.pos, (uint32_t)bits);      break;
+    default: store64(w.pos, bits);                break;
+    }
+
+    w.pos += size;
+    return end_tag(e, &w);
+}
+
+nbt_status nbt_emit_byte(struct nbt_emitter* e, const char* name, int8_t v)
+{
+    return emit_scalar(e, name, TAG_BYTE, (uint8_t)v, 1);
+}
+
+nbt_status nbt_emit_short(struct nbt_emitter* e, const char* name, int16_t v)
+{
+    return emit_scalar(e, name, TAG_SHORT, (uint16_t)v, 2);
+}
+
+nbt_status nbt_emit_int(struct nbt_emitter* e, const char* name, int32_t v)
+{
+    return emit_scalar(e, name, TAG_INT, (uint32_t)v, 4);
+}
+
+nbt_status nbt_emit_long(struct nbt_emitter* e, const char* name, int64_t v)
+{
+    return emit_scalar(e, name, TAG_LONG, (uint64_t)v, 8);
+}
+
+nbt_status nbt_emit_float(struct nbt_emitter* e, const char* name, float v)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof bits);
+
+    return emit_scalar(e, name, TAG_FLOAT, bits, 4);
+}
+
+nbt_status nbt_emit_double(struct nbt_emitter* e, const char* name, double v)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof bits);
+
+    return emit_scalar(e, name, TAG_DOUBLE, bits, 8);
+}
+
+nbt_status nbt_emit_string(struct nbt_emitter* e, const char* name, const char* s)
+{
+    assert(e);
+    assert(s);
+
+    size_t len = strlen(s);
+
+    if(len > 32767 /* SHORT_MAX */)
+        return fail(e);
+
+    struct nbt_writer w = writer(e);
+
+    if(begin_tag(e, &w, TAG_STRING, name) != NBT_OK)
+        return e->err;
+
+    make_room(&w, 2);
+    store16(w.pos, (uint16_t)len);
+    w.pos += 2;
+
+    put_raw(&w, s, len);
+    return end_tag(e, &w);
+}
+
+/* Writes an array's length, then its elements, swapping as many as fit in the stage at a time. */
+static nbt_status emit_array(struct nbt_emitter* e, const char* name, nbt_type type,
+                             const void* data, int32_t length, size_t size)
+{
+    assert(e);
+    assert(data || length == 0);
+
+    if(length < 0)
+        return fail(e);
+
+    struct nbt_writer w = writer(e);
+
+    if(begin_tag(e, &w, type, name) != NBT_OK)
+        return e->err;
+
+    make_room(&w, 4);
+    store32(w.pos, (uint32_t)length);
+    w.pos += 4;
+
+    if(size == 1)
+    {
+        put_raw(&w, data, (size_t)length);
+        return end_tag(e, &w);
+    }
+
+    for(int32_t i = 0; i < length; )
+    {
+        int32_t n = (int32_t)((w.end - w.pos) / size);
+
+        if(n == 0)
+        {
+            flush_stage(&w);
+            continue;
+        }
+
+        if(n > length - i) n = length - i;
+
+        if(size == 4)
+            for(int32_t j = 0; j < n; j++)
+                store32(w.pos + j * 4, (uint32_t)((const int32_t*)data)[i + j]);
+        else
+            for(int32_t j = 0; j < n; j++)
+                store64(w.pos + j * 8, (uint64_t)((const int64_t*)data)[i + j]);
+
+        w.pos += (size_t)n * size;
+        i += n;
+    }
+
+    return end_tag(e, &w);
+}
+
+nbt_status nbt_emit_byte_array(struct nbt_emitter* e, const char* name, const unsigned char* data, int32_t length)
+{
+    return emit_array(e, name, TAG_BYTE_ARRAY, data, length, 1);
+}
+
+nbt_status nbt_emit_int_array(struct nbt_emitter* e, const char* name, const int32_t* data, int32_t length)
+{
+    return emit_array(e, name, TAG_INT_ARRAY, data, length, sizeof(int32_t));
+}
+
+nbt_status nbt_emit_long_array(struct nbt_emitter* e, const char* name, const int64_t* data, int32_t length)
+{
+    return emit_array(e, name, TAG_LONG_ARRAY, data, length, sizeof(int64_t));
+}
+
+nbt_status nbt_emitter_finish(struct nbt_emitter* e)
+{
+    assert(e);
+
+    if(e->err == NBT_OK && !e->done)
+        fail(e);
+
+    struct nbt_writer w = writer(e);
+
+    flush_stage(&w);
+    save(e, &w);
+
+    if(e->err == NBT_OK && e->sink->flush)
+        e->err = e->sink->flush(e->sink->ctx);
+
+    return e->err;
+}
@@ -0,0 +1,475 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#include "nbt.h"
+
+#include "buffer.h"
+#include "list.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A frozen block starts with a header, which is followed by the root's
+ * record. Every node is a fixed-size record. Everything a record refers to
+ * (its name, its string or array, its children) lives somewhere after it in
+ * the block, at an offset counted from the start of the record itself. That
+ * way nothing in the block depends on where it was loaded.
+ *
+ * The children of a list or compound are an array of records, so they can be
+ * indexed directly. Compounds also carry a permutation of their children,
+ * sorted by name, for binary searching. Lists of scalars are stored as a flat
+ * array of elements instead, just like packed lists.
+ *
+ * Scalars are stored native-endian, and arrays are aligned to their element
+ * size, so they can be read in place.
+ */
+#define FROZEN_MAGIC      "NBTF"
+#define FROZEN_VERSION    1
+#define FROZEN_BYTE_ORDER 0x0102 /* reads as 0x0201 on the wrong machine */
+
+struct header {
+    char     magic[4];
+    uint16_t version;
+    uint16_t byte_order;
+    uint32_t size; /* of the whole block, header included */
+    uint32_t root; /* offset of the root's record from the start of the block */
+};
+
+enum {
+    FROZEN_PACKED = 1 << 0 /* The list's elements are a flat array of scalars. */
+};
+
+struct nbt_frozen {
+    uint8_t  type;
+    uint8_t  list_type; /* The type of a list's elements. */
+    uint8_t  flags;     /* Any combination of FROZEN_* bits. */
+    uint8_t  unused;
+
+    uint32_t name;      /* Offset of the null-terminated name, or 0 if none. */
+    uint32_t length;    /* Of the string, array or list, or 0. */
+    uint32_t data;      /* Offset of the string, array or children, or 0. */
+
+    union {
+        int64_t  i;      /* TAG_BYTE through TAG_LONG */
+        float    f;
+        double   d;
+        uint32_t sorted; /* Offset of a compound's sorted permutation. */
+    } value;
+};
+
+static inline const void* at(const nbt_frozen* n, uint32_t off)
+{
+    return off ? (const char*)n + off : NULL;
+}
+
+/*
+ * Appends `n' zeroed bytes to the block, aligned to `align', and stores their
+ * offset in `off'.
+ */
+static nbt_status reserve(struct buffer* b, size_t n, size_t align, size_t* off)
+{
+    size_t pad = (align - b->len % align) % align;
+
+    /* Offsets have to fit in 32 bits. */
+    if(b->len + pad + n > UINT32_MAX)
+        return NBT_ERR;
+
+    if(buffer_reserve(b, b->len + pad + n))
+        return NBT_EMEM;
+
+    memset(b->data + b->len, 0, pad + n);
+
+    *off = b->len + pad;
+    b->len += pad + n;
+
+    return NBT_OK;
+}
+
+/* Copies `n' bytes into the block, and points `*field' of the record at `rec' to them. */
+static nbt_status freeze_bytes(struct buffer* b, const void* data, size_t n, size_t align, size_t rec, uint32_t* field)
+{
+    size_t off;
+    nbt_status err;
+
+    if((err = reserve(b, n, align, &off)) != NBT_OK)
+        return err;
+
+    memcpy(b->data + off, data, n);
+    *field = (uint32_t)(off - rec);
+
+    return NBT_OK;
+}
+
+/* A compound's child, for sorting them by name. */
+struct sort_entry {
+    const char* name;
+    uint32_t    i;
+};
+
+/*
+ * Orders names, with unnamed children before all the named ones, even those
+ * named "". Freezing and lookups have to agree on this.
+ */
+static int compare_names(const char* a, const char* b)
+{
+    if(a == NULL || b == NULL)
+        return (a != NULL) - (b != NULL);
+
+    return strcmp(a, b);
+}
+
+static int compare_entries(const void* va, const void* vb)
+{
+    const struct sort_entry* a = va;
+    const struct sort_entry* b = vb;
+
+    int r = compare_names(a->name, b->name);
+
+    /* Keep children of the same name in order, so lookups find the first. */
+    return r ? r : (a->i > b->i) - (a->i < b->i);
+}
+
+static nbt_status freeze_node(struct buffer* b, const nbt_node* node, size_t rec);
+
+static nbt_status freeze_children(struct buffer* b, const nbt_node* node, struct nbt_frozen* f, size_t rec)
+{
+    const struct nbt_list* list = node->type == TAG_LIST ? node->payload.tag_list
+                                                         : node->payload.tag_compound;
+    size_t count = list_length(&list->entry);
+    size_t arr;
+    nbt_status err;
+
+    if((err = reserve(b, count * sizeof(struct nbt_frozen), 8, &arr)) != NBT_OK)
+        return err;
+
+    f->length = (uint32_t)count;
+    f->data   = count ? (uint32_t)(arr - rec) : 0;
+
+    size_t i = 0;
+    const struct list_head* pos;
+    list_for_each(pos, &list->entry)
+    {
+        const nbt_node* child = list_entry(pos, const struct nbt_list, entry)->data;
+
+        if((err = freeze_node(b, child, arr + i++ * sizeof(struct nbt_frozen))) != NBT_OK)
+            return err;
+    }
+
+    if(node->type != TAG_COMPOUND || count == 0)
+        return NBT_OK;
+
+    struct sort_entry* sorted = malloc(count * sizeof *sorted);
+    if(sorted == NULL) return NBT_EMEM;
+
+    i = 0;
+    list_for_each(pos, &list->entry)
+    {
+        const nbt_node* child = list_entry(pos, const struct nbt_list, entry)->data;
+
+        sorted[i] = (struct sort_entry) { child->name, (uint32_t)i };
+        i++;
+    }
+
+    qsort(sorted, count, sizeof *sorted, compare_entries);
+
+    size_t perm;
+
+    if((err = reserve(b, count * sizeof(uint32_t), sizeof(uint32_t), &perm)) == NBT_OK)
+    {
+        uint32_t* p = (uint32_t*)(b->data + perm);
+
+        for(i = 0; i < count; i++)
+            p[i] = sorted[i].i;
+
+        f->value.sorted = (uint32_t)(perm - rec);
+    }
+
+    free(sorted);
+    return err;
+}
+
+/* Stores a list of scalars as a flat array, whether or not it's packed. */
+static nbt_status freeze_scalars(struct buffer* b, const nbt_node* node, struct nbt_frozen* f, size_t rec)
+{
+    struct nbt_span span;
+    size_t size = nbt_scalar_size(f->list_type);
+
+    f->flags |= FROZEN_PACKED;
+
+    if(nbt_list_span(node, &span))
+    {
+        f->length = span.length;
+        return span.length ? freeze_bytes(b, span.data, span.length * size, size, rec, &f->data)
+                           : NBT_OK;
+    }
+
+    const struct nbt_list* list = node->payload.tag_list;
+    size_t count = list_length(&list->entry);
+    size_t off;
+    nbt_status err;
+
+    if(count == 0)
+        return NBT_OK;
+
+    if((err = reserve(b, count * size, size, &off)) != NBT_OK)
+        return err;
+
+    f->length = (uint32_t)count;
+    f->data   = (uint32_t)(off - rec);
+
+    const struct list_head* pos;
+    list_for_each(pos, &list->entry)
+    {
+        /* Every member of the payload union starts at its beginning. */
+        memcpy(b->data + off, &list_entry(pos, const struct nbt_list, entry)->data->payload, size);
+        off += size;
+    }
+
+    return NBT_OK;
+}
+
+/* Freezes `node' into the record at offset `rec', which is already reserved. */
+static nbt_status freeze_node(struct buffer* b, const nbt_node* node, size_t rec)
+{
+    struct nbt_frozen f;
+    nbt_status err = NBT_OK;
+
+    memset(&f, 0, sizeof f);
+    f.type = node->type;
+
+    if(node->name != NULL &&
+       (err = freeze_bytes(b, node->name, strlen(node->name) + 1, 1, rec, &f.name)) != NBT_OK)
+        return err;
+
+    switch(node->type)
+    {
+    case TAG_BYTE:   f.value.i = node->payload.tag_byte;   break;
+    case TAG_SHORT:  f.value.i = node->payload.tag_short;  break;
+    case TAG_INT:    f.value.i = node->payload.tag_int;    break;
+    case TAG_LONG:   f.value.i = node->payload.tag_long;   break;
+    case TAG_FLOAT:  f.value.f = node->payload.tag_float;  break;
+    case TAG_DOUBLE: f.value.d = node->payload.tag_double; break;
+
+    case TAG_STRING:
+        f.length = (uint32_t)strlen(node->payload.tag_string);
+        err = freeze_bytes(b, node->payload.tag_string, f.length + 1, 1, rec, &f.data);
+        break;
+
+    case TAG_BYTE_ARRAY:
+        f.length = node->payload.tag_byte_array.length;
+        if(f.length)
+            err = freeze_bytes(b, node->payload.tag_byte_array.data, f.length, 1, rec, &f.data);
+        break;
+
+    case TAG_INT_ARRAY:
+        f.length = node->payload.tag_int_array.length;
+        if(f.length)
+            err = freeze_bytes(b, node->payload.tag_int_array.data, f.length * sizeof(int32_t),
+                               sizeof(int32_t), rec, &f.data);
+        break;
+
+    case TAG_LONG_ARRAY:
+        f.length = node->payload.tag_long_array.length;
+        if(f.length)
+            err = freeze_bytes(b, node->payload.tag_long_array.data, f.length * sizeof(int64_t),
+                               sizeof(int64_t), rec, &f.data);
+        break;
+
+    case TAG_LIST:
+        f.list_type = node->flags & NBT_NODE_PACKED ? node->payload.tag_packed_list.type
+                                                    : node->payload.tag_list->data->type;
+
+        err = nbt_scalar_size(f.list_type) ? freeze_scalars(b, node, &f, rec)
+                                           : freeze_children(b, node, &f, rec);
+        break;
+
+    case TAG_COMPOUND:
+        err = freeze_children(b, node, &f, rec);
+        break;
+
+    default:
+        err = NBT_ERR;
+        break;
+    }
+
+    /* The block may have moved since we started, so don't hold on to pointers. */
+    if(err == NBT_OK)
+        memcpy(b->data + rec, &f, sizeof f);
+
+    return err;
+}
+
+struct buffer nbt_freeze(const nbt_node* tree)
+{
+    errno = NBT_OK;
+
+    if(tree == NULL) return BUFFER_INIT;
+
+    struct buffer b = BUFFER_INIT;
+    size_t hdr, root;
+    nbt_status err;
+
+    if((err = reserve(&b, sizeof(struct header), 8, &hdr))       != NBT_OK ||
+       (err = reserve(&b, sizeof(struct nbt_frozen), 8, &root)) != NBT_OK ||
+       (err = freeze_node(&b, tree, root))                       != NBT_OK)
+    {
+        buffer_free(&b);
+        errno = err;
+        return BUFFER_INIT;
+    }
+
+    struct header h = {
+        .magic      = FROZEN_MAGIC,
+        .version    = FROZEN_VERSION,
+        .byte_order = FROZEN_BYTE_ORDER,
+        .size       = (uint32_t)b.len,
+        .root       = (uint32_t)root
+    };
+
+    memcpy(b.data + hdr, &h, sizeof h);
+
+    return b;
+}
+
+const nbt_frozen* nbt_frozen_root(const void* block, size_t len)
+{
+    const struct header* h = block;
+
+    if(block == NULL || len < sizeof *h || (uintptr_t)block % 8 != 0 ||
+       memcmp(h->magic, FROZEN_MAGIC, sizeof h->magic) != 0 ||
+       h->version != FROZEN_VERSION || h->byte_order != FROZEN_BYTE_ORDER ||
+       h->size > len || h->root % 8 != 0 || h->root + sizeof(struct nbt_frozen) > h->size)
+    {
+        errno = NBT_ERR;
+        return NULL;
+    }
+
+    return (const nbt_frozen*)((const char*)block + h->root);
+}
+
+nbt_type nbt_frozen_type(const nbt_frozen* n)
+{
+    return n->type;
+}
+
+const char* nbt_frozen_name(const nbt_frozen* n)
+{
+    return at(n, n->name);
+}
+
+int32_t nbt_frozen_length(const nbt_frozen* n)
+{
+    return n->length;
+}
+
+nbt_type nbt_frozen_list_type(const nbt_frozen* n)
+{
+    return n->type == TAG_LIST ? n->list_type : TAG_INVALID;
+}
+
+int64_t nbt_frozen_int(const nbt_frozen* n)
+{
+    switch(n->type)
+    {
+    case TAG_BYTE: case TAG_SHORT: case TAG_INT: case TAG_LONG:
+        return n->value.i;
+    case TAG_FLOAT:
+        return (int64_t)n->value.f;
+    case TAG_DOUBLE:
+        return (int64_t)n->value.d;
+    default:
+        return 0;
+    }
+}
+
+double nbt_frozen_double(const nbt_frozen* n)
+{
+    switch(n->type)
+    {
+    case TAG_BYTE: case TAG_SHORT: case TAG_INT: case TAG_LONG:
+        return (double)n->value.i;
+    case TAG_FLOAT:
+        return n->value.f;
+    case TAG_DOUBLE:
+        return n->value.d;
+    default:
+        return 0;
+    }
+}
+
+const char* nbt_frozen_string(const nbt_frozen* n)
+{
+    return n->type == TAG_STRING ? at(n, n->data) : NULL;
+}
+
+const void* nbt_frozen_array(const nbt_frozen* n)
+{
+    if(n->type != TAG_BYTE_ARRAY && n->type != TAG_INT_ARRAY && n->type != TAG_LONG_ARRAY)
+        return NULL;
+
+    return at(n, n->data);
+}
+
+bool nbt_frozen_span(const nbt_frozen* n, struct nbt_span* span)
+{
+    if(n->type != TAG_LIST || !(n->flags & FROZEN_PACKED))
+        return false;
+
+    *span = (struct nbt_span) {
+        .data   = at(n, n->data),
+        .length = n->length,
+        .type   = n->list_type
+    };
+
+    return true;
+}
+
+const nbt_frozen* nbt_frozen_child(const nbt_frozen* n, int32_t i)
+{
+    if((n->type != TAG_LIST && n->type != TAG_COMPOUND) || (n->flags & FROZEN_PACKED))
+        return NULL;
+
+    if(i < 0 || (uint32_t)i >= n->length)
+        return NULL;
+
+    return (const nbt_frozen*)at(n, n->data) + i;
+}
+
+const nbt_frozen* nbt_frozen_get(const nbt_frozen* n, const char* name)
+{
+    if(n->type != TAG_COMPOUND || n->length == 0)
+        return NULL;
+
+    const nbt_frozen* children = at(n, n->data);
+    const uint32_t* sorted = at(n, n->value.sorted);
+    uint32_t lo = 0, hi = n->length;
+
+    /* Find the first child whose name isn't less than `name'. */
+    while(lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const char* cur = nbt_frozen_name(&children[sorted[mid]]);
+
+        if(compare_names(cur, name) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if(lo == n->length)
+        return NULL;
+
+    const nbt_frozen* found = &children[sorted[lo]];
+
+    return compare_names(nbt_frozen_name(found), name) == 0 ? found : NULL;
+}
@@ -0,0 +1,362 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#include "nbt.h"
+#include "nbt_internal.h"
+
+#include "list.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Compounds with fewer children than this are just scanned. Walking a handful
+ * of list entries is faster than hashing, and it saves us the memory.
+ */
+#define INDEX_THRESHOLD 8
+
+/*
+ * An open-addressing hash table mapping a child's name to its list entry.
+ * We store the list entry rather than the node so that nbt_compound_take can
+ * unlink it. Empty slots are NULL. The table is always at most half full.
+ */
+struct nbt_index {
+    size_t mask;  /* capacity - 1. The capacity is a power of two. */
+    size_t used;  /* The number of non-empty slots. */
+    bool   dups;  /* Did we ever see two children with the same name? */
+
+    struct nbt_list** slots;
+};
+
+/* FNV-1a. Names are short, so anything fancier isn't worth it. */
+static inline size_t hash_name(const char* s)
+{
+    uint32_t h = 2166136261u;
+
+    for(; *s; s++)
+        h = (h ^ (unsigned char)*s) * 16777619u;
+
+    return h;
+}
+
+static inline const char* entry_name(const struct nbt_list* entry)
+{
+    return entry->data->name;
+}
+
+/*
+ * Returns the slot holding `name', or the empty slot where it would go if it
+ * isn't in the table.
+ */
+static size_t find_slot(const struct nbt_index* idx, const char* name)
+{
+    size_t i = hash_name(name) & idx->mask;
+
+    while(idx->slots[i] != NULL &&
+          entry_name(idx->slots[i]) != name && /* interned names are cheap */
+          strcmp(entry_name(idx->slots[i]), name) != 0)
+        i = (i + 1) & idx->mask;
+
+    return i;
+}
+
+static int index_grow(struct nbt_index* idx, size_t capacity)
+{
+    struct nbt_list** old = idx->slots;
+    size_t old_cap = old ? idx->mask + 1 : 0;
+
+    struct nbt_list** slots = calloc(capacity, sizeof *slots);
+    if(slots == NULL) return 1;
+
+    idx->slots = slots;
+    idx->mask  = capacity - 1;
+
+    for(size_t i = 0; i < old_cap; i++)
+        if(old[i] != NULL)
+            idx->slots[find_slot(idx, entry_name(old[i]))] = old[i];
+
+    free(old);
+    return 0;
+}
+
+/*
+ * Adds `entry' to the index, unless a child of the same name is already in
+ * there. In that case the first one wins, just like nbt_find_by_name.
+ */
+static int index_insert(struct nbt_index* idx, struct nbt_list* entry)
+{
+    const char* name = entry_name(entry);
+
+    /* Unnamed children can't be looked up by name anyway. */
+    if(name == NULL) return 0;
+
+    if((idx->used + 1) * 2 > idx->mask + 1 &&
+       index_grow(idx, (idx->mask + 1) * 2))
+        return 1;
+
+    size_t i = find_slot(idx, name);
+
+    if(idx->slots[i] != NULL)
+        return idx->dups = true, 0;
+
+    idx->slots[i] = entry;
+    idx->used++;
+
+    return 0;
+}
+
+/*
+ * Removes the slot at `i'. Since we use linear probing, every entry in the
+ * same cluster after it has to be shuffled back so lookups don't stop short.
+ */
+static void index_remove_slot(struct nbt_index* idx, size_t i)
+{
+    idx->slots[i] = NULL;
+    idx->used--;
+
+    for(size_t j = (i + 1) & idx->mask;
+        idx->slots[j] != NULL;
+        j = (j + 1) & idx->mask)
+    {
+        struct nbt_list* moved = idx->slots[j];
+
+        idx->slots[j] = NULL;
+        idx->slots[find_slot(idx, entry_name(moved))] = moved;
+    }
+}
+
+static void index_free(struct nbt_index* idx)
+{
+    if(idx == NULL) return;
+
+    free(idx->slots);
+    free(idx);
+}
+
+static struct nbt_index* index_build(const struct nbt_list* list)
+{
+    struct nbt_index* idx = malloc(sizeof *idx);
+    if(idx == NULL) return NULL;
+
+    *idx = (struct nbt_index) { .mask = 0, .used = 0, .dups = false, .slots = NULL };
+
+    if(index_grow(idx, 2 * INDEX_THRESHOLD))
+        goto build_error;
+
+    const struct list_head* pos;
+    list_for_each(pos, &list->entry)
+        if(index_insert(idx, list_entry(pos, struct nbt_list, entry)))
+            goto build_error;
+
+    return idx;
+
+build_error:
+    index_free(idx);
+    return NULL;
+}
+
+void nbt_compound_invalidate(nbt_node* compound)
+{
+    if(compound == NULL || compound->type != TAG_COMPOUND)
+        return;
+
+    index_free(compound->index);
+    compound->index = NULL;
+}
+
+/* Does the list have at least INDEX_THRESHOLD entries? Walks at most that many. */
+static bool worth_indexing(const struct nbt_list* list)
+{
+    const struct list_head* pos;
+    size_t n = 0;
+
+    list_for_each(pos, &list->entry)
+        if(++n >= INDEX_THRESHOLD)
+            return true;
+
+    return false;
+}
+
+/* Returns the list entry of the first child named `name', or NULL. */
+static struct nbt_list* scan_compound(const struct nbt_list* list, const char* name)
+{
+    const struct list_head* pos;
+
+    list_for_each(pos, &list->entry)
+    {
+        struct nbt_list* entry = list_entry(pos, struct nbt_list, entry);
+        const char* cur = entry_name(entry);
+
+        if(cur == name || (cur && name && strcmp(cur, name) == 0))
+            return entry;
+    }
+
+    return NULL;
+}
+
+/*
+ * Any compound may be read from several threads at once: the root of a shared
+ * tree knows it's shared, but the compounds under it don't, and nbt_reduce's
+ * visitors all look things up at the same time. So indexes are built lazily
+ * by whoever gets there first, and published with a compare-and-swap. Once
+ * published, an index only changes along with the compound's children, and
+ * those mustn't change while anyone else can see them.
+ */
+#ifdef __GNUC__
+static inline struct nbt_index* load_index(const nbt_node* compound)
+{
+    return __atomic_load_n(&compound->index, __ATOMIC_ACQUIRE);
+}
+
+/* Returns the published index: `idx', or whatever beat it there. */
+static struct nbt_index* publish_index(nbt_node* compound, struct nbt_index* idx)
+{
+    struct nbt_index* winner = NULL;
+
+    if(idx == NULL ||
+       __atomic_compare_exchange_n(&compound->index, &winner, idx, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return idx;
+
+    index_free(idx);
+    return winner;
+}
+#else
+static inline struct nbt_index* load_index(const nbt_node* compound) { return compound->index; }
+
+static struct nbt_index* publish_index(nbt_node* compound, struct nbt_index* idx)
+{
+    return compound->index = idx;
+}
+#endif
+
+static struct nbt_list* compound_lookup(nbt_node* compound, const char* name)
+{
+    if(compound == NULL || compound->type != TAG_COMPOUND)
+        return NULL;
+
+    struct nbt_list* list = compound->payload.tag_compound;
+    struct nbt_index* idx = load_index(compound);
+
+    if(idx == NULL && name != NULL && worth_indexing(list))
+        idx = publish_index(compound, index_build(list));
+
+    /*
+     * Unnamed children aren't indexed, so we have to go look for them. We'll
+     * also end up here if the index couldn't be allocated.
+     */
+    if(idx == NULL || name == NULL)
+        return scan_compound(list, name);
+
+    return idx->slots[find_slot(idx, name)];
+}
+
+struct nbt_list* _nbt_compound_entry(nbt_node* compound, const char* name)
+{
+    return compound_lookup(compound, name);
+}
+
+nbt_node* nbt_compound_get(nbt_node* compound, const char* name)
+{
+    struct nbt_list* entry = compound_lookup(compound, name);
+
+    return entry ? entry->data : NULL;
+}
+
+nbt_status nbt_compound_append(nbt_node* compound, nbt_node* child)
+{
+    assert(compound && compound->type == TAG_COMPOUND);
+    assert(child && child->name);
+    assert(!is_shared(compound));
+
+    if((compound->flags ^ child->flags) & NBT_NODE_AUGMENTED)
+        return NBT_ERR;
+
+    struct nbt_list* entry = nbt_alloc_list();
+    if(entry == NULL)
+        return NBT_EMEM;
+
+    entry->data = child;
+    list_add_tail(&entry->entry, &compound->payload.tag_compound->entry);
+
+    /* Rather than unwinding the append, just stop indexing this compound. */
+    if(compound->index && index_insert(compound->index, entry))
+        nbt_compound_invalidate(compound);
+
+    if(is_augmented(compound))
+        _nbt_aug_link(compound, child);
+
+    return NBT_OK;
+}
+
+nbt_node* nbt_compound_take(nbt_node* compound, const char* name)
+{
+    assert(compound == NULL || !is_shared(compound));
+
+    struct nbt_list* entry = compound_lookup(compound, name);
+
+    if(entry == NULL)
+        return NULL;
+
+    list_del(&entry->entry);
+
+    struct nbt_index* idx = compound->index;
+
+    if(idx != NULL && name != NULL)
+    {
+        index_remove_slot(idx, find_slot(idx, name));
+
+        /*
+         * Well-formed compounds never have two children of the same name, but
+         * if this one did, the next one in line has to take over the slot.
+         */
+        struct nbt_list* shadowed;
+
+        if(idx->dups &&
+           (shadowed = scan_compound(compound->payload.tag_compound, name)) != NULL &&
+           index_insert(idx, shadowed))
+            nbt_compound_invalidate(compound);
+    }
+
+    nbt_node* ret = entry->data;
+    nbt_release_list(entry);
+
+    if(is_augmented(compound))
+        _nbt_aug_unlink(compound, ret);
+
+    return ret;
+}
+
+nbt_status nbt_compound_index(nbt_node* tree)
+{
+    if(tree == NULL) return NBT_OK;
+
+    if(tree->type != TAG_LIST && tree->type != TAG_COMPOUND)
+        return NBT_OK;
+
+    if(tree->flags & NBT_NODE_PACKED)
+        return NBT_OK;
+
+    struct nbt_list* list = tree->type == TAG_LIST ? tree->payload.tag_list : tree->payload.tag_compound;
+    nbt_status err = NBT_OK;
+
+    const struct list_head* pos;
+    list_for_each(pos, &list->entry)
+    {
+        nbt_status r = nbt_compound_index(list_entry(pos, struct nbt_list, entry)->data);
+        if(r != NBT_OK) err = r;
+    }
+
+    if(tree->type == TAG_COMPOUND && load_index(tree) == NULL && worth_indexing(list))
+        if(publish_index(tree, index_build(list)) == NULL)
+            err = NBT_EMEM;
+
+    return err;
+}
@@ -0,0 +1,210 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#include "nbt.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The intern table is split into shards, each with its own lock, so that
+ * threads parsing different trees rarely fight over the same mutex. Strings
+ * are never freed: they're carved out of big chunks which live until the
+ * process dies. There are only so many distinct tag names in the world.
+ */
+#define SHARDS     16
+#define CHUNK_SIZE 4096
+
+struct slot {
+    uint32_t    hash;
+    uint32_t    len;
+    const char* str; /* NULL if the slot is empty. */
+};
+
+struct shard {
+    pthread_mutex_t lock;
+
+    size_t mask;  /* capacity - 1 */
+    size_t used;
+    struct slot* slots;
+
+    /*
+     * The chunk we're currently carving strings out of. The first few bytes
+     * of every chunk point to the previous one, so they're all reachable.
+     */
+    char*  chunk;
+    size_t chunk_left;
+};
+
+static struct shard shards[SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+static void init_shards(void)
+{
+    for(size_t i = 0; i < SHARDS; i++)
+    {
+        pthread_mutex_init(&shards[i].lock, NULL);
+
+        shards[i].mask       = 0;
+        shards[i].used       = 0;
+        shards[i].slots      = NULL;
+        shards[i].chunk      = NULL;
+        shards[i].chunk_left = 0;
+    }
+}
+
+/* FNV-1a. */
+static inline uint32_t hash_bytes(const char* s, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    for(size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+
+    return h;
+}
+
+static inline bool slot_matches(const struct slot* sl, uint32_t hash, const char* s, size_t len)
+{
+    return sl->hash == hash && sl->len == len && memcmp(sl->str, s, len) == 0;
+}
+
+/* Returns the slot holding the string, or the empty slot where it'd go. */
+static struct slot* find_slot(const struct shard* sh, uint32_t hash, const char* s, size_t len)
+{
+    /* The low bits picked the shard, so use the high ones for the slot. */
+    size_t i = (hash >> 4) & sh->mask;
+
+    while(sh->slots[i].str != NULL && !slot_matches(&sh->slots[i], hash, s, len))
+        i = (i + 1) & sh->mask;
+
+    return &sh->slots[i];
+}
+
+static int shard_grow(struct shard* sh)
+{
+    size_t old_cap = sh->slots ? sh->mask + 1 : 0;
+    size_t new_cap = old_cap ? old_cap * 2 : 64;
+
+    struct slot* old = sh->slots;
+    struct slot* slots = calloc(new_cap, sizeof *slots);
+
+    if(slots == NULL) return 1;
+
+    sh->slots = slots;
+    sh->mask  = new_cap - 1;
+
+    for(size_t i = 0; i < old_cap; i++)
+        if(old[i].str != NULL)
+            *find_slot(sh, old[i].hash, old[i].str, old[i].len) = old[i];
+
+    free(old);
+    return 0;
+}
+
+/* Copies `len' bytes of `s' into the shard's chunk and null-terminates them. */
+static char* shard_store(struct shard* sh, const char* s, size_t len)
+{
+    char* ret;
+
+    /* Big strings get a chunk all of their own, so we don't waste the rest. */
+    if(len + 1 > CHUNK_SIZE / 4)
+    {
+        char** own = malloc(sizeof(char*) + len + 1);
+        if(own == NULL) return NULL;
+
+        ret = (char*)(own + 1);
+
+        /* Link it in behind the current chunk so it stays reachable. */
+        if(sh->chunk != NULL)
+        {
+            *own = *(char**)sh->chunk;
+            *(char**)sh->chunk = (char*)own;
+        }
+        else
+        {
+            *own = NULL;
+            sh->chunk      = (char*)own;
+            sh->chunk_left = 0;
+        }
+    }
+    else
+    {
+        if(sh->chunk_left < len + 1)
+        {
+            char* chunk = malloc(CHUNK_SIZE);
+            if(chunk == NULL) return NULL;
+
+            *(char**)chunk = sh->chunk;
+
+            sh->chunk      = chunk;
+            sh->chunk_left = CHUNK_SIZE - sizeof(char*);
+        }
+
+        ret = sh->chunk + (CHUNK_SIZE - sh->chunk_left);
+        sh->chunk_left -= len + 1;
+    }
+
+    memcpy(ret, s, len);
+    ret[len] = '\0';
+
+    return ret;
+}
+
+static const char* intern(const char* s, size_t len, bool insert)
+{
+    pthread_once(&shards_once, init_shards);
+
+    uint32_t hash = hash_bytes(s, len);
+    struct shard* sh = &shards[hash % SHARDS];
+    const char* ret = NULL;
+
+    pthread_mutex_lock(&sh->lock);
+
+    if(sh->slots == NULL && (!insert || shard_grow(sh)))
+        goto out;
+
+    struct slot* sl = find_slot(sh, hash, s, len);
+
+    if(sl->str != NULL || !insert)
+    {
+        ret = sl->str;
+        goto out;
+    }
+
+    if((sh->used + 1) * 2 > sh->mask + 1)
+    {
+        if(shard_grow(sh))
+            goto out;
+
+        sl = find_slot(sh, hash, s, len);
+    }
+
+    if((ret = shard_store(sh, s, len)) == NULL)
+        goto out;
+
+    *sl = (struct slot) { .hash = hash, .len = (uint32_t)len, .str = ret };
+    sh->used++;
+
+out:
+    pthread_mutex_unlock(&sh->lock);
+    return ret;
+}
+
+const char* nbt_intern(const char* s, size_t len)
+{
+    return intern(s, len, true);
+}
+
+const char* nbt_intern_find(const char* s, size_t len)
+{
+    return intern(s, len, false);
+}
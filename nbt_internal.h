@@ -0,0 +1,311 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#ifndef NBT_INTERNAL_H
+#define NBT_INTERNAL_H
+
+/*
+ * Declarations shared between the library's source files. None of this is
+ * part of the API, so don't include it from outside the library.
+ */
+
+#include "nbt.h"
+
+#include <assert.h>
+#include <string.h>
+
+/*
+ * An augmented node (see NBT_PARSE_AUGMENT) is a regular node with some extra
+ * bookkeeping tacked onto the end. Every node in an augmented tree is one of
+ * these, and has NBT_NODE_AUGMENTED set. Get from one to the other with
+ * AUGMENTED().
+ */
+struct nbt_augmented {
+    nbt_node node;
+
+    nbt_node* parent;   /* NULL for the root. */
+    size_t    children; /* The number of direct child nodes. */
+    size_t    size;     /* nbt_size of this subtree. */
+
+    /*
+     * The subtree's hash, once something's asked for it. If a node's hash is
+     * cached, so are all of its descendants', so forgetting one means
+     * forgetting all of its ancestors' too. See _nbt_aug_touch.
+     */
+    uint64_t  hash;
+    bool      hashed;
+    bool      inexact;  /* Are there floats in the subtree? */
+};
+
+#define AUGMENTED(n) list_entry((n), struct nbt_augmented, node)
+
+static inline bool is_augmented(const nbt_node* node)
+{
+    return node->flags & NBT_NODE_AUGMENTED;
+}
+
+/*
+ * Returns an uninitialized augmented node from the pool, with only the
+ * NBT_NODE_AUGMENTED flag set. nbt_release_node knows what to do with it.
+ */
+nbt_node* _nbt_alloc_augmented(void);
+
+/*
+ * Makes `node' the parent of all of its direct children, and recounts its
+ * cached sizes from theirs. Its ancestors are NOT updated. This is meant for
+ * freshly built nodes, whose children are all up to date.
+ */
+void _nbt_aug_adopt(nbt_node* node);
+
+/*
+ * The same as _nbt_aug_adopt, but for nodes which are already part of a tree:
+ * every ancestor of `node' is fixed up too.
+ */
+void _nbt_aug_refresh(nbt_node* node);
+
+/*
+ * Forgets the cached hashes of `node' and its ancestors. Anything which
+ * changes an augmented tree has to call this, or one of the functions below
+ * which do.
+ */
+void _nbt_aug_touch(nbt_node* node);
+
+/*
+ * Call these right after `child' has been linked into, or unlinked from,
+ * `parent''s list. Both must be augmented.
+ */
+void _nbt_aug_link(nbt_node* parent, nbt_node* child);
+void _nbt_aug_unlink(nbt_node* parent, nbt_node* child);
+
+/* Does the node have child nodes? Packed lists are lists, but they don't. */
+static inline bool has_children(const nbt_node* node)
+{
+    return node->type == TAG_COMPOUND ||
+          (node->type == TAG_LIST && !(node->flags & NBT_NODE_PACKED));
+}
+
+/*
+ * The pieces of nbt_filter, which nbt_filter_parallel shares. _nbt_filter_copy
+ * copies everything about a node but its children, and gives a list or
+ * compound an empty list for them. Sets errno and returns NULL if we ran out
+ * of memory. _nbt_filter_add appends a child to the copy, and once they're
+ * all in, _nbt_filter_finish has to be called on it.
+ */
+nbt_node* _nbt_filter_copy(const nbt_node* tree);
+nbt_status _nbt_filter_add(nbt_node* parent, nbt_node* child);
+void _nbt_filter_finish(nbt_node* node);
+
+/* A copy of `tree', augmented or not, whatever `tree' is. See nbt_treeops.c. */
+nbt_node* _nbt_clone(const nbt_node* tree, bool augment);
+
+/* The list entry of `compound''s child called `name', or NULL. See nbt_index.c. */
+struct nbt_list* _nbt_compound_entry(nbt_node* compound, const char* name);
+
+/*
+ * Reads a name at `*p', quoted or not, in the syntax of nbt_path_compile, into
+ * `buf', and moves `*p' past it. Returns how long it is, or -1 if it isn't a
+ * name. See nbt_path.c.
+ */
+long _nbt_read_path_name(const char** p, char* buf);
+
+/*
+ * The element count of a list (see NBT_NODE_COUNTED), or -1 if we don't know
+ * it without walking the list.
+ */
+static inline int32_t list_count(const struct nbt_list* list)
+{
+    return list->data && (list->data->flags & NBT_NODE_COUNTED) ? list->data->payload.tag_int : -1;
+}
+
+static inline void list_set_count(struct nbt_list* list, int32_t count)
+{
+    list->data->flags |= NBT_NODE_COUNTED;
+    list->data->payload.tag_int = count;
+}
+
+/*
+ * Decompresses zlib or gzip data onto the end of `out'. On failure, `out' is
+ * left as it was. See nbt_loading.c.
+ */
+nbt_status _nbt_inflate(const void* mem, size_t len, struct buffer* out);
+
+/* One dot-separated piece of a path, as in nbt_find_by_path. */
+struct nbt_path_part {
+    const char* name;     /* Not null-terminated! */
+    size_t len;
+    const char* interned; /* The interned name, if it's been interned. */
+};
+
+/*
+ * Splitting paths up, for trees and binary NBT alike. See nbt_treeops.c.
+ * _nbt_count_parts says how many parts `path' has, and _nbt_split_path puts
+ * them in `parts'.
+ */
+size_t _nbt_count_parts(const char* path);
+void _nbt_split_path(const char* path, struct nbt_path_part* parts, size_t n);
+
+/* Most paths are short enough to split up on the stack. */
+#define NBT_PATH_PARTS_ON_STACK 16
+
+/*
+ * Splits `path' into `stack' if it fits there, or into the heap if it doesn't,
+ * and sets `*n' to the number of parts. Returns NULL, with errno set, if we
+ * ran out of memory. Free the result with _nbt_free_parts.
+ */
+struct nbt_path_part* _nbt_split_parts(const char* path, struct nbt_path_part* stack, size_t* n);
+void _nbt_free_parts(struct nbt_path_part* parts, struct nbt_path_part* stack);
+
+/* Does the part match the event's name? List elements match empty parts. */
+bool _nbt_part_matches(const struct nbt_path_part* part, const struct nbt_event* ev);
+
+/* Compresses binary NBT into `sink', without flushing it. See nbt_loading.c. */
+nbt_status _nbt_deflate(const void* mem, size_t len, nbt_compression_strategy strat, struct nbt_sink* sink);
+
+/*
+ * Where the dumpers put their output. When dumping into memory which is known
+ * to be big enough, `sink' is NULL and [pos, end) is all of it. Otherwise, we
+ * fill up a small staging area, and hand it to the sink whenever it's full.
+ */
+struct nbt_writer {
+    unsigned char* start;
+    unsigned char* pos;
+    unsigned char* end;
+
+    struct nbt_sink* sink;
+    nbt_status err; /* The first error the sink gave us. */
+};
+
+/* How big the staging area of a streaming dump is. */
+#define NBT_STAGE_SIZE 8192
+
+static inline void flush_stage(struct nbt_writer* w)
+{
+    if(w->sink == NULL || w->pos == w->start)
+        return;
+
+    if(w->err == NBT_OK)
+        w->err = w->sink->write(w->sink->ctx, w->start, w->pos - w->start);
+
+    w->pos = w->start;
+}
+
+/* Makes room for `n' more bytes. `n' had better fit in the staging area. */
+static inline void make_room(struct nbt_writer* w, size_t n)
+{
+    if((size_t)(w->end - w->pos) < n)
+        flush_stage(w);
+
+    assert((size_t)(w->end - w->pos) >= n);
+}
+
+static inline void put_byte(struct nbt_writer* w, uint8_t byte)
+{
+    make_room(w, 1);
+    *w->pos++ = byte;
+}
+
+/* Copies `n' bytes to the output as they are. Big pieces skip the staging area. */
+static inline void put_raw(struct nbt_writer* w, const void* data, size_t n)
+{
+    /* Empty arrays may have no data at all, and memcpy doesn't like NULL. */
+    if(n == 0)
+        return;
+
+    if((size_t)(w->end - w->pos) < n)
+    {
+        flush_stage(w);
+
+        if(n > (size_t)(w->end - w->pos))
+        {
+            if(w->err == NBT_OK)
+                w->err = w->sink->write(w->sink->ctx, data, n);
+
+            return;
+        }
+    }
+
+    memcpy(w->pos, data, n);
+    w->pos += n;
+}
+
+static inline void put_str(struct nbt_writer* w, const char* s)
+{
+    put_raw(w, s, strlen(s));
+}
+
+#define put_literal(w, s) put_raw((w), (s), sizeof(s) - 1)
+
+/*
+ * Number formatting for the text dumpers, in nbt_parsing.c. Each one writes at
+ * `out', which needs NBT_NUMBER_ROOM bytes, and returns the end of it.
+ * _nbt_format_real only takes finite numbers.
+ */
+#define NBT_NUMBER_ROOM 32
+
+char* _nbt_format_uint(char* out, uint64_t n);
+char* _nbt_format_int(char* out, int64_t n);
+char* _nbt_format_real(char* out, double x, bool single);
+
+static inline void put_int(struct nbt_writer* w, int64_t n)
+{
+    make_room(w, NBT_NUMBER_ROOM);
+    w->pos = (unsigned char*)_nbt_format_int((char*)w->pos, n);
+}
+
+static inline void put_uint(struct nbt_writer* w, uint64_t n)
+{
+    make_room(w, NBT_NUMBER_ROOM);
+    w->pos = (unsigned char*)_nbt_format_uint((char*)w->pos, n);
+}
+
+/* Can `c' appear in an unquoted SNBT key or string? */
+static inline bool snbt_bare_char(char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           c == '_' || c == '-' || c == '.' || c == '+';
+}
+
+/*
+ * Reference counts (see nbt_share). A node's `refs' counts its owners beyond
+ * the first, so nodes built from scratch start out unshared at zero. Owners
+ * can live on different threads, so we use atomics where we have them.
+ */
+#ifdef __GNUC__
+static inline bool is_shared(const nbt_node* node)
+{
+    return __atomic_load_n(&node->refs, __ATOMIC_ACQUIRE) != 0;
+}
+
+static inline void ref_get(nbt_node* node)
+{
+    __atomic_fetch_add(&node->refs, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Drops an owner of `node'. Returns false if there was only the one, in which
+ * case it's the caller's to free.
+ */
+static inline bool ref_put(nbt_node* node)
+{
+    uint32_t refs = __atomic_load_n(&node->refs, __ATOMIC_ACQUIRE);
+
+    while(refs != 0)
+        if(__atomic_compare_exchange_n(&node->refs, &refs, refs - 1, true,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return true;
+
+    return false;
+}
+#else
+static inline bool is_shared(const nbt_node* node) { return node->refs != 0; }
+static inline void ref_get(nbt_node* node)         { node->refs++; }
+static inline bool ref_put(nbt_node* node)         { return node->refs ? node->refs--, true : false; }
+#endif
+
+#endif
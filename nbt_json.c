@@ -0,0 +1,575 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#include "nbt.h"
+#include "nbt_internal.h"
+
+#include "buffer.h"
+#include "list.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * JSON output. The same helpers write values for two drivers: one walks a
+ * tree, the other follows the event parser over binary NBT. The only real
+ * difference between them is that arrays from the event parser are still
+ * big-endian.
+ */
+
+/* Writes `len' bytes of `s' as a JSON string. */
+static void put_json_string(struct nbt_writer* w, const char* s, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    put_literal(w, "\"");
+
+    const char* run = s;
+    const char* end = s + len;
+
+    for(; s < end; s++)
+    {
+        unsigned char c = (unsigned char)*s;
+
+        if(c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        put_raw(w, run, s - run);
+        run = s + 1;
+
+        switch(c)
+        {
+        case '"':  put_literal(w, "\\\""); break;
+        case '\\': put_literal(w, "\\\\"); break;
+        case '\n': put_literal(w, "\\n");  break;
+        case '\t': put_literal(w, "\\t");  break;
+        case '\r': put_literal(w, "\\r");  break;
+        case '\b': put_literal(w, "\\b");  break;
+        case '\f': put_literal(w, "\\f");  break;
+
+        default:
+            {
+                char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+                put_raw(w, esc, sizeof esc);
+            }
+            break;
+        }
+    }
+
+    put_raw(w, run, s - run);
+    put_literal(w, "\"");
+}
+
+/*
+ * Opens a value. When its type is written out, that's an object with the type
+ * in it, which close_value has to close. Lists say what they hold as well,
+ * which is TAG_END for an empty one: trees don't remember any better.
+ */
+static void open_value(struct nbt_writer* w, nbt_type type, nbt_type list_type, bool typed)
+{
+    if(!typed)
+        return;
+
+    put_literal(w, "{\"type\":\"");
+    put_str(w, nbt_type_to_string(type));
+
+    if(type == TAG_LIST)
+    {
+        put_literal(w, "\",\"elements\":\"");
+        put_str(w, nbt_type_to_string(list_type));
+    }
+
+    put_literal(w, "\",\"value\":");
+}
+
+static void close_value(struct nbt_writer* w, bool typed)
+{
+    if(typed)
+        put_literal(w, "}");
+}
+
+static void put_json_int(struct nbt_writer* w, int64_t n, bool quoted)
+{
+    if(quoted) put_literal(w, "\"");
+    put_int(w, n);
+    if(quoted) put_literal(w, "\"");
+}
+
+/* JSON has no words for NaN or infinity, so they're null, or strings if the type is written out. */
+static void put_json_real(struct nbt_writer* w, double x, bool single, bool typed)
+{
+    if(x != x || x == INFINITY || x == -INFINITY)
+    {
+        if(!typed)
+            put_literal(w, "null");
+        else
+            put_str(w, x != x ? "\"NaN\"" : x > 0 ? "\"Infinity\"" : "\"-Infinity\"");
+
+        return;
+    }
+
+    make_room(w, NBT_NUMBER_ROOM);
+    w->pos = (unsigned char*)_nbt_format_real((char*)w->pos, x, single);
+}
+
+/* Writes a byte array as base64. */
+static void put_base64(struct nbt_writer* w, const unsigned char* data, size_t len)
+{
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    put_literal(w, "\"");
+
+    for(size_t i = 0; i < len; i += 3)
+    {
+        uint32_t bits = (uint32_t)data[i] << 16;
+
+        if(i + 1 < len) bits |= (uint32_t)data[i + 1] << 8;
+        if(i + 2 < len) bits |= data[i + 2];
+
+        make_room(w, 4);
+
+        w->pos[0] = digits[bits >> 18];
+        w->pos[1] = digits[bits >> 12 & 0x3F];
+        w->pos[2] = i + 1 < len ? digits[bits >> 6 & 0x3F] : '=';
+        w->pos[3] = i + 2 < len ? digits[bits & 0x3F] : '=';
+
+        w->pos += 4;
+    }
+
+    put_literal(w, "\"");
+}
+
+static int64_t array_get(const void* data, int32_t i, nbt_type type, bool big_endian)
+{
+    const unsigned char* p = data;
+
+    if(type == TAG_BYTE_ARRAY)
+        return (int8_t)p[i];
+
+    if(!big_endian)
+        return type == TAG_INT_ARRAY ? ((const int32_t*)data)[i] : ((const int64_t*)data)[i];
+
+    size_t size = type == TAG_INT_ARRAY ? 4 : 8;
+    uint64_t n = 0;
+
+    for(size_t b = 0; b < size; b++)
+        n = n << 8 | p[i * size + b];
+
+    return type == TAG_INT_ARRAY ? (int32_t)(uint32_t)n : (int64_t)n;
+}
+
+/* The most room an array element can take: a sign, 19 digits, two quotes and a comma. */
+#define JSON_ELEMENT_ROOM 23
+
+static void put_json_array(struct nbt_writer* w, const void* data, int32_t length, nbt_type type,
+                           bool big_endian, unsigned flags)
+{
+    assert(length >= 0);
+
+    if(type == TAG_BYTE_ARRAY && (flags & NBT_JSON_BASE64))
+    {
+        put_base64(w, data, (size_t)length);
+        return;
+    }
+
+    bool quoted = type == TAG_LONG_ARRAY && (flags & NBT_JSON_LONG_STRINGS);
+
+    put_literal(w, "[");
+
+    for(int32_t i = 0; i < length; )
+    {
+        int32_t stop = i + (int32_t)((w->end - w->pos) / JSON_ELEMENT_ROOM);
+
+        if(stop == i)
+        {
+            flush_stage(w);
+            continue;
+        }
+
+        if(stop > length) stop = length;
+
+        char* out = (char*)w->pos;
+
+        for(; i < stop; i++)
+        {
+            if(i > 0)   *out++ = ',';
+            if(quoted)  *out++ = '"';
+
+            out = _nbt_format_int(out, array_get(data, i, type, big_endian));
+
+            if(quoted)  *out++ = '"';
+        }
+
+        w->pos = (unsigned char*)out;
+    }
+
+    put_literal(w, "]");
+}
+
+static void put_json_key(struct nbt_writer* w, const char* name, size_t len)
+{
+    put_json_string(w, name ? name : "", name ? len : 0);
+    put_literal(w, ":");
+}
+
+/*
+ * Writes a scalar, string or array. Integers come in `integer', reals in
+ * `real', and everything else in `data' and `length'.
+ */
+static void put_json_leaf(struct nbt_writer* w, nbt_type type, int64_t integer, double real,
+                          const void* data, int32_t length, bool big_endian, unsigned flags, bool typed)
+{
+    open_value(w, type, TAG_INVALID, typed);
+
+    switch(type)
+    {
+    case TAG_BYTE:
+    case TAG_SHORT:
+    case TAG_INT:
+        put_int(w, integer);
+        break;
+
+    case TAG_LONG:
+        put_json_int(w, integer, flags & NBT_JSON_LONG_STRINGS);
+        break;
+
+    case TAG_FLOAT:
+    case TAG_DOUBLE:
+        put_json_real(w, real, type == TAG_FLOAT, typed);
+        break;
+
+    case TAG_STRING:
+        put_json_string(w, data, (size_t)length);
+        break;
+
+    default:
+        put_json_array(w, data, length, type, big_endian, flags);
+        break;
+    }
+
+    close_value(w, typed);
+}
+
+/* The same as put_json_leaf, for a node in a tree. */
+static void put_json_node_leaf(struct nbt_writer* w, const nbt_node* tree, unsigned flags, bool typed)
+{
+    int64_t integer = 0;
+    double real = 0;
+    const void* data = NULL;
+    int32_t length = 0;
+
+    switch(tree->type)
+    {
+    case TAG_BYTE:   integer = tree->payload.tag_byte;   break;
+    case TAG_SHORT:  integer = tree->payload.tag_short;  break;
+    case TAG_INT:    integer = tree->payload.tag_int;    break;
+    case TAG_LONG:   integer = tree->payload.tag_long;   break;
+    case TAG_FLOAT:  real    = tree->payload.tag_float;  break;
+    case TAG_DOUBLE: real    = tree->payload.tag_double; break;
+
+    case TAG_STRING:
+        data   = tree->payload.tag_string;
+        length = (int32_t)strlen(tree->payload.tag_string);
+        break;
+
+    case TAG_BYTE_ARRAY:
+        data   = tree->payload.tag_byte_array.data;
+        length = tree->payload.tag_byte_array.length;
+        break;
+
+    case TAG_INT_ARRAY:
+        data   = tree->payload.tag_int_array.data;
+        length = tree->payload.tag_int_array.length;
+        break;
+
+    default:
+        data   = tree->payload.tag_long_array.data;
+        length = tree->payload.tag_long_array.length;
+        break;
+    }
+
+    put_json_leaf(w, tree->type, integer, real, data, length, false, flags, typed);
+}
+
+/*
+ * Writes a node. `typed' is whether its type gets written out, which it does
+ * for everything but list elements, since the list says what they are.
+ */
+static nbt_status write_json(struct nbt_writer* w, const nbt_node* tree, unsigned flags, bool typed)
+{
+    const struct list_head* pos;
+    nbt_status err;
+
+    switch(tree->type)
+    {
+    case TAG_BYTE: case TAG_SHORT: case TAG_INT: case TAG_LONG:
+    case TAG_FLOAT: case TAG_DOUBLE:
+    case TAG_BYTE_ARRAY: case TAG_INT_ARRAY: case TAG_LONG_ARRAY:
+        put_json_node_leaf(w, tree, flags, typed);
+        return NBT_OK;
+
+    case TAG_STRING:
+        if(tree->payload.tag_string == NULL)
+            return NBT_ERR;
+
+        put_json_node_leaf(w, tree, flags, typed);
+        return NBT_OK;
+
+    case TAG_LIST:
+        if(tree->flags & NBT_NODE_PACKED)
+        {
+            const struct nbt_packed_list* list = &tree->payload.tag_packed_list;
+            struct nbt_span span = { list->data, list->length, list->type };
+
+            open_value(w, TAG_LIST, list->length ? list->type : TAG_INVALID, typed);
+            put_literal(w, "[");
+
+            for(int32_t i = 0; i < list->length; i++)
+            {
+                nbt_node elem;
+
+                nbt_span_get(&span, i, &elem);
+
+                if(i > 0) put_literal(w, ",");
+                put_json_node_leaf(w, &elem, flags, false);
+            }
+        }
+        else
+        {
+            const struct nbt_list* list = tree->payload.tag_list;
+
+            open_value(w, TAG_LIST, list_empty(&list->entry) ? TAG_INVALID : list->data->type, typed);
+            put_literal(w, "[");
+
+            list_for_each(pos, &list->entry)
+            {
+                if(pos != list->entry.flink) put_literal(w, ",");
+
+                if((err = write_json(w, list_entry(pos, const struct nbt_list, entry)->data, flags, false)) != NBT_OK)
+                    return err;
+            }
+        }
+
+        put_literal(w, "]");
+        close_value(w, typed);
+        return NBT_OK;
+
+    case TAG_COMPOUND:
+        open_value(w, TAG_COMPOUND, TAG_INVALID, typed);
+        put_literal(w, "{");
+
+        list_for_each(pos, &tree->payload.tag_compound->entry)
+        {
+            const nbt_node* child = list_entry(pos, const struct nbt_list, entry)->data;
+
+            if(pos != tree->payload.tag_compound->entry.flink) put_literal(w, ",");
+
+            put_json_key(w, child->name, child->name ? strlen(child->name) : 0);
+
+            if((err = write_json(w, child, flags, flags & NBT_JSON_TYPED)) != NBT_OK)
+                return err;
+        }
+
+        put_literal(w, "}");
+        close_value(w, typed);
+        return NBT_OK;
+
+    default:
+        return NBT_ERR;
+    }
+}
+
+/* Wraps the root up in an object under its own name, if we were asked to. */
+static void open_root(struct nbt_writer* w, const char* name, size_t len, unsigned flags)
+{
+    if(flags & NBT_JSON_NAMED_ROOT)
+    {
+        put_literal(w, "{");
+        put_json_key(w, name, len);
+    }
+}
+
+static void close_root(struct nbt_writer* w, unsigned flags)
+{
+    if(flags & NBT_JSON_NAMED_ROOT)
+        put_literal(w, "}");
+}
+
+/* Finishes off a dump into a sink, returning the first error anything had. */
+static nbt_status finish(struct nbt_writer* w, nbt_status err)
+{
+    flush_stage(w);
+
+    if(err == NBT_OK)
+        err = w->err;
+
+    if(err == NBT_OK && w->sink->flush)
+        err = w->sink->flush(w->sink->ctx);
+
+    return err;
+}
+
+nbt_status nbt_dump_json_to(const nbt_node* tree, unsigned flags, struct nbt_sink* sink)
+{
+    assert(tree);
+    assert(sink);
+
+    unsigned char stage[NBT_STAGE_SIZE];
+    struct nbt_writer w = { stage, stage, stage + sizeof stage, sink, NBT_OK };
+
+    open_root(&w, tree->name, tree->name ? strlen(tree->name) : 0, flags);
+
+    nbt_status err = write_json(&w, tree, flags, flags & NBT_JSON_TYPED);
+
+    close_root(&w, flags);
+
+    return finish(&w, err);
+}
+
+char* nbt_dump_json(const nbt_node* tree, unsigned flags)
+{
+    errno = NBT_OK;
+
+    assert(tree);
+
+    struct buffer b = BUFFER_INIT;
+    struct nbt_sink sink = nbt_sink_buffer(&b);
+
+    nbt_status err = nbt_dump_json_to(tree, flags, &sink);
+
+    if(err == NBT_OK && buffer_reserve(&b, b.len + 1))
+        err = NBT_EMEM;
+
+    if(err != NBT_OK)
+    {
+        errno = err;
+        buffer_free(&b);
+        return NULL;
+    }
+
+    b.data[b.len] = '\0';
+
+    return (char*)b.data;
+}
+
+/*
+ * Writes the tree in `len' bytes of binary NBT, following the event parser.
+ * Whether a container's type was written out is remembered on a stack of our
+ * own, alongside whether it has had any children yet.
+ */
+static nbt_status write_json_events(struct nbt_writer* w, const void* mem, size_t len, unsigned flags)
+{
+    struct nbt_reader* r = malloc(sizeof *r);
+
+    if(r == NULL)
+        return NBT_EMEM;
+
+    nbt_reader_init(r, mem, len);
+
+    bool typed_here[NBT_READER_MAX_DEPTH];
+    bool had_child[NBT_READER_MAX_DEPTH];
+
+    struct nbt_event ev;
+    nbt_status err;
+
+    while((err = nbt_reader_next(r, &ev)) == NBT_OK && ev.kind != NBT_EVENT_DONE)
+    {
+        if(ev.kind == NBT_EVENT_END)
+        {
+            put_str(w, ev.type == TAG_LIST ? "]" : "}");
+            close_value(w, typed_here[ev.depth]);
+
+            if(ev.depth == 0)
+                close_root(w, flags);
+
+            continue;
+        }
+
+        /* List elements don't say what they are: their list does. */
+        bool typed = (flags & NBT_JSON_TYPED) && ev.name != NULL;
+
+        if(ev.depth == 0)
+            open_root(w, ev.name, ev.name_len, flags);
+        else
+        {
+            if(had_child[ev.depth - 1])
+                put_literal(w, ",");
+
+            had_child[ev.depth - 1] = true;
+
+            if(ev.name != NULL)
+                put_json_key(w, ev.name, ev.name_len);
+        }
+
+        if(ev.kind == NBT_EVENT_BEGIN)
+        {
+            typed_here[ev.depth] = typed;
+            had_child[ev.depth]  = false;
+
+            open_value(w, ev.type, ev.length ? ev.list_type : TAG_INVALID, typed);
+            put_str(w, ev.type == TAG_LIST ? "[" : "{");
+        }
+        else
+        {
+            put_json_leaf(w, ev.type, ev.value.integer, ev.value.real,
+                          ev.payload, ev.length, true, flags, typed);
+
+            if(ev.depth == 0)
+                close_root(w, flags);
+        }
+    }
+
+    free(r);
+    return err;
+}
+
+nbt_status nbt_dump_json_binary(const void* mem, size_t len, unsigned flags, struct nbt_sink* sink)
+{
+    assert(sink);
+
+    unsigned char stage[NBT_STAGE_SIZE];
+    struct nbt_writer w = { stage, stage, stage + sizeof stage, sink, NBT_OK };
+
+    return finish(&w, write_json_events(&w, mem, len, flags));
+}
+
+nbt_status nbt_region_dump_json(nbt_region* region, unsigned flags, struct nbt_sink* sink)
+{
+    assert(region);
+    assert(sink);
+
+    unsigned char stage[NBT_STAGE_SIZE];
+    struct nbt_writer w = { stage, stage, stage + sizeof stage, sink, NBT_OK };
+
+    struct buffer chunk = BUFFER_INIT;
+    nbt_status err = NBT_OK;
+
+    for(int z = 0; z < 32 && err == NBT_OK; z++)
+        for(int x = 0; x < 32 && err == NBT_OK; x++)
+        {
+            if(!nbt_region_has_chunk(region, x, z))
+                continue;
+
+            if((err = nbt_region_read(region, x, z, &chunk)) != NBT_OK)
+                break;
+
+            if((err = write_json_events(&w, chunk.data, chunk.len, flags)) != NBT_OK)
+                break;
+
+            put_literal(&w, "\n");
+            err = w.err;
+        }
+
+    buffer_free(&chunk);
+    return finish(&w, err);
+}
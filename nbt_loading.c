@@ -8,6 +8,7 @@
  * -----------------------------------------------------------------------------
  */
 #include "nbt.h"
+#include "nbt_internal.h"
 
 #include "buffer.h"
 #include "list.h"
@@ -54,45 +55,60 @@ static struct buffer read_file(FILE* fp)
     return ret;
 }
 
-static nbt_status write_file(FILE* fp, const void* data, size_t len)
+/*
+ * A sink which deflates everything written to it, and passes the result on to
+ * another sink.
+ */
+struct deflate_sink {
+    z_stream stream;
+    struct nbt_sink* out;
+    unsigned char chunk[CHUNK_SIZE];
+};
+
+/* Runs deflate over whatever input is pending, until it wants more. */
+static nbt_status deflate_pending(struct deflate_sink* d, int flush)
 {
-    const char* cdata = data;
-    size_t bytes_left = len;
-
-    size_t bytes_written;
+    int zlib_ret;
 
     do {
-        bytes_written = fwrite(cdata, 1, bytes_left, fp);
-        if(ferror(fp)) return NBT_EIO;
+        d->stream.next_out  = d->chunk;
+        d->stream.avail_out = sizeof d->chunk;
 
-        bytes_left -= bytes_written;
-        cdata      += bytes_written;
+        if((zlib_ret = deflate(&d->stream, flush)) == Z_STREAM_ERROR)
+            return NBT_EZ;
 
-    } while(bytes_left > 0);
+        size_t have = sizeof d->chunk - d->stream.avail_out;
+        nbt_status err;
+
+        if(have && (err = d->out->write(d->out->ctx, d->chunk, have)) != NBT_OK)
+            return err;
+
+    } while(d->stream.avail_out == 0);
 
     return NBT_OK;
 }
 
-/*
- * Reads in uncompressed data and returns a buffer with the $(strat)-compressed
- * data within. Returns a NULL buffer on failure, and sets errno appropriately.
- */
-static struct buffer __compress(const void* mem,
-                                size_t len,
-                                nbt_compression_strategy strat)
+static nbt_status deflate_write(void* ctx, const void* data, size_t len)
 {
-    struct buffer ret = BUFFER_INIT;
+    struct deflate_sink* d = ctx;
 
-    errno = NBT_OK;
+    d->stream.next_in  = (void*)data;
+    d->stream.avail_in = len;
 
-    z_stream stream = {
-        .zalloc   = Z_NULL,
-        .zfree    = Z_NULL,
-        .opaque   = Z_NULL,
-        .next_in  = (void*)mem,
-        .avail_in = len
+    return deflate_pending(d, Z_NO_FLUSH);
+}
+
+/* Gets `d' ready to compress into `out'. */
+static nbt_status deflate_begin(struct deflate_sink* d, nbt_compression_strategy strat, struct nbt_sink* out)
+{
+    d->stream = (z_stream) {
+        .zalloc = Z_NULL,
+        .zfree  = Z_NULL,
+        .opaque = Z_NULL
     };
 
+    d->out = out;
+
     /* "The default value is 15"... */
     int windowbits = 15;
 
@@ -101,58 +117,70 @@ static struct buffer __compress(const void* mem,
     if(strat == STRAT_GZIP)
         windowbits += 16;
 
-    if(deflateInit2(&stream,
+    if(deflateInit2(&d->stream,
                     Z_DEFAULT_COMPRESSION,
                     Z_DEFLATED,
                     windowbits,
                     8,
                     Z_DEFAULT_STRATEGY
                    ) != Z_OK)
-    {
-        errno = NBT_EZ;
-        return BUFFER_INIT;
-    }
+        return NBT_EZ;
 
-    assert(stream.avail_in == len); /* I'm not sure if zlib will clobber this */
+    return NBT_OK;
+}
 
-    do {
-        if(buffer_reserve(&ret, ret.len + CHUNK_SIZE))
-        {
-            errno = NBT_EMEM;
-            goto compression_error;
-        }
+nbt_status nbt_dump_compressed_to(const nbt_node* tree,
+                                  nbt_compression_strategy strat,
+                                  struct nbt_sink* sink)
+{
+    assert(sink);
 
-        stream.next_out  = ret.data + ret.len;
-        stream.avail_out = CHUNK_SIZE;
+    if(tree == NULL) return NBT_OK;
 
-        if(deflate(&stream, Z_FINISH) == Z_STREAM_ERROR)
-            goto compression_error;
+    struct deflate_sink d;
 
-        ret.len += CHUNK_SIZE - stream.avail_out;
+    if(deflate_begin(&d, strat, sink) != NBT_OK)
+        return NBT_EZ;
 
-    } while(stream.avail_out == 0);
+    struct nbt_sink through = { deflate_write, NULL, &d };
+    nbt_status err = nbt_dump_binary_to(tree, &through);
 
-    (void)deflateEnd(&stream);
-    return ret;
+    if(err == NBT_OK)
+        err = deflate_pending(&d, Z_FINISH);
 
-compression_error:
-    if(errno == NBT_OK)
-        errno = NBT_EZ;
+    (void)deflateEnd(&d.stream);
 
-    (void)deflateEnd(&stream);
-    buffer_free(&ret);
-    return BUFFER_INIT;
+    if(err == NBT_OK && sink->flush)
+        err = sink->flush(sink->ctx);
+
+    return err;
+}
+
+/* Compresses `len' bytes of binary NBT into `sink', which isn't flushed. */
+nbt_status _nbt_deflate(const void* mem, size_t len, nbt_compression_strategy strat, struct nbt_sink* sink)
+{
+    struct deflate_sink d;
+
+    if(deflate_begin(&d, strat, sink) != NBT_OK)
+        return NBT_EZ;
+
+    nbt_status err = deflate_write(&d, mem, len);
+
+    if(err == NBT_OK)
+        err = deflate_pending(&d, Z_FINISH);
+
+    (void)deflateEnd(&d.stream);
+    return err;
 }
 
 /*
- * Reads in zlib-compressed data, and returns a buffer with the decompressed
- * data within. Returns a NULL buffer on failure, and sets errno appropriately.
+ * Decompresses zlib or gzip data, appending it to `out', so a buffer can be
+ * reused across calls. On failure, `out' has its old length back.
  */
-static struct buffer __decompress(const void* mem, size_t len)
+nbt_status _nbt_inflate(const void* mem, size_t len, struct buffer* out)
 {
-    struct buffer ret = BUFFER_INIT;
-
-    errno = NBT_OK;
+    size_t old_len = out->len;
+    nbt_status err = NBT_EZ;
 
     z_stream stream = {
         .zalloc   = Z_NULL,
@@ -165,27 +193,24 @@ static struct buffer __decompress(const void* mem, size_t len)
     /* "Add 32 to windowBits to enable zlib and gzip decoding with automatic
      * header detection" */
     if(inflateInit2(&stream, 15 + 32) != Z_OK)
-    {
-        errno = NBT_EZ;
-        return BUFFER_INIT;
-    }
+        return NBT_EZ;
 
     int zlib_ret;
 
     do {
-        if(buffer_reserve(&ret, ret.len + CHUNK_SIZE))
+        if(buffer_reserve(out, out->len + CHUNK_SIZE))
         {
-            errno = NBT_EMEM;
+            err = NBT_EMEM;
             goto decompression_error;
         }
 
         stream.avail_out = CHUNK_SIZE;
-        stream.next_out  = (unsigned char*)ret.data + ret.len;
+        stream.next_out  = (unsigned char*)out->data + out->len;
 
         switch((zlib_ret = inflate(&stream, Z_NO_FLUSH)))
         {
         case Z_MEM_ERROR:
-            errno = NBT_EMEM;
+            err = NBT_EMEM;
             /* fall through */
 
         case Z_DATA_ERROR: case Z_NEED_DICT:
@@ -193,7 +218,7 @@ static struct buffer __decompress(const void* mem, size_t len)
 
         default:
             /* update our buffer length to reflect the new data */
-            ret.len += CHUNK_SIZE - stream.avail_out;
+            out->len += CHUNK_SIZE - stream.avail_out;
         }
 
     } while(stream.avail_out == 0);
@@ -205,16 +230,13 @@ static struct buffer __decompress(const void* mem, size_t len)
     if(zlib_ret != Z_STREAM_END) goto decompression_error;
     (void)inflateEnd(&stream);
 
-    return ret;
+    return NBT_OK;
 
 decompression_error:
-    if(errno == NBT_OK)
-        errno = NBT_EZ;
-
     (void)inflateEnd(&stream);
 
-    buffer_free(&ret);
-    return BUFFER_INIT;
+    out->len = old_len;
+    return err;
 }
 
 /*
@@ -253,10 +275,13 @@ nbt_node* nbt_parse_path(const char* filename)
 
 nbt_node* nbt_parse_compressed(const void* chunk_start, size_t length)
 {
-    struct buffer decompressed = __decompress(chunk_start, length);
+    struct buffer decompressed = BUFFER_INIT;
 
-    if(decompressed.data == NULL)
+    if((errno = _nbt_inflate(chunk_start, length, &decompressed)) != NBT_OK)
+    {
+        buffer_free(&decompressed);
         return NULL;
+    }
 
     nbt_node* ret = nbt_parse(decompressed.data, decompressed.len);
 
@@ -265,31 +290,25 @@ nbt_node* nbt_parse_compressed(const void* chunk_start, size_t length)
 }
 
 /*
- * Once again, all we're doing is handing the actual compression off to
- * nbt_dump_compressed, then dumping it into the file.
+ * Nothing is buffered here: the tree is compressed straight into the file as
+ * it's dumped.
  */
 nbt_status nbt_dump_file(const nbt_node* tree, FILE* fp, nbt_compression_strategy strat)
 {
-    struct buffer compressed = nbt_dump_compressed(tree, strat);
-
-    if(compressed.data == NULL)
-        return (nbt_status)errno;
-
-    nbt_status ret = write_file(fp, compressed.data, compressed.len);
+    struct nbt_sink sink = nbt_sink_file(fp);
 
-    buffer_free(&compressed);
-    return ret;
+    return nbt_dump_compressed_to(tree, strat, &sink);
 }
 
 struct buffer nbt_dump_compressed(const nbt_node* tree, nbt_compression_strategy strat)
 {
-    struct buffer uncompressed = nbt_dump_binary(tree);
+    struct buffer ret = BUFFER_INIT;
+    struct nbt_sink sink = nbt_sink_buffer(&ret);
 
-    if(uncompressed.data == NULL)
-        return BUFFER_INIT;
+    errno = NBT_OK;
 
-    struct buffer compressed = __compress(uncompressed.data, uncompressed.len, strat);
+    if((errno = nbt_dump_compressed_to(tree, strat, &sink)) != NBT_OK)
+        buffer_free(&ret);
 
-    buffer_free(&uncompressed);
-    return compressed;
+    return ret;
 }
@@ -0,0 +1,538 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 200809L /* for sysconf */
+
+#include "nbt.h"
+#include "nbt_internal.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Every call gets its own threads, which share one stack of tasks. A task is
+ * a run of siblings, which whoever picks it up walks completely, handing out
+ * any big lists or compounds it comes across in the same way. A thread which
+ * has to wait for its tasks to be done (the filter has to, to put its copies
+ * together) picks up other tasks while it waits, so nobody sits idle while
+ * there's work, and nobody can deadlock waiting on a task nobody's running.
+ *
+ * If a task can't be allocated, whoever was going to hand it out just does
+ * the work itself. Running out of memory makes things slower, not wrong.
+ */
+
+/* Tasks which somebody is waiting on. */
+struct group {
+    size_t pending;     /* Guarded by the pool's lock. */
+    nbt_status err;     /* Also guarded, for filters. */
+};
+
+struct task {
+    struct task* next;
+    struct group* group;
+
+    const struct list_head* first;  /* The siblings in [first, end)... */
+    const struct list_head* end;
+    nbt_node** out;                 /* ...and where a filter puts their copies. */
+};
+
+struct pool {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;    /* There's a task, a group's done, or it's time to go. */
+
+    struct task* tasks;
+    bool closing;
+    bool stopped;           /* A visitor said stop. */
+
+    size_t grain;
+
+    /* A walk calls `reducer', and a filter calls `filter'. */
+    const struct nbt_reducer* reducer;
+    nbt_predicate_t filter;
+    void* aux;
+
+    struct group all;       /* Every task of a walk. */
+};
+
+struct worker {
+    struct pool* pool;
+    void* acc;              /* This thread's part of a reduction. */
+    bool stopped;
+    pthread_t thread;
+};
+
+static void run(struct worker* w, struct task* t);
+
+/* Called with the lock held. */
+static void finish(struct pool* p, struct task* t)
+{
+    if(--t->group->pending == 0)
+        pthread_cond_broadcast(&p->wake);
+
+    free(t);
+}
+
+/* Takes a task off the stack and runs it. Called with the lock held. */
+static void run_one(struct worker* w)
+{
+    struct pool* p = w->pool;
+    struct task* t = p->tasks;
+
+    p->tasks = t->next;
+    w->stopped = p->stopped;
+
+    pthread_mutex_unlock(&p->lock);
+
+    if(!w->stopped)
+        run(w, t);
+
+    pthread_mutex_lock(&p->lock);
+    finish(p, t);
+}
+
+static void* work(void* arg)
+{
+    struct worker* w = arg;
+    struct pool* p = w->pool;
+
+    pthread_mutex_lock(&p->lock);
+
+    for(;;)
+    {
+        if(p->tasks != NULL)
+            run_one(w);
+        else if(p->closing)
+            break;
+        else
+            pthread_cond_wait(&p->wake, &p->lock);
+    }
+
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+/* Waits for every task in `g' to be done, running tasks in the meantime. */
+static void join(struct worker* w, struct group* g)
+{
+    struct pool* p = w->pool;
+
+    pthread_mutex_lock(&p->lock);
+
+    while(g->pending > 0)
+    {
+        if(p->tasks != NULL)
+            run_one(w);
+        else
+            pthread_cond_wait(&p->wake, &p->lock);
+    }
+
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Returns false if the task couldn't be allocated. */
+static bool submit(struct worker* w, struct group* g, const struct list_head* first,
+                   const struct list_head* end, nbt_node** out)
+{
+    struct pool* p = w->pool;
+    struct task* t = malloc(sizeof *t);
+
+    if(t == NULL)
+        return false;
+
+    *t = (struct task) { NULL, g, first, end, out };
+
+    pthread_mutex_lock(&p->lock);
+
+    t->next  = p->tasks;
+    p->tasks = t;
+    g->pending++;
+    w->stopped = p->stopped;
+
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+
+    return true;
+}
+
+/*
+ * Hands out the children of `list' to the other threads, `grain' at a time,
+ * as part of `g'. The last run of them is left for the caller: it starts at
+ * the returned child, which is the `*index'th.
+ */
+static const struct list_head* share(struct worker* w, struct group* g, const struct nbt_list* list,
+                                     nbt_node** out, size_t* index)
+{
+    const struct list_head* head  = &list->entry;
+    const struct list_head* first = head->flink;
+    size_t i = 0;
+
+    for(;;)
+    {
+        const struct list_head* end = first;
+        size_t n = 0;
+
+        for(; end != head && n < w->pool->grain; n++)
+            end = end->flink;
+
+        if(end == head || !submit(w, g, first, end, out ? out + i : NULL))
+            break;
+
+        first = end;
+        i    += n;
+    }
+
+    *index = i;
+    return first;
+}
+
+static void stop(struct worker* w)
+{
+    struct pool* p = w->pool;
+
+    w->stopped = true;
+
+    pthread_mutex_lock(&p->lock);
+    p->stopped = true;
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void walk_run(struct worker* w, const struct list_head* first, const struct list_head* end);
+
+static void walk(struct worker* w, const nbt_node* node)
+{
+    struct pool* p = w->pool;
+
+    if(!p->reducer->visit(node, w->acc, p->aux))
+    {
+        stop(w);
+        return;
+    }
+
+    if(has_children(node))
+    {
+        const struct nbt_list* list = node->payload.tag_list;
+        size_t i;
+
+        walk_run(w, share(w, &p->all, list, NULL, &i), &list->entry);
+    }
+}
+
+static void walk_run(struct worker* w, const struct list_head* first, const struct list_head* end)
+{
+    for(const struct list_head* pos = first; pos != end && !w->stopped; pos = pos->flink)
+        walk(w, list_entry(pos, const struct nbt_list, entry)->data);
+}
+
+static nbt_node* filter_node(struct worker* w, const nbt_node* tree, nbt_status* err);
+
+static void filter_run(struct worker* w, struct group* g, const struct list_head* first,
+                       const struct list_head* end, nbt_node** out)
+{
+    struct pool* p = w->pool;
+
+    for(const struct list_head* pos = first; pos != end; pos = pos->flink)
+    {
+        nbt_status err = NBT_OK;
+
+        *out++ = filter_node(w, list_entry(pos, const struct nbt_list, entry)->data, &err);
+
+        if(err != NBT_OK)
+        {
+            pthread_mutex_lock(&p->lock);
+            if(g->err == NBT_OK) g->err = err;
+            pthread_mutex_unlock(&p->lock);
+            return;
+        }
+    }
+}
+
+/* Filters the children of `tree' into `copy', in order. */
+static nbt_status filter_children(struct worker* w, nbt_node* copy, const nbt_node* tree)
+{
+    const struct nbt_list* list = tree->payload.tag_list;
+    size_t n = list_length(&list->entry);
+    nbt_node** out = NULL;
+    nbt_status err = NBT_OK;
+
+    /* Small enough to do ourselves, or there's no room to keep the copies in. */
+    if(n <= w->pool->grain || (out = calloc(n, sizeof *out)) == NULL)
+    {
+        const struct list_head* pos;
+        list_for_each(pos, &list->entry)
+        {
+            nbt_node* child = filter_node(w, list_entry(pos, const struct nbt_list, entry)->data, &err);
+
+            if(err != NBT_OK)
+                return err;
+
+            if(child != NULL && (err = _nbt_filter_add(copy, child)) != NBT_OK)
+            {
+                nbt_free(child);
+                return err;
+            }
+        }
+
+        return NBT_OK;
+    }
+
+    struct group g = { 0, NBT_OK };
+    size_t i;
+    const struct list_head* rest = share(w, &g, list, out, &i);
+
+    filter_run(w, &g, rest, &list->entry, out + i);
+    join(w, &g);
+
+    err = g.err;
+
+    for(i = 0; i < n; i++)
+        if(out[i] != NULL && (err != NBT_OK || (err = _nbt_filter_add(copy, out[i])) != NBT_OK))
+            nbt_free(out[i]);
+
+    free(out);
+    return err;
+}
+
+static nbt_node* filter_node(struct worker* w, const nbt_node* tree, nbt_status* err)
+{
+    if(!w->pool->filter(tree, w->pool->aux))
+        return NULL;
+
+    nbt_node* ret = _nbt_filter_copy(tree);
+
+    if(ret == NULL)
+    {
+        *err = NBT_EMEM;
+        return NULL;
+    }
+
+    if(has_children(tree) && (*err = filter_children(w, ret, tree)) != NBT_OK)
+    {
+        nbt_free(ret);
+        return NULL;
+    }
+
+    _nbt_filter_finish(ret);
+    return ret;
+}
+
+static void run(struct worker* w, struct task* t)
+{
+    if(t->out != NULL)
+        filter_run(w, t->group, t->first, t->end, t->out);
+    else
+        walk_run(w, t->first, t->end);
+}
+
+static unsigned thread_count(const struct nbt_parallel* opts)
+{
+    if(opts != NULL && opts->threads > 0)
+        return opts->threads;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (unsigned)cores : 1;
+}
+
+/*
+ * Gets `p' and its workers going. The caller is workers[0], and does its share
+ * of the work after this returns. Returns how many workers there are, which
+ * may be fewer than were asked for, if threads couldn't be started.
+ */
+static unsigned start(struct pool* p, struct worker* workers, unsigned n, const struct nbt_parallel* opts)
+{
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+
+    p->tasks   = NULL;
+    p->closing = false;
+    p->stopped = false;
+    p->grain   = opts != NULL && opts->grain > 0 ? opts->grain : NBT_PARALLEL_GRAIN;
+    p->all     = (struct group) { 0, NBT_OK };
+
+    unsigned started = 1;
+
+    for(unsigned i = 0; i < n; i++)
+    {
+        workers[i].pool    = p;
+        workers[i].stopped = false;
+    }
+
+    while(started < n && pthread_create(&workers[started].thread, NULL, work, &workers[started]) == 0)
+        started++;
+
+    return started;
+}
+
+static void stop_pool(struct pool* p, struct worker* workers, unsigned n)
+{
+    pthread_mutex_lock(&p->lock);
+    p->closing = true;
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+
+    for(unsigned i = 1; i < n; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    pthread_cond_destroy(&p->wake);
+    pthread_mutex_destroy(&p->lock);
+}
+
+bool nbt_reduce(const nbt_node* tree, const struct nbt_reducer* r, void* result, void* aux,
+                const struct nbt_parallel* opts)
+{
+    assert(r);
+    assert(result);
+
+    unsigned n = thread_count(opts);
+    struct worker solo;
+    struct worker* workers = malloc(n * sizeof *workers);
+    unsigned char* accs = malloc(n * r->size + 1);
+
+    r->init(result, aux);
+
+    /* Without the memory for threads, this one folds straight into `result'. */
+    if(workers == NULL || accs == NULL)
+    {
+        free(workers);
+        free(accs);
+
+        workers = &solo;
+        accs    = NULL;
+        n       = 1;
+    }
+
+    for(unsigned i = 0; i < n; i++)
+    {
+        workers[i].acc = accs ? accs + i * r->size : result;
+
+        if(accs != NULL)
+            r->init(workers[i].acc, aux);
+    }
+
+    struct pool p;
+    p.reducer = r;
+    p.filter  = NULL;
+    p.aux     = aux;
+
+    n = start(&p, workers, n, opts);
+
+    if(tree != NULL)
+        walk(&workers[0], tree);
+
+    join(&workers[0], &p.all);
+    stop_pool(&p, workers, n);
+
+    if(accs != NULL)
+    {
+        for(unsigned i = 0; i < n; i++)
+            r->combine(result, workers[i].acc, aux);
+
+        free(workers);
+        free(accs);
+    }
+
+    return !p.stopped;
+}
+
+/* nbt_map_parallel is a reduction with nothing to reduce. */
+struct mapping {
+    nbt_predicate_t visit;
+    void* aux;
+};
+
+static void map_init(void* acc, void* aux)                        { (void)acc; (void)aux; }
+static void map_combine(void* acc, const void* other, void* aux)  { (void)acc; (void)other; (void)aux; }
+
+static bool map_visit(const nbt_node* node, void* acc, void* aux)
+{
+    (void)acc;
+    const struct mapping* m = aux;
+
+    return m->visit(node, m->aux);
+}
+
+bool nbt_map_parallel(const nbt_node* tree, nbt_predicate_t v, void* aux, const struct nbt_parallel* opts)
+{
+    assert(v);
+
+    static const struct nbt_reducer mapper = { 0, map_init, map_visit, map_combine };
+    struct mapping m = { v, aux };
+    char unused;
+
+    return nbt_reduce(tree, &mapper, &unused, &m, opts);
+}
+
+static void size_init(void* acc, void* aux)
+{
+    (void)aux;
+    *(size_t*)acc = 0;
+}
+
+static bool size_visit(const nbt_node* node, void* acc, void* aux)
+{
+    (void)node; (void)aux;
+    *(size_t*)acc += 1;
+
+    return true;
+}
+
+static void size_combine(void* acc, const void* other, void* aux)
+{
+    (void)aux;
+    *(size_t*)acc += *(const size_t*)other;
+}
+
+size_t nbt_size_parallel(const nbt_node* tree, const struct nbt_parallel* opts)
+{
+    static const struct nbt_reducer sizer = { sizeof(size_t), size_init, size_visit, size_combine };
+
+    if(tree == NULL || is_augmented(tree))
+        return nbt_size(tree);
+
+    size_t size;
+    nbt_reduce(tree, &sizer, &size, NULL, opts);
+
+    return size;
+}
+
+nbt_node* nbt_filter_parallel(const nbt_node* tree, nbt_predicate_t filter, void* aux,
+                              const struct nbt_parallel* opts)
+{
+    assert(filter);
+
+    unsigned n = thread_count(opts);
+    struct worker solo;
+    struct worker* workers = malloc(n * sizeof *workers);
+
+    if(workers == NULL)
+    {
+        workers = &solo;
+        n       = 1;
+    }
+
+    struct pool p;
+    p.reducer = NULL;
+    p.filter  = filter;
+    p.aux     = aux;
+
+    n = start(&p, workers, n, opts);
+
+    nbt_status err = NBT_OK;
+    nbt_node* ret = tree != NULL ? filter_node(&workers[0], tree, &err) : NULL;
+
+    stop_pool(&p, workers, n);
+
+    if(workers != &solo)
+        free(workers);
+
+    errno = err;
+    return ret;
+}
@@ -8,15 +8,17 @@
  * -----------------------------------------------------------------------------
  */
 #include "nbt.h"
+#include "nbt_internal.h"
 
 #include "buffer.h"
 #include "list.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <float.h>
 #include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
-#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -51,8 +53,11 @@ static void* be2ne(void* s, size_t len)
     return little_endian() ? swap_bytes(s, len) : s;
 }
 
-/* native endian to big endian. works the exact same as its inverse */
-#define ne2be be2ne
+/* little endian to native endian. works in-place */
+static void* le2ne(void* s, size_t len)
+{
+    return little_endian() ? s : swap_bytes(s, len);
+}
 
 /* A special form of memcpy which copies `n' bytes into `dest', then returns
  * `src' + n.
@@ -72,26 +77,27 @@ static const void* swapped_memscan(void* dest, const void* src, size_t n)
     return be2ne(dest, n), ret;
 }
 
-#define CHECKED_MALLOC(var, n, on_error) do { \
-    if((var = malloc(n)) == NULL)             \
-    {                                         \
-        errno = NBT_EMEM;                     \
-        on_error;                             \
-    }                                         \
-} while(0)
+/* The same as swapped_memscan, but from little endian. */
+static const void* le_memscan(void* dest, const void* src, size_t n)
+{
+    const void* ret = memscan(dest, src, n);
+    return le2ne(dest, n), ret;
+}
 
-#define CHECKED_APPEND(b, ptr, len) do { \
-    if(buffer_append((b), (ptr), (len))) \
-        return NBT_EMEM;                 \
+#define CHECKED_ALLOC(var, allocation, on_error) do { \
+    if((var = (allocation)) == NULL)                  \
+    {                                                 \
+        errno = NBT_EMEM;                             \
+        on_error;                                     \
+    }                                                 \
 } while(0)
 
-/* Parses a tag, given a name (may be NULL) and a type. Fills in the payload. */
-static nbt_node* parse_unnamed_tag(nbt_type type, char* name, const char** memory, size_t* length);
+#define CHECKED_MALLOC(var, n, on_error) CHECKED_ALLOC(var, malloc(n), on_error)
 
 /*
  * Reads some bytes from the memory stream. This macro will read `n'
- * bytes into `dest', call either memscan or swapped_memscan depending on
- * `scanner', then fix the length. If anything funky goes down, `on_failure'
+ * bytes into `dest', call `scanner' to copy them (memscan, or one
+ * of the swapping ones), then fix the length. If anything funky goes down, `on_failure'
  * will be executed.
  */
 #define READ_GENERIC(dest, n, scanner, on_failure) do { \
@@ -100,156 +106,86 @@ static nbt_node* parse_unnamed_tag(nbt_type type, char* name, const char** memor
     *length -= (n);                                     \
 } while(0)
 
-/* printfs into the end of a buffer. Note: no null-termination! */
-static void bprintf(struct buffer* b, const char* restrict format, ...)
-{
-    va_list args;
-    int siz;
-
-    va_start(args, format);
-    siz = vsnprintf(NULL, 0, format, args);
-    va_end(args);
-
-    buffer_reserve(b, b->len + siz + 1);
-
-    va_start(args, format);
-    vsnprintf((char*)(b->data + b->len), siz + 1, format, args);
-    va_end(args);
-
-    b->len += siz; // remember - no null terminator!
-}
-
 /*
- * Reads a string from memory, moving the pointer and updating the length
- * appropriately. Returns NULL on failure.
+ * Reads an unsigned LEB128 varint of at most `max' bytes: seven bits to a
+ * byte, least significant first, with the top bit set on all but the last.
  */
-static char* read_string(const char** memory, size_t* length)
+static bool read_varint(uint64_t* out, size_t max, const char** memory, size_t* length)
 {
-    int16_t string_length;
-    char* ret = NULL;
-
-    READ_GENERIC(&string_length, sizeof string_length, swapped_memscan, goto parse_error);
+    uint64_t n = 0;
 
-    if(string_length < 0)               goto parse_error;
-    if(*length < (size_t)string_length) goto parse_error;
+    for(size_t i = 0; i < max && *length > 0; i++)
+    {
+        uint8_t byte = (uint8_t)**memory;
 
-    CHECKED_MALLOC(ret, string_length + 1, goto parse_error);
+        ++*memory;
+        --*length;
 
-    READ_GENERIC(ret, (size_t)string_length, memscan, goto parse_error);
+        n |= (uint64_t)(byte & 0x7f) << (7 * i);
 
-    ret[string_length] = '\0'; /* don't forget to NULL-terminate ;) */
-    return ret;
-
-parse_error:
-    if(errno == NBT_OK)
-        errno = NBT_ERR;
+        if(!(byte & 0x80))
+        {
+            *out = n;
+            return true;
+        }
+    }
 
-    free(ret);
-    return NULL;
+    return false;
 }
 
-static nbt_node* parse_named_tag(const char** memory, size_t* length)
+/* Zigzag encoding maps 0, -1, 1, -2... to 0, 1, 2, 3... so small negatives stay short. */
+static inline uint64_t zigzag(int64_t n)
 {
-  char* name = NULL;
-
-  uint8_t type;
-  READ_GENERIC(&type, sizeof type, memscan, goto parse_error);
-
-  name = read_string(memory, length);
-
-  nbt_node* ret = parse_unnamed_tag((nbt_type)type, name, memory, length);
-  if(ret == NULL) goto parse_error;
-
-  return ret;
-
-parse_error:
-  if(errno == NBT_OK)
-    errno = NBT_ERR;
-
-  free(name);
-  return NULL;
+    return n < 0 ? ~((uint64_t)n << 1) : (uint64_t)n << 1;
 }
 
-static struct nbt_byte_array read_byte_array(const char** memory, size_t* length)
+static bool read_zigzag32(int32_t* out, const char** memory, size_t* length)
 {
-    struct nbt_byte_array ret;
-    ret.data = NULL;
-
-    READ_GENERIC(&ret.length, sizeof ret.length, swapped_memscan, goto parse_error);
-
-    if(ret.length < 0) goto parse_error;
-
-    CHECKED_MALLOC(ret.data, ret.length, goto parse_error);
-
-    READ_GENERIC(ret.data, (size_t)ret.length, memscan, goto parse_error);
+    uint64_t n;
 
-    return ret;
-
-parse_error:
-    if(errno == NBT_OK)
-        errno = NBT_ERR;
+    if(!read_varint(&n, 5, memory, length) || n > UINT32_MAX)
+        return false;
 
-    free(ret.data);
-    ret.data = NULL;
-    return ret;
+    *out = (int32_t)((uint32_t)(n >> 1) ^ (0u - (uint32_t)(n & 1)));
+    return true;
 }
 
-static struct nbt_int_array read_int_array(const char** memory, size_t* length)
+static bool read_zigzag64(int64_t* out, const char** memory, size_t* length)
 {
-    struct nbt_int_array ret;
-    ret.data = NULL;
-
-    READ_GENERIC(&ret.length, sizeof ret.length, swapped_memscan, goto parse_error);
-
-    if(ret.length < 0) goto parse_error;
-
-    CHECKED_MALLOC(ret.data, ret.length * sizeof(int32_t), goto parse_error);
-
-    READ_GENERIC(ret.data, (size_t)ret.length * sizeof(int32_t), memscan, goto parse_error);
+    uint64_t n;
 
+    if(!read_varint(&n, 10, memory, length))
+        return false;
 
-    // Byteswap the whole array.
-    for(int32_t i = 0; i < ret.length; i++)
-        be2ne(ret.data + i, sizeof(int32_t));
-
-    return ret;
-
-parse_error:
-    if(errno == NBT_OK)
-        errno = NBT_ERR;
-
-    free(ret.data);
-    ret.data = NULL;
-    return ret;
+    *out = (int64_t)((n >> 1) ^ (0 - (n & 1)));
+    return true;
 }
 
-static struct nbt_long_array read_long_array(const char** memory, size_t* length)
+static inline size_t varint_size(uint64_t n)
 {
-    struct nbt_long_array ret;
-    ret.data = NULL;
-
-    READ_GENERIC(&ret.length, sizeof ret.length, swapped_memscan, goto parse_error);
-
-    if(ret.length < 0) goto parse_error;
+    size_t size = 1;
 
-    CHECKED_MALLOC(ret.data, ret.length * sizeof(int64_t), goto parse_error);
-
-    READ_GENERIC(ret.data, (size_t)ret.length * sizeof(int64_t), memscan, goto parse_error);
+    for(; n >= 0x80; n >>= 7)
+        size++;
 
+    return size;
+}
 
-    // Byteswap the whole array.
-    for(int32_t i = 0; i < ret.length; i++)
-        be2ne(ret.data + i, sizeof(int64_t));
+static inline void put_varint(struct nbt_writer* w, uint64_t n)
+{
+    make_room(w, varint_size(n));
 
-    return ret;
+    for(; n >= 0x80; n >>= 7)
+        *w->pos++ = (unsigned char)(n | 0x80);
 
-parse_error:
-    if(errno == NBT_OK)
-        errno = NBT_ERR;
+    *w->pos++ = (unsigned char)n;
+}
 
-    free(ret.data);
-    ret.data = NULL;
-    return ret;
+/* Frees a name which came out of read_name. */
+static void free_name(char* name, unsigned flags)
+{
+    if(!(flags & NBT_PARSE_INTERN))
+        free(name);
 }
 
 /*
@@ -285,556 +221,1173 @@ static nbt_type list_is_homogenous(const struct nbt_list* list)
     return type;
 }
 
-static struct nbt_list* read_list(const char** memory, size_t* length)
+/*
+ * Returns the type of a list's elements, or TAG_INVALID if it can't be
+ * dumped, and stores its length in `len'. Lists the library built already
+ * know both. Anything spliced by hand has to be walked and checked first.
+ */
+static nbt_type list_header(const struct nbt_list* list, int32_t* len)
+{
+    if(list_count(list) >= 0)
+    {
+        *len = list_count(list);
+        return list->data->type;
+    }
+
+    size_t n = list_length(&list->entry);
+
+    if(n > 2147483647 /* INT_MAX */)
+        return TAG_INVALID;
+
+    *len = (int32_t)n;
+    return list_is_homogenous(list);
+}
+
+
+/*
+ * Stamp out the parser and writer for each encoding. Java's copy keeps the
+ * plain names, since it's the one everything else here uses.
+ */
+#define CODEC_ENCODING NBT_ENCODING_JAVA
+#define CODEC(name) name
+#include "nbt_codec.h"
+#undef CODEC
+#undef CODEC_ENCODING
+
+#define CODEC_ENCODING NBT_ENCODING_BEDROCK
+#define CODEC(name) name##_le
+#include "nbt_codec.h"
+#undef CODEC
+#undef CODEC_ENCODING
+
+#define CODEC_ENCODING NBT_ENCODING_NETWORK
+#define CODEC(name) name##_net
+#include "nbt_codec.h"
+#undef CODEC
+#undef CODEC_ENCODING
+
+/* Each encoding's entry points, picked once per parse or dump. */
+struct codec {
+    nbt_node* (*parse)(const char** memory, size_t* length, unsigned flags);
+    nbt_status (*measure)(const nbt_node* tree, bool dump_type, size_t* size);
+    void (*write)(struct nbt_writer* w, const nbt_node* tree, bool dump_type);
+};
+
+static const struct codec codecs[] = {
+    [NBT_ENCODING_JAVA]    = { parse_named_tag,     measure_node,     write_node     },
+    [NBT_ENCODING_BEDROCK] = { parse_named_tag_le,  measure_node_le,  write_node_le  },
+    [NBT_ENCODING_NETWORK] = { parse_named_tag_net, measure_node_net, write_node_net },
+};
+
+/* Returns the codec for `encoding', or NULL if there's no such encoding. */
+static const struct codec* codec_for(nbt_encoding encoding)
 {
-    uint8_t type;
-    int32_t elems;
-    struct nbt_list* ret;
+    if((unsigned)encoding >= sizeof codecs / sizeof *codecs)
+        return NULL;
 
-    CHECKED_MALLOC(ret, sizeof *ret, goto parse_error);
+    return &codecs[encoding];
+}
 
-    /* we allocate the data pointer to store the type of the list in the first
-     * sentinel element */
-    CHECKED_MALLOC(ret->data, sizeof *ret->data, goto parse_error);
+nbt_node* nbt_parse(const void* mem, size_t len)
+{
+    return nbt_parse_ex(mem, len, NBT_PARSE_DEFAULT);
+}
 
-    INIT_LIST_HEAD(&ret->entry);
+nbt_node* nbt_parse_ex(const void* mem, size_t len, unsigned flags)
+{
+    return nbt_parse_encoded(mem, len, NBT_ENCODING_JAVA, flags);
+}
 
-    READ_GENERIC(&type, sizeof type, swapped_memscan, goto parse_error);
-    READ_GENERIC(&elems, sizeof elems, swapped_memscan, goto parse_error);
+nbt_node* nbt_parse_encoded(const void* mem, size_t len, nbt_encoding encoding, unsigned flags)
+{
+    size_t consumed;
+    return nbt_parse_prefix(mem, len, encoding, flags, &consumed);
+}
 
-    ret->data->type = type == TAG_INVALID ? TAG_COMPOUND : (nbt_type)type;
+nbt_node* nbt_parse_prefix(const void* mem, size_t len, nbt_encoding encoding, unsigned flags, size_t* consumed)
+{
+    assert(consumed);
 
-    for(int32_t i = 0; i < elems; i++)
-    {
-        struct nbt_list* new;
+    errno = NBT_OK;
+    *consumed = 0;
 
-        CHECKED_MALLOC(new, sizeof *new, goto parse_error);
+    const struct codec* codec = codec_for(encoding);
 
-        new->data = parse_unnamed_tag((nbt_type)type, NULL, memory, length);
+    if(codec == NULL)
+    {
+        errno = NBT_ERR;
+        return NULL;
+    }
 
-        if(new->data == NULL)
-        {
-            free(new);
-            goto parse_error;
-        }
+    const char** memory = (const char**)&mem;
+    size_t* length = &len;
+    size_t total = len;
 
-        list_add_tail(&new->entry, &ret->entry);
+    nbt_node* ret = codec->parse(memory, length, flags);
+
+    if(ret != NULL && (flags & NBT_PARSE_INDEX) && nbt_compound_index(ret) != NBT_OK)
+    {
+        nbt_free(ret);
+        errno = NBT_EMEM;
+        return NULL;
     }
 
+    if(ret != NULL)
+        *consumed = total - len;
+
     return ret;
+}
 
-parse_error:
-    if(errno == NBT_OK)
-        errno = NBT_ERR;
+/*
+ * The canonical form. It's the binary format, written by write_canonical
+ * instead of write_node, so it's exactly as big as the regular dump.
+ */
+
+/* Writes a scalar, with every NaN made the same and -0 made 0. */
+static void put_canonical_scalar(struct nbt_writer* w, const nbt_node* n)
+{
+    if(n->type == TAG_FLOAT)
+    {
+        float f = n->payload.tag_float;
+
+        if(f != f)       f = NAN;
+        else if(f == 0)  f = 0;
+
+        put_scalar(w, &f, sizeof f);
+    }
+    else if(n->type == TAG_DOUBLE)
+    {
+        double d = n->payload.tag_double;
 
-    nbt_free_list(ret);
-    return NULL;
+        if(d != d)       d = NAN;
+        else if(d == 0)  d = 0;
+
+        put_scalar(w, &d, sizeof d);
+    }
+    else
+        put_scalar(w, &n->payload, nbt_scalar_size(n->type));
 }
 
-static struct nbt_list* read_compound(const char** memory, size_t* length)
+/* A compound's child, and where it was, so equal names keep their order. */
+struct sorted_child {
+    const nbt_node* node;
+    size_t index;
+};
+
+static int compare_children(const void* a, const void* b)
 {
-    struct nbt_list* ret;
+    const struct sorted_child* x = a;
+    const struct sorted_child* y = b;
 
-    CHECKED_MALLOC(ret, sizeof *ret, goto parse_error);
+    int diff = strcmp(x->node->name ? x->node->name : "",
+                      y->node->name ? y->node->name : "");
 
-    ret->data = NULL;
-    INIT_LIST_HEAD(&ret->entry);
+    if(diff != 0)
+        return diff;
 
-    for(;;)
-    {
-        uint8_t type;
-        char* name = NULL;
-        struct nbt_list* new_entry;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
 
-        READ_GENERIC(&type, sizeof type, swapped_memscan, goto parse_error);
+/* Compounds this small are sorted on the stack. */
+#define SMALL_COMPOUND 32
 
-        if(type == 0) break; /* TAG_END == 0. We've hit the end of the list when type == TAG_END. */
+static nbt_status write_canonical(struct nbt_writer* w, const nbt_node* tree, bool dump_type)
+{
+    if(dump_type)
+        put_byte(w, (uint8_t)tree->type);
 
-        name = read_string(memory, length);
-        if(name == NULL) goto parse_error;
+    if(tree->name)
+        write_string(w, tree->name);
+
+    const struct list_head* pos;
+    nbt_status err;
+
+    switch(tree->type)
+    {
+    case TAG_LIST:
+        if(tree->flags & NBT_NODE_PACKED)
+        {
+            const struct nbt_packed_list* p = &tree->payload.tag_packed_list;
+            struct nbt_span span = { p->data, p->length, p->type };
 
-        CHECKED_MALLOC(new_entry, sizeof *new_entry,
-            free(name);
-            goto parse_error;
-        );
+            put_byte(w, p->length ? (uint8_t)p->type : 0);
+            put_int32(w, p->length);
 
-        new_entry->data = parse_unnamed_tag((nbt_type)type, name, memory, length);
+            for(int32_t i = 0; i < p->length; i++)
+            {
+                nbt_node elem;
 
-        if(new_entry->data == NULL)
+                nbt_span_get(&span, i, &elem);
+                put_canonical_scalar(w, &elem);
+            }
+        }
+        else
         {
-            free(new_entry);
-            free(name);
-            goto parse_error;
+            int32_t len;
+            nbt_type type = list_header(tree->payload.tag_list, &len);
+
+            /* Empty lists are all lists of TAG_End. */
+            put_byte(w, len ? (uint8_t)type : 0);
+            put_int32(w, len);
+
+            list_for_each(pos, &tree->payload.tag_list->entry)
+                if((err = write_canonical(w, list_entry(pos, const struct nbt_list, entry)->data, false)) != NBT_OK)
+                    return err;
         }
+        return NBT_OK;
 
-        list_add_tail(&new_entry->entry, &ret->entry);
-    }
+    case TAG_COMPOUND:
+        {
+            struct sorted_child small[SMALL_COMPOUND];
+            struct sorted_child* children = small;
+            size_t n = 0;
 
-    return ret;
+            size_t count = list_length(&tree->payload.tag_compound->entry);
 
-parse_error:
-    if(errno == NBT_OK)
-        errno = NBT_ERR;
-    nbt_free_list(ret);
+            if(count > SMALL_COMPOUND && (children = malloc(count * sizeof *children)) == NULL)
+                return NBT_EMEM;
 
-    return NULL;
-}
+            list_for_each(pos, &tree->payload.tag_compound->entry)
+            {
+                children[n].node  = list_entry(pos, const struct nbt_list, entry)->data;
+                children[n].index = n;
+                n++;
+            }
 
-/*
- * Parses a tag, given a name (may be NULL) and a type. Fills in the payload.
- */
-static nbt_node* parse_unnamed_tag(nbt_type type, char* name, const char** memory, size_t* length)
-{
-    nbt_node* node;
+            qsort(children, n, sizeof *children, compare_children);
 
-    CHECKED_MALLOC(node, sizeof *node, goto parse_error);
+            err = NBT_OK;
 
-    node->type = type;
-    node->name = name;
+            for(size_t i = 0; i < n && err == NBT_OK; i++)
+                err = write_canonical(w, children[i].node, true);
 
-#define COPY_INTO_PAYLOAD(payload_name) \
-    READ_GENERIC(&node->payload.payload_name, sizeof node->payload.payload_name, swapped_memscan, goto parse_error);
+            if(children != small)
+                free(children);
+
+            put_byte(w, 0); /* TAG_End */
+            return err;
+        }
 
-    switch(type)
-    {
-    case TAG_BYTE:
-        COPY_INTO_PAYLOAD(tag_byte);
-        break;
-    case TAG_SHORT:
-        COPY_INTO_PAYLOAD(tag_short);
-        break;
-    case TAG_INT:
-        COPY_INTO_PAYLOAD(tag_int);
-        break;
-    case TAG_LONG:
-        COPY_INTO_PAYLOAD(tag_long);
-        break;
     case TAG_FLOAT:
-        COPY_INTO_PAYLOAD(tag_float);
-        break;
     case TAG_DOUBLE:
-        COPY_INTO_PAYLOAD(tag_double);
-        break;
-    case TAG_BYTE_ARRAY:
-        node->payload.tag_byte_array = read_byte_array(memory, length);
-        break;
-    case TAG_INT_ARRAY:
-        node->payload.tag_int_array = read_int_array(memory, length);
-        break;
-    case TAG_LONG_ARRAY:
-        node->payload.tag_long_array = read_long_array(memory, length);
-        break;
-    case TAG_STRING:
-        node->payload.tag_string = read_string(memory, length);
-        break;
-    case TAG_LIST:
-        node->payload.tag_list = read_list(memory, length);
-        break;
-    case TAG_COMPOUND:
-        node->payload.tag_compound = read_compound(memory, length);
-        break;
+        put_canonical_scalar(w, tree);
+        return NBT_OK;
 
     default:
-        goto parse_error; /* Unknown node or TAG_END. Either way, we shouldn't be parsing this. */
+        {
+            /* Nothing else has more than one way of being written. */
+            nbt_node payload = *tree;
+
+            payload.name = NULL;
+            write_node(w, &payload, false);
+            return NBT_OK;
+        }
     }
+}
 
-#undef COPY_INTO_PAYLOAD
+nbt_status nbt_dump_canonical_to(const nbt_node* tree, struct nbt_sink* sink)
+{
+    assert(sink);
 
-    if(errno != NBT_OK) goto parse_error;
+    if(tree == NULL) return NBT_OK;
 
-    return node;
+    if(nbt_serialized_size(tree) == 0)
+        return (nbt_status)errno;
 
-parse_error:
-    if(errno == NBT_OK)
-        errno = NBT_ERR;
+    unsigned char stage[NBT_STAGE_SIZE];
+    struct nbt_writer w = { stage, stage, stage + sizeof stage, sink, NBT_OK };
 
-    free(node);
-    return NULL;
-}
+    nbt_status err = write_canonical(&w, tree, true);
+    flush_stage(&w);
 
-nbt_node* nbt_parse(const void* mem, size_t len)
-{
-    errno = NBT_OK;
+    if(err == NBT_OK)
+        err = w.err;
 
-    const char** memory = (const char**)&mem;
-    size_t* length = &len;
+    if(err == NBT_OK && sink->flush)
+        err = sink->flush(sink->ctx);
 
-    return parse_named_tag(memory, length);
+    return err;
 }
 
-/* spaces, not tabs ;) */
-static void indent(struct buffer* b, size_t amount)
+struct buffer nbt_dump_canonical(const nbt_node* tree)
 {
-    size_t spaces = amount * 4; /* 4 spaces per indent */
+    size_t size = nbt_serialized_size(tree);
 
-    char temp[spaces + 1];
+    if(size == 0)
+        return BUFFER_INIT;
 
-    for(size_t i = 0; i < spaces; ++i)
-        temp[i] = ' ';
-    temp[spaces] = '\0';
+    struct buffer ret = {
+        .data = malloc(size),
+        .len  = size,
+        .cap  = size
+    };
 
-    bprintf(b, "%s", temp);
-}
+    if(ret.data == NULL)
+    {
+        errno = NBT_EMEM;
+        return BUFFER_INIT;
+    }
+
+    struct nbt_writer w = { ret.data, ret.data, ret.data + size, NULL, NBT_OK };
+    nbt_status err = write_canonical(&w, tree, true);
 
-static nbt_status __nbt_dump_ascii(const nbt_node*, struct buffer*, size_t ident);
+    if(err != NBT_OK)
+    {
+        errno = err;
+        buffer_free(&ret);
+        return BUFFER_INIT;
+    }
 
-/* prints the node's name, or (null) if it has none. */
-#define SAFE_NAME(node) ((node)->name ? (node)->name : "<null>")
+    assert(w.pos == w.end);
+    return ret;
+}
 
-static void dump_byte_array(const struct nbt_byte_array ba, struct buffer* b)
+/*
+ * Binary dumps are done in two passes. The first one measures exactly how
+ * many bytes the tree needs, and checks that it can be dumped at all. The
+ * second one writes it out with no bounds checks and no reallocation, since by
+ * then we know everything fits.
+ */
+
+/* Measures `tree' as `codec' would write it. See nbt_serialized_size. */
+static size_t measure_tree(const nbt_node* tree, const struct codec* codec)
 {
-    assert(ba.length >= 0);
+    errno = NBT_OK;
+
+    if(tree == NULL) return 0;
+
+    size_t size = 0;
+    nbt_status err;
+
+    if((err = codec->measure(tree, true, &size)) != NBT_OK)
+    {
+        errno = err;
+        return 0;
+    }
 
-    bprintf(b, "[ ");
-    for(int32_t i = 0; i < ba.length; ++i)
-        bprintf(b, "%u ", +ba.data[i]);
-    bprintf(b, "]");
+    return size;
 }
 
-static void dump_int_array(const struct nbt_int_array ia, struct buffer* b)
+size_t nbt_serialized_size(const nbt_node* tree)
 {
-    assert(ia.length >= 0);
-
-    bprintf(b, "[ ");
-    for(int32_t i = 0; i < ia.length; ++i)
-        bprintf(b, "%u ", +ia.data[i]);
-    bprintf(b, "]");
+    return measure_tree(tree, &codecs[NBT_ENCODING_JAVA]);
 }
 
-static void dump_long_array(const struct nbt_long_array la, struct buffer* b)
+/* Writes a tree, already measured at `size' bytes, into memory that fits it. */
+static void write_tree(const nbt_node* tree, const struct codec* codec, void* buf, size_t size)
 {
-    assert(la.length >= 0);
+    struct nbt_writer w = { buf, buf, (unsigned char*)buf + size, NULL, NBT_OK };
+
+    codec->write(&w, tree, true);
 
-    bprintf(b, "[ ");
-    for(int32_t i = 0; i < la.length; ++i)
-        bprintf(b, "%u ", +la.data[i]);
-    bprintf(b, "]");
+    assert(w.pos == w.end);
 }
 
-static nbt_status dump_list_contents_ascii(const struct nbt_list* list, struct buffer* b, size_t ident)
+nbt_status nbt_dump_binary_into(const nbt_node* tree, void* buf, size_t cap, size_t* written)
 {
-    const struct list_head* pos;
+    return nbt_dump_encoded_into(tree, NBT_ENCODING_JAVA, NBT_DUMP_DEFAULT, buf, cap, written);
+}
 
-    list_for_each(pos, &list->entry)
-    {
-        const struct nbt_list* entry = list_entry(pos, const struct nbt_list, entry);
-        nbt_status err;
+nbt_status nbt_dump_encoded_into(const nbt_node* tree, nbt_encoding encoding, unsigned flags,
+                                 void* buf, size_t cap, size_t* written)
+{
+    assert(written);
 
-        if((err = __nbt_dump_ascii(entry->data, b, ident)) != NBT_OK)
-            return err;
-    }
+    const struct codec* codec = codec_for(encoding);
+
+    *written = 0;
+
+    if(codec == NULL) return NBT_ERR;
+    if(tree == NULL)  return NBT_OK;
+
+    /* The writers leave out the names of nodes which don't have one. */
+    nbt_node root = *tree;
+
+    if(flags & NBT_DUMP_NAMELESS)
+        root.name = NULL;
+
+    size_t size = measure_tree(&root, codec);
+
+    *written = size;
+
+    if(size == 0)
+        return (nbt_status)errno;
 
+    if(size > cap)
+        return NBT_EMEM;
+
+    write_tree(&root, codec, buf, size);
     return NBT_OK;
 }
 
-static nbt_status __nbt_dump_ascii(const nbt_node* tree, struct buffer* b, size_t ident)
+struct buffer nbt_dump_binary(const nbt_node* tree)
 {
-    if(tree == NULL) return NBT_OK;
+    return nbt_dump_encoded(tree, NBT_ENCODING_JAVA);
+}
 
-    indent(b, ident);
+struct buffer nbt_dump_encoded(const nbt_node* tree, nbt_encoding encoding)
+{
+    const struct codec* codec = codec_for(encoding);
 
-    if(tree->type == TAG_BYTE)
-        bprintf(b, "TAG_Byte(\"%s\"): %i\n", SAFE_NAME(tree), (int)tree->payload.tag_byte);
-    else if(tree->type == TAG_SHORT)
-        bprintf(b, "TAG_Short(\"%s\"): %i\n", SAFE_NAME(tree), (int)tree->payload.tag_short);
-    else if(tree->type == TAG_INT)
-        bprintf(b, "TAG_Int(\"%s\"): %i\n", SAFE_NAME(tree), (int)tree->payload.tag_int);
-    else if(tree->type == TAG_LONG)
-        bprintf(b, "TAG_Long(\"%s\"): %" PRIi64 "\n", SAFE_NAME(tree), tree->payload.tag_long);
-    else if(tree->type == TAG_FLOAT)
-        bprintf(b, "TAG_Float(\"%s\"): %f\n", SAFE_NAME(tree), (double)tree->payload.tag_float);
-    else if(tree->type == TAG_DOUBLE)
-        bprintf(b, "TAG_Double(\"%s\"): %f\n", SAFE_NAME(tree), tree->payload.tag_double);
-    else if(tree->type == TAG_BYTE_ARRAY)
-    {
-        bprintf(b, "TAG_Byte_Array(\"%s\"): ", SAFE_NAME(tree));
-        dump_byte_array(tree->payload.tag_byte_array, b);
-        bprintf(b, "\n");
-    }
-    else if(tree->type == TAG_INT_ARRAY)
+    if(codec == NULL)
     {
-        bprintf(b, "Tag_Int_Array(\"%s\"): ", SAFE_NAME(tree));
-        dump_int_array(tree->payload.tag_int_array, b);
-        bprintf(b, "\n");
+        errno = NBT_ERR;
+        return BUFFER_INIT;
     }
-    else if(tree->type == TAG_LONG_ARRAY)
+
+    size_t size = measure_tree(tree, codec);
+
+    if(size == 0)
+        return BUFFER_INIT;
+
+    struct buffer ret = {
+        .data = malloc(size),
+        .len  = size,
+        .cap  = size
+    };
+
+    if(ret.data == NULL)
     {
-        bprintf(b, "Tag_Long_Array(\"%s\"): ", SAFE_NAME(tree));
-        dump_long_array(tree->payload.tag_long_array, b);
-        bprintf(b, "\n");
+        errno = NBT_EMEM;
+        return BUFFER_INIT;
     }
-    else if(tree->type == TAG_STRING)
-    {
-        if(tree->payload.tag_string == NULL)
-            return NBT_ERR;
 
-        bprintf(b, "TAG_String(\"%s\"): %s\n", SAFE_NAME(tree), tree->payload.tag_string);
-    }
-    else if(tree->type == TAG_LIST)
-    {
-        bprintf(b, "TAG_List(\"%s\") [%s]\n", SAFE_NAME(tree), nbt_type_to_string(tree->payload.tag_list->data->type));
-        indent(b, ident);
-        bprintf(b, "{\n");
+    write_tree(tree, codec, ret.data, size);
+    return ret;
+}
 
-        nbt_status err = dump_list_contents_ascii(tree->payload.tag_list, b, ident + 1);
+nbt_status nbt_dump_binary_to(const nbt_node* tree, struct nbt_sink* sink)
+{
+    return nbt_dump_encoded_to(tree, NBT_ENCODING_JAVA, sink);
+}
 
-        indent(b, ident);
-        bprintf(b, "}\n");
+nbt_status nbt_dump_encoded_to(const nbt_node* tree, nbt_encoding encoding, struct nbt_sink* sink)
+{
+    assert(sink);
 
-        if(err != NBT_OK)
-            return err;
-    }
-    else if(tree->type == TAG_COMPOUND)
-    {
-        bprintf(b, "TAG_Compound(\"%s\")\n", SAFE_NAME(tree));
-        indent(b, ident);
-        bprintf(b, "{\n");
+    const struct codec* codec = codec_for(encoding);
 
-        nbt_status err = dump_list_contents_ascii(tree->payload.tag_compound, b, ident + 1);
+    if(codec == NULL) return NBT_ERR;
+    if(tree == NULL)  return NBT_OK;
 
-        indent(b, ident);
-        bprintf(b, "}\n");
+    /* Make sure the whole thing can be dumped before we write any of it. */
+    if(measure_tree(tree, codec) == 0)
+        return (nbt_status)errno;
 
-        if(err != NBT_OK)
-            return err;
-    }
+    unsigned char stage[NBT_STAGE_SIZE];
+    struct nbt_writer w = { stage, stage, stage + sizeof stage, sink, NBT_OK };
 
-    else
-        return NBT_ERR;
+    codec->write(&w, tree, true);
+    flush_stage(&w);
 
-    return NBT_OK;
+    if(w.err == NBT_OK && sink->flush)
+        w.err = sink->flush(sink->ctx);
+
+    return w.err;
 }
 
-char* nbt_dump_ascii(const nbt_node* tree)
+/* Dumps `tree' with `dump' into a fresh null-terminated string. */
+static char* dump_to_string(const nbt_node* tree, nbt_status (*dump)(const nbt_node*, struct nbt_sink*))
 {
     errno = NBT_OK;
 
     assert(tree);
 
     struct buffer b = BUFFER_INIT;
+    struct nbt_sink sink = nbt_sink_buffer(&b);
 
-    if((errno = __nbt_dump_ascii(tree, &b, 0)) != NBT_OK) goto OOM;
-    if(         buffer_reserve(&b, b.len + 1))            goto OOM;
+    nbt_status err = dump(tree, &sink);
 
-    b.data[b.len] = '\0'; /* null-terminate that biatch, since bprintf doesn't
-                             do that for us. */
+    if(err == NBT_OK && buffer_reserve(&b, b.len + 1))
+        err = NBT_EMEM;
 
-    return (char*)b.data;
+    if(err != NBT_OK)
+    {
+        errno = err;
+        buffer_free(&b);
+        return NULL;
+    }
 
-OOM:
-    if(errno != NBT_OK)
-        errno = NBT_EMEM;
+    b.data[b.len] = '\0'; /* the writer doesn't null-terminate for us */
 
-    buffer_free(&b);
-    return NULL;
+    return (char*)b.data;
 }
 
-static nbt_status dump_byte_array_binary(const struct nbt_byte_array ba, struct buffer* b)
+/*
+ * Ascii dumps go through the same writer as binary ones, so they stream to a
+ * sink just the same. Numbers are formatted by hand: going through printf for
+ * each one used to be most of the cost.
+ */
+
+static const char digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+char* _nbt_format_uint(char* out, uint64_t n)
 {
-    int32_t dumped_length = ba.length;
+    char tmp[20];
+    char* p = tmp + sizeof tmp;
 
-    ne2be(&dumped_length, sizeof dumped_length);
+    while(n >= 100)
+    {
+        p -= 2;
+        memcpy(p, digit_pairs + (n % 100) * 2, 2);
+        n /= 100;
+    }
 
-    CHECKED_APPEND(b, &dumped_length, sizeof dumped_length);
+    if(n >= 10)
+    {
+        p -= 2;
+        memcpy(p, digit_pairs + n * 2, 2);
+    }
+    else
+        *--p = (char)('0' + n);
 
-    if(ba.length) assert(ba.data);
+    size_t len = tmp + sizeof tmp - p;
+    memcpy(out, p, len);
 
-    CHECKED_APPEND(b, ba.data, ba.length);
+    return out + len;
+}
 
-    return NBT_OK;
+char* _nbt_format_int(char* out, int64_t n)
+{
+    if(n < 0)
+    {
+        *out++ = '-';
+        return _nbt_format_uint(out, -(uint64_t)n);
+    }
+
+    return _nbt_format_uint(out, (uint64_t)n);
 }
 
-static nbt_status dump_int_array_binary(const struct nbt_int_array ia, struct buffer* b)
+/*
+ * As few digits as it takes to read it back exactly. Whole numbers are common
+ * enough to get formatted by hand. There's always a dot, so it can't be taken
+ * for an integer.
+ */
+char* _nbt_format_real(char* out, double x, bool single)
 {
-    int32_t dumped_length = ia.length;
+    assert(x == x && x != INFINITY && x != -INFINITY);
+
+    if(x > -9e15 && x < 9e15 && x == (double)(int64_t)x)
+    {
+        if(signbit(x))
+            *out++ = '-';
+
+        out = _nbt_format_uint(out, (uint64_t)fabs(x));
+
+        *out++ = '.';
+        *out++ = '0';
+
+        return out;
+    }
 
-    ne2be(&dumped_length, sizeof dumped_length);
+    char tmp[40];
+    int len = snprintf(tmp, sizeof tmp, "%.*g", single ? 6 : 15, x);
 
-    CHECKED_APPEND(b, &dumped_length, sizeof dumped_length);
+    if(single ? strtof(tmp, NULL) != (float)x : strtod(tmp, NULL) != x)
+        len = snprintf(tmp, sizeof tmp, "%.*g", single ? 9 : 17, x);
 
-    if(ia.length) assert(ia.data);
+    char* exp = memchr(tmp, 'e', len);
 
-    for(int32_t i = 0; i < ia.length; i++)
+    if(memchr(tmp, '.', len) == NULL)
     {
-        int32_t swappedElem = ia.data[i];
-        ne2be(&swappedElem, sizeof(swappedElem));
-        CHECKED_APPEND(b, &swappedElem, sizeof(swappedElem));
+        /* 1e+20 becomes 1.0e+20 */
+        size_t at = exp ? (size_t)(exp - tmp) : (size_t)len;
+
+        memmove(tmp + at + 2, tmp + at, len - at);
+        memcpy(tmp + at, ".0", 2);
+        len += 2;
     }
 
-    return NBT_OK;
+    memcpy(out, tmp, len);
+    return out + len;
 }
 
-static nbt_status dump_long_array_binary(const struct nbt_long_array la, struct buffer* b)
+/*
+ * Writes `x' at `out' just like printf's "%f" would, and returns the end of it.
+ *
+ * That takes rounding x * 10^6 to the nearest integer, with ties going to the
+ * even one, which needs the exact product. We get it as the unevaluated sum
+ * `hi' + `lo' with Dekker's trick: 10^6 has only 14 significant bits, so once
+ * `x' is split in halves, every partial product is exact.
+ *
+ * Returns NULL without writing anything if `x' is too big for that (or not a
+ * number at all), in which case printf has to do it.
+ */
+static char* format_fixed(char* out, double x)
 {
-    int32_t dumped_length = la.length;
+    if(FLT_EVAL_METHOD != 0 || !(x > -4e9 && x < 4e9))
+        return NULL;
+
+    if(signbit(x))
+    {
+        *out++ = '-';
+        x = -x;
+    }
+
+    double hi = x * 1e6;
 
-    ne2be(&dumped_length, sizeof dumped_length);
+    double big  = x * 134217729.0; /* 2^27 + 1 */
+    double x_hi = big - (big - x);
+    double x_lo = x - x_hi;
+    double lo   = (x_hi * 1e6 - hi) + x_lo * 1e6;
 
-    CHECKED_APPEND(b, &dumped_length, sizeof dumped_length);
+    /* hi < 2^52, so both of these are exact. */
+    uint64_t n = (uint64_t)hi;
+    double past_half = (hi - (double)n) - 0.5;
 
-    if(la.length) assert(la.data);
+    /* `lo' is smaller than the gap to the halfway mark, unless we're on it. */
+    if(past_half > 0 || (past_half == 0 && (lo > 0 || (lo == 0 && (n & 1)))))
+        n++;
 
-    for(int32_t i = 0; i < la.length; i++)
+    out = _nbt_format_uint(out, n / 1000000);
+    *out++ = '.';
+
+    uint32_t frac = n % 1000000;
+
+    for(int i = 5; i >= 0; i--)
     {
-        int64_t swappedElem = la.data[i];
-        ne2be(&swappedElem, sizeof(swappedElem));
-        CHECKED_APPEND(b, &swappedElem, sizeof(swappedElem));
+        out[i] = (char)('0' + frac % 10);
+        frac /= 10;
     }
 
-    return NBT_OK;
+    return out + 6;
 }
 
-static nbt_status dump_string_binary(const char* name, struct buffer* b)
+static void put_fixed(struct nbt_writer* w, double x)
 {
-    assert(name);
+    make_room(w, NBT_NUMBER_ROOM);
 
-    size_t len = strlen(name);
+    char* end = format_fixed((char*)w->pos, x);
 
-    if(len > 32767 /* SHORT_MAX */)
-        return NBT_ERR;
+    if(end != NULL)
+    {
+        w->pos = (unsigned char*)end;
+        return;
+    }
 
-    { /* dump the length */
-        int16_t dumped_len = (int16_t)len;
-        ne2be(&dumped_len, sizeof dumped_len);
+    char tmp[512]; /* "%f" of DBL_MAX is 316 characters long */
+    int len = snprintf(tmp, sizeof tmp, "%f", x);
 
-        CHECKED_APPEND(b, &dumped_len, sizeof dumped_len);
-    }
+    put_raw(w, tmp, len);
+}
 
-    CHECKED_APPEND(b, name, len);
+/* spaces, not tabs ;) */
+static void put_indent(struct nbt_writer* w, size_t amount)
+{
+    static const char spaces[] = "                                                                ";
 
-    return NBT_OK;
+    size_t n = amount * 4; /* 4 spaces per indent */
+
+    while(n > 0)
+    {
+        size_t chunk = n < sizeof spaces - 1 ? n : sizeof spaces - 1;
+
+        put_raw(w, spaces, chunk);
+        n -= chunk;
+    }
 }
 
-static nbt_status __dump_binary(const nbt_node*, bool, struct buffer*);
+/* Writes something like `TAG_Int("name")'. */
+static void put_label(struct nbt_writer* w, const char* tag, const nbt_node* tree)
+{
+    put_str(w, tag);
+    put_literal(w, "(\"");
+    put_str(w, tree->name ? tree->name : "<null>");
+    put_literal(w, "\")");
+}
 
-static nbt_status dump_list_binary(const struct nbt_list* list, struct buffer* b)
+/* The most room an array element can take: 20 digits and a space. */
+#define ELEMENT_ROOM 21
+
+/*
+ * Writes an array of `type', with every element followed by a space. As many
+ * elements as are sure to fit in the staging area are formatted in one go.
+ * Anything past `limit' is just counted.
+ */
+static void put_array(struct nbt_writer* w, const void* data, int32_t length, nbt_type type, size_t limit)
 {
-    nbt_type type = list_is_homogenous(list);
+    assert(length >= 0);
 
-    size_t len = list_length(&list->entry);
+    size_t shown = length;
+    if(limit != 0 && limit < shown)
+        shown = limit;
 
-    if(len > 2147483647 /* INT_MAX */)
-        return NBT_ERR;
+    put_literal(w, "[ ");
 
-    assert(type != TAG_INVALID);
+    for(size_t i = 0; i < shown; )
+    {
+        size_t stop = i + (w->end - w->pos) / ELEMENT_ROOM;
 
-    if(type == TAG_INVALID)
-        return NBT_ERR;
+        if(stop == i)
+        {
+            flush_stage(w);
+            continue;
+        }
+
+        if(stop > shown) stop = shown;
+
+        char* out = (char*)w->pos;
 
+        /* Every element is printed unsigned, as it always has been. */
+        switch(type)
+        {
+        case TAG_BYTE_ARRAY:
+            for(; i < stop; i++, *out++ = ' ')
+                out = _nbt_format_uint(out, ((const unsigned char*)data)[i]);
+            break;
+
+        case TAG_INT_ARRAY:
+            for(; i < stop; i++, *out++ = ' ')
+                out = _nbt_format_uint(out, (uint32_t)((const int32_t*)data)[i]);
+            break;
+
+        default:
+            for(; i < stop; i++, *out++ = ' ')
+                out = _nbt_format_uint(out, (uint64_t)((const int64_t*)data)[i]);
+            break;
+        }
+
+        w->pos = (unsigned char*)out;
+    }
+
+    if(shown < (size_t)length)
     {
-        int8_t _type = (int8_t)type;
-        ne2be(&_type, sizeof _type); /* unnecessary, but left in to keep similar code looking similar */
-        CHECKED_APPEND(b, &_type, sizeof _type);
+        put_literal(w, "... ");
+        put_uint(w, (size_t)length - shown);
+        put_literal(w, " more ");
     }
 
+    put_literal(w, "]");
+}
+
+static const struct nbt_ascii_options default_ascii_options = { 0, 0 };
+
+static nbt_status write_ascii(struct nbt_writer* w, const nbt_node* tree, size_t ident, const struct nbt_ascii_options* opts);
+
+/* Writes a list's or compound's `{ ... }' block, with its contents if there's room. */
+static nbt_status write_ascii_block(struct nbt_writer* w, const nbt_node* tree, size_t ident, const struct nbt_ascii_options* opts)
+{
+    put_indent(w, ident);
+
+    if(opts->max_depth != 0 && ident + 1 >= opts->max_depth)
     {
-        int32_t dumped_len = (int32_t)len;
-        ne2be(&dumped_len, sizeof dumped_len);
-        CHECKED_APPEND(b, &dumped_len, sizeof dumped_len);
+        put_literal(w, "{ ... }\n");
+        return NBT_OK;
     }
 
-    const struct list_head* pos;
-    list_for_each(pos, &list->entry)
+    put_literal(w, "{\n");
+
+    nbt_status err = NBT_OK;
+
+    if(tree->flags & NBT_NODE_PACKED)
+    {
+        /* Packed elements are dumped just like the nodes they'd otherwise be. */
+        const struct nbt_packed_list* list = &tree->payload.tag_packed_list;
+        struct nbt_span span = { list->data, list->length, list->type };
+
+        for(int32_t i = 0; i < list->length && err == NBT_OK; i++)
+        {
+            nbt_node elem;
+
+            nbt_span_get(&span, i, &elem);
+            err = write_ascii(w, &elem, ident + 1, opts);
+        }
+    }
+    else
     {
-        const struct nbt_list* entry = list_entry(pos, const struct nbt_list, entry);
-        nbt_status ret;
+        const struct nbt_list* list = tree->type == TAG_LIST ? tree->payload.tag_list
+                                                             : tree->payload.tag_compound;
+        const struct list_head* pos;
 
-        if((ret = __dump_binary(entry->data, false, b)) != NBT_OK)
-            return ret;
+        list_for_each(pos, &list->entry)
+            if((err = write_ascii(w, list_entry(pos, const struct nbt_list, entry)->data, ident + 1, opts)) != NBT_OK)
+                break;
     }
 
-    return NBT_OK;
+    put_indent(w, ident);
+    put_literal(w, "}\n");
+
+    return err;
 }
 
-static nbt_status dump_compound_binary(const struct nbt_list* list, struct buffer* b)
+static nbt_status write_ascii(struct nbt_writer* w, const nbt_node* tree, size_t ident, const struct nbt_ascii_options* opts)
 {
-    const struct list_head* pos;
-    list_for_each(pos, &list->entry)
+    if(tree == NULL) return NBT_OK;
+
+    put_indent(w, ident);
+
+    switch(tree->type)
     {
-        const struct nbt_list* entry = list_entry(pos, const struct nbt_list, entry);
-        nbt_status ret;
+    case TAG_BYTE:
+        put_label(w, "TAG_Byte", tree);
+        put_literal(w, ": ");
+        put_int(w, tree->payload.tag_byte);
+        break;
 
-        if((ret = __dump_binary(entry->data, true, b)) != NBT_OK)
-            return ret;
-    }
+    case TAG_SHORT:
+        put_label(w, "TAG_Short", tree);
+        put_literal(w, ": ");
+        put_int(w, tree->payload.tag_short);
+        break;
 
-    /* write out TAG_End */
-    uint8_t zero = 0;
-    CHECKED_APPEND(b, &zero, sizeof zero);
+    case TAG_INT:
+        put_label(w, "TAG_Int", tree);
+        put_literal(w, ": ");
+        put_int(w, tree->payload.tag_int);
+        break;
+
+    case TAG_LONG:
+        put_label(w, "TAG_Long", tree);
+        put_literal(w, ": ");
+        put_int(w, tree->payload.tag_long);
+        break;
+
+    case TAG_FLOAT:
+        put_label(w, "TAG_Float", tree);
+        put_literal(w, ": ");
+        put_fixed(w, tree->payload.tag_float);
+        break;
+
+    case TAG_DOUBLE:
+        put_label(w, "TAG_Double", tree);
+        put_literal(w, ": ");
+        put_fixed(w, tree->payload.tag_double);
+        break;
+
+    case TAG_BYTE_ARRAY:
+        put_label(w, "TAG_Byte_Array", tree);
+        put_literal(w, ": ");
+        put_array(w, tree->payload.tag_byte_array.data, tree->payload.tag_byte_array.length,
+                  TAG_BYTE_ARRAY, opts->max_elements);
+        break;
+
+    case TAG_INT_ARRAY:
+        put_label(w, "Tag_Int_Array", tree);
+        put_literal(w, ": ");
+        put_array(w, tree->payload.tag_int_array.data, tree->payload.tag_int_array.length,
+                  TAG_INT_ARRAY, opts->max_elements);
+        break;
+
+    case TAG_LONG_ARRAY:
+        put_label(w, "Tag_Long_Array", tree);
+        put_literal(w, ": ");
+        put_array(w, tree->payload.tag_long_array.data, tree->payload.tag_long_array.length,
+                  TAG_LONG_ARRAY, opts->max_elements);
+        break;
+
+    case TAG_STRING:
+        if(tree->payload.tag_string == NULL)
+            return NBT_ERR;
+
+        put_label(w, "TAG_String", tree);
+        put_literal(w, ": ");
+        put_str(w, tree->payload.tag_string);
+        break;
+
+    case TAG_LIST:
+        {
+            bool packed = tree->flags & NBT_NODE_PACKED;
+            nbt_type type = packed ? tree->payload.tag_packed_list.type : tree->payload.tag_list->data->type;
+
+            put_label(w, "TAG_List", tree);
+            put_literal(w, " [");
+            put_str(w, nbt_type_to_string(type));
+            put_literal(w, "]\n");
+
+            return write_ascii_block(w, tree, ident, opts);
+        }
+
+    case TAG_COMPOUND:
+        put_label(w, "TAG_Compound", tree);
+        put_literal(w, "\n");
+
+        return write_ascii_block(w, tree, ident, opts);
+
+    default:
+        return NBT_ERR;
+    }
 
+    put_literal(w, "\n");
     return NBT_OK;
 }
 
+nbt_status nbt_dump_ascii_ex(const nbt_node* tree, const struct nbt_ascii_options* opts, struct nbt_sink* sink)
+{
+    assert(tree);
+    assert(sink);
+
+    if(opts == NULL)
+        opts = &default_ascii_options;
+
+    unsigned char stage[NBT_STAGE_SIZE];
+    struct nbt_writer w = { stage, stage, stage + sizeof stage, sink, NBT_OK };
+
+    nbt_status err = write_ascii(&w, tree, 0, opts);
+    flush_stage(&w);
+
+    if(err == NBT_OK)
+        err = w.err;
+
+    if(err == NBT_OK && sink->flush)
+        err = sink->flush(sink->ctx);
+
+    return err;
+}
+
+nbt_status nbt_dump_ascii_to(const nbt_node* tree, struct nbt_sink* sink)
+{
+    return nbt_dump_ascii_ex(tree, NULL, sink);
+}
+
+char* nbt_dump_ascii(const nbt_node* tree)
+{
+    return dump_to_string(tree, nbt_dump_ascii_to);
+}
+
 /*
- * @param dump_type   Should we dump the type, or just skip it? We need to skip
- *                    when dumping lists, because the list header already says
- *                    the type.
+ * SNBT is written the way the game writes it: all on one line, with a suffix
+ * on every number but ints, and keys only quoted when they have to be.
  */
-static nbt_status __dump_binary(const nbt_node* tree, bool dump_type, struct buffer* b)
+
+/* Writes `s' in double quotes, escaping whatever would end it early. */
+static void put_quoted(struct nbt_writer* w, const char* s)
 {
-    if(dump_type)
-    { /* write out the type */
-        int8_t type = (int8_t)tree->type;
+    put_literal(w, "\"");
+
+    for(const char* run = s; ; s++)
+    {
+        if(*s == '"' || *s == '\\' || *s == '\0')
+        {
+            put_raw(w, run, s - run);
+
+            if(*s == '\0')
+                break;
 
-        CHECKED_APPEND(b, &type, sizeof type);
+            put_byte(w, '\\');
+            run = s;
+        }
     }
 
-    if(tree->name)
+    put_literal(w, "\"");
+}
+
+static void put_key(struct nbt_writer* w, const char* name)
+{
+    const char* s = name ? name : "";
+
+    while(snbt_bare_char(*s))
+        s++;
+
+    if(*s == '\0' && s != name)
+        put_raw(w, name, s - name);
+    else
+        put_quoted(w, name ? name : "");
+}
+
+/* Writes a float or double with its suffix, spelling out the ones which aren't finite like the game does. */
+static void put_real(struct nbt_writer* w, double x, bool single)
+{
+    if(x != x || x == INFINITY || x == -INFINITY)
+        put_str(w, x != x ? "NaN" : x > 0 ? "Infinity" : "-Infinity");
+    else
     {
-        nbt_status err;
+        make_room(w, NBT_NUMBER_ROOM);
+        w->pos = (unsigned char*)_nbt_format_real((char*)w->pos, x, single);
+    }
 
-        if((err = dump_string_binary(tree->name, b)) != NBT_OK)
-            return err;
+    put_byte(w, single ? 'f' : 'd');
+}
+
+/* The most room an SNBT array element can take: a sign, 19 digits, a suffix and a comma. */
+#define SNBT_ELEMENT_ROOM 22
+
+/* Writes an array's elements, separated by commas. As many as fit are formatted in one go. */
+static void put_snbt_array(struct nbt_writer* w, const void* data, int32_t length, nbt_type type)
+{
+    assert(length >= 0);
+
+    put_str(w, type == TAG_BYTE_ARRAY ? "[B;" : type == TAG_INT_ARRAY ? "[I;" : "[L;");
+
+    for(int32_t i = 0; i < length; )
+    {
+        int32_t stop = i + (int32_t)((w->end - w->pos) / SNBT_ELEMENT_ROOM);
+
+        if(stop == i)
+        {
+            flush_stage(w);
+            continue;
+        }
+
+        if(stop > length) stop = length;
+
+        char* out = (char*)w->pos;
+
+        for(; i < stop; i++)
+        {
+            if(i > 0) *out++ = ',';
+
+            switch(type)
+            {
+            case TAG_BYTE_ARRAY:
+                out = _nbt_format_int(out, (int8_t)((const unsigned char*)data)[i]);
+                *out++ = 'b';
+                break;
+
+            case TAG_INT_ARRAY:
+                out = _nbt_format_int(out, ((const int32_t*)data)[i]);
+                break;
+
+            default:
+                out = _nbt_format_int(out, ((const int64_t*)data)[i]);
+                *out++ = 'L';
+                break;
+            }
+        }
+
+        w->pos = (unsigned char*)out;
     }
 
-#define DUMP_NUM(type, x) do {               \
-    type temp = x;                           \
-    ne2be(&temp, sizeof temp);               \
-    CHECKED_APPEND(b, &temp, sizeof temp);   \
-} while(0)
+    put_literal(w, "]");
+}
 
-    if(tree->type == TAG_BYTE)
-        DUMP_NUM(int8_t, tree->payload.tag_byte);
-    else if(tree->type == TAG_SHORT)
-        DUMP_NUM(int16_t, tree->payload.tag_short);
-    else if(tree->type == TAG_INT)
-        DUMP_NUM(int32_t, tree->payload.tag_int);
-    else if(tree->type == TAG_LONG)
-        DUMP_NUM(int64_t, tree->payload.tag_long);
-    else if(tree->type == TAG_FLOAT)
-        DUMP_NUM(float, tree->payload.tag_float);
-    else if(tree->type == TAG_DOUBLE)
-        DUMP_NUM(double, tree->payload.tag_double);
-    else if(tree->type == TAG_BYTE_ARRAY)
-        return dump_byte_array_binary(tree->payload.tag_byte_array, b);
-    else if(tree->type == TAG_INT_ARRAY)
-        return dump_int_array_binary(tree->payload.tag_int_array, b);
-    else if(tree->type == TAG_LONG_ARRAY)
-        return dump_long_array_binary(tree->payload.tag_long_array, b);
-    else if(tree->type == TAG_STRING)
-        return dump_string_binary(tree->payload.tag_string, b);
-    else if(tree->type == TAG_LIST)
-        return dump_list_binary(tree->payload.tag_list, b);
-    else if(tree->type == TAG_COMPOUND)
-        return dump_compound_binary(tree->payload.tag_compound, b);
+static nbt_status write_snbt(struct nbt_writer* w, const nbt_node* tree)
+{
+    const struct list_head* pos;
+    nbt_status err;
 
-    else
+    switch(tree->type)
+    {
+    case TAG_BYTE:
+        put_int(w, tree->payload.tag_byte);
+        put_byte(w, 'b');
+        break;
+
+    case TAG_SHORT:
+        put_int(w, tree->payload.tag_short);
+        put_byte(w, 's');
+        break;
+
+    case TAG_INT:
+        put_int(w, tree->payload.tag_int);
+        break;
+
+    case TAG_LONG:
+        put_int(w, tree->payload.tag_long);
+        put_byte(w, 'L');
+        break;
+
+    case TAG_FLOAT:
+        put_real(w, tree->payload.tag_float, true);
+        break;
+
+    case TAG_DOUBLE:
+        put_real(w, tree->payload.tag_double, false);
+        break;
+
+    case TAG_BYTE_ARRAY:
+        put_snbt_array(w, tree->payload.tag_byte_array.data,
+                          tree->payload.tag_byte_array.length, TAG_BYTE_ARRAY);
+        break;
+
+    case TAG_INT_ARRAY:
+        put_snbt_array(w, tree->payload.tag_int_array.data,
+                          tree->payload.tag_int_array.length, TAG_INT_ARRAY);
+        break;
+
+    case TAG_LONG_ARRAY:
+        put_snbt_array(w, tree->payload.tag_long_array.data,
+                          tree->payload.tag_long_array.length, TAG_LONG_ARRAY);
+        break;
+
+    case TAG_STRING:
+        if(tree->payload.tag_string == NULL)
+            return NBT_ERR;
+
+        put_quoted(w, tree->payload.tag_string);
+        break;
+
+    case TAG_LIST:
+        put_literal(w, "[");
+
+        if(tree->flags & NBT_NODE_PACKED)
+        {
+            const struct nbt_packed_list* list = &tree->payload.tag_packed_list;
+            struct nbt_span span = { list->data, list->length, list->type };
+
+            for(int32_t i = 0; i < list->length; i++)
+            {
+                nbt_node elem;
+
+                nbt_span_get(&span, i, &elem);
+
+                if(i > 0) put_literal(w, ",");
+                if((err = write_snbt(w, &elem)) != NBT_OK)
+                    return err;
+            }
+        }
+        else
+            list_for_each(pos, &tree->payload.tag_list->entry)
+            {
+                if(pos != tree->payload.tag_list->entry.flink) put_literal(w, ",");
+                if((err = write_snbt(w, list_entry(pos, const struct nbt_list, entry)->data)) != NBT_OK)
+                    return err;
+            }
+
+        put_literal(w, "]");
+        break;
+
+    case TAG_COMPOUND:
+        put_literal(w, "{");
+
+        list_for_each(pos, &tree->payload.tag_compound->entry)
+        {
+            const nbt_node* child = list_entry(pos, const struct nbt_list, entry)->data;
+
+            if(pos != tree->payload.tag_compound->entry.flink) put_literal(w, ",");
+
+            put_key(w, child->name);
+            put_literal(w, ":");
+
+            if((err = write_snbt(w, child)) != NBT_OK)
+                return err;
+        }
+
+        put_literal(w, "}");
+        break;
+
+    default:
         return NBT_ERR;
+    }
 
     return NBT_OK;
-
-#undef DUMP_NUM
 }
 
-struct buffer nbt_dump_binary(const nbt_node* tree)
+nbt_status nbt_dump_snbt_to(const nbt_node* tree, struct nbt_sink* sink)
 {
-    errno = NBT_OK;
+    assert(tree);
+    assert(sink);
 
-    if(tree == NULL) return BUFFER_INIT;
+    unsigned char stage[NBT_STAGE_SIZE];
+    struct nbt_writer w = { stage, stage, stage + sizeof stage, sink, NBT_OK };
 
-    struct buffer ret = BUFFER_INIT;
+    nbt_status err = write_snbt(&w, tree);
+    flush_stage(&w);
 
-    errno = __dump_binary(tree, true, &ret);
+    if(err == NBT_OK)
+        err = w.err;
 
-    return ret;
+    if(err == NBT_OK && sink->flush)
+        err = sink->flush(sink->ctx);
+
+    return err;
+}
+
+char* nbt_dump_snbt(const nbt_node* tree)
+{
+    return dump_to_string(tree, nbt_dump_snbt_to);
 }
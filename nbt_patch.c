@@ -0,0 +1,213 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#include "nbt.h"
+#include "nbt_internal.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Finding and overwriting tags in binary NBT. Paths are looked up with the
+ * event parser, skipping every subtree whose name doesn't match, so nothing
+ * is allocated. Patches never change the size of anything, so the rest of
+ * the buffer stays where it was.
+ */
+
+bool _nbt_part_matches(const struct nbt_path_part* part, const struct nbt_event* ev)
+{
+    return part->len == ev->name_len && (part->len == 0 || memcmp(part->name, ev->name, part->len) == 0);
+}
+
+nbt_status nbt_locate(const void* memory, size_t length, const char* path, struct nbt_event* ev)
+{
+    assert(path);
+    assert(ev);
+
+    struct nbt_path_part stack[NBT_PATH_PARTS_ON_STACK];
+    size_t n;
+
+    struct nbt_path_part* parts = _nbt_split_parts(path, stack, &n);
+    struct nbt_reader* r = parts ? malloc(sizeof *r) : NULL;
+
+    if(r == NULL)
+    {
+        if(parts) _nbt_free_parts(parts, stack);
+        return NBT_EMEM;
+    }
+
+    nbt_reader_init(r, memory, length);
+
+    /* How many of the parts the tags we're inside of have matched. */
+    size_t matched = 0;
+    nbt_status err;
+
+    while((err = nbt_reader_next(r, ev)) == NBT_OK && ev->kind != NBT_EVENT_DONE)
+    {
+        if(ev->kind == NBT_EVENT_END)
+        {
+            /* Everything deeper was skipped, so this has to be one we matched. */
+            matched--;
+            continue;
+        }
+
+        if(ev->depth == matched && _nbt_part_matches(&parts[matched], ev))
+        {
+            if(matched == n - 1)
+                break;
+
+            if(ev->kind == NBT_EVENT_BEGIN)
+                matched++;
+        }
+        /* Skipping eats the END too, so `matched' is left alone. */
+        else if(ev->kind == NBT_EVENT_BEGIN && (err = nbt_reader_skip(r)) != NBT_OK)
+            break;
+    }
+
+    free(r);
+    _nbt_free_parts(parts, stack);
+    return err;
+}
+
+/* Finds a tag to patch, which has to be there and of one of `types'. */
+static nbt_status find(void* memory, size_t length, const char* path, struct nbt_event* ev,
+                       const nbt_type* types, size_t n)
+{
+    nbt_status err = nbt_locate(memory, length, path, ev);
+
+    if(err != NBT_OK)
+        return err;
+
+    if(ev->kind == NBT_EVENT_DONE)
+        return NBT_ERR;
+
+    for(size_t i = 0; i < n; i++)
+        if(ev->type == types[i])
+            return NBT_OK;
+
+    return NBT_ERR;
+}
+
+/* Writes the low `size' bytes of `n' big-endian. */
+static void store(unsigned char* p, uint64_t n, size_t size)
+{
+    for(size_t i = size; i > 0; i--, n >>= 8)
+        p[i - 1] = (unsigned char)n;
+}
+
+nbt_status nbt_patch_int(void* memory, size_t length, const char* path, int64_t value)
+{
+    static const nbt_type types[] = { TAG_BYTE, TAG_SHORT, TAG_INT, TAG_LONG };
+
+    struct nbt_event ev;
+    nbt_status err = find(memory, length, path, &ev, types, 4);
+
+    if(err != NBT_OK)
+        return err;
+
+    size_t size = nbt_scalar_size(ev.type);
+
+    /* The value has to fit in the tag as it is. */
+    if(size < 8)
+    {
+        int64_t limit = (int64_t)1 << (size * 8 - 1);
+
+        if(value < -limit || value >= limit)
+            return NBT_ERR;
+    }
+
+    store((unsigned char*)ev.payload, (uint64_t)value, size);
+    return NBT_OK;
+}
+
+nbt_status nbt_patch_real(void* memory, size_t length, const char* path, double value)
+{
+    static const nbt_type types[] = { TAG_FLOAT, TAG_DOUBLE };
+
+    struct nbt_event ev;
+    nbt_status err = find(memory, length, path, &ev, types, 2);
+
+    if(err != NBT_OK)
+        return err;
+
+    if(ev.type == TAG_FLOAT)
+    {
+        float f = (float)value;
+        uint32_t bits;
+
+        memcpy(&bits, &f, sizeof bits);
+        store((unsigned char*)ev.payload, bits, sizeof bits);
+    }
+    else
+    {
+        uint64_t bits;
+
+        memcpy(&bits, &value, sizeof bits);
+        store((unsigned char*)ev.payload, bits, sizeof bits);
+    }
+
+    return NBT_OK;
+}
+
+nbt_status nbt_patch_string(void* memory, size_t length, const char* path, const char* value)
+{
+    static const nbt_type types[] = { TAG_STRING };
+
+    assert(value);
+
+    struct nbt_event ev;
+    nbt_status err = find(memory, length, path, &ev, types, 1);
+
+    if(err != NBT_OK)
+        return err;
+
+    if(strlen(value) != (size_t)ev.length)
+        return NBT_ERR;
+
+    memcpy((void*)ev.payload, value, (size_t)ev.length);
+    return NBT_OK;
+}
+
+nbt_status nbt_patch_array(void* memory, size_t length, const char* path,
+                           nbt_type type, const void* data, int32_t count)
+{
+    assert(data || count == 0);
+
+    struct nbt_event ev;
+    nbt_status err = find(memory, length, path, &ev, &type, 1);
+
+    if(err != NBT_OK)
+        return err;
+
+    if(count != ev.length)
+        return NBT_ERR;
+
+    unsigned char* p = (unsigned char*)ev.payload;
+
+    switch(type)
+    {
+    case TAG_BYTE_ARRAY:
+        memcpy(p, data, (size_t)count);
+        return NBT_OK;
+
+    case TAG_INT_ARRAY:
+        for(int32_t i = 0; i < count; i++)
+            store(p + (size_t)i * 4, (uint32_t)((const int32_t*)data)[i], 4);
+        return NBT_OK;
+
+    case TAG_LONG_ARRAY:
+        for(int32_t i = 0; i < count; i++)
+            store(p + (size_t)i * 8, (uint64_t)((const int64_t*)data)[i], 8);
+        return NBT_OK;
+
+    default:
+        return NBT_ERR;
+    }
+}
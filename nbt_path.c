@@ -0,0 +1,946 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#include "nbt.h"
+#include "nbt_internal.h"
+
+#include "list.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Compiled paths. A path is parsed once into an array of steps, with every
+ * name in it interned, so it's a pointer compare against interned trees. A
+ * query walks the tree depth first. Each frame on the iterator's stack is a
+ * list or compound which has matched the steps before its own, and whose
+ * children are being matched against that step.
+ */
+
+typedef enum {
+    STEP_CHILD,         /* .name    A compound's children called `name'. */
+    STEP_ANY_CHILD,     /* .*       All of a compound's children. */
+    STEP_INDEX,         /* [n]      A list's nth element. */
+    STEP_ANY_ELEMENT,   /* [*]      All of a list's elements. */
+    STEP_DESCEND,       /* ..name   Everything underneath called `name'. */
+    STEP_ANY_DESCEND    /* ..*      Everything underneath. */
+} step_kind;
+
+struct step {
+    step_kind kind;
+    const char* name;   /* Interned. */
+    size_t len;
+    int32_t index;      /* Counted from the end if it's negative. */
+};
+
+struct nbt_path {
+    nbt_type type;      /* What a match has to be, or TAG_INVALID for anything. */
+    size_t n;
+    struct step steps[];
+};
+
+/* Can `c' end an unquoted name? */
+static bool ends_name(char c)
+{
+    return c == '\0' || c == '.' || c == '[' || c == ']' || c == '"' || c == '@';
+}
+
+long _nbt_read_path_name(const char** p, char* buf)
+{
+    const char* s = *p;
+    long len = 0;
+
+    if(*s != '"')
+    {
+        while(!ends_name(*s))
+            buf[len++] = *s++;
+
+        *p = s;
+        return len > 0 ? len : -1;
+    }
+
+    for(s++; *s != '"'; s++)
+    {
+        if(*s == '\\')
+            s++;
+
+        if(*s == '\0')
+            return -1;
+
+        buf[len++] = *s;
+    }
+
+    *p = s + 1;
+    return len;
+}
+
+/*
+ * Reads the name or `*' after a `.' or `..', and fills in `step' with it.
+ * `named' and `any' are the kinds of step it makes.
+ */
+static nbt_status read_target(const char** p, char* buf, struct step* step, step_kind named, step_kind any)
+{
+    if((*p)[0] == '*' && ends_name((*p)[1]))
+    {
+        step->kind = any;
+        (*p)++;
+        return NBT_OK;
+    }
+
+    long len = _nbt_read_path_name(p, buf);
+
+    if(len < 0)
+        return NBT_ERR;
+
+    step->kind = named;
+    step->len  = (size_t)len;
+
+    return (step->name = nbt_intern(buf, step->len)) ? NBT_OK : NBT_EMEM;
+}
+
+/* Reads what's in between `[' and `]'. */
+static nbt_status read_subscript(const char** p, char* buf, struct step* step)
+{
+    const char* s = *p;
+    nbt_status err = NBT_OK;
+
+    if(*s == '*')
+    {
+        step->kind = STEP_ANY_ELEMENT;
+        s++;
+    }
+    else if(*s == '"')
+    {
+        *p = s;
+        err = read_target(p, buf, step, STEP_CHILD, STEP_ANY_CHILD);
+        s = *p;
+    }
+    else
+    {
+        bool negative = *s == '-';
+        int64_t n = 0;
+
+        if(negative) s++;
+
+        if(!isdigit((unsigned char)*s))
+            return NBT_ERR;
+
+        for(; isdigit((unsigned char)*s); s++)
+            if((n = n * 10 + (*s - '0')) > 2147483647 /* INT_MAX */)
+                return NBT_ERR;
+
+        step->kind  = STEP_INDEX;
+        step->index = (int32_t)(negative ? -n : n);
+    }
+
+    if(err != NBT_OK || *s != ']')
+        return err != NBT_OK ? err : NBT_ERR;
+
+    *p = s + 1;
+    return NBT_OK;
+}
+
+/* Reads the type after an `@': TAG_Long_Array, long_array, and so on. */
+static nbt_type read_type(const char* s)
+{
+    if(strncmp(s, "TAG_", 4) == 0 || strncmp(s, "tag_", 4) == 0)
+        s += 4;
+
+    for(nbt_type t = TAG_BYTE; t <= TAG_LONG_ARRAY; t++)
+    {
+        const char* name = nbt_type_to_string(t) + 4;
+        size_t i = 0;
+
+        while(name[i] && tolower((unsigned char)s[i]) == tolower((unsigned char)name[i]))
+            i++;
+
+        if(name[i] == '\0' && s[i] == '\0')
+            return t;
+    }
+
+    return TAG_INVALID;
+}
+
+/* How many steps `path' could have at most. */
+static size_t max_steps(const char* path)
+{
+    size_t max = 1;
+    for(const char* p = path; *p; p++)
+        if(*p == '.' || *p == '[')
+            max++;
+
+    return max;
+}
+
+/*
+ * Parses `path' into `steps', which has room for max_steps(path), and its type
+ * filter into `type'. `buf' needs as much room as `path' does.
+ */
+static nbt_status parse_path(const char* path, char* buf, struct step* steps, size_t* n, nbt_type* type)
+{
+    const char* p = path;
+    nbt_status err = NBT_OK;
+
+    *type = TAG_INVALID;
+    *n    = 0;
+
+    while(*p != '\0' && *p != '@' && err == NBT_OK)
+    {
+        struct step* step = &steps[*n];
+
+        if(p[0] == '.' && p[1] == '.')
+        {
+            p += 2;
+            err = read_target(&p, buf, step, STEP_DESCEND, STEP_ANY_DESCEND);
+        }
+        else if(p[0] == '[')
+        {
+            p++;
+            err = read_subscript(&p, buf, step);
+        }
+        else if(p[0] == '.' || p == path)
+        {
+            /* The first step doesn't need its dot. */
+            if(p[0] == '.') p++;
+            err = read_target(&p, buf, step, STEP_CHILD, STEP_ANY_CHILD);
+        }
+        else
+            err = NBT_ERR;
+
+        ++*n;
+        assert(*n <= max_steps(path) || err != NBT_OK);
+    }
+
+    if(err == NBT_OK && *p == '@' && (*type = read_type(p + 1)) == TAG_INVALID)
+        err = NBT_ERR;
+
+    return err;
+}
+
+nbt_path* nbt_path_compile(const char* path)
+{
+    assert(path);
+
+    errno = NBT_OK;
+
+    nbt_path* ret = malloc(sizeof *ret + max_steps(path) * sizeof *ret->steps);
+    char* buf     = malloc(strlen(path) + 1);
+    nbt_status err;
+
+    if(ret == NULL || buf == NULL)
+        err = NBT_EMEM;
+    else
+        err = parse_path(path, buf, ret->steps, &ret->n, &ret->type);
+
+    free(buf);
+
+    if(err != NBT_OK)
+    {
+        errno = err;
+        free(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+void nbt_path_free(nbt_path* path)
+{
+    free(path);
+}
+
+void nbt_path_begin(struct nbt_path_iter* it, const nbt_path* path, nbt_node* tree)
+{
+    assert(it);
+    assert(path);
+
+    it->path  = path;
+    it->root  = tree;
+    it->err   = NBT_OK;
+    it->depth = 0;
+}
+
+static bool name_matches(const struct step* s, const nbt_node* node)
+{
+    if(node->name == NULL)
+        return false;
+
+    if(node->flags & NBT_NODE_INTERNED)
+        return node->name == s->name;
+
+    return strncmp(node->name, s->name, s->len) == 0 && node->name[s->len] == '\0';
+}
+
+/* Could anything in `node' match `s'? */
+static bool can_match(const struct step* s, const nbt_node* node)
+{
+    switch(s->kind)
+    {
+    case STEP_CHILD:
+    case STEP_ANY_CHILD:
+        return node->type == TAG_COMPOUND;
+
+    case STEP_INDEX:
+    case STEP_ANY_ELEMENT:
+        return node->type == TAG_LIST && has_children(node);
+
+    default:
+        return has_children(node);
+    }
+}
+
+/* Gets ready to match the children of `node' against step `k'. */
+static nbt_status push(struct nbt_path_iter* it, nbt_node* node, size_t k)
+{
+    if(!can_match(&it->path->steps[k], node))
+        return NBT_OK;
+
+    if(it->depth == NBT_PATH_MAX_DEPTH)
+        return NBT_ERR;
+
+    struct nbt_list* list = node->type == TAG_LIST ? node->payload.tag_list : node->payload.tag_compound;
+
+    it->stack[it->depth].head  = &list->entry;
+    it->stack[it->depth].pos   = &list->entry;
+    it->stack[it->depth].again = NULL;
+    it->stack[it->depth].step  = k;
+    it->depth++;
+
+    return NBT_OK;
+}
+
+/* Returns the list entry `index' places from the start of `head', or from its end if it's negative. */
+static struct list_head* nth(struct list_head* head, int32_t index)
+{
+    struct list_head* pos = head;
+
+    if(index >= 0)
+    {
+        for(pos = pos->flink; pos != head && index > 0; pos = pos->flink)
+            index--;
+    }
+    else
+    {
+        for(pos = pos->blink; pos != head && index < -1; pos = pos->blink)
+            index++;
+    }
+
+    return pos;
+}
+
+nbt_node* nbt_path_next(struct nbt_path_iter* it)
+{
+    assert(it);
+
+    const nbt_path* path = it->path;
+
+    errno = it->err;
+
+    if(it->err != NBT_OK)
+        return NULL;
+
+    /* The root is looked at on the first call. */
+    if(it->root != NULL)
+    {
+        nbt_node* root = it->root;
+        it->root = NULL;
+
+        if(path->n == 0)
+            return path->type == TAG_INVALID || root->type == path->type ? root : NULL;
+
+        if((it->err = push(it, root, 0)) != NBT_OK)
+            goto too_deep;
+    }
+
+    while(it->depth > 0)
+    {
+        struct nbt_path_frame* f = &it->stack[it->depth - 1];
+        const struct step* s = &path->steps[f->step];
+
+        /* A child to descend into with the same step, after its own match. */
+        if(f->again != NULL)
+        {
+            nbt_node* again = f->again;
+            f->again = NULL;
+
+            if((it->err = push(it, again, f->step)) != NBT_OK)
+                goto too_deep;
+
+            continue;
+        }
+
+        if(s->kind == STEP_INDEX)
+        {
+            /* There's only one element to look at, so we go straight to it. */
+            f->pos = f->pos == f->head ? nth(f->head, s->index) : f->head;
+        }
+        else
+            f->pos = f->pos->flink;
+
+        if(f->pos == f->head)
+        {
+            it->depth--;
+            continue;
+        }
+
+        nbt_node* child = list_entry(f->pos, struct nbt_list, entry)->data;
+        bool matched;
+
+        switch(s->kind)
+        {
+        case STEP_CHILD:
+            matched = name_matches(s, child);
+            break;
+
+        case STEP_DESCEND:
+            matched = name_matches(s, child);
+            f->again = child;
+            break;
+
+        case STEP_ANY_DESCEND:
+            matched = true;
+            f->again = child;
+            break;
+
+        default:
+            matched = true;
+            break;
+        }
+
+        if(!matched)
+            continue;
+
+        if(f->step + 1 < path->n)
+        {
+            if((it->err = push(it, child, f->step + 1)) != NBT_OK)
+                goto too_deep;
+        }
+        else if(path->type == TAG_INVALID || child->type == path->type)
+            return child;
+    }
+
+    return NULL;
+
+too_deep:
+    it->depth = 0;
+    errno = it->err;
+    return NULL;
+}
+
+nbt_node* nbt_path_first(const nbt_path* path, nbt_node* tree)
+{
+    struct nbt_path_iter* it = malloc(sizeof *it);
+
+    if(it == NULL)
+    {
+        errno = NBT_EMEM;
+        return NULL;
+    }
+
+    nbt_path_begin(it, path, tree);
+
+    nbt_node* ret = nbt_path_next(it);
+
+    free(it);
+    return ret;
+}
+
+/*
+ * The matcher. Its queries are merged into a trie of steps, and the trie's
+ * nodes are the states of an automaton. Walking the tree, every level keeps
+ * the states which are active there. A child's are worked out from its
+ * parent's, and a subtree with none active is never walked at all. A `..'
+ * step has to stay active in everything underneath where it started, so its
+ * state is carried down as a `descend_only' item, which only follows `..'
+ * edges.
+ */
+
+#define NONE ((size_t)-1)
+
+struct edge {
+    struct step step;
+    size_t target;
+    size_t next;        /* The state's next edge, or NONE. */
+};
+
+/* A query which ends at a state. */
+struct accept {
+    size_t query;
+    nbt_type type;
+    size_t next;
+};
+
+struct state {
+    size_t edges;       /* The first edge, or NONE. */
+    size_t accepts;     /* The first accept, or NONE. */
+};
+
+struct nbt_matcher {
+    struct state* states;
+    struct edge* edges;
+    struct accept* accepts;
+    size_t n_states;
+    size_t n_edges;
+};
+
+static bool is_descent(const struct step* s)
+{
+    return s->kind == STEP_DESCEND || s->kind == STEP_ANY_DESCEND;
+}
+
+static bool same_step(const struct step* a, const struct step* b)
+{
+    if(a->kind != b->kind)
+        return false;
+
+    if(a->kind == STEP_CHILD || a->kind == STEP_DESCEND)
+        return a->name == b->name; /* Both interned. */
+
+    return a->kind != STEP_INDEX || a->index == b->index;
+}
+
+static size_t new_state(nbt_matcher* m)
+{
+    m->states[m->n_states] = (struct state) { NONE, NONE };
+    return m->n_states++;
+}
+
+/* Returns the state `step' leads to from `from', adding it if it's new. */
+static size_t follow(nbt_matcher* m, size_t from, const struct step* step)
+{
+    for(size_t e = m->states[from].edges; e != NONE; e = m->edges[e].next)
+        if(same_step(&m->edges[e].step, step))
+            return m->edges[e].target;
+
+    size_t to = new_state(m);
+
+    m->edges[m->n_edges] = (struct edge) { *step, to, m->states[from].edges };
+    m->states[from].edges = m->n_edges++;
+
+    return to;
+}
+
+void nbt_matcher_free(nbt_matcher* m)
+{
+    if(m == NULL) return;
+
+    free(m->states);
+    free(m->edges);
+    free(m->accepts);
+    free(m);
+}
+
+nbt_matcher* nbt_matcher_compile(const char* const* paths, size_t n)
+{
+    assert(paths || n == 0);
+
+    errno = NBT_OK;
+
+    size_t total = 0, most = 1, longest = 0;
+
+    for(size_t i = 0; i < n; i++)
+    {
+        size_t steps = max_steps(paths[i]);
+        size_t len   = strlen(paths[i]);
+
+        total += steps;
+        if(steps > most)  most    = steps;
+        if(len > longest) longest = len;
+    }
+
+    nbt_matcher* m = calloc(1, sizeof *m);
+    struct step* steps = malloc(most * sizeof *steps);
+    char* buf = malloc(longest + 1);
+    nbt_status err = NBT_OK;
+
+    if(m == NULL || steps == NULL || buf == NULL ||
+       (m->states  = malloc((total + 1) * sizeof *m->states))   == NULL ||
+       (m->edges   = malloc((total + 1) * sizeof *m->edges))    == NULL ||
+       (m->accepts = malloc((n + 1) * sizeof *m->accepts))      == NULL)
+    {
+        err = NBT_EMEM;
+        goto done;
+    }
+
+    new_state(m);
+
+    for(size_t q = 0; q < n && err == NBT_OK; q++)
+    {
+        size_t k;
+        nbt_type type;
+
+        if((err = parse_path(paths[q], buf, steps, &k, &type)) != NBT_OK)
+            break;
+
+        size_t s = 0;
+
+        for(size_t i = 0; i < k; i++)
+            s = follow(m, s, &steps[i]);
+
+        m->accepts[q] = (struct accept) { q, type, m->states[s].accepts };
+        m->states[s].accepts = q;
+    }
+
+done:
+    free(steps);
+    free(buf);
+
+    if(err != NBT_OK)
+    {
+        errno = err;
+        nbt_matcher_free(m);
+        return NULL;
+    }
+
+    return m;
+}
+
+/* A state which is active at some level of the walk. */
+struct item {
+    size_t state;
+    bool descend_only;
+};
+
+/* What a child looks like to the matcher, whether it's a node or an event. */
+struct child {
+    const char* name;   /* Not null-terminated. NULL for list elements. */
+    size_t len;
+    bool interned;
+    bool has_children;
+
+    bool in_list;
+    int32_t index;      /* Where it is in its list... */
+    int32_t count;      /* ...and how long that is. */
+
+    nbt_type type;
+};
+
+struct run {
+    const nbt_matcher* m;
+
+    struct item* items; /* Every level's items, one level after the other. */
+    size_t len;
+    size_t cap;
+
+    size_t* stamps;     /* Which child each item was last added for. */
+    size_t visit;
+
+    nbt_match_t on_node;
+    nbt_node* node;
+    nbt_event_match_t on_event;
+    const struct nbt_event* ev;
+    void* aux;
+
+    bool stopped;
+};
+
+static nbt_status begin_run(struct run* r, const nbt_matcher* m)
+{
+    r->m       = m;
+    r->len     = 0;
+    r->cap     = 64;
+    r->visit   = 0;
+    r->stopped = false;
+    r->items   = malloc(r->cap * sizeof *r->items);
+    r->stamps  = calloc(m->n_states * 2, sizeof *r->stamps);
+
+    return r->items && r->stamps ? NBT_OK : NBT_EMEM;
+}
+
+static void end_run(struct run* r)
+{
+    free(r->items);
+    free(r->stamps);
+}
+
+/* Makes `state' active at the child, unless it already is. */
+static nbt_status add(struct run* r, size_t state, bool descend_only)
+{
+    size_t* stamp = &r->stamps[state * 2 + descend_only];
+
+    if(*stamp == r->visit)
+        return NBT_OK;
+
+    *stamp = r->visit;
+
+    if(r->len == r->cap)
+    {
+        struct item* items = realloc(r->items, r->cap * 2 * sizeof *items);
+
+        if(items == NULL)
+            return NBT_EMEM;
+
+        r->items = items;
+        r->cap  *= 2;
+    }
+
+    r->items[r->len++] = (struct item) { state, descend_only };
+    return NBT_OK;
+}
+
+/* The child has made it to `state'. Reports the queries which end there. */
+static nbt_status reach(struct run* r, size_t state, const struct child* c)
+{
+    const struct state* s = &r->m->states[state];
+
+    if(r->stamps[state * 2] == r->visit)
+        return NBT_OK;
+
+    for(size_t a = s->accepts; a != NONE && !r->stopped; a = r->m->accepts[a].next)
+    {
+        const struct accept* accept = &r->m->accepts[a];
+
+        if(accept->type != TAG_INVALID && accept->type != c->type)
+            continue;
+
+        r->stopped = r->on_node ? !r->on_node(accept->query, r->node, r->aux)
+                                : !r->on_event(accept->query, r->ev, r->aux);
+    }
+
+    if(s->edges == NONE || !c->has_children)
+    {
+        r->stamps[state * 2] = r->visit;
+        return NBT_OK;
+    }
+
+    return add(r, state, false);
+}
+
+static bool names_equal(const struct step* s, const struct child* c)
+{
+    if(c->name == NULL)
+        return false;
+
+    if(c->interned)
+        return c->name == s->name;
+
+    return c->len == s->len && memcmp(c->name, s->name, s->len) == 0;
+}
+
+static bool edge_matches(const struct step* s, const struct child* c)
+{
+    switch(s->kind)
+    {
+    case STEP_CHILD:
+    case STEP_DESCEND:
+        return names_equal(s, c);
+
+    case STEP_ANY_CHILD:
+        return !c->in_list;
+
+    case STEP_ANY_ELEMENT:
+        return c->in_list;
+
+    case STEP_INDEX:
+        return c->in_list && c->index == (s->index < 0 ? c->count + s->index : s->index);
+
+    default:
+        return true;
+    }
+}
+
+/*
+ * Works out which states are active at a child, from the items active at its
+ * parent, items[from, to). They're added to the end of the items.
+ */
+static nbt_status step_into(struct run* r, size_t from, size_t to, const struct child* c)
+{
+    const nbt_matcher* m = r->m;
+    nbt_status err;
+
+    r->visit++;
+
+    for(size_t i = from; i < to && !r->stopped; i++)
+    {
+        struct item it = r->items[i];
+
+        for(size_t e = m->states[it.state].edges; e != NONE && !r->stopped; e = m->edges[e].next)
+        {
+            const struct step* s = &m->edges[e].step;
+            bool descent = is_descent(s);
+
+            if(it.descend_only && !descent)
+                continue;
+
+            if(descent && c->has_children && (err = add(r, it.state, true)) != NBT_OK)
+                return err;
+
+            if(edge_matches(s, c) && (err = reach(r, m->edges[e].target, c)) != NBT_OK)
+                return err;
+        }
+    }
+
+    return NBT_OK;
+}
+
+/* Matches the children of `node', whose active items are items[from, to). */
+static nbt_status walk(struct run* r, nbt_node* node, size_t from, size_t to)
+{
+    struct nbt_list* list = node->type == TAG_LIST ? node->payload.tag_list : node->payload.tag_compound;
+    struct child c;
+    nbt_status err;
+
+    c.in_list = node->type == TAG_LIST;
+    c.count   = c.in_list ? nbt_list_length(node) : -1;
+    c.index   = 0;
+
+    struct list_head* pos;
+    list_for_each(pos, &list->entry)
+    {
+        nbt_node* child = list_entry(pos, struct nbt_list, entry)->data;
+        size_t start = r->len;
+
+        c.name         = child->name;
+        c.interned     = (child->flags & NBT_NODE_INTERNED) != 0;
+        c.len          = child->name && !c.interned ? strlen(child->name) : 0;
+        c.has_children = has_children(child);
+        c.type         = child->type;
+
+        r->node = child;
+
+        if((err = step_into(r, from, to, &c)) != NBT_OK)
+            return err;
+
+        if(r->len > start && !r->stopped && (err = walk(r, child, start, r->len)) != NBT_OK)
+            return err;
+
+        if(r->stopped)
+            return NBT_OK;
+
+        r->len = start;
+        c.index++;
+    }
+
+    return NBT_OK;
+}
+
+nbt_status nbt_matcher_run(const nbt_matcher* m, nbt_node* tree, nbt_match_t match, void* aux)
+{
+    assert(m);
+    assert(match);
+
+    if(tree == NULL)
+        return NBT_OK;
+
+    struct run r;
+    nbt_status err = begin_run(&r, m);
+
+    r.on_node  = match;
+    r.on_event = NULL;
+    r.node     = tree;
+    r.aux      = aux;
+
+    /* The root is where every query starts. */
+    struct child root = { NULL, 0, false, has_children(tree), false, 0, 0, tree->type };
+
+    r.visit++;
+
+    if(err == NBT_OK)
+        err = reach(&r, 0, &root);
+
+    if(err == NBT_OK && r.len > 0 && !r.stopped)
+        err = walk(&r, tree, 0, r.len);
+
+    end_run(&r);
+    return err;
+}
+
+/* A list or compound the event parser is inside of. */
+struct level {
+    size_t from, to;    /* Its active items. */
+    int32_t index;      /* Which of its children is next. */
+    int32_t count;
+    bool in_list;
+};
+
+struct binary_run {
+    struct nbt_reader reader;
+    struct level levels[NBT_READER_MAX_DEPTH];
+};
+
+nbt_status nbt_matcher_run_binary(const nbt_matcher* m, const void* memory, size_t length,
+                                  nbt_event_match_t match, void* aux)
+{
+    assert(m);
+    assert(match);
+
+    struct binary_run* b = malloc(sizeof *b);
+    struct run r;
+    nbt_status err = begin_run(&r, m);
+
+    if(b == NULL)
+        err = NBT_EMEM;
+
+    r.on_node  = NULL;
+    r.on_event = match;
+    r.aux      = aux;
+
+    if(err != NBT_OK)
+        goto done;
+
+    nbt_reader_init(&b->reader, memory, length);
+
+    struct nbt_event ev;
+
+    while(!r.stopped && (err = nbt_reader_next(&b->reader, &ev)) == NBT_OK && ev.kind != NBT_EVENT_DONE)
+    {
+        if(ev.kind == NBT_EVENT_END)
+        {
+            r.len = b->levels[ev.depth].from;
+            continue;
+        }
+
+        size_t start = r.len;
+        struct child c = {
+            .name         = ev.name,
+            .len          = ev.name_len,
+            .interned     = false,
+            .has_children = ev.kind == NBT_EVENT_BEGIN,
+            .type         = ev.type
+        };
+
+        r.ev = &ev;
+
+        if(ev.depth == 0)
+        {
+            r.visit++;
+            err = reach(&r, 0, &c);
+        }
+        else
+        {
+            struct level* parent = &b->levels[ev.depth - 1];
+
+            c.in_list = parent->in_list;
+            c.index   = parent->index++;
+            c.count   = parent->count;
+
+            err = step_into(&r, parent->from, parent->to, &c);
+        }
+
+        if(err != NBT_OK || ev.kind != NBT_EVENT_BEGIN || r.stopped)
+            continue;
+
+        /* Nothing in here can match, so it isn't looked at. */
+        if(r.len == start)
+        {
+            err = nbt_reader_skip(&b->reader);
+            continue;
+        }
+
+        b->levels[ev.depth] = (struct level) { start, r.len, 0, ev.length, ev.type == TAG_LIST };
+    }
+
+done:
+    end_run(&r);
+    free(b);
+    return err;
+}
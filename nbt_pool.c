@@ -0,0 +1,264 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#include "nbt.h"
+#include "nbt_internal.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#ifdef __GNUC__
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(  (x), 0)
+#else
+#define likely(x)   (x)
+#define unlikely(x) (x)
+#endif
+
+/*
+ * Every thread keeps a free list of nbt_nodes, one of augmented nodes and one
+ * of nbt_list entries. Since those are the only sizes we ever ask for, there's
+ * nothing to search: allocating is popping, freeing is pushing, and no locks
+ * are involved. Objects are still individually malloc'd, so it doesn't matter
+ * which thread (or whether the library at all) allocated or frees them.
+ *
+ * A thread never hoards more than POOL_LIMIT objects of each kind. Anything
+ * past that goes straight back to the system.
+ */
+#ifndef POOL_LIMIT
+#define POOL_LIMIT 65536
+#endif
+
+struct free_obj {
+    struct free_obj* next;
+};
+
+struct free_list {
+    struct free_obj* head;
+    size_t count;
+};
+
+struct pool {
+    struct free_list nodes;
+    struct free_list augmented;
+    struct free_list lists;
+
+    struct nbt_pool_stats stats;
+};
+
+static pthread_key_t  pool_key;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Where a thread's pool points once it has been destroyed. Other thread-exit
+ * destructors may still release nodes after ours has run, and they have to
+ * free them rather than start a new pool which nobody would ever destroy.
+ */
+static struct pool pool_gone;
+
+#ifdef __GNUC__
+/* A cache of pthread_getspecific(pool_key), which isn't exactly free. */
+static __thread struct pool* this_pool;
+#endif
+
+static void drain(struct free_list* l)
+{
+    while(l->head != NULL)
+    {
+        struct free_obj* next = l->head->next;
+        free(l->head);
+        l->head = next;
+    }
+
+    l->count = 0;
+}
+
+/*
+ * Runs when a thread exits, so its pool doesn't leak. Setting the key again
+ * means pthreads calls us once more for it, which does nothing.
+ */
+static void pool_destroy(void* vpool)
+{
+    struct pool* p = vpool;
+
+    if(p != &pool_gone)
+    {
+        drain(&p->nodes);
+        drain(&p->augmented);
+        drain(&p->lists);
+        free(p);
+    }
+
+    pthread_setspecific(pool_key, &pool_gone);
+
+#ifdef __GNUC__
+    this_pool = &pool_gone;
+#endif
+}
+
+static void make_key(void)
+{
+    pthread_key_create(&pool_key, pool_destroy);
+}
+
+/*
+ * Returns the calling thread's pool, or NULL if it couldn't be created or the
+ * thread is on its way out.
+ */
+static struct pool* get_pool(void)
+{
+    struct pool* p;
+
+#ifdef __GNUC__
+    if(likely((p = this_pool) != NULL))
+        return p != &pool_gone ? p : NULL;
+#endif
+
+    pthread_once(&pool_once, make_key);
+
+    p = pthread_getspecific(pool_key);
+
+    if(p == &pool_gone)
+        return NULL;
+
+    if(p == NULL)
+    {
+        if((p = calloc(1, sizeof *p)) == NULL)
+            return NULL;
+
+        if(pthread_setspecific(pool_key, p) != 0)
+            return free(p), NULL;
+    }
+
+#ifdef __GNUC__
+    this_pool = p;
+#endif
+
+    return p;
+}
+
+static void* pool_get(struct free_list* l, size_t* hits, size_t* misses, size_t size)
+{
+    struct free_obj* o = l->head;
+
+    if(o == NULL)
+        return (*misses)++, malloc(size);
+
+    l->head = o->next;
+    l->count--;
+    (*hits)++;
+
+    return o;
+}
+
+static void pool_put(struct free_list* l, void* ptr)
+{
+    if(l->count >= POOL_LIMIT)
+    {
+        free(ptr);
+        return;
+    }
+
+    struct free_obj* o = ptr;
+
+    o->next = l->head;
+    l->head = o;
+    l->count++;
+}
+
+nbt_node* nbt_alloc_node(void)
+{
+    struct pool* p = get_pool();
+
+    if(unlikely(p == NULL))
+        return malloc(sizeof(nbt_node));
+
+    return pool_get(&p->nodes, &p->stats.node_hits, &p->stats.node_misses, sizeof(nbt_node));
+}
+
+nbt_node* _nbt_alloc_augmented(void)
+{
+    struct pool* p = get_pool();
+    struct nbt_augmented* ret;
+
+    if(unlikely(p == NULL))
+        ret = malloc(sizeof *ret);
+    else
+        ret = pool_get(&p->augmented, &p->stats.node_hits, &p->stats.node_misses, sizeof *ret);
+
+    if(ret == NULL)
+        return NULL;
+
+    ret->node.flags = NBT_NODE_AUGMENTED;
+    return &ret->node;
+}
+
+struct nbt_list* nbt_alloc_list(void)
+{
+    struct pool* p = get_pool();
+
+    if(unlikely(p == NULL))
+        return malloc(sizeof(struct nbt_list));
+
+    return pool_get(&p->lists, &p->stats.list_hits, &p->stats.list_misses, sizeof(struct nbt_list));
+}
+
+void nbt_release_node(nbt_node* node)
+{
+    struct pool* p;
+
+    if(node == NULL) return;
+
+    /* Augmented nodes are the tail end of a bigger allocation. */
+    void* ptr = is_augmented(node) ? (void*)AUGMENTED(node) : (void*)node;
+
+    if(unlikely((p = get_pool()) == NULL))
+        free(ptr);
+    else
+        pool_put(is_augmented(node) ? &p->augmented : &p->nodes, ptr);
+}
+
+void nbt_release_list(struct nbt_list* list)
+{
+    struct pool* p;
+
+    if(list == NULL) return;
+
+    if(unlikely((p = get_pool()) == NULL))
+        free(list);
+    else
+        pool_put(&p->lists, list);
+}
+
+void nbt_pool_stats(struct nbt_pool_stats* stats)
+{
+    struct pool* p = get_pool();
+
+    if(p == NULL)
+    {
+        *stats = (struct nbt_pool_stats) { 0, 0, 0, 0, 0, 0 };
+        return;
+    }
+
+    *stats = p->stats;
+
+    stats->pooled_nodes = p->nodes.count + p->augmented.count;
+    stats->pooled_lists = p->lists.count;
+}
+
+void nbt_pool_trim(void)
+{
+    struct pool* p = get_pool();
+
+    if(p == NULL) return;
+
+    drain(&p->nodes);
+    drain(&p->augmented);
+    drain(&p->lists);
+}
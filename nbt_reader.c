@@ -0,0 +1,340 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#include "nbt.h"
+
+#include <assert.h>
+#include <string.h>
+
+/*
+ * The event parser. It accepts exactly what nbt_parse does, but instead of
+ * recursing, it keeps the lists and compounds it's inside of on its own stack,
+ * so it can stop after every tag.
+ */
+
+/* Big-endian loads. These compile down to a load and a byte swap. */
+static inline uint16_t load16(const unsigned char* p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t load32(const unsigned char* p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline uint64_t load64(const unsigned char* p)
+{
+    return (uint64_t)load32(p) << 32 | load32(p + 4);
+}
+
+void nbt_reader_init(struct nbt_reader* r, const void* memory, size_t length)
+{
+    assert(r);
+    assert(memory || length == 0);
+
+    r->data   = memory;
+    r->length = length;
+    r->pos    = 0;
+    r->depth  = 0;
+    r->state  = NBT_OK;
+    r->done   = false;
+}
+
+/* Fails the reader for good. */
+static nbt_status fail(struct nbt_reader* r, nbt_status err)
+{
+    r->state = err;
+    return err;
+}
+
+static inline bool have(const struct nbt_reader* r, size_t n)
+{
+    return r->length - r->pos >= n;
+}
+
+static nbt_status push(struct nbt_reader* r, nbt_type container, nbt_type elems, int32_t left)
+{
+    if(r->depth == NBT_READER_MAX_DEPTH)
+        return fail(r, NBT_ERR);
+
+    r->stack[r->depth].type      = (uint8_t)container;
+    r->stack[r->depth].list_type = (uint8_t)elems;
+    r->stack[r->depth].left      = left;
+    r->depth++;
+
+    return NBT_OK;
+}
+
+/* Reads the payload of a tag of `type', whose name (if any) is already in `ev'. */
+static nbt_status read_payload(struct nbt_reader* r, nbt_type type, struct nbt_event* ev)
+{
+    const unsigned char* p = r->data + r->pos;
+
+    ev->kind      = NBT_EVENT_VALUE;
+    ev->type      = type;
+    ev->payload   = p;
+    ev->length    = 0;
+    ev->list_type = TAG_INVALID;
+    ev->depth     = r->depth;
+
+    size_t size = nbt_scalar_size(type);
+
+    if(size != 0)
+    {
+        if(!have(r, size))
+            return fail(r, NBT_ERR);
+
+        switch(type)
+        {
+        case TAG_BYTE:   ev->value.integer = (int8_t)p[0];           break;
+        case TAG_SHORT:  ev->value.integer = (int16_t)load16(p);     break;
+        case TAG_INT:    ev->value.integer = (int32_t)load32(p);     break;
+        case TAG_LONG:   ev->value.integer = (int64_t)load64(p);     break;
+
+        case TAG_FLOAT:
+            {
+                uint32_t bits = load32(p);
+                float f;
+
+                memcpy(&f, &bits, sizeof f);
+                ev->value.real = f;
+            }
+            break;
+
+        default:
+            {
+                uint64_t bits = load64(p);
+
+                memcpy(&ev->value.real, &bits, sizeof ev->value.real);
+            }
+            break;
+        }
+
+        r->pos += size;
+        ev->end = r->pos;
+
+        return NBT_OK;
+    }
+
+    switch(type)
+    {
+    case TAG_BYTE_ARRAY:
+    case TAG_INT_ARRAY:
+    case TAG_LONG_ARRAY:
+        {
+            if(!have(r, 4))
+                return fail(r, NBT_ERR);
+
+            int32_t length = (int32_t)load32(p);
+            size_t elem = type == TAG_BYTE_ARRAY ? 1 : type == TAG_INT_ARRAY ? 4 : 8;
+
+            if(length < 0 || (r->length - r->pos - 4) / elem < (size_t)length)
+                return fail(r, NBT_ERR);
+
+            ev->payload = p + 4;
+            ev->length  = length;
+
+            r->pos += 4 + (size_t)length * elem;
+            break;
+        }
+
+    case TAG_STRING:
+        {
+            if(!have(r, 2))
+                return fail(r, NBT_ERR);
+
+            int16_t length = (int16_t)load16(p);
+
+            if(length < 0 || !have(r, 2 + (size_t)length))
+                return fail(r, NBT_ERR);
+
+            ev->payload = p + 2;
+            ev->length  = length;
+
+            r->pos += 2 + (size_t)length;
+            break;
+        }
+
+    case TAG_LIST:
+        {
+            if(!have(r, 5))
+                return fail(r, NBT_ERR);
+
+            nbt_type elems = (nbt_type)p[0];
+            int32_t length = (int32_t)load32(p + 1);
+
+            if(length < 0 || (length > 0 && (elems == TAG_INVALID || elems > TAG_LONG_ARRAY)))
+                return fail(r, NBT_ERR);
+
+            ev->kind      = NBT_EVENT_BEGIN;
+            ev->payload   = p + 5;
+            ev->length    = length;
+            ev->list_type = elems;
+
+            r->pos += 5;
+
+            if(push(r, TAG_LIST, elems, length) != NBT_OK)
+                return r->state;
+
+            break;
+        }
+
+    case TAG_COMPOUND:
+        ev->kind   = NBT_EVENT_BEGIN;
+        ev->length = -1;
+
+        if(push(r, TAG_COMPOUND, TAG_INVALID, -1) != NBT_OK)
+            return r->state;
+
+        break;
+
+    default:
+        return fail(r, NBT_ERR);
+    }
+
+    ev->end = r->pos;
+    return NBT_OK;
+}
+
+/* Reads a tag's type and name. Returns TAG_INVALID for a TAG_End. */
+static nbt_status read_header(struct nbt_reader* r, nbt_type* type, struct nbt_event* ev)
+{
+    if(!have(r, 1))
+        return fail(r, NBT_ERR);
+
+    *type = (nbt_type)r->data[r->pos++];
+
+    if(*type == TAG_INVALID)
+        return NBT_OK;
+
+    if(!have(r, 2))
+        return fail(r, NBT_ERR);
+
+    int16_t length = (int16_t)load16(r->data + r->pos);
+
+    if(length < 0 || !have(r, 2 + (size_t)length))
+        return fail(r, NBT_ERR);
+
+    ev->name     = (const char*)r->data + r->pos + 2;
+    ev->name_len = (size_t)length;
+
+    r->pos += 2 + (size_t)length;
+    return NBT_OK;
+}
+
+/* Reports the end of the innermost list or compound. */
+static nbt_status pop(struct nbt_reader* r, struct nbt_event* ev)
+{
+    r->depth--;
+
+    ev->kind      = NBT_EVENT_END;
+    ev->type      = (nbt_type)r->stack[r->depth].type;
+    ev->name      = NULL;
+    ev->name_len  = 0;
+    ev->payload   = NULL;
+    ev->length    = 0;
+    ev->list_type = (nbt_type)r->stack[r->depth].list_type;
+    ev->depth     = r->depth;
+    ev->end       = r->pos;
+
+    if(r->depth == 0)
+        r->done = true;
+
+    return NBT_OK;
+}
+
+nbt_status nbt_reader_next(struct nbt_reader* r, struct nbt_event* ev)
+{
+    assert(r && ev);
+
+    if(r->state != NBT_OK)
+        return r->state;
+
+    if(r->done)
+    {
+        ev->kind  = NBT_EVENT_DONE;
+        ev->start = ev->end = r->pos;
+        return NBT_OK;
+    }
+
+    ev->start    = r->pos;
+    ev->name     = NULL;
+    ev->name_len = 0;
+
+    nbt_type type;
+
+    if(r->depth == 0)
+    {
+        if(read_header(r, &type, ev) != NBT_OK)
+            return r->state;
+
+        /* The root can't be a TAG_End. */
+        if(type == TAG_INVALID)
+            return fail(r, NBT_ERR);
+    }
+    else if(r->stack[r->depth - 1].type == TAG_COMPOUND)
+    {
+        if(read_header(r, &type, ev) != NBT_OK)
+            return r->state;
+
+        if(type == TAG_INVALID)
+            return pop(r, ev);
+    }
+    else
+    {
+        if(r->stack[r->depth - 1].left == 0)
+            return pop(r, ev);
+
+        r->stack[r->depth - 1].left--;
+        type = (nbt_type)r->stack[r->depth - 1].list_type;
+    }
+
+    if(read_payload(r, type, ev) != NBT_OK)
+        return r->state;
+
+    if(r->depth == 0)
+        r->done = true;
+
+    return NBT_OK;
+}
+
+nbt_status nbt_reader_skip(struct nbt_reader* r)
+{
+    assert(r);
+    assert(r->depth > 0);
+
+    if(r->state != NBT_OK)
+        return r->state;
+
+    size_t target = r->depth - 1;
+    struct nbt_event ev;
+
+    while(r->depth > target)
+    {
+        /* Lists of scalars are skipped over in one go. */
+        size_t size = nbt_scalar_size((nbt_type)r->stack[r->depth - 1].list_type);
+
+        if(r->stack[r->depth - 1].type == TAG_LIST && size != 0 && r->stack[r->depth - 1].left > 0)
+        {
+            size_t left = (size_t)r->stack[r->depth - 1].left;
+
+            if((r->length - r->pos) / size < left)
+                return fail(r, NBT_ERR);
+
+            r->pos += left * size;
+            r->stack[r->depth - 1].left = 0;
+        }
+
+        if(nbt_reader_next(r, &ev) != NBT_OK)
+            return r->state;
+    }
+
+    return NBT_OK;
+}
@@ -0,0 +1,316 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#include "nbt.h"
+#include "nbt_internal.h"
+
+#include "buffer.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Region files (.mcr and .mca alike) hold 32x32 chunks in 4KiB sectors. The
+ * first sector says where each chunk is, as a 3-byte sector offset and a
+ * 1-byte sector count. The second says when each was last saved. A chunk
+ * starts with its length and how it's compressed.
+ *
+ * Chunks are rewritten where they are if they still fit, and at the end of
+ * the file if they don't, which leaves their old sectors unused, as the game
+ * itself does.
+ */
+
+#define SECTOR_SIZE 4096
+#define CHUNKS      1024
+
+/* How each chunk is compressed, from the byte in front of it. */
+#define COMPRESSION_GZIP 1
+#define COMPRESSION_ZLIB 2
+#define COMPRESSION_NONE 3
+
+struct nbt_region {
+    FILE* fp;
+
+    uint32_t locations[CHUNKS];
+    uint32_t timestamps[CHUNKS];
+
+    struct buffer raw; /* The last chunk we read or wrote, compressed. */
+
+    size_t sectors;    /* Where the next chunk which doesn't fit goes. */
+};
+
+static uint32_t load32(const unsigned char* p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void store32(unsigned char* p, uint32_t n)
+{
+    p[0] = (unsigned char)(n >> 24);
+    p[1] = (unsigned char)(n >> 16);
+    p[2] = (unsigned char)(n >> 8);
+    p[3] = (unsigned char)n;
+}
+
+/* Opens a region with fopen's `mode', or `fallback' if that fails. */
+static nbt_region* open_region(const char* path, const char* mode, const char* fallback)
+{
+    assert(path);
+
+    errno = NBT_OK;
+
+    nbt_region* ret = malloc(sizeof *ret);
+
+    if(ret == NULL)
+    {
+        errno = NBT_EMEM;
+        return NULL;
+    }
+
+    ret->raw = BUFFER_INIT;
+
+    if((ret->fp = fopen(path, mode)) == NULL && (fallback == NULL || (ret->fp = fopen(path, fallback)) == NULL))
+    {
+        free(ret);
+        errno = NBT_EIO;
+        return NULL;
+    }
+
+    unsigned char header[2 * SECTOR_SIZE];
+    size_t got = fread(header, 1, sizeof header, ret->fp);
+
+    /* The game leaves empty files around for regions with no chunks. */
+    if(got == 0 && !ferror(ret->fp))
+        memset(header, 0, sizeof header);
+    else if(got != sizeof header)
+    {
+        nbt_region_close(ret);
+        errno = NBT_EIO;
+        return NULL;
+    }
+
+    ret->sectors = got == 0 ? 0 : 2;
+
+    for(size_t i = 0; i < CHUNKS; i++)
+    {
+        ret->locations[i]  = load32(header + 4 * i);
+        ret->timestamps[i] = load32(header + SECTOR_SIZE + 4 * i);
+
+        size_t end = (ret->locations[i] >> 8) + (ret->locations[i] & 0xFF);
+
+        if(end > ret->sectors)
+            ret->sectors = end;
+    }
+
+    return ret;
+}
+
+nbt_region* nbt_region_open(const char* path)
+{
+    return open_region(path, "rb", NULL);
+}
+
+nbt_region* nbt_region_open_rw(const char* path)
+{
+    return open_region(path, "r+b", "w+b");
+}
+
+void nbt_region_close(nbt_region* region)
+{
+    if(region == NULL) return;
+
+    fclose(region->fp);
+    buffer_free(&region->raw);
+    free(region);
+}
+
+static size_t chunk_index(int x, int z)
+{
+    assert(x >= 0 && x < 32 && z >= 0 && z < 32);
+
+    return (size_t)x + (size_t)z * 32;
+}
+
+bool nbt_region_has_chunk(const nbt_region* region, int x, int z)
+{
+    assert(region);
+
+    return region->locations[chunk_index(x, z)] != 0;
+}
+
+uint32_t nbt_region_timestamp(const nbt_region* region, int x, int z)
+{
+    assert(region);
+
+    return region->timestamps[chunk_index(x, z)];
+}
+
+nbt_status nbt_region_read(nbt_region* region, int x, int z, struct buffer* out)
+{
+    assert(region);
+    assert(out);
+
+    out->len = 0;
+
+    uint32_t location = region->locations[chunk_index(x, z)];
+
+    if(location == 0)
+        return NBT_OK;
+
+    long   offset  = (long)(location >> 8) * SECTOR_SIZE;
+    size_t sectors = location & 0xFF;
+
+    unsigned char header[5];
+
+    if(fseek(region->fp, offset, SEEK_SET) != 0 ||
+       fread(header, 1, sizeof header, region->fp) != sizeof header)
+        return NBT_EIO;
+
+    /* The length counts the compression byte, but not itself. */
+    size_t length = load32(header);
+
+    if(length == 0 || length + 4 > sectors * SECTOR_SIZE)
+        return NBT_ERR;
+
+    length--;
+
+    switch(header[4])
+    {
+    case COMPRESSION_NONE:
+        if(buffer_reserve(out, length))
+            return NBT_EMEM;
+
+        if(fread(out->data, 1, length, region->fp) != length)
+            return NBT_EIO;
+
+        out->len = length;
+        return NBT_OK;
+
+    case COMPRESSION_GZIP:
+    case COMPRESSION_ZLIB:
+        if(buffer_reserve(&region->raw, length))
+            return NBT_EMEM;
+
+        if(fread(region->raw.data, 1, length, region->fp) != length)
+            return NBT_EIO;
+
+        region->raw.len = length;
+
+        return _nbt_inflate(region->raw.data, region->raw.len, out);
+
+    default:
+        /* Chunks kept in their own files, or compressed some other way. */
+        return NBT_ERR;
+    }
+}
+
+nbt_node* nbt_region_chunk(nbt_region* region, int x, int z, unsigned flags)
+{
+    struct buffer data = BUFFER_INIT;
+    nbt_node* ret = NULL;
+
+    if((errno = nbt_region_read(region, x, z, &data)) == NBT_OK && data.len != 0)
+        ret = nbt_parse_ex(data.data, data.len, flags);
+
+    buffer_free(&data);
+    return ret;
+}
+
+/* Writes `len' bytes at `offset'. */
+static nbt_status write_at(nbt_region* region, long offset, const void* data, size_t len)
+{
+    if(fseek(region->fp, offset, SEEK_SET) != 0 || fwrite(data, 1, len, region->fp) != len)
+        return NBT_EIO;
+
+    return NBT_OK;
+}
+
+nbt_status nbt_region_write(nbt_region* region, int x, int z, const void* data, size_t len, uint32_t timestamp)
+{
+    assert(region);
+    assert(data || len == 0);
+
+    size_t i = chunk_index(x, z);
+    nbt_status err;
+
+    /* An empty file has no header yet. */
+    if(region->sectors < 2)
+    {
+        static const unsigned char zeros[2 * SECTOR_SIZE];
+
+        if((err = write_at(region, 0, zeros, sizeof zeros)) != NBT_OK)
+            return err;
+
+        region->sectors = 2;
+    }
+
+    /* Compress it behind room for its length and compression type. */
+    struct nbt_sink sink = nbt_sink_buffer(&region->raw);
+
+    region->raw.len = 0;
+
+    if(buffer_reserve(&region->raw, SECTOR_SIZE))
+        return NBT_EMEM;
+
+    region->raw.len = 5;
+
+    if((err = _nbt_deflate(data, len, STRAT_INFLATE, &sink)) != NBT_OK)
+        return err;
+
+    store32(region->raw.data, (uint32_t)(region->raw.len - 4));
+    region->raw.data[4] = COMPRESSION_ZLIB;
+
+    /* Chunks take up whole sectors. */
+    size_t sectors = (region->raw.len + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    size_t padding = sectors * SECTOR_SIZE - region->raw.len;
+
+    /* Anything bigger than this is kept in a file of its own, which we don't do. */
+    if(sectors > 0xFF)
+        return NBT_ERR;
+
+    if(buffer_reserve(&region->raw, region->raw.len + padding))
+        return NBT_EMEM;
+
+    memset(region->raw.data + region->raw.len, 0, padding);
+    region->raw.len += padding;
+
+    size_t offset = region->locations[i] >> 8;
+
+    if(region->locations[i] == 0 || sectors > (region->locations[i] & 0xFF))
+        offset = region->sectors;
+
+    if(offset > 0xFFFFFF)
+        return NBT_ERR;
+
+    if((err = write_at(region, (long)offset * SECTOR_SIZE, region->raw.data, region->raw.len)) != NBT_OK)
+        return err;
+
+    /* The header's only updated once the chunk's safely written. */
+    unsigned char entry[4];
+
+    region->locations[i] = (uint32_t)(offset << 8 | sectors);
+    store32(entry, region->locations[i]);
+
+    if((err = write_at(region, (long)(4 * i), entry, sizeof entry)) != NBT_OK)
+        return err;
+
+    region->timestamps[i] = timestamp;
+    store32(entry, timestamp);
+
+    if((err = write_at(region, (long)(SECTOR_SIZE + 4 * i), entry, sizeof entry)) != NBT_OK)
+        return err;
+
+    if(offset + sectors > region->sectors)
+        region->sectors = offset + sectors;
+
+    return fflush(region->fp) == 0 ? NBT_OK : NBT_EIO;
+}
@@ -0,0 +1,146 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 200809L /* for writev */
+
+#include "nbt.h"
+
+#include "buffer.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static nbt_status file_write(void* ctx, const void* data, size_t len)
+{
+    FILE* fp = ctx;
+
+    if(len && fwrite(data, 1, len, fp) != len)
+        return NBT_EIO;
+
+    return NBT_OK;
+}
+
+struct nbt_sink nbt_sink_file(FILE* fp)
+{
+    assert(fp);
+    return (struct nbt_sink) { file_write, NULL, fp };
+}
+
+static nbt_status buffer_write(void* ctx, const void* data, size_t len)
+{
+    return buffer_append(ctx, data, len) ? NBT_EMEM : NBT_OK;
+}
+
+struct nbt_sink nbt_sink_buffer(struct buffer* b)
+{
+    assert(b);
+    return (struct nbt_sink) { buffer_write, NULL, b };
+}
+
+static nbt_status fixed_write(void* ctx, const void* data, size_t len)
+{
+    struct nbt_fixed_sink* f = ctx;
+
+    if(len > f->cap - f->len)
+        return NBT_EMEM;
+
+    memcpy(f->data + f->len, data, len);
+    f->len += len;
+
+    return NBT_OK;
+}
+
+struct nbt_sink nbt_sink_fixed(struct nbt_fixed_sink* f)
+{
+    assert(f && f->len <= f->cap);
+    return (struct nbt_sink) { fixed_write, NULL, f };
+}
+
+/* Keeps calling writev until every byte of `iov' is out. `iov' gets clobbered. */
+static nbt_status writev_all(int fd, struct iovec* iov, int n)
+{
+    while(n > 0)
+    {
+        ssize_t written = writev(fd, iov, n);
+
+        if(written < 0)
+        {
+            if(errno == EINTR) continue;
+            return NBT_EIO;
+        }
+
+        /* Skip over whatever made it, which might end in the middle of a piece. */
+        while(n > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            n--;
+        }
+
+        if(n > 0)
+        {
+            iov->iov_base  = (char*)iov->iov_base + written;
+            iov->iov_len  -= written;
+        }
+    }
+
+    return NBT_OK;
+}
+
+static nbt_status fd_write(void* ctx, const void* data, size_t len)
+{
+    struct nbt_fd_sink* s = ctx;
+
+    /* Small pieces wait for company. */
+    if(len < sizeof s->stage && len <= sizeof s->stage - s->used)
+    {
+        memcpy(s->stage + s->used, data, len);
+        s->used += len;
+        return NBT_OK;
+    }
+
+    /* Big ones go straight out, along with everything that was waiting. */
+    struct iovec iov[2] = {
+        { s->stage,     s->used },
+        { (void*)data,  len     }
+    };
+
+    nbt_status err = s->used ? writev_all(s->fd, iov, 2)
+                             : writev_all(s->fd, iov + 1, 1);
+
+    s->used = 0;
+    return err;
+}
+
+static nbt_status fd_flush(void* ctx)
+{
+    struct nbt_fd_sink* s = ctx;
+
+    if(s->used == 0)
+        return NBT_OK;
+
+    struct iovec iov = { s->stage, s->used };
+
+    s->used = 0;
+    return writev_all(s->fd, &iov, 1);
+}
+
+struct nbt_sink nbt_sink_fd(struct nbt_fd_sink* s, int fd)
+{
+    assert(s);
+
+    s->fd   = fd;
+    s->used = 0;
+
+    return (struct nbt_sink) { fd_write, fd_flush, s };
+}
@@ -0,0 +1,838 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#include "nbt.h"
+#include "nbt_internal.h"
+
+#include "list.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A parser for SNBT, the text form of NBT which commands and data packs use:
+ *
+ *     {Pos:[1.0d,2.0d],id:"minecraft:pig",Tags:[B;1b,0b]}
+ *
+ * It's a plain recursive descent over the text. Nothing is copied on the way
+ * in, except for the names and strings which end up in the tree.
+ */
+
+#define CHECKED_ALLOC(var, allocation, on_error) do { \
+    if((var = (allocation)) == NULL)                  \
+    {                                                 \
+        errno = NBT_EMEM;                             \
+        on_error;                                     \
+    }                                                 \
+} while(0)
+
+#define CHECKED_MALLOC(var, n, on_error) CHECKED_ALLOC(var, malloc(n), on_error)
+
+/* How deep lists and compounds may be nested. The game draws the line here too. */
+#define MAX_DEPTH 512
+
+struct snbt_parser {
+    const char* pos;
+    const char* end;
+    unsigned depth;
+};
+
+static nbt_node* parse_value(struct snbt_parser* p);
+
+static void skip_space(struct snbt_parser* p)
+{
+    while(p->pos < p->end &&
+          (*p->pos == ' ' || *p->pos == '\t' || *p->pos == '\n' || *p->pos == '\r'))
+        p->pos++;
+}
+
+/* Skips any whitespace, then `c' if it's next. Returns whether it was. */
+static bool consume(struct snbt_parser* p, char c)
+{
+    skip_space(p);
+
+    if(p->pos < p->end && *p->pos == c)
+    {
+        p->pos++;
+        return true;
+    }
+
+    return false;
+}
+
+static nbt_node* new_node(nbt_type type)
+{
+    nbt_node* ret;
+
+    CHECKED_ALLOC(ret, nbt_alloc_node(), return NULL);
+
+    ret->type  = type;
+    ret->flags = 0;
+    ret->refs  = 0;
+    ret->name  = NULL;
+    ret->index = NULL;
+
+    memset(&ret->payload, 0, sizeof ret->payload);
+
+    return ret;
+}
+
+/* Returns an empty list. Lists (but not compounds) have a sentinel node with their type. */
+static struct nbt_list* new_list(bool typed)
+{
+    struct nbt_list* ret;
+
+    CHECKED_ALLOC(ret, nbt_alloc_list(), return NULL);
+
+    INIT_LIST_HEAD(&ret->entry);
+    ret->data = NULL;
+
+    if(typed)
+    {
+        if((ret->data = new_node(TAG_COMPOUND)) == NULL)
+        {
+            nbt_release_list(ret);
+            return NULL;
+        }
+
+        list_set_count(ret, 0);
+    }
+
+    return ret;
+}
+
+/* Adds `child' to the end of `list'. On failure, `child' is freed. */
+static bool append(struct nbt_list* list, nbt_node* child)
+{
+    struct nbt_list* entry;
+
+    CHECKED_ALLOC(entry, nbt_alloc_list(),
+        nbt_free(child);
+        return false;
+    );
+
+    entry->data = child;
+    list_add_tail(&entry->entry, &list->entry);
+
+    return true;
+}
+
+static int hex_digit(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+
+    return -1;
+}
+
+/*
+ * Decodes the escape sequence after a backslash at `*src', leaving `*src'
+ * after it. The result is written as UTF-8 at `out', which is returned moved
+ * past it, or NULL if the escape makes no sense. No escape decodes to more
+ * bytes than it takes up.
+ */
+static char* unescape(const char** src, const char* end, char* out)
+{
+    char c = *(*src)++;
+    int digits = 0;
+
+    switch(c)
+    {
+    case '\\': case '\'': case '"':
+        *out++ = c;
+        return out;
+
+    case 'n': *out++ = '\n'; return out;
+    case 't': *out++ = '\t'; return out;
+    case 'r': *out++ = '\r'; return out;
+    case 'b': *out++ = '\b'; return out;
+    case 'f': *out++ = '\f'; return out;
+    case 's': *out++ = ' ';  return out;
+
+    case 'x': digits = 2; break;
+    case 'u': digits = 4; break;
+    case 'U': digits = 8; break;
+
+    default:
+        return NULL;
+    }
+
+    if(end - *src < digits)
+        return NULL;
+
+    uint32_t cp = 0;
+
+    for(int i = 0; i < digits; i++)
+    {
+        int d = hex_digit(*(*src)++);
+
+        if(d < 0) return NULL;
+        cp = cp << 4 | (uint32_t)d;
+    }
+
+    if(cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+        return NULL;
+
+    if(cp < 0x80)
+        *out++ = (char)cp;
+    else if(cp < 0x800)
+    {
+        *out++ = (char)(0xC0 | cp >> 6);
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    }
+    else if(cp < 0x10000)
+    {
+        *out++ = (char)(0xE0 | cp >> 12);
+        *out++ = (char)(0x80 | (cp >> 6 & 0x3F));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        *out++ = (char)(0xF0 | cp >> 18);
+        *out++ = (char)(0x80 | (cp >> 12 & 0x3F));
+        *out++ = (char)(0x80 | (cp >> 6 & 0x3F));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    }
+
+    return out;
+}
+
+/* Reads a string in single or double quotes, the opening one being next. */
+static char* read_quoted(struct snbt_parser* p)
+{
+    char quote = *p->pos++;
+    const char* start = p->pos;
+    const char* s = start;
+    bool escaped = false;
+
+    while(s < p->end && *s != quote)
+    {
+        if(*s == '\\')
+        {
+            escaped = true;
+            s++;
+        }
+
+        s++;
+    }
+
+    if(s >= p->end)
+    {
+        errno = NBT_ERR;
+        return NULL;
+    }
+
+    char* ret;
+    CHECKED_MALLOC(ret, s - start + 1, return NULL);
+
+    if(!escaped)
+    {
+        memcpy(ret, start, s - start);
+        ret[s - start] = '\0';
+    }
+    else
+    {
+        char* out = ret;
+
+        for(const char* in = start; in < s; )
+        {
+            if(*in != '\\')
+            {
+                *out++ = *in++;
+                continue;
+            }
+
+            in++;
+
+            if((out = unescape(&in, s, out)) == NULL)
+            {
+                free(ret);
+                errno = NBT_ERR;
+                return NULL;
+            }
+        }
+
+        *out = '\0';
+    }
+
+    p->pos = s + 1;
+    return ret;
+}
+
+/* Reads an unquoted run of characters, returning its bounds in `*start' and `*end'. */
+static bool read_bare(struct snbt_parser* p, const char** start, const char** end)
+{
+    *start = p->pos;
+
+    while(p->pos < p->end && snbt_bare_char(*p->pos))
+        p->pos++;
+
+    *end = p->pos;
+
+    return *start != *end;
+}
+
+static char* copy_string(const char* start, const char* end)
+{
+    char* ret;
+
+    CHECKED_MALLOC(ret, end - start + 1, return NULL);
+
+    memcpy(ret, start, end - start);
+    ret[end - start] = '\0';
+
+    return ret;
+}
+
+/*
+ * Parses [start, end) as a decimal integer, with an optional sign and no
+ * leading zeros. Returns false if it isn't one, or isn't in [min, max].
+ */
+static bool parse_integer(const char* start, const char* end, int64_t min, int64_t max, int64_t* out)
+{
+    const char* s = start;
+    bool negative = false;
+
+    if(s < end && (*s == '-' || *s == '+'))
+        negative = *s++ == '-';
+
+    if(s == end || (*s == '0' && end - s > 1))
+        return false;
+
+    uint64_t n = 0;
+
+    for(; s < end; s++)
+    {
+        unsigned d = (unsigned)(*s - '0');
+
+        if(d > 9 || n > (UINT64_MAX - d) / 10)
+            return false;
+
+        n = n * 10 + d;
+    }
+
+    if(negative ? n > (uint64_t)-(min + 1) + 1 : n > (uint64_t)max)
+        return false;
+
+    *out = negative ? (int64_t)(0 - n) : (int64_t)n;
+    return true;
+}
+
+/* Every power of ten a double holds exactly. */
+static const double exact_powers[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*
+ * Parses [start, end) as a decimal real number, optionally in scientific
+ * notation. If `need_dot', it has to have a decimal point, so that it can't be
+ * mistaken for an integer. `NaN' and `Infinity' are accepted too, since that's
+ * how the game writes them.
+ *
+ * Numbers with few enough digits are converted exactly with a multiplication
+ * or division by a power of ten, which is correctly rounded as long as both
+ * sides are exact. Everything else goes to strtod or strtof.
+ */
+static bool parse_real(const char* start, const char* end, bool need_dot, bool single, double* out)
+{
+    const char* s = start;
+    bool negative = false;
+
+    if(s < end && (*s == '-' || *s == '+'))
+        negative = *s++ == '-';
+
+    if(!need_dot)
+    {
+        if(end - s == 3 && memcmp(s, "NaN", 3) == 0 && s == start)
+        {
+            *out = NAN;
+            return true;
+        }
+
+        if(end - s == 8 && memcmp(s, "Infinity", 8) == 0)
+        {
+            *out = negative ? -INFINITY : INFINITY;
+            return true;
+        }
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;     /* in the mantissa, not counting leading zeros */
+    int exponent = 0;
+    bool any = false, dot = false, exact = true;
+
+    for(; s < end; s++)
+    {
+        if(*s == '.' && !dot)
+        {
+            dot = true;
+            continue;
+        }
+
+        unsigned d = (unsigned)(*s - '0');
+        if(d > 9) break;
+
+        any = true;
+
+        if(mantissa == 0 && d == 0)
+        {
+            if(dot) exponent--;
+            continue;
+        }
+
+        if(digits < 19)
+        {
+            mantissa = mantissa * 10 + d;
+            digits++;
+
+            if(dot) exponent--;
+        }
+        else
+        {
+            exact = false;
+            if(!dot) exponent++;
+        }
+    }
+
+    if(!any || (need_dot && !dot))
+        return false;
+
+    if(s < end && (*s == 'e' || *s == 'E'))
+    {
+        bool negative_exp = false;
+        int e = 0;
+
+        if(++s < end && (*s == '-' || *s == '+'))
+            negative_exp = *s++ == '-';
+
+        if(s == end)
+            return false;
+
+        for(; s < end; s++)
+        {
+            unsigned d = (unsigned)(*s - '0');
+            if(d > 9) return false;
+
+            if(e < 100000) e = e * 10 + (int)d;
+        }
+
+        exponent += negative_exp ? -e : e;
+    }
+
+    if(s != end)
+        return false;
+
+    if(FLT_EVAL_METHOD == 0 && exact)
+    {
+        if(single && mantissa <= (1u << 24) && exponent >= -10 && exponent <= 10)
+        {
+            float f = (float)mantissa;
+            float p = (float)exact_powers[exponent < 0 ? -exponent : exponent];
+
+            f = exponent < 0 ? f / p : f * p;
+            *out = negative ? -f : f;
+            return true;
+        }
+
+        if(!single && mantissa <= (UINT64_C(1) << 53) && exponent >= -22 && exponent <= 22)
+        {
+            double d = (double)mantissa;
+
+            d = exponent < 0 ? d / exact_powers[-exponent] : d * exact_powers[exponent];
+            *out = negative ? -d : d;
+            return true;
+        }
+    }
+
+    /* The hard way. strtod wants its own null-terminated copy. */
+    char small[64];
+    char* copy = small;
+
+    if((size_t)(end - start) >= sizeof small && (copy = malloc(end - start + 1)) == NULL)
+        return false;
+
+    memcpy(copy, start, end - start);
+    copy[end - start] = '\0';
+
+    *out = single ? strtof(copy, NULL) : strtod(copy, NULL);
+
+    if(copy != small)
+        free(copy);
+
+    return true;
+}
+
+/*
+ * Works out what an unquoted value is: a number if it looks like one (with a
+ * suffix for anything but ints and doubles), true or false for a byte, and a
+ * string if nothing else fits.
+ */
+static nbt_node* parse_bare_value(struct snbt_parser* p)
+{
+    const char* start;
+    const char* end;
+
+    if(!read_bare(p, &start, &end))
+    {
+        errno = NBT_ERR;
+        return NULL;
+    }
+
+    nbt_node* ret;
+    int64_t i;
+    double d;
+
+#define RETURN_SCALAR(type, payload_name, value) do { \
+    if((ret = new_node(type)) != NULL)                \
+        ret->payload.payload_name = (value);          \
+    return ret;                                       \
+} while(0)
+
+    switch(end[-1])
+    {
+    case 'b': case 'B':
+        if(parse_integer(start, end - 1, INT8_MIN, INT8_MAX, &i))
+            RETURN_SCALAR(TAG_BYTE, tag_byte, (int8_t)i);
+        break;
+
+    case 's': case 'S':
+        if(parse_integer(start, end - 1, INT16_MIN, INT16_MAX, &i))
+            RETURN_SCALAR(TAG_SHORT, tag_short, (int16_t)i);
+        break;
+
+    case 'l': case 'L':
+        if(parse_integer(start, end - 1, INT64_MIN, INT64_MAX, &i))
+            RETURN_SCALAR(TAG_LONG, tag_long, i);
+        break;
+
+    case 'f': case 'F':
+        if(parse_real(start, end - 1, false, true, &d))
+            RETURN_SCALAR(TAG_FLOAT, tag_float, (float)d);
+        break;
+
+    case 'd': case 'D':
+        if(parse_real(start, end - 1, false, false, &d))
+            RETURN_SCALAR(TAG_DOUBLE, tag_double, d);
+        break;
+    }
+
+    if(parse_integer(start, end, INT32_MIN, INT32_MAX, &i))
+        RETURN_SCALAR(TAG_INT, tag_int, (int32_t)i);
+
+    if(parse_real(start, end, true, false, &d))
+        RETURN_SCALAR(TAG_DOUBLE, tag_double, d);
+
+    if(end - start == 4 && memcmp(start, "true", 4) == 0)
+        RETURN_SCALAR(TAG_BYTE, tag_byte, 1);
+
+    if(end - start == 5 && memcmp(start, "false", 5) == 0)
+        RETURN_SCALAR(TAG_BYTE, tag_byte, 0);
+
+#undef RETURN_SCALAR
+
+    char* s = copy_string(start, end);
+    if(s == NULL) return NULL;
+
+    if((ret = new_node(TAG_STRING)) == NULL)
+    {
+        free(s);
+        return NULL;
+    }
+
+    ret->payload.tag_string = s;
+    return ret;
+}
+
+/*
+ * Reads the elements of a [B;...], [I;...] or [L;...] array, after the `;'.
+ * Elements are integers, which may carry the suffix of the array's type.
+ */
+static nbt_node* parse_array(struct snbt_parser* p, nbt_type type)
+{
+    size_t size;
+    int64_t min, max;
+    char suffix;
+
+    if(type == TAG_BYTE_ARRAY)     size = 1, min = INT8_MIN,  max = INT8_MAX,  suffix = 'b';
+    else if(type == TAG_INT_ARRAY) size = 4, min = INT32_MIN, max = INT32_MAX, suffix = 0;
+    else                           size = 8, min = INT64_MIN, max = INT64_MAX, suffix = 'l';
+
+    unsigned char* data = NULL;
+    size_t length = 0, cap = 0;
+
+    while(!consume(p, ']'))
+    {
+        const char* start;
+        const char* end;
+        int64_t i;
+
+        skip_space(p);
+
+        if(!read_bare(p, &start, &end))
+            goto parse_error;
+
+        if(suffix && (end[-1] | 0x20) == suffix)
+            end--;
+
+        if(!parse_integer(start, end, min, max, &i))
+        {
+            if(type == TAG_BYTE_ARRAY && end - start == 4 && memcmp(start, "true", 4) == 0)
+                i = 1;
+            else if(type == TAG_BYTE_ARRAY && end - start == 5 && memcmp(start, "false", 5) == 0)
+                i = 0;
+            else
+                goto parse_error;
+        }
+
+        if(length == cap)
+        {
+            size_t new_cap = cap ? cap * 2 : 16;
+            unsigned char* new_data;
+
+            if(new_cap > 2147483647 /* INT_MAX */)
+                goto parse_error;
+
+            CHECKED_ALLOC(new_data, realloc(data, new_cap * size), goto parse_error);
+
+            data = new_data;
+            cap  = new_cap;
+        }
+
+        if(type == TAG_BYTE_ARRAY)     data[length] = (unsigned char)(int8_t)i;
+        else if(type == TAG_INT_ARRAY) ((int32_t*)data)[length] = (int32_t)i;
+        else                           ((int64_t*)data)[length] = i;
+
+        length++;
+
+        if(!consume(p, ','))
+        {
+            if(consume(p, ']')) break;
+            goto parse_error;
+        }
+    }
+
+    nbt_node* ret = new_node(type);
+    if(ret == NULL) goto parse_error;
+
+    /* All three array structs look the same, but for the type of `data'. */
+    if(type == TAG_BYTE_ARRAY)
+        ret->payload.tag_byte_array = (struct nbt_byte_array) { data, (int32_t)length };
+    else if(type == TAG_INT_ARRAY)
+        ret->payload.tag_int_array  = (struct nbt_int_array)  { (int32_t*)data, (int32_t)length };
+    else
+        ret->payload.tag_long_array = (struct nbt_long_array) { (int64_t*)data, (int32_t)length };
+
+    return ret;
+
+parse_error:
+    if(errno == NBT_OK)
+        errno = NBT_ERR;
+
+    free(data);
+    return NULL;
+}
+
+/* Reads a list or an array, after the `['. */
+static nbt_node* parse_list(struct snbt_parser* p)
+{
+    /* Arrays are marked right after the bracket: no whitespace allowed. */
+    if(p->end - p->pos >= 2 && p->pos[1] == ';')
+    {
+        char c = p->pos[0];
+        nbt_type type = c == 'B' ? TAG_BYTE_ARRAY :
+                        c == 'I' ? TAG_INT_ARRAY  :
+                        c == 'L' ? TAG_LONG_ARRAY : TAG_INVALID;
+
+        if(type != TAG_INVALID)
+        {
+            p->pos += 2;
+            return parse_array(p, type);
+        }
+    }
+
+    nbt_node* ret = new_node(TAG_LIST);
+    if(ret == NULL) return NULL;
+
+    if((ret->payload.tag_list = new_list(true)) == NULL)
+    {
+        nbt_release_node(ret);
+        return NULL;
+    }
+
+    struct nbt_list* list = ret->payload.tag_list;
+    int32_t count = 0;
+
+    while(!consume(p, ']'))
+    {
+        nbt_node* elem = parse_value(p);
+        if(elem == NULL) goto parse_error;
+
+        /* The first element decides what the list holds. */
+        if(count == 0)
+            list->data->type = elem->type;
+        else if(elem->type != list->data->type)
+        {
+            nbt_free(elem);
+            goto parse_error;
+        }
+
+        if(!append(list, elem) || count == 2147483647 /* INT_MAX */)
+            goto parse_error;
+
+        list_set_count(list, ++count);
+
+        if(!consume(p, ','))
+        {
+            if(consume(p, ']')) break;
+            goto parse_error;
+        }
+    }
+
+    return ret;
+
+parse_error:
+    if(errno == NBT_OK)
+        errno = NBT_ERR;
+
+    nbt_free(ret);
+    return NULL;
+}
+
+/* Reads a compound, after the `{'. */
+static nbt_node* parse_compound(struct snbt_parser* p)
+{
+    nbt_node* ret = new_node(TAG_COMPOUND);
+    if(ret == NULL) return NULL;
+
+    if((ret->payload.tag_compound = new_list(false)) == NULL)
+    {
+        nbt_release_node(ret);
+        return NULL;
+    }
+
+    while(!consume(p, '}'))
+    {
+        char* name;
+        const char* start;
+        const char* end;
+
+        if(p->pos < p->end && (*p->pos == '"' || *p->pos == '\''))
+            name = read_quoted(p);
+        else if(read_bare(p, &start, &end))
+            name = copy_string(start, end);
+        else
+            goto parse_error;
+
+        if(name == NULL)
+            goto parse_error;
+
+        nbt_node* value;
+
+        if(!consume(p, ':') || (value = parse_value(p)) == NULL)
+        {
+            free(name);
+            goto parse_error;
+        }
+
+        value->name = name;
+
+        if(!append(ret->payload.tag_compound, value))
+            goto parse_error;
+
+        if(!consume(p, ','))
+        {
+            if(consume(p, '}')) break;
+            goto parse_error;
+        }
+    }
+
+    return ret;
+
+parse_error:
+    if(errno == NBT_OK)
+        errno = NBT_ERR;
+
+    nbt_free(ret);
+    return NULL;
+}
+
+static nbt_node* parse_value(struct snbt_parser* p)
+{
+    skip_space(p);
+
+    if(p->pos == p->end)
+    {
+        errno = NBT_ERR;
+        return NULL;
+    }
+
+    char c = *p->pos;
+
+    if(c == '"' || c == '\'')
+    {
+        char* s = read_quoted(p);
+        if(s == NULL) return NULL;
+
+        nbt_node* ret = new_node(TAG_STRING);
+
+        if(ret == NULL)
+            free(s);
+        else
+            ret->payload.tag_string = s;
+
+        return ret;
+    }
+
+    if(c != '{' && c != '[')
+        return parse_bare_value(p);
+
+    if(p->depth == MAX_DEPTH)
+    {
+        errno = NBT_ERR;
+        return NULL;
+    }
+
+    p->pos++;
+    p->depth++;
+
+    nbt_node* ret = c == '{' ? parse_compound(p) : parse_list(p);
+
+    p->depth--;
+    return ret;
+}
+
+nbt_node* nbt_parse_snbt(const char* text, size_t length)
+{
+    assert(text || length == 0);
+
+    errno = NBT_OK;
+
+    struct snbt_parser p = { text, text + length, 0 };
+
+    nbt_node* ret = parse_value(&p);
+    if(ret == NULL) return NULL;
+
+    skip_space(&p);
+
+    /* Trailing garbage means we misunderstood something. */
+    if(p.pos != p.end)
+    {
+        nbt_free(ret);
+        errno = NBT_ERR;
+        return NULL;
+    }
+
+    return ret;
+}
@@ -0,0 +1,311 @@
+/*
+ * -----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Lukas Niederbremer <webmaster@flippeh.de> and Clark Gaebel <cg.wowus.cg@gmail.com>
+ * wrote this file. As long as you retain this notice you can do whatever you
+ * want with this stuff. If we meet some day, and you think this stuff is worth
+ * it, you can buy us a beer in return.
+ * -----------------------------------------------------------------------------
+ */
+#include "nbt.h"
+#include "nbt_internal.h"
+
+#include "buffer.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The transformer follows the event parser through the input, and keeps track
+ * of which rules could still match at each depth as a bitmask. A subtree no
+ * rule can reach is skipped over by the parser and copied to the output in
+ * one piece, so most of the input is never looked at twice.
+ *
+ * A list's count is only known once its elements have been through the
+ * rules. So the output is collected in a buffer, and only handed to the sink
+ * when there's no list open whose count may still change.
+ */
+
+/* Rules are kept as bits of a mask. */
+#define MAX_RULES 64
+
+/* Output is handed to the sink once this much has built up. */
+#define FLUSH_SIZE (64 * 1024)
+
+struct compiled_rule {
+    struct nbt_path_part* parts;
+    size_t n;
+};
+
+struct level {
+    uint64_t active;   /* Rules which have matched all the way down to here. */
+    size_t count_at;   /* Where a list's count is in the output. */
+    int32_t kept;      /* How many of a list's elements made it. */
+    bool is_list;
+};
+
+struct transform {
+    struct nbt_reader reader;
+    struct nbt_emitter emitter;
+
+    const struct nbt_transform_rule* rules;
+    struct compiled_rule compiled[MAX_RULES];
+    size_t n;
+
+    struct buffer out;
+    struct buffer scratch;  /* Where replacements are emitted to. */
+    struct nbt_sink* sink;
+    size_t open_lists;
+
+    struct level stack[NBT_READER_MAX_DEPTH];
+};
+
+static bool part_matches(const struct nbt_path_part* part, const struct nbt_event* ev)
+{
+    return (part->len == 1 && part->name[0] == '*') || _nbt_part_matches(part, ev);
+}
+
+/* Which of the rules in `active' still match once `ev' is added to the path? */
+static uint64_t matching_rules(const struct transform* t, uint64_t active, const struct nbt_event* ev)
+{
+    uint64_t ret = 0;
+
+    for(size_t i = 0; i < t->n; i++)
+        if((active >> i & 1) && t->compiled[i].n > ev->depth && part_matches(&t->compiled[i].parts[ev->depth], ev))
+            ret |= (uint64_t)1 << i;
+
+    return ret;
+}
+
+static nbt_status emit(struct transform* t, const void* data, size_t len)
+{
+    return buffer_append(&t->out, data, len) ? NBT_EMEM : NBT_OK;
+}
+
+/* Hands the output over, unless there's a count in it still to be fixed. */
+static nbt_status flush(struct transform* t, bool force)
+{
+    if(t->open_lists > 0 || (!force && t->out.len < FLUSH_SIZE) || t->out.len == 0)
+        return NBT_OK;
+
+    nbt_status err = t->sink->write(t->sink->ctx, t->out.data, t->out.len);
+
+    t->out.len = 0;
+    return err;
+}
+
+/* Counts an element towards the list it's in, if it's in one. */
+static void kept(struct transform* t, const struct nbt_event* ev)
+{
+    if(ev->depth > 0 && t->stack[ev->depth - 1].is_list)
+        t->stack[ev->depth - 1].kept++;
+}
+
+/*
+ * Writes a tag the rewriter emitted in place of `ev'. It's given the name
+ * `ev' had, and in a list, it has to be of the list's type.
+ */
+static nbt_status replace(struct transform* t, const struct nbt_event* ev)
+{
+    const unsigned char* p = t->scratch.data;
+
+    size_t name_len = (size_t)p[1] << 8 | p[2];
+    size_t header = 3 + name_len;
+    nbt_status err;
+
+    if(ev->name == NULL)
+    {
+        if(ev->depth > 0 && p[0] != t->reader.stack[ev->depth - 1].list_type)
+            return NBT_ERR;
+    }
+    else
+    {
+        unsigned char tag[3] = { p[0], (unsigned char)(ev->name_len >> 8), (unsigned char)ev->name_len };
+
+        if((err = emit(t, tag, sizeof tag)) != NBT_OK || (err = emit(t, ev->name, ev->name_len)) != NBT_OK)
+            return err;
+    }
+
+    return emit(t, p + header, t->scratch.len - header);
+}
+
+/* Asks a rule's rewriter what to do with `ev'. */
+static nbt_transform_action rewrite(struct transform* t, size_t rule, const struct nbt_event* ev, nbt_status* err)
+{
+    const struct nbt_transform_rule* r = &t->rules[rule];
+
+    if(r->rewrite == NULL)
+        return NBT_TRANSFORM_DROP;
+
+    struct nbt_sink sink = nbt_sink_buffer(&t->scratch);
+
+    t->scratch.len = 0;
+    nbt_emitter_init(&t->emitter, &sink);
+
+    nbt_transform_action action = r->rewrite(ev, &t->emitter, r->aux);
+
+    if(action == NBT_TRANSFORM_REPLACE && (*err = nbt_emitter_finish(&t->emitter)) == NBT_OK)
+        *err = replace(t, ev);
+
+    return action;
+}
+
+static nbt_status run(struct transform* t, const void* memory)
+{
+    const unsigned char* in = memory;
+    struct nbt_event ev;
+    nbt_status err;
+
+    while((err = nbt_reader_next(&t->reader, &ev)) == NBT_OK && ev.kind != NBT_EVENT_DONE)
+    {
+        if(ev.kind == NBT_EVENT_END)
+        {
+            struct level* l = &t->stack[ev.depth];
+
+            if(l->is_list)
+            {
+                unsigned char* count = t->out.data + l->count_at;
+
+                count[0] = (unsigned char)(l->kept >> 24);
+                count[1] = (unsigned char)(l->kept >> 16);
+                count[2] = (unsigned char)(l->kept >> 8);
+                count[3] = (unsigned char)l->kept;
+
+                t->open_lists--;
+            }
+            else if((err = emit(t, "", 1)) != NBT_OK) /* TAG_End */
+                return err;
+
+            if((err = flush(t, false)) != NBT_OK)
+                return err;
+
+            continue;
+        }
+
+        uint64_t active = ev.depth == 0 ? ~(uint64_t)0 : t->stack[ev.depth - 1].active;
+        uint64_t matched = matching_rules(t, active, &ev);
+
+        /* The first rule which ends here gets to say what happens. */
+        for(size_t i = 0; i < t->n; i++)
+        {
+            if(!(matched >> i & 1) || t->compiled[i].n != ev.depth + 1)
+                continue;
+
+            nbt_transform_action action = rewrite(t, i, &ev, &err);
+
+            if(err != NBT_OK)
+                return err;
+
+            if(action == NBT_TRANSFORM_KEEP)
+                break;
+
+            if(action == NBT_TRANSFORM_REPLACE)
+                kept(t, &ev);
+
+            if(ev.kind == NBT_EVENT_BEGIN && (err = nbt_reader_skip(&t->reader)) != NBT_OK)
+                return err;
+
+            goto next;
+        }
+
+        /* Rules which go deeper than this. */
+        for(size_t i = 0; i < t->n; i++)
+            if(t->compiled[i].n <= ev.depth + 1)
+                matched &= ~((uint64_t)1 << i);
+
+        kept(t, &ev);
+
+        if(ev.kind == NBT_EVENT_VALUE || matched == 0)
+        {
+            /* Nothing in here can change, so it's copied as it is. */
+            if(ev.kind == NBT_EVENT_BEGIN && (err = nbt_reader_skip(&t->reader)) != NBT_OK)
+                return err;
+
+            size_t end = ev.kind == NBT_EVENT_BEGIN ? t->reader.pos : ev.end;
+
+            if((err = emit(t, in + ev.start, end - ev.start)) != NBT_OK)
+                return err;
+        }
+        else
+        {
+            if((err = emit(t, in + ev.start, ev.end - ev.start)) != NBT_OK)
+                return err;
+
+            struct level* l = &t->stack[ev.depth];
+
+            l->active   = matched;
+            l->is_list  = ev.type == TAG_LIST;
+            l->count_at = t->out.len - 4;
+            l->kept     = 0;
+
+            if(l->is_list)
+                t->open_lists++;
+        }
+
+    next:
+        if((err = flush(t, false)) != NBT_OK)
+            return err;
+    }
+
+    return err;
+}
+
+nbt_status nbt_transform(const void* memory, size_t length,
+                         const struct nbt_transform_rule* rules, size_t n,
+                         struct nbt_sink* sink)
+{
+    assert(rules || n == 0);
+    assert(sink);
+
+    if(n > MAX_RULES)
+        return NBT_ERR;
+
+    size_t parts = 0;
+
+    for(size_t i = 0; i < n; i++)
+        parts += _nbt_count_parts(rules[i].path);
+
+    struct transform* t = malloc(sizeof *t);
+    struct nbt_path_part* split = malloc((parts ? parts : 1) * sizeof *split);
+
+    if(t == NULL || split == NULL)
+    {
+        free(t);
+        free(split);
+        return NBT_EMEM;
+    }
+
+    t->rules      = rules;
+    t->n          = n;
+    t->out        = BUFFER_INIT;
+    t->scratch    = BUFFER_INIT;
+    t->sink       = sink;
+    t->open_lists = 0;
+
+    for(size_t i = 0, at = 0; i < n; i++)
+    {
+        t->compiled[i].parts = split + at;
+        t->compiled[i].n     = _nbt_count_parts(rules[i].path);
+
+        _nbt_split_path(rules[i].path, t->compiled[i].parts, t->compiled[i].n);
+        at += t->compiled[i].n;
+    }
+
+    nbt_reader_init(&t->reader, memory, length);
+
+    nbt_status err = run(t, memory);
+
+    if(err == NBT_OK)
+        err = flush(t, true);
+
+    if(err == NBT_OK && sink->flush)
+        err = sink->flush(sink->ctx);
+
+    buffer_free(&t->out);
+    buffer_free(&t->scratch);
+    free(split);
+    free(t);
+
+    return err;
+}
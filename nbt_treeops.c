@@ -8,6 +8,7 @@
  * -----------------------------------------------------------------------------
  */
 #include "nbt.h"
+#include "nbt_internal.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -24,14 +25,40 @@ static inline char* _nbt_strdup(const char* s)
     return r;
 }
 
-#define CHECKED_MALLOC(var, n, on_error) do { \
-    if((var = malloc(n)) == NULL)             \
-    {                                         \
-        errno = NBT_EMEM;                     \
-        on_error;                             \
-    }                                         \
+#define CHECKED_ALLOC(var, allocation, on_error) do { \
+    if((var = (allocation)) == NULL)                  \
+    {                                                 \
+        errno = NBT_EMEM;                             \
+        on_error;                                     \
+    }                                                 \
 } while(0)
 
+#define CHECKED_MALLOC(var, n, on_error) CHECKED_ALLOC(var, malloc(n), on_error)
+
+/*
+ * Returns a fresh node with nothing but its flags filled in. Augmented trees
+ * have to stay augmented all the way down.
+ */
+static inline nbt_node* alloc_node(bool augmented)
+{
+    nbt_node* ret = augmented ? _nbt_alloc_augmented() : nbt_alloc_node();
+
+    if(ret != NULL)
+    {
+        ret->flags = augmented ? NBT_NODE_AUGMENTED : 0;
+        ret->refs  = 0;
+    }
+
+    return ret;
+}
+
+/* Interned names belong to the intern table, not to the node. */
+static inline void free_name(nbt_node* node)
+{
+    if(!(node->flags & NBT_NODE_INTERNED))
+        free(node->name);
+}
+
 void nbt_free_list(struct nbt_list* list)
 {
     if (!list)
@@ -44,22 +71,31 @@ void nbt_free_list(struct nbt_list* list)
         struct nbt_list* entry = list_entry(current, struct nbt_list, entry);
 
         nbt_free(entry->data);
-        free(entry);
+        nbt_release_list(entry);
     }
 
-    free(list->data);
-    free(list);
+    nbt_release_node(list->data);
+    nbt_release_list(list);
 }
 
 void nbt_free(nbt_node* tree)
 {
     if(tree == NULL) return;
 
-    if(tree->type == TAG_LIST)
+    /* Someone else still has a share of it. */
+    if(ref_put(tree)) return;
+
+    if(tree->type == TAG_LIST && (tree->flags & NBT_NODE_PACKED))
+        free(tree->payload.tag_packed_list.data);
+
+    else if(tree->type == TAG_LIST)
         nbt_free_list(tree->payload.tag_list);
 
     else if (tree->type == TAG_COMPOUND)
+    {
+        nbt_compound_invalidate(tree);
         nbt_free_list(tree->payload.tag_compound);
+    }
 
     else if(tree->type == TAG_BYTE_ARRAY)
         free(tree->payload.tag_byte_array.data);
@@ -73,17 +109,19 @@ void nbt_free(nbt_node* tree)
     else if(tree->type == TAG_STRING)
         free(tree->payload.tag_string);
 
-    free(tree->name);
-    free(tree);
+    free_name(tree);
+    nbt_release_node(tree);
 }
 
-static struct nbt_list* clone_list(struct nbt_list* list)
+static nbt_node* clone_node(nbt_node* tree, bool augment);
+
+static struct nbt_list* clone_list(struct nbt_list* list, const bool* augment)
 {
     /* even empty lists are valid pointers! */
     assert(list);
 
     struct nbt_list* ret;
-    CHECKED_MALLOC(ret, sizeof *ret, goto clone_error);
+    CHECKED_ALLOC(ret, nbt_alloc_list(), return NULL);
 
     INIT_LIST_HEAD(&ret->entry);
 
@@ -91,8 +129,9 @@ static struct nbt_list* clone_list(struct nbt_list* list)
 
     if(list->data != NULL)
     {
-        CHECKED_MALLOC(ret->data, sizeof *ret->data, goto clone_error);
-        ret->data->type = list->data->type;
+        CHECKED_ALLOC(ret->data, alloc_node(false), goto clone_error);
+        ret->data->type  = list->data->type;
+        ret->data->index = NULL;
     }
 
     struct list_head* pos;
@@ -101,19 +140,31 @@ static struct nbt_list* clone_list(struct nbt_list* list)
         struct nbt_list* current = list_entry(pos, struct nbt_list, entry);
         struct nbt_list* new;
 
-        CHECKED_MALLOC(new, sizeof *new, goto clone_error);
+        CHECKED_ALLOC(new, nbt_alloc_list(), goto clone_error);
 
-        new->data = nbt_clone(current->data);
+        /* A NULL `augment' means to share the children instead. */
+        if(augment == NULL)
+        {
+            ref_get(current->data);
+            new->data = current->data;
+        }
+        else
+        {
+            new->data = clone_node(current->data, *augment);
+        }
 
         if(new->data == NULL)
         {
-            free(new);
+            nbt_release_list(new);
             goto clone_error;
         }
 
         list_add_tail(&new->entry, &ret->entry);
     }
 
+    if(list_count(list) >= 0)
+        list_set_count(ret, list_count(list));
+
     return ret;
 
 clone_error:
@@ -127,72 +178,224 @@ static inline char* safe_strdup(const char* s)
     return s ? _nbt_strdup(s) : NULL;
 }
 
-nbt_node* nbt_clone(nbt_node* tree)
+/* Copies a packed list's elements. Returns false if we ran out of memory. */
+static bool copy_packed(struct nbt_packed_list* dst, const struct nbt_packed_list* src)
 {
-    if(tree == NULL) return NULL;
-    assert(tree->type != TAG_INVALID);
+    size_t bytes = src->length * nbt_scalar_size(src->type);
 
-    nbt_node* ret = NULL;
-    CHECKED_MALLOC(ret, sizeof *ret, return NULL);
+    *dst = *src;
+
+    if(bytes == 0)
+        return dst->data = NULL, true;
+
+    CHECKED_MALLOC(dst->data, bytes, return false);
+    memcpy(dst->data, src->data, bytes);
+
+    return true;
+}
 
-    ret->type = tree->type;
-    ret->name = safe_strdup(tree->name);
+/*
+ * Gives `dst' a copy of `src''s name. Interned names are just shared. Returns
+ * false if we ran out of memory.
+ */
+static inline bool copy_name(nbt_node* dst, const nbt_node* src)
+{
+    dst->flags |= src->flags & NBT_NODE_INTERNED;
+    dst->name   = src->flags & NBT_NODE_INTERNED ? src->name : safe_strdup(src->name);
 
-    if(tree->name && ret->name == NULL) goto clone_error;
+    return src->name == NULL || dst->name != NULL;
+}
+
+/*
+ * Copies the payload of a node without children: scalars, strings, arrays and
+ * packed lists. Returns false if we ran out of memory.
+ */
+static bool copy_leaf(nbt_node* dst, const nbt_node* src)
+{
+    assert(!has_children(src));
 
-    if(tree->type == TAG_STRING)
+    if(src->type == TAG_STRING)
     {
-        ret->payload.tag_string = _nbt_strdup(tree->payload.tag_string);
-        if(ret->payload.tag_string == NULL) goto clone_error;
+        dst->payload.tag_string = _nbt_strdup(src->payload.tag_string);
+        return dst->payload.tag_string != NULL;
     }
 
-    else if(tree->type == TAG_BYTE_ARRAY)
+    else if(src->type == TAG_BYTE_ARRAY)
     {
-        unsigned char* newbuf;
-        CHECKED_MALLOC(newbuf, tree->payload.tag_byte_array.length, goto clone_error);
+        unsigned char* newbuf = NULL;
 
-        memcpy(newbuf,
-               tree->payload.tag_byte_array.data,
-               tree->payload.tag_byte_array.length);
+        /* Empty arrays may have no data at all, and malloc(0) may return NULL. */
+        if(src->payload.tag_byte_array.length > 0)
+        {
+            CHECKED_MALLOC(newbuf, src->payload.tag_byte_array.length, return false);
 
-        ret->payload.tag_byte_array.data   = newbuf;
-        ret->payload.tag_byte_array.length = tree->payload.tag_byte_array.length;
+            memcpy(newbuf,
+                   src->payload.tag_byte_array.data,
+                   src->payload.tag_byte_array.length);
+        }
+
+        dst->payload.tag_byte_array.data   = newbuf;
+        dst->payload.tag_byte_array.length = src->payload.tag_byte_array.length;
     }
 
-    else if(tree->type == TAG_INT_ARRAY)
+    else if(src->type == TAG_INT_ARRAY)
     {
-        int32_t* newbuf;
-        CHECKED_MALLOC(newbuf, tree->payload.tag_int_array.length * sizeof(int32_t), goto clone_error);
+        size_t bytes = src->payload.tag_int_array.length * sizeof(int32_t);
+
+        int32_t* newbuf = NULL;
 
-        memcpy(newbuf,
-               tree->payload.tag_int_array.data,
-               tree->payload.tag_int_array.length);
+        if(bytes > 0)
+        {
+            CHECKED_MALLOC(newbuf, bytes, return false);
+            memcpy(newbuf, src->payload.tag_int_array.data, bytes);
+        }
 
-        ret->payload.tag_int_array.data   = newbuf;
-        ret->payload.tag_int_array.length = tree->payload.tag_int_array.length;
+        dst->payload.tag_int_array.data   = newbuf;
+        dst->payload.tag_int_array.length = src->payload.tag_int_array.length;
     }
 
-    else if(tree->type == TAG_LIST)
+    else if(src->type == TAG_LONG_ARRAY)
+    {
+        size_t bytes = src->payload.tag_long_array.length * sizeof(int64_t);
+
+        int64_t* newbuf = NULL;
+
+        if(bytes > 0)
+        {
+            CHECKED_MALLOC(newbuf, bytes, return false);
+            memcpy(newbuf, src->payload.tag_long_array.data, bytes);
+        }
+
+        dst->payload.tag_long_array.data   = newbuf;
+        dst->payload.tag_long_array.length = src->payload.tag_long_array.length;
+    }
+
+    else if(src->type == TAG_LIST && (src->flags & NBT_NODE_PACKED))
+    {
+        if(!copy_packed(&dst->payload.tag_packed_list, &src->payload.tag_packed_list))
+            return false;
+
+        dst->flags |= NBT_NODE_PACKED;
+    }
+
+    else
+    {
+        dst->payload = src->payload;
+    }
+
+    return true;
+}
+
+/* Clones `tree', making every node of the clone augmented if asked to. */
+static nbt_node* clone_node(nbt_node* tree, bool augment)
+{
+    if(tree == NULL) return NULL;
+    assert(tree->type != TAG_INVALID);
+
+    nbt_node* ret = NULL;
+    CHECKED_ALLOC(ret, alloc_node(augment), return NULL);
+
+    ret->type  = tree->type;
+    ret->index = NULL;
+
+    if(!copy_name(ret, tree)) goto clone_error;
+
+    if(tree->type == TAG_LIST && has_children(tree))
     {
-        ret->payload.tag_list = clone_list(tree->payload.tag_list);
+        ret->payload.tag_list = clone_list(tree->payload.tag_list, &augment);
         if(ret->payload.tag_list == NULL) goto clone_error;
     }
     else if(tree->type == TAG_COMPOUND)
     {
-        ret->payload.tag_compound = clone_list(tree->payload.tag_compound);
+        ret->payload.tag_compound = clone_list(tree->payload.tag_compound, &augment);
         if(ret->payload.tag_compound == NULL) goto clone_error;
     }
-    else
+    else if(!copy_leaf(ret, tree))
     {
-        ret->payload = tree->payload;
+        goto clone_error;
+    }
+
+    if(augment)
+    {
+        AUGMENTED(ret)->parent = NULL;
+        _nbt_aug_adopt(ret);
     }
 
     return ret;
 
 clone_error:
-    if(ret) free(ret->name);
+    if(ret) free_name(ret);
+
+    nbt_release_node(ret);
+    return NULL;
+}
+
+nbt_node* _nbt_clone(const nbt_node* tree, bool augment)
+{
+    return clone_node((nbt_node*)tree, augment);
+}
+
+nbt_node* nbt_clone(nbt_node* tree)
+{
+    return tree ? clone_node(tree, is_augmented(tree)) : NULL;
+}
+
+nbt_node* nbt_augment(nbt_node* tree)
+{
+    return clone_node(tree, true);
+}
+
+nbt_node* nbt_share(nbt_node* tree)
+{
+    if(tree == NULL) return NULL;
+
+    if(is_augmented(tree))
+        return nbt_clone(tree);
+
+    ref_get(tree);
+    return tree;
+}
+
+nbt_node* nbt_unshare(nbt_node* node)
+{
+    if(node == NULL || !is_shared(node))
+        return node;
+
+    assert(!is_augmented(node));
+
+    nbt_node* ret = NULL;
+    CHECKED_ALLOC(ret, alloc_node(false), return NULL);
+
+    ret->type  = node->type;
+    ret->index = NULL;
+
+    if(!copy_name(ret, node)) goto unshare_error;
+
+    if(node->type == TAG_LIST && has_children(node))
+    {
+        ret->payload.tag_list = clone_list(node->payload.tag_list, NULL);
+        if(ret->payload.tag_list == NULL) goto unshare_error;
+    }
+    else if(node->type == TAG_COMPOUND)
+    {
+        ret->payload.tag_compound = clone_list(node->payload.tag_compound, NULL);
+        if(ret->payload.tag_compound == NULL) goto unshare_error;
+    }
+    else if(!copy_leaf(ret, node))
+    {
+        goto unshare_error;
+    }
+
+    /*
+     * The copy holds its own shares of the children, so let go of ours. If the
+     * other owners let go in the meantime, this frees the original.
+     */
+    nbt_free(node);
+    return ret;
 
-    free(ret);
+unshare_error:
+    free_name(ret);
+    nbt_release_node(ret);
     return NULL;
 }
 
@@ -204,6 +407,9 @@ bool nbt_map(nbt_node* tree, nbt_visitor_t v, void* aux)
     if(!v(tree, aux)) return false;
 
     /* And if the item is a list or compound, recurse through each of their elements. */
+    if(!has_children(tree))
+        return true;
+
     if(tree->type == TAG_COMPOUND)
     {
         struct list_head* pos;
@@ -225,156 +431,300 @@ bool nbt_map(nbt_node* tree, nbt_visitor_t v, void* aux)
     return true;
 }
 
-/* Only returns NULL on error. An empty list is still a valid pointer */
-static struct nbt_list* filter_list(const struct nbt_list* list, nbt_predicate_t predicate, void* aux)
+void nbt_iter_init(struct nbt_iter* it, nbt_node* tree, nbt_order order)
 {
-    assert(list);
+    it->order = order;
+    it->root  = tree;
+    it->last  = NULL;
+    it->err   = NBT_OK;
+    it->depth = 0;
+}
 
-    struct nbt_list* ret = NULL;
-    CHECKED_MALLOC(ret, sizeof *ret, goto filter_error);
+/* Walks into `node', which has to have children. */
+static nbt_status iter_push(struct nbt_iter* it, nbt_node* node)
+{
+    if(it->depth == NBT_ITER_MAX_DEPTH)
+        return NBT_ERR;
 
-    ret->data = NULL;
-    INIT_LIST_HEAD(&ret->entry);
+    it->stack[it->depth++] = (struct nbt_iter_frame) {
+        node, &node->payload.tag_compound->entry
+    };
 
-    const struct list_head* pos;
-    list_for_each(pos, &list->entry)
+    return NBT_OK;
+}
+
+/* Moves on to the next child of the innermost list or compound, or NULL if there isn't one. */
+static nbt_node* iter_advance(struct nbt_iter* it)
+{
+    struct nbt_iter_frame* top = &it->stack[it->depth - 1];
+
+    top->pos = top->pos->flink;
+
+    if(top->pos == &top->node->payload.tag_compound->entry)
+        return NULL;
+
+    return list_entry(top->pos, struct nbt_list, entry)->data;
+}
+
+static nbt_node* next_preorder(struct nbt_iter* it)
+{
+    nbt_node* node = it->last;
+
+    it->last = NULL;
+
+    if(node != NULL && has_children(node) && (it->err = iter_push(it, node)) != NBT_OK)
+        return NULL;
+
+    if((node = it->root) != NULL)
     {
-        const struct nbt_list* p = list_entry(pos, struct nbt_list, entry);
+        it->root = NULL;
+        return it->last = node;
+    }
+
+    for(; it->depth > 0; it->depth--)
+        if((node = iter_advance(it)) != NULL)
+            return it->last = node;
+
+    return NULL;
+}
+
+static nbt_node* next_postorder(struct nbt_iter* it)
+{
+    nbt_node* node = it->root;
+
+    if(node != NULL)
+        it->root = NULL;
+    else if(it->depth == 0)
+        return NULL;
+    else if((node = iter_advance(it)) == NULL)
+        return it->stack[--it->depth].node; /* All its children are done. */
 
-        nbt_node* new_node = nbt_filter(p->data, predicate, aux);
+    /* Nodes with children come after them, so find the first one with none. */
+    while(has_children(node))
+    {
+        if((it->err = iter_push(it, node)) != NBT_OK)
+            return NULL;
 
-        if(errno != NBT_OK)  goto filter_error;
-        if(new_node == NULL) continue;
+        nbt_node* first = iter_advance(it);
 
-        struct nbt_list* new_entry;
-        CHECKED_MALLOC(new_entry, sizeof *new_entry, goto filter_error);
+        if(first == NULL)
+            return it->stack[--it->depth].node;
 
-        new_entry->data = new_node;
-        list_add_tail(&new_entry->entry, &ret->entry);
+        node = first;
     }
 
+    return node;
+}
+
+nbt_node* nbt_iter_next(struct nbt_iter* it)
+{
+    assert(it);
+
+    nbt_node* ret = NULL;
+
+    if(it->err == NBT_OK)
+        ret = it->order == NBT_PREORDER ? next_preorder(it) : next_postorder(it);
+
+    errno = it->err;
     return ret;
+}
 
-filter_error:
-    if(errno == NBT_OK)
-        errno = NBT_EMEM;
+void nbt_iter_skip_children(struct nbt_iter* it)
+{
+    assert(it);
 
-    nbt_free_list(ret);
-    return NULL;
+    if(it->order == NBT_PREORDER)
+        it->last = NULL;
 }
 
-nbt_node* nbt_filter(const nbt_node* tree, nbt_predicate_t filter, void* aux)
+/* An empty list like `list', or NULL if we ran out of memory. */
+static struct nbt_list* empty_like(const struct nbt_list* list)
 {
-    assert(filter);
+    struct nbt_list* ret = NULL;
+    CHECKED_ALLOC(ret, nbt_alloc_list(), return NULL);
 
-    errno = NBT_OK;
+    ret->data = NULL;
+    INIT_LIST_HEAD(&ret->entry);
 
-    if(tree == NULL)       return NULL;
-    if(!filter(tree, aux)) return NULL;
+    /* Lists have to keep their type, even if nothing in them survives. */
+    if(list->data != NULL)
+    {
+        CHECKED_ALLOC(ret->data, alloc_node(false), nbt_release_list(ret); return NULL);
+        ret->data->type  = list->data->type;
+        ret->data->index = NULL;
+
+        if(list_count(list) >= 0)
+            list_set_count(ret, 0);
+    }
+
+    return ret;
+}
 
+nbt_node* _nbt_filter_copy(const nbt_node* tree)
+{
     nbt_node* ret = NULL;
-    CHECKED_MALLOC(ret, sizeof *ret, goto filter_error);
+    CHECKED_ALLOC(ret, alloc_node(is_augmented(tree)), return NULL);
 
-    ret->type = tree->type;
-    ret->name = safe_strdup(tree->name);
+    ret->type  = tree->type;
+    ret->index = NULL;
 
-    if(tree->name && ret->name == NULL) goto filter_error;
+    if(!copy_name(ret, tree)) goto copy_error;
 
-    if(tree->type == TAG_STRING)
+    if(has_children(tree))
     {
-        ret->payload.tag_string = _nbt_strdup(tree->payload.tag_string);
-        if(ret->payload.tag_string == NULL) goto filter_error;
+        ret->payload.tag_list = empty_like(tree->payload.tag_list);
+        if(ret->payload.tag_list == NULL) goto copy_error;
     }
-
-    else if(tree->type == TAG_BYTE_ARRAY)
+    /* Packed elements aren't nodes, so the predicate never sees them. */
+    else if(!copy_leaf(ret, tree))
     {
-        CHECKED_MALLOC(ret->payload.tag_byte_array.data,
-                       tree->payload.tag_byte_array.length,
-                       goto filter_error);
+        goto copy_error;
+    }
 
-        memcpy(ret->payload.tag_byte_array.data,
-               tree->payload.tag_byte_array.data,
-               tree->payload.tag_byte_array.length);
+    return ret;
 
-        ret->payload.tag_byte_array.length = tree->payload.tag_byte_array.length;
-    }
+copy_error:
+    errno = NBT_EMEM;
 
-    else if(tree->type == TAG_INT_ARRAY)
-    {
-        CHECKED_MALLOC(ret->payload.tag_int_array.data,
-                       tree->payload.tag_int_array.length * sizeof(int32_t),
-                       goto filter_error);
+    free_name(ret);
+    nbt_release_node(ret);
+    return NULL;
+}
 
-        memcpy(ret->payload.tag_int_array.data,
-               tree->payload.tag_int_array.data,
-               tree->payload.tag_int_array.length);
+nbt_status _nbt_filter_add(nbt_node* parent, nbt_node* child)
+{
+    struct nbt_list* list = parent->payload.tag_list;
+    struct nbt_list* entry = nbt_alloc_list();
 
-        ret->payload.tag_int_array.length = tree->payload.tag_int_array.length;
-    }
+    if(entry == NULL)
+        return NBT_EMEM;
 
-    /* Okay, we want to keep this node, but keep traversing the tree! */
-    else if(tree->type == TAG_LIST)
-    {
-        ret->payload.tag_list = filter_list(tree->payload.tag_list, filter, aux);
-        if(ret->payload.tag_list == NULL) goto filter_error;
-    }
-    else if(tree->type == TAG_COMPOUND)
+    entry->data = child;
+    list_add_tail(&entry->entry, &list->entry);
+
+    if(list_count(list) >= 0)
+        list_set_count(list, list_count(list) + 1);
+
+    return NBT_OK;
+}
+
+void _nbt_filter_finish(nbt_node* node)
+{
+    if(is_augmented(node))
     {
-        ret->payload.tag_compound = filter_list(tree->payload.tag_compound, filter, aux);
-        if(ret->payload.tag_compound == NULL) goto filter_error;
+        AUGMENTED(node)->parent = NULL;
+        _nbt_aug_adopt(node);
     }
-    else
+}
+
+nbt_node* nbt_filter(const nbt_node* tree, nbt_predicate_t filter, void* aux)
+{
+    assert(filter);
+
+    errno = NBT_OK;
+
+    if(tree == NULL)       return NULL;
+    if(!filter(tree, aux)) return NULL;
+
+    nbt_node* ret = _nbt_filter_copy(tree);
+    if(ret == NULL) return NULL;
+
+    /* Okay, we want to keep this node, but keep traversing the tree! */
+    if(has_children(tree))
     {
-        ret->payload = tree->payload;
+        const struct list_head* pos;
+        list_for_each(pos, &tree->payload.tag_list->entry)
+        {
+            nbt_node* child = nbt_filter(list_entry(pos, struct nbt_list, entry)->data, filter, aux);
+
+            if(errno != NBT_OK)  goto filter_error;
+            if(child == NULL)    continue;
+
+            if((errno = _nbt_filter_add(ret, child)) != NBT_OK)
+            {
+                nbt_free(child);
+                goto filter_error;
+            }
+        }
     }
 
+    _nbt_filter_finish(ret);
     return ret;
 
 filter_error:
-    if(errno == NBT_OK)
-        errno = NBT_EMEM;
-
-    if(ret) free(ret->name);
-
-    free(ret);
+    nbt_free(ret);
+    errno = NBT_EMEM;
     return NULL;
 }
 
-nbt_node* nbt_filter_inplace(nbt_node* tree, nbt_predicate_t filter, void* aux)
+/*
+ * `is_root' is true for the node nbt_filter_inplace was called on. Only that
+ * one has to tell its ancestors that it shrank: everything below it gets
+ * recounted by its own parent on the way back up.
+ */
+static nbt_node* filter_inplace(nbt_node* tree, nbt_predicate_t filter, void* aux, bool is_root)
 {
-    assert(filter);
-
     if(tree == NULL)               return                 NULL;
     if(!filter(tree, aux))         return nbt_free(tree), NULL;
-    if(tree->type != TAG_LIST &&
-       tree->type != TAG_COMPOUND) return tree;
+    if(!has_children(tree))        return tree;
+
+    /* Don't pull the rug out from under the other owners. */
+    if(is_shared(tree))
+    {
+        nbt_node* copy = nbt_unshare(tree);
+
+        if(copy == NULL)
+            return errno = NBT_EMEM, tree;
+
+        tree = copy;
+    }
 
     struct list_head* pos;
     struct list_head* n;
     struct nbt_list* list = tree->type == TAG_LIST ? tree->payload.tag_list : tree->payload.tag_compound;
 
+    /* Children are about to be freed from under the index. Rebuild it later. */
+    nbt_compound_invalidate(tree);
+
     list_for_each_safe(pos, n, &list->entry)
     {
         struct nbt_list* cur = list_entry(pos, struct nbt_list, entry);
 
-        cur->data = nbt_filter_inplace(cur->data, filter, aux);
+        cur->data = filter_inplace(cur->data, filter, aux, false);
 
         if(cur->data == NULL)
         {
             list_del(pos);
-            free(cur);
+            nbt_release_list(cur);
+
+            if(list_count(list) > 0)
+                list_set_count(list, list_count(list) - 1);
         }
     }
 
+    if(is_augmented(tree))
+    {
+        if(is_root) _nbt_aug_refresh(tree);
+        else        _nbt_aug_adopt(tree);
+    }
+
     return tree;
 }
 
+nbt_node* nbt_filter_inplace(nbt_node* tree, nbt_predicate_t filter, void* aux)
+{
+    assert(filter);
+
+    errno = NBT_OK;
+
+    return filter_inplace(tree, filter, aux, true);
+}
+
 nbt_node* nbt_find(nbt_node* tree, nbt_predicate_t predicate, void* aux)
 {
     if(tree == NULL)                  return NULL;
     if(predicate(tree, aux))          return tree;
-    if(tree->type != TAG_LIST &&
-       tree->type != TAG_COMPOUND)    return NULL;
+    if(!has_children(tree))           return NULL;
 
     struct list_head* pos;
     struct nbt_list* list = tree->type == TAG_LIST ? tree->payload.tag_list : tree->payload.tag_compound;
@@ -391,24 +741,41 @@ nbt_node* nbt_find(nbt_node* tree, nbt_predicate_t predicate, void* aux)
     return NULL;
 }
 
-static bool names_are_equal(const nbt_node* node, void* vname)
+/*
+ * A name we're searching for. `interned' is its interned copy, or NULL if it
+ * was never interned. Interned names can then be compared by pointer.
+ */
+struct name_query {
+    const char* name;
+    const char* interned;
+};
+
+static bool names_are_equal(const nbt_node* node, void* vquery)
 {
-    const char* name = vname;
+    const struct name_query* query = vquery;
 
     assert(node);
 
-    if(name == NULL && node->name == NULL)
+    if(query->name == NULL && node->name == NULL)
         return true;
 
-    if(name == NULL || node->name == NULL)
+    if(query->name == NULL || node->name == NULL)
         return false;
 
-    return strcmp(node->name, name) == 0;
+    if(node->flags & NBT_NODE_INTERNED)
+        return node->name == query->interned;
+
+    return strcmp(node->name, query->name) == 0;
 }
 
 nbt_node* nbt_find_by_name(nbt_node* tree, const char* name)
 {
-    return nbt_find(tree, &names_are_equal, (void*)name);
+    struct name_query query = {
+        .name     = name,
+        .interned = name ? nbt_intern_find(name, strlen(name)) : NULL
+    };
+
+    return nbt_find(tree, &names_are_equal, &query);
 }
 
 /*
@@ -443,35 +810,32 @@ static int partial_strcmp(const char* s1, size_t len, const char* s2)
     return s2[len] != '\0';
 }
 
-/*
- * Format:
- *   current_name.[other shit]
- * OR
- *   current_name'\0'
- *
- * where current_name can be empty.
- */
-nbt_node* nbt_find_by_path(nbt_node* tree, const char* path)
+static bool part_matches(const struct nbt_path_part* part, const nbt_node* node)
 {
-    assert(tree);
-    assert(path);
+    if(node->flags & NBT_NODE_INTERNED)
+        return node->name == part->interned;
 
-    /* The end of the "current_name" piece. */
-    size_t e = index_of(path, '.');
-
-    bool names_match = partial_strcmp(path, e, tree->name) == 0;
+    return partial_strcmp(part->name, part->len, node->name) == 0;
+}
 
+/*
+ * If `trail' isn't NULL, trail[i] is set to the list entry holding the i'th
+ * node on the way to the one we found. The root isn't in a list, so trail[0]
+ * is left alone.
+ */
+static nbt_node* find_by_parts(nbt_node* tree, const struct nbt_path_part* parts, size_t n, struct nbt_list** trail)
+{
     /* Names don't match. These aren't the droids you're looking for. */
-    if(!names_match)                                         return NULL;
+    if(!part_matches(parts, tree))                           return NULL;
 
     /* We're a leaf node, and the names match. Wooo found it. */
-    if(path[e] == '\0')                                     return tree;
+    if(n == 1)                                               return tree;
 
     /*
-     * Initial names match, but the string isn't at the end. We're expecting a
+     * Initial names match, but the path isn't at the end. We're expecting a
      * list, but haven't hit one.
      */
-    if(tree->type != TAG_LIST && tree->type != TAG_COMPOUND) return NULL;
+    if(!has_children(tree))                                  return NULL;
 
     /* At this point, the inital names match, and we're not at a leaf node. */
 
@@ -482,7 +846,9 @@ nbt_node* nbt_find_by_path(nbt_node* tree, const char* path)
         struct nbt_list* elem = list_entry(pos, struct nbt_list, entry);
         nbt_node* r;
 
-        if((r = nbt_find_by_path(elem->data, path + e + 1)) != NULL)
+        if(trail) trail[1] = elem;
+
+        if((r = find_by_parts(elem->data, parts + 1, n - 1, trail ? trail + 1 : NULL)) != NULL)
             return r;
     }
 
@@ -490,6 +856,175 @@ nbt_node* nbt_find_by_path(nbt_node* tree, const char* path)
     return NULL;
 }
 
+size_t _nbt_count_parts(const char* path)
+{
+    size_t n = 1;
+    for(const char* p = path; *p; p++)
+        if(*p == '.')
+            n++;
+
+    return n;
+}
+
+/*
+ * Format:
+ *   current_name.[other shit]
+ * OR
+ *   current_name'\0'
+ *
+ * where current_name can be empty.
+ *
+ * The path is split up once, so that we don't have to keep rescanning it at
+ * every level of the tree.
+ */
+void _nbt_split_path(const char* path, struct nbt_path_part* parts, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        /* The end of the "current_name" piece. */
+        size_t e = index_of(path, '.');
+
+        parts[i] = (struct nbt_path_part) {
+            .name     = path,
+            .len      = e,
+            .interned = nbt_intern_find(path, e)
+        };
+
+        path += e + 1;
+    }
+}
+
+struct nbt_path_part* _nbt_split_parts(const char* path, struct nbt_path_part* stack, size_t* n)
+{
+    struct nbt_path_part* parts = stack;
+
+    *n = _nbt_count_parts(path);
+
+    if(*n > NBT_PATH_PARTS_ON_STACK)
+        CHECKED_MALLOC(parts, *n * sizeof *parts, return NULL);
+
+    _nbt_split_path(path, parts, *n);
+    return parts;
+}
+
+void _nbt_free_parts(struct nbt_path_part* parts, struct nbt_path_part* stack)
+{
+    if(parts != stack)
+        free(parts);
+}
+
+nbt_node* nbt_find_by_path(nbt_node* tree, const char* path)
+{
+    assert(tree);
+    assert(path);
+
+    struct nbt_path_part stack[NBT_PATH_PARTS_ON_STACK];
+    size_t n;
+
+    struct nbt_path_part* parts = _nbt_split_parts(path, stack, &n);
+    if(parts == NULL) return NULL;
+
+    nbt_node* ret = find_by_parts(tree, parts, n, NULL);
+
+    _nbt_free_parts(parts, stack);
+    return ret;
+}
+
+/* Returns the entry of `parent''s list which holds `child'. */
+static struct nbt_list* entry_of(nbt_node* parent, const nbt_node* child)
+{
+    struct nbt_list* list = parent->type == TAG_LIST ? parent->payload.tag_list : parent->payload.tag_compound;
+
+    struct list_head* pos;
+    list_for_each(pos, &list->entry)
+    {
+        struct nbt_list* entry = list_entry(pos, struct nbt_list, entry);
+
+        if(entry->data == child)
+            return entry;
+    }
+
+    return NULL;
+}
+
+nbt_node* nbt_writable(nbt_node** tree, const char* path)
+{
+    assert(tree && *tree);
+
+    errno = NBT_OK;
+
+    struct nbt_path_part stack[NBT_PATH_PARTS_ON_STACK];
+    struct nbt_list* trail_stack[NBT_PATH_PARTS_ON_STACK];
+    struct nbt_path_part* parts = NULL;
+    struct nbt_list** trail = trail_stack;
+    nbt_node* ret = NULL;
+    size_t n = 1;
+
+    if(path != NULL)
+    {
+        if((parts = _nbt_split_parts(path, stack, &n)) == NULL)
+            return NULL;
+
+        if(n > NBT_PATH_PARTS_ON_STACK)
+            CHECKED_MALLOC(trail, n * sizeof *trail, goto writable_exit);
+
+        if(find_by_parts(*tree, parts, n, trail) == NULL)
+            goto writable_exit;
+    }
+
+    /*
+     * Copy our way down from the root. Each copy shares its children with the
+     * original, so the next node on the trail is still in its list. A parent
+     * which wasn't copied still has the entry we found it in. One which was
+     * has a new list, so the entry has to be found again, but copying the
+     * list already cost that much.
+     *
+     * Unsharing a node may free the original, and the trail's entries in it
+     * with it, so the next node is read off the trail before that happens.
+     */
+    nbt_node* parent = *tree;
+    nbt_node* next = n > 1 ? trail[1]->data : NULL;
+    bool copied = is_shared(parent);
+
+    if((parent = nbt_unshare(parent)) == NULL)
+    {
+        errno = NBT_EMEM;
+        goto writable_exit;
+    }
+
+    *tree = parent;
+
+    for(size_t i = 1; i < n; i++)
+    {
+        struct nbt_list* entry = copied ? entry_of(parent, next) : trail[i];
+        assert(entry && entry->data == next);
+
+        nbt_node* child = entry->data;
+        next = i + 1 < n ? trail[i + 1]->data : NULL;
+        copied = is_shared(child);
+
+        if((child = nbt_unshare(child)) == NULL)
+        {
+            errno = NBT_EMEM;
+            goto writable_exit;
+        }
+
+        entry->data = child;
+        parent = child;
+    }
+
+    ret = parent;
+
+writable_exit:
+    if(trail != trail_stack)
+        free(trail);
+
+    if(parts != NULL)
+        _nbt_free_parts(parts, stack);
+
+    return ret;
+}
+
 /* Gets the length of the list, plus the length of all its children. */
 static inline size_t nbt_full_list_length(struct nbt_list* list)
 {
@@ -507,6 +1042,11 @@ size_t nbt_size(const nbt_node* tree)
     if(tree == NULL)
         return 0;
 
+    if(is_augmented(tree))
+        return AUGMENTED(tree)->size;
+
+    if(tree->type == TAG_LIST && (tree->flags & NBT_NODE_PACKED))
+        return 1;
     if(tree->type == TAG_LIST)
         return nbt_full_list_length(tree->payload.tag_list) + 1;
     if(tree->type == TAG_COMPOUND)
@@ -515,8 +1055,71 @@ size_t nbt_size(const nbt_node* tree)
     return 1;
 }
 
+int32_t nbt_list_length(const nbt_node* list)
+{
+    if(list == NULL || list->type != TAG_LIST)
+        return -1;
+
+    if(list->flags & NBT_NODE_PACKED)
+        return list->payload.tag_packed_list.length;
+
+    int32_t count = list_count(list->payload.tag_list);
+
+    return count >= 0 ? count : (int32_t)list_length(&list->payload.tag_list->entry);
+}
+
+nbt_status nbt_list_append(nbt_node* list, nbt_node* elem)
+{
+    assert(list && list->type == TAG_LIST);
+    assert(elem);
+    assert(!is_shared(list));
+
+    if((list->flags ^ elem->flags) & NBT_NODE_AUGMENTED)
+        return NBT_ERR;
+
+    nbt_status err;
+
+    if((list->flags & NBT_NODE_PACKED) && (err = nbt_list_unpack(list)) != NBT_OK)
+        return err;
+
+    struct nbt_list* l = list->payload.tag_list;
+    bool empty = list_empty(&l->entry);
+    int32_t count = empty ? 0 : list_count(l);
+
+    /* This is the only way in, so this is where the list stays homogenous. */
+    if(!empty && elem->type != l->data->type)
+        return NBT_ERR;
+
+    if(count == INT32_MAX)
+        return NBT_ERR;
+
+    struct nbt_list* entry;
+    CHECKED_ALLOC(entry, nbt_alloc_list(), return NBT_EMEM);
+
+    entry->data = elem;
+    list_add_tail(&entry->entry, &l->entry);
+
+    l->data->type = elem->type;
+
+    if(count >= 0)
+        list_set_count(l, count + 1);
+
+    if(is_augmented(list))
+        _nbt_aug_link(list, elem);
+
+    return NBT_OK;
+}
+
+void nbt_list_invalidate(nbt_node* list)
+{
+    if(list == NULL || list->type != TAG_LIST || (list->flags & NBT_NODE_PACKED))
+        return;
+
+    list->payload.tag_list->data->flags &= ~NBT_NODE_COUNTED;
+}
+
 nbt_node* nbt_list_item(nbt_node* list, int n) {
-    if (list == NULL || (list->type != TAG_LIST && list->type != TAG_COMPOUND))
+    if (list == NULL || !has_children(list))
         return NULL;
     
     int i = 0;
@@ -529,3 +1132,142 @@ nbt_node* nbt_list_item(nbt_node* list, int n) {
 
     return NULL;
 }
+
+bool nbt_list_span(const nbt_node* list, struct nbt_span* span)
+{
+    if(list == NULL || list->type != TAG_LIST || !(list->flags & NBT_NODE_PACKED))
+        return false;
+
+    span->data   = list->payload.tag_packed_list.data;
+    span->length = list->payload.tag_packed_list.length;
+    span->type   = list->payload.tag_packed_list.type;
+
+    return true;
+}
+
+void nbt_span_get(const struct nbt_span* span, int32_t i, nbt_node* elem)
+{
+    size_t size = nbt_scalar_size(span->type);
+
+    assert(i >= 0 && i < span->length);
+
+    elem->type  = span->type;
+    elem->flags = 0;
+    elem->refs  = 0;
+    elem->name  = NULL;
+    elem->index = NULL;
+
+    /* Every scalar lives at the start of the payload union. */
+    memcpy(&elem->payload, (const char*)span->data + i * size, size);
+}
+
+nbt_status nbt_list_pack(nbt_node* list)
+{
+    assert(list);
+
+    if(list->type != TAG_LIST || (list->flags & NBT_NODE_PACKED))
+        return NBT_OK;
+
+    assert(!is_shared(list));
+
+    struct nbt_list* l = list->payload.tag_list;
+    nbt_type type = l->data->type;
+    size_t size = nbt_scalar_size(type);
+
+    if(size == 0)
+        return NBT_OK;
+
+    size_t len = 0;
+    const struct list_head* pos;
+
+    list_for_each(pos, &l->entry)
+    {
+        /* A mixed list is broken anyway. Leave it for dump_binary to reject. */
+        if(list_entry(pos, struct nbt_list, entry)->data->type != type)
+            return NBT_OK;
+
+        len++;
+    }
+
+    if(len > 2147483647 /* INT_MAX */)
+        return NBT_ERR;
+
+    struct nbt_packed_list packed = { NULL, (int32_t)len, type };
+
+    if(len && (packed.data = malloc(len * size)) == NULL)
+        return NBT_EMEM;
+
+    char* out = packed.data;
+    list_for_each(pos, &l->entry)
+    {
+        memcpy(out, &list_entry(pos, struct nbt_list, entry)->data->payload, size);
+        out += size;
+    }
+
+    nbt_free_list(l);
+
+    list->payload.tag_packed_list = packed;
+    list->flags |= NBT_NODE_PACKED;
+
+    if(is_augmented(list))
+        _nbt_aug_refresh(list);
+
+    return NBT_OK;
+}
+
+nbt_status nbt_list_unpack(nbt_node* list)
+{
+    assert(list);
+
+    if(list->type != TAG_LIST || !(list->flags & NBT_NODE_PACKED))
+        return NBT_OK;
+
+    assert(!is_shared(list));
+
+    struct nbt_span span;
+    nbt_list_span(list, &span);
+
+    struct nbt_list* ret;
+    CHECKED_ALLOC(ret, nbt_alloc_list(), return NBT_EMEM);
+
+    INIT_LIST_HEAD(&ret->entry);
+    CHECKED_ALLOC(ret->data, nbt_alloc_node(), goto unpack_error);
+
+    ret->data->type  = span.type;
+    ret->data->flags = 0;
+    ret->data->refs  = 0;
+    ret->data->index = NULL;
+
+    for(int32_t i = 0; i < span.length; i++)
+    {
+        struct nbt_list* new;
+        CHECKED_ALLOC(new, nbt_alloc_list(), goto unpack_error);
+        CHECKED_ALLOC(new->data, alloc_node(is_augmented(list)), nbt_release_list(new); goto unpack_error);
+
+        unsigned aug = new->data->flags;
+
+        nbt_span_get(&span, i, new->data);
+        new->data->flags = aug;
+
+        if(aug & NBT_NODE_AUGMENTED)
+            _nbt_aug_adopt(new->data);
+
+        list_add_tail(&new->entry, &ret->entry);
+    }
+
+    list_set_count(ret, span.length);
+
+    free(list->payload.tag_packed_list.data);
+
+    list->payload.tag_list = ret;
+    list->flags &= ~NBT_NODE_PACKED;
+
+    if(is_augmented(list))
+        _nbt_aug_refresh(list);
+
+    return NBT_OK;
+
+unpack_error:
+    nbt_free_list(ret);
+    return NBT_EMEM;
+}
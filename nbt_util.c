@@ -8,7 +8,10 @@
  * -----------------------------------------------------------------------------
  */
 #include "nbt.h"
+#include "nbt_internal.h"
 
+#include <assert.h>
+#include <math.h>
 #include <string.h>
 
 const char* nbt_type_to_string(nbt_type t)
@@ -28,12 +31,28 @@ const char* nbt_type_to_string(nbt_type t)
         DEF_CASE(TAG_LIST);
         DEF_CASE(TAG_COMPOUND);
         DEF_CASE(TAG_INT_ARRAY);
+        DEF_CASE(TAG_LONG_ARRAY);
     default:
         return "TAG_UNKNOWN";
     }
 #undef DEF_CASE
 }
 
+size_t nbt_scalar_size(nbt_type t)
+{
+    switch(t)
+    {
+    case TAG_BYTE:   return sizeof(int8_t);
+    case TAG_SHORT:  return sizeof(int16_t);
+    case TAG_INT:    return sizeof(int32_t);
+    case TAG_LONG:   return sizeof(int64_t);
+    case TAG_FLOAT:  return sizeof(float);
+    case TAG_DOUBLE: return sizeof(double);
+    default:
+        return 0;
+    }
+}
+
 const char* nbt_error_to_string(nbt_status s)
 {
     switch(s)
@@ -79,12 +98,92 @@ static inline bool floats_are_close(double a, double b)
     return (min(a, b) + epsilon) >= max(a, b);
 }
 
+/*
+ * Compares two lists, at least one of which is packed. Packing is just a
+ * storage detail, so a packed list equals the unpacked list it came from.
+ */
+static bool packed_lists_eq(const nbt_node* a, const nbt_node* b)
+{
+    if(!(a->flags & NBT_NODE_PACKED))
+    {
+        const nbt_node* t = a;
+        a = b;
+        b = t;
+    }
+
+    struct nbt_span as, bs;
+    nbt_list_span(a, &as);
+
+    if(nbt_list_span(b, &bs))
+    {
+        if(as.type != bs.type || as.length != bs.length)
+            return false;
+
+        /* Floats still need to be compared with some slack, so no memcmp. */
+        for(int32_t i = 0; i < as.length; i++)
+        {
+            nbt_node ae, be;
+
+            nbt_span_get(&as, i, &ae);
+            nbt_span_get(&bs, i, &be);
+
+            if(!nbt_eq(&ae, &be))
+                return false;
+        }
+
+        return true;
+    }
+
+    const struct list_head* pos;
+    int32_t i = 0;
+
+    list_for_each(pos, &b->payload.tag_list->entry)
+    {
+        nbt_node ae;
+
+        if(i == as.length)
+            return false;
+
+        nbt_span_get(&as, i++, &ae);
+
+        if(!nbt_eq(&ae, list_entry(pos, const struct nbt_list, entry)->data))
+            return false;
+    }
+
+    return i == as.length;
+}
+
+/*
+ * Equal trees hash the same, so if both hashes are cached and they don't
+ * match, there's no need to look inside. Unless there are floats in there:
+ * nbt_eq lets them be a little different, and the hash doesn't.
+ */
+static bool hashes_differ(const nbt_node* a, const nbt_node* b)
+{
+    if(!is_augmented(a) || !is_augmented(b))
+        return false;
+
+    const struct nbt_augmented* x = AUGMENTED(a);
+    const struct nbt_augmented* y = AUGMENTED(b);
+
+    return x->hashed && y->hashed && !x->inexact && !y->inexact && x->hash != y->hash;
+}
+
 bool nbt_eq(const nbt_node* restrict a, const nbt_node* restrict b)
 {
     if(a->type != b->type)
         return false;
 
-    if(safe_strcmp(a->name, b->name) != 0)
+    /* Interned names are equal if and only if they're the same pointer. */
+    if(a->flags & b->flags & NBT_NODE_INTERNED)
+    {
+        if(a->name != b->name)
+            return false;
+    }
+    else if(safe_strcmp(a->name, b->name) != 0)
+        return false;
+
+    if(hashes_differ(a, b))
         return false;
 
     switch(a->type)
@@ -103,17 +202,29 @@ bool nbt_eq(const nbt_node* restrict a, const nbt_node* restrict b)
         return floats_are_close(a->payload.tag_double, b->payload.tag_double);
     case TAG_BYTE_ARRAY:
         if(a->payload.tag_byte_array.length != b->payload.tag_byte_array.length) return false;
-        return memcmp(a->payload.tag_byte_array.data,
+        return a->payload.tag_byte_array.length == 0 ||
+               memcmp(a->payload.tag_byte_array.data,
                       b->payload.tag_byte_array.data,
                       a->payload.tag_byte_array.length) == 0;
     case TAG_INT_ARRAY:
         if(a->payload.tag_int_array.length != b->payload.tag_int_array.length) return false;
-        return memcmp(a->payload.tag_int_array.data,
+        return a->payload.tag_int_array.length == 0 ||
+               memcmp(a->payload.tag_int_array.data,
                       b->payload.tag_int_array.data,
-                      a->payload.tag_int_array.length) == 0;
+                      a->payload.tag_int_array.length * sizeof(int32_t)) == 0;
+    case TAG_LONG_ARRAY:
+        if(a->payload.tag_long_array.length != b->payload.tag_long_array.length) return false;
+        return a->payload.tag_long_array.length == 0 ||
+               memcmp(a->payload.tag_long_array.data,
+                      b->payload.tag_long_array.data,
+                      a->payload.tag_long_array.length * sizeof(int64_t)) == 0;
     case TAG_STRING:
         return strcmp(a->payload.tag_string, b->payload.tag_string) == 0;
     case TAG_LIST:
+        if((a->flags | b->flags) & NBT_NODE_PACKED)
+            return packed_lists_eq(a, b);
+        /* fall through */
+
     case TAG_COMPOUND:
     {
         struct list_head *ai, *bi;
@@ -143,3 +254,245 @@ bool nbt_eq(const nbt_node* restrict a, const nbt_node* restrict b)
     }
 }
 
+/*
+ * Structural hashing. Every value is fed into the hash 64 bits at a time, and
+ * mixed with a multiply and a rotate. Compound children are hashed on their
+ * own and added up, so their order doesn't matter and nothing has to be
+ * sorted. Lists are hashed in order.
+ */
+
+#define HASH_MUL 0x9E3779B97F4A7C15ULL
+
+static inline uint64_t hash_mix(uint64_t h, uint64_t v)
+{
+    h ^= v * HASH_MUL;
+    h = h << 31 | h >> 33;
+    return h * 0xBF58476D1CE4E5B9ULL;
+}
+
+/* The splitmix64 finalizer, so every input bit reaches every output bit. */
+static inline uint64_t hash_finish(uint64_t h)
+{
+    h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27; h *= 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return h;
+}
+
+/* Bytes are read little-endian whatever the machine, so hashes are portable. */
+static uint64_t hash_bytes(uint64_t h, const unsigned char* p, size_t len)
+{
+    h = hash_mix(h, len);
+
+    for(; len >= 8; p += 8, len -= 8)
+    {
+        uint64_t v = 0;
+
+        for(int i = 7; i >= 0; i--)
+            v = v << 8 | p[i];
+
+        h = hash_mix(h, v);
+    }
+
+    if(len > 0)
+    {
+        uint64_t v = 0;
+
+        while(len > 0)
+            v = v << 8 | p[--len];
+
+        h = hash_mix(h, v);
+    }
+
+    return h;
+}
+
+/* A float's bits, with every NaN made the same and -0 made 0. */
+static uint64_t hash_real(double x)
+{
+    uint64_t bits;
+
+    if(x != x)       x = NAN;
+    else if(x == 0)  x = 0;
+
+    memcpy(&bits, &x, sizeof bits);
+    return bits;
+}
+
+/* Hashes a scalar, whether it's a node of its own or a packed list element. */
+static uint64_t hash_scalar(const nbt_node* n)
+{
+    uint64_t h = hash_mix(HASH_MUL, n->type);
+
+    switch(n->type)
+    {
+    case TAG_BYTE:   return hash_mix(h, (uint64_t)n->payload.tag_byte);
+    case TAG_SHORT:  return hash_mix(h, (uint64_t)n->payload.tag_short);
+    case TAG_INT:    return hash_mix(h, (uint64_t)n->payload.tag_int);
+    case TAG_LONG:   return hash_mix(h, (uint64_t)n->payload.tag_long);
+    case TAG_FLOAT:  return hash_mix(h, hash_real(n->payload.tag_float));
+    default:         return hash_mix(h, hash_real(n->payload.tag_double));
+    }
+}
+
+static uint64_t hash_node(const nbt_node* n);
+
+static uint64_t hash_contents(const nbt_node* n)
+{
+    uint64_t h = hash_mix(HASH_MUL, n->type);
+    const struct list_head* pos;
+
+    switch(n->type)
+    {
+    case TAG_BYTE: case TAG_SHORT: case TAG_INT: case TAG_LONG:
+    case TAG_FLOAT: case TAG_DOUBLE:
+        return hash_scalar(n);
+
+    case TAG_STRING:
+        return hash_bytes(h, (const unsigned char*)n->payload.tag_string, strlen(n->payload.tag_string));
+
+    case TAG_BYTE_ARRAY:
+        return hash_bytes(h, n->payload.tag_byte_array.data, (size_t)n->payload.tag_byte_array.length);
+
+    case TAG_INT_ARRAY:
+        {
+            const int32_t* data = n->payload.tag_int_array.data;
+            int32_t length = n->payload.tag_int_array.length;
+            int32_t i = 0;
+
+            h = hash_mix(h, (uint64_t)length);
+
+            for(; i + 1 < length; i += 2)
+                h = hash_mix(h, (uint64_t)(uint32_t)data[i] << 32 | (uint32_t)data[i + 1]);
+
+            if(i < length)
+                h = hash_mix(h, (uint32_t)data[i]);
+
+            return h;
+        }
+
+    case TAG_LONG_ARRAY:
+        h = hash_mix(h, (uint64_t)n->payload.tag_long_array.length);
+
+        for(int32_t i = 0; i < n->payload.tag_long_array.length; i++)
+            h = hash_mix(h, (uint64_t)n->payload.tag_long_array.data[i]);
+
+        return h;
+
+    case TAG_LIST:
+        /* Empty lists hash the same whatever they were declared to hold. */
+        if(n->flags & NBT_NODE_PACKED)
+        {
+            struct nbt_span span;
+
+            nbt_list_span(n, &span);
+
+            for(int32_t i = 0; i < span.length; i++)
+            {
+                nbt_node elem;
+
+                nbt_span_get(&span, i, &elem);
+                h = hash_mix(h, hash_scalar(&elem));
+            }
+
+            h = hash_mix(h, (uint64_t)span.length);
+        }
+        else
+        {
+            size_t length = 0;
+
+            list_for_each(pos, &n->payload.tag_list->entry)
+            {
+                h = hash_mix(h, hash_node(list_entry(pos, const struct nbt_list, entry)->data));
+                length++;
+            }
+
+            h = hash_mix(h, length);
+        }
+
+        return hash_finish(h);
+
+    case TAG_COMPOUND:
+        {
+            uint64_t sum = 0;
+
+            list_for_each(pos, &n->payload.tag_compound->entry)
+            {
+                const nbt_node* child = list_entry(pos, const struct nbt_list, entry)->data;
+                const char* name = child->name ? child->name : "";
+
+                uint64_t c = hash_bytes(HASH_MUL, (const unsigned char*)name, strlen(name));
+
+                sum += hash_finish(hash_mix(c, hash_node(child)));
+            }
+
+            return hash_finish(hash_mix(h, sum));
+        }
+
+    default:
+        return h;
+    }
+}
+
+/* Is `n' a float, or does it have any in it? Its children are hashed already. */
+static bool is_inexact(const nbt_node* n)
+{
+    const struct list_head* pos;
+
+    switch(n->type)
+    {
+    case TAG_FLOAT: case TAG_DOUBLE:
+        return true;
+
+    case TAG_LIST:
+        if(n->flags & NBT_NODE_PACKED)
+            return n->payload.tag_packed_list.type == TAG_FLOAT ||
+                   n->payload.tag_packed_list.type == TAG_DOUBLE;
+        /* fall through */
+
+    case TAG_COMPOUND:
+        list_for_each(pos, &n->payload.tag_list->entry)
+            if(AUGMENTED(list_entry(pos, const struct nbt_list, entry)->data)->inexact)
+                return true;
+
+        return false;
+
+    default:
+        return false;
+    }
+}
+
+/*
+ * Augmented nodes remember their hashes, so a subtree which hasn't changed is
+ * never hashed twice. That makes these Merkle trees: a change only costs
+ * rehashing the nodes between it and the root.
+ */
+static uint64_t hash_node(const nbt_node* n)
+{
+    if(!is_augmented(n))
+        return hash_contents(n);
+
+    struct nbt_augmented* aug = AUGMENTED(n);
+
+    if(!aug->hashed)
+    {
+        aug->hash    = hash_contents(n);
+        aug->inexact = is_inexact(n);
+        aug->hashed  = true;
+    }
+
+    return aug->hash;
+}
+
+uint64_t nbt_hash(const nbt_node* tree)
+{
+    assert(tree);
+
+    return hash_finish(hash_node(tree));
+}
+
+bool nbt_changed(const nbt_node* tree, uint64_t since)
+{
+    return nbt_hash(tree) != since;
+}
+